@@ -16,6 +16,10 @@
 #include "F_Combo.h"
 #include "oSVM.h"
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 //--------------------------------------------------------------------- METHODS
 
 F_Combo::F_Combo(vector<eFeatureType>& feature_types,
@@ -28,30 +32,7 @@ F_Combo::F_Combo(vector<eFeatureType>& feature_types,
     _feature = Feature::getFeature(slice, *it);
     features.push_back(_feature);
   }
-
-  // Initialize feature vectors
-  printf("[F_Combo] Allocating memory to store %ld different features\n", features.size());
-  feature_buffer = new osvm_node*[features.size()];
-
-  uint fidx = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    int max_index = (*iFeature)->getSizeFeatureVectorForOneSupernode()+1;
-    feature_buffer[fidx] = new osvm_node[max_index];
-
-    int i = 0;
-    for(i = 0;i < max_index-1; i++)
-      feature_buffer[fidx][i].index = i+1;
-    feature_buffer[fidx][i].index = -1;
-
-    ++fidx;
-  }
-
-  sizeFV = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    sizeFV += (*iFeature)->getSizeFeatureVectorForOneSupernode();
-  }
+  initOffsets();
 }
 
 F_Combo::F_Combo(vector<eFeatureType>& feature_types,
@@ -64,33 +45,9 @@ F_Combo::F_Combo(vector<eFeatureType>& feature_types,
     _feature = Feature::getFeature(slice, *it);
     features.push_back(_feature);
   }
-
-  // Initialize feature vectors
-  printf("[F_Combo] Allocating memory to store %ld different features\n", features.size());
-  feature_buffer = new osvm_node*[features.size()];
-
-  uint fidx = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    int max_index = (*iFeature)->getSizeFeatureVectorForOneSupernode()+1;
-    feature_buffer[fidx] = new osvm_node[max_index];
-
-    int i = 0;
-    for(i = 0;i < max_index-1; i++)
-      feature_buffer[fidx][i].index = i+1;
-    feature_buffer[fidx][i].index = -1;
-
-    ++fidx;
-  }
-
-  sizeFV = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    sizeFV += (*iFeature)->getSizeFeatureVectorForOneSupernode();
-  }
+  initOffsets();
 }
 
-
 void F_Combo::init()
 {
   normalize_features = false;
@@ -101,15 +58,27 @@ void F_Combo::init()
   }
 }
 
-F_Combo::~F_Combo()
+void F_Combo::initOffsets()
 {
+  printf("[F_Combo] Combining %ld different features\n", features.size());
+  offsets = new int[features.size()+1];
+  offsets[0] = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    delete *iFeature;
-    delete[] feature_buffer[fidx];
+    offsets[fidx+1] = offsets[fidx] + (*iFeature)->getSizeFeatureVectorForOneSupernode();
     ++fidx;
   }
+  sizeFV = offsets[features.size()];
+}
+
+F_Combo::~F_Combo()
+{
+  for(vector<Feature*>::iterator iFeature = features.begin();
+      iFeature != features.end(); iFeature++) {
+    delete *iFeature;
+  }
+  delete[] offsets;
 }
 
 int F_Combo::getSizeFeatureVectorForOneSupernode()
@@ -117,34 +86,159 @@ int F_Combo::getSizeFeatureVectorForOneSupernode()
   return sizeFV;
 }
 
-bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
+void F_Combo::normalize(osvm_node* x)
 {
-  uint idx = 0;
-  uint fidx = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
+  for(uint fidx = 0; fidx < features.size(); ++fidx) {
+    double norm = 0;
+    if(normalize_features == L1_NORM) {
+      for(int i = offsets[fidx]; i < offsets[fidx+1]; i++) {
+        norm += x[i].value;
+      }
+    } else {
+      for(int i = offsets[fidx]; i < offsets[fidx+1]; i++) {
+        norm += x[i].value*x[i].value;
+      }
+      norm = sqrt(norm);
+    }
+    if(fabs(norm) < 1e-20) {
+      norm = 1.0;
+    }
+    for(int i = offsets[fidx]; i < offsets[fidx+1]; i++) {
+      x[i].value /= norm;
+    }
+  }
+}
 
-    osvm_node *sx = feature_buffer[fidx];
-    ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx, slice, supernodeId);
+void F_Combo::normalize(float* output, ulong nRows)
+{
+  if(normalize_features <= 0) {
+    return;
+  }
 
-    if(normalize_features > 0) {
-      double norm = oSVM::norm(sx, normalize_features);
-      if(fabs(norm) < 1e-20) {
-        norm = 1.0;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(long r = 0; r < (long)nRows; ++r) {
+    float* row = output + r*sizeFV;
+    for(uint fidx = 0; fidx < features.size(); ++fidx) {
+      float* v = row + offsets[fidx];
+      const int n = offsets[fidx+1] - offsets[fidx];
+      // contiguous reductions and scaling are vectorized by the compiler
+      float norm = 0;
+      if(normalize_features == L1_NORM) {
+        for(int i = 0; i < n; i++) {
+          norm += v[i];
+        }
+      } else {
+        for(int i = 0; i < n; i++) {
+          norm += v[i]*v[i];
+        }
+        norm = sqrtf(norm);
+      }
+      if(fabsf(norm) < 1e-20f) {
+        norm = 1.0f;
       }
-      for(int i = 0;sx[i].index != -1; i++) {
-        x[idx].value = sx[i].value/norm;
-        idx++;
+      const float invNorm = 1.0f/norm;
+      for(int i = 0; i < n; i++) {
+        v[i] *= invNorm;
       }
+    }
+  }
+}
+
+bool F_Combo::getFeatureMatrix(Slice_P* slice, float* output)
+{
+  const ulong nSupernodes = slice->getNbSupernodes();
+
+  vector<uint> parallelFeatures;
+  vector<uint> sequentialFeatures;
+  for(uint fidx = 0; fidx < features.size(); ++fidx) {
+    if(features[fidx]->isThreadSafe()) {
+      parallelFeatures.push_back(fidx);
     } else {
-      for(int i = 0;sx[i].index != -1; i++) {
-        x[idx].value = sx[i].value;
-        idx++;
+      sequentialFeatures.push_back(fidx);
+    }
+  }
+
+  // Sub-features such as F_Sift, F_Lbp or F_Dft compute the data of the
+  // whole slice the first time they are called, using their own parallel
+  // loops. The first supernode is processed before the parallel region so
+  // that these computations are not nested (and serialized) in it.
+  if(nSupernodes > 0) {
+    osvm_node* x = new osvm_node[sizeFV+1];
+    for(vector<uint>::iterator it = parallelFeatures.begin();
+        it != parallelFeatures.end(); ++it) {
+      features[*it]->getFeatureVectorForOneSupernode(x + offsets[*it], slice, 0);
+      for(int i = offsets[*it]; i < offsets[*it+1]; i++) {
+        output[i] = x[i].value;
       }
     }
+    delete[] x;
   }
 
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    osvm_node* x = new osvm_node[sizeFV+1];
+    for(int i = 0; i < sizeFV; i++) {
+      x[i].index = i+1;
+    }
+    x[sizeFV].index = -1;
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for(long sid = 1; sid < (long)nSupernodes; ++sid) {
+      float* row = output + sid*sizeFV;
+      for(vector<uint>::iterator it = parallelFeatures.begin();
+          it != parallelFeatures.end(); ++it) {
+        features[*it]->getFeatureVectorForOneSupernode(x + offsets[*it], slice, sid);
+        for(int i = offsets[*it]; i < offsets[*it+1]; i++) {
+          row[i] = x[i].value;
+        }
+      }
+    }
+
+    delete[] x;
+  }
+
+  if(!sequentialFeatures.empty()) {
+    osvm_node* x = new osvm_node[sizeFV+1];
+    for(int i = 0; i < sizeFV; i++) {
+      x[i].index = i+1;
+    }
+    x[sizeFV].index = -1;
+
+    for(ulong sid = 0; sid < nSupernodes; ++sid) {
+      float* row = output + sid*sizeFV;
+      for(vector<uint>::iterator it = sequentialFeatures.begin();
+          it != sequentialFeatures.end(); ++it) {
+        features[*it]->getFeatureVectorForOneSupernode(x + offsets[*it], slice, sid);
+        for(int i = offsets[*it]; i < offsets[*it+1]; i++) {
+          row[i] = x[i].value;
+        }
+      }
+    }
+
+    delete[] x;
+  }
+
+  normalize(output, nSupernodes);
+  return true;
+}
+
+bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
+{
+  uint fidx = 0;
+  for(vector<Feature*>::iterator iFeature = features.begin();
+      iFeature != features.end(); iFeature++) {
+    (*iFeature)->getFeatureVectorForOneSupernode(x + offsets[fidx], slice, supernodeId);
+    ++fidx;
+  }
+  if(normalize_features > 0) {
+    normalize(x);
+  }
   return true;
 }
 
@@ -152,82 +246,43 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n,
                                               const int x,
                                               const int y)
 {
-  uint idx = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
+    (*iFeature)->getFeatureVectorForOneSupernode(n + offsets[fidx], x, y);
     ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx,x,y);
-
-    if(normalize_features > 0) {
-      double norm = oSVM::norm(sx, normalize_features);
-      for(int i = 0;sx[i].index != -1; i++) {
-        n[idx].value = sx[i].value/norm;
-        idx++;
-      }
-    } else {
-      for(int i = 0;sx[i].index != -1; i++) {
-        n[idx].value = sx[i].value;
-        idx++;
-      }
-    }
   }
-
+  if(normalize_features > 0) {
+    normalize(n);
+  }
   return true;
 }
 
 bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, int supernodeId)
 {
-  uint idx = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
+    (*iFeature)->getFeatureVectorForOneSupernode(x + offsets[fidx], slice3d, supernodeId);
     ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx, slice3d, supernodeId);
-
-    if(normalize_features > 0) {
-      double norm = oSVM::norm(sx, normalize_features);
-      for(int i = 0;sx[i].index != -1; i++) {
-        x[idx].value = sx[i].value/norm;
-        idx++;
-      }
-    } else {
-      for(int i = 0;sx[i].index != -1; i++) {
-        x[idx].value = sx[i].value;
-        idx++;
-      }
-    }
   }
-
+  if(normalize_features > 0) {
+    normalize(x);
+  }
   return true;
 }
 
 bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n, Slice3d* slice3d,
                                               const int x, const int y, const int z)
 {
-  uint idx = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
+    (*iFeature)->getFeatureVectorForOneSupernode(n + offsets[fidx], slice3d, x, y, z);
     ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx,slice3d,x,y,z);
-
-    if(normalize_features > 0) {
-      double norm = oSVM::norm(sx, normalize_features);
-      for(int i = 0;sx[i].index != -1; i++) {
-        n[idx].value = sx[i].value/norm;
-        idx++;
-      }
-    } else {
-      for(int i = 0;sx[i].index != -1; i++) {
-        n[idx].value = sx[i].value;
-        idx++;
-      }
-    }
   }
-
+  if(normalize_features > 0) {
+    normalize(n);
+  }
   return true;
-}
\ No newline at end of file
+}
@@ -27,6 +27,16 @@ using namespace std;
 
 /**
  * Combo class combines different features
+ *
+ * Each sub-feature writes its values directly into its own slice of the
+ * output vector (given by precomputed offsets), so F_Combo itself holds no
+ * state during extraction. getFeatureMatrix (used by
+ * Slice_P::precomputeFeatures) processes the supernodes in parallel, except
+ * for the sub-features that are not thread-safe (F_Precomputed and the
+ * sparse F_LoadFromFile, see Feature::isThreadSafe) which are computed in a
+ * second, sequential pass.
+ * If normalize_combo_features is set to 1 (L1) or 2 (L2) in the config
+ * file, every sub-vector is divided by its norm.
  */
 class F_Combo : public Feature
 {
@@ -74,15 +84,40 @@ class F_Combo : public Feature
                                        const int y,
                                        const int z);
 
+  /**
+   * Compute the feature vectors of all the supernodes of the slice
+   * (supernodes are processed in parallel) followed by a single
+   * normalization pass.
+   * @param output nSupernodes*getSizeFeatureVectorForOneSupernode() values
+   */
+  bool getFeatureMatrix(Slice_P* slice, float* output);
+
   void init();
 
+  /**
+   * Normalize every sub-vector of the given rows (row major, contiguous)
+   */
+  void normalize(float* output, ulong nRows);
+
  private:
+
+  /**
+   * Compute the offsets of the sub-features
+   */
+  void initOffsets();
+
+  /**
+   * Normalize every sub-vector of a single feature vector in place
+   */
+  void normalize(osvm_node* x);
+
   vector<Feature*> features;
   int normalize_features;
   int sizeFV;
 
-  // use to store features
-  osvm_node** feature_buffer;
+  // offset of each sub-feature in the feature vector (features.size()+1
+  // entries)
+  int* offsets;
 };
 
 #endif // F_COMBO_H
@@ -1,4 +1,3 @@
-
 /////////////////////////////////////////////////////////////////////////
 // This program is free software; you can redistribute it and/or       //
 // modify it under the terms of the GNU General Public License         //
@@ -13,110 +12,399 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #include "F_Dft.h"
+#include "Config.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include <math.h>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Table of twiddle factors exp(-2*pi*i*k/n) for k < n/2 (interleaved).
+ */
+static float* createTwiddles(int n)
+{
+  float* twiddles = new float[n];
+  for(int k = 0; k < n/2; ++k) {
+    twiddles[2*k] = cos(2.0*M_PI*k/n);
+    twiddles[2*k+1] = -sin(2.0*M_PI*k/n);
+  }
+  return twiddles;
+}
+
+/**
+ * In-place radix-2 FFT of n complex values stored with the given stride
+ * (in complex values). The inverse transform is not normalized.
+ */
+static void fft1d(float* data, int n, int stride, const float* twiddles, bool inverse)
+{
+  // bit reversal permutation
+  for(int i = 1, j = 0; i < n; ++i) {
+    int bit = n >> 1;
+    for(; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if(i < j) {
+      float* a = data + 2*i*stride;
+      float* b = data + 2*j*stride;
+      float t = a[0]; a[0] = b[0]; b[0] = t;
+      t = a[1]; a[1] = b[1]; b[1] = t;
+    }
+  }
+
+  const float sign = inverse?-1.0f:1.0f;
+  for(int m = 2; m <= n; m <<= 1) {
+    const int half = m >> 1;
+    const int step = n/m;
+    for(int i = 0; i < n; i += m) {
+      for(int j = 0; j < half; ++j) {
+        const float wr = twiddles[2*j*step];
+        const float wi = sign*twiddles[2*j*step+1];
+        float* a = data + 2*(i+j)*stride;
+        float* b = data + 2*(i+j+half)*stride;
+        const float tr = wr*b[0] - wi*b[1];
+        const float ti = wr*b[1] + wi*b[0];
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+}
+
+/**
+ * In-place 2d FFT of a width x height complex plane (width and height are
+ * powers of 2). Rows and columns are transformed in parallel when called
+ * outside of a parallel region.
+ */
+static void fft2d(float* data, int width, int height,
+                  const float* twiddlesX, const float* twiddlesY, bool inverse)
+{
+#ifdef WITH_OPENMP
+#pragma omp parallel for if(!omp_in_parallel())
+#endif
+  for(int y = 0; y < height; ++y) {
+    fft1d(data + 2*(ulong)y*width, width, 1, twiddlesX, inverse);
+  }
 
-using namespace cv;
+#ifdef WITH_OPENMP
+#pragma omp parallel if(!omp_in_parallel())
+#endif
+  {
+    // columns are copied to a contiguous buffer to avoid strided accesses
+    float* column = new float[2*height];
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for(int x = 0; x < width; ++x) {
+      for(int y = 0; y < height; ++y) {
+        column[2*y] = data[2*((ulong)y*width + x)];
+        column[2*y+1] = data[2*((ulong)y*width + x)+1];
+      }
+      fft1d(column, height, 1, twiddlesY, inverse);
+      for(int y = 0; y < height; ++y) {
+        data[2*((ulong)y*width + x)] = column[2*y];
+        data[2*((ulong)y*width + x)+1] = column[2*y+1];
+      }
+    }
+    delete[] column;
+  }
+}
 
-F_Dft::F_Dft(const char* image_name,
-             int _n_rows, int _n_cols)
+/**
+ * Mirror an index in [0, n[ (without repeating the border).
+ */
+static long reflect(long i, long n)
 {
-  n_cols = _n_cols;
-  n_rows = _n_rows;
-
-  Mat img = imread(image_name, CV_LOAD_IMAGE_GRAYSCALE);
-  if( img.empty() ) {
-    printf("Cannot read image file: %s\n", image_name);
-    return;
-  }
-  int M = getOptimalDFTSize( img.rows );
-  int N = getOptimalDFTSize( img.cols );
-  //printf("M %d N %d\n", M, N);
-  Mat padded;
-  copyMakeBorder(img, padded, 0, M - img.rows, 0, N - img.cols, BORDER_CONSTANT, Scalar::all(0));
-
-  Mat planes[] = {Mat_<float>(padded), Mat::zeros(padded.size(), CV_32F)};
-  Mat complexImg;
-  merge(planes, 2, complexImg);
-
-  dft(complexImg, complexImg);
-
-  // compute log(1 + sqrt(Re(DFT(img))**2 + Im(DFT(img))**2))
-  split(complexImg, planes);
-  magnitude(planes[0], planes[1], planes[0]);
-  planes[0].copyTo(mag);
-  mag += Scalar::all(1);
-  log(mag, mag);
-
-  // crop the spectrum, if it has an odd number of rows or columns
-  //mag = mag(Rect(0, 0, mag.cols & -2, mag.rows & -2));
-  mag = mag(Rect(0, 0, n_rows, n_cols));
-
-  /*
-  int cx = mag.cols/2;
-  int cy = mag.rows/2;
-
-  // rearrange the quadrants of Fourier image
-  // so that the origin is at the image center
-  Mat tmp;
-  Mat q0(mag, Rect(0, 0, cx, cy));
-  Mat q1(mag, Rect(cx, 0, cx, cy));
-  Mat q2(mag, Rect(0, cy, cx, cy));
-  Mat q3(mag, Rect(cx, cy, cx, cy));
-
-  q0.copyTo(tmp);
-  q3.copyTo(q0);
-  tmp.copyTo(q3);
-
-  q1.copyTo(tmp);
-  q2.copyTo(q1);
-  tmp.copyTo(q2);
-  */
-
-  normalize(mag, mag, 0, 1, CV_MINMAX);
+  if(n == 1) {
+    return 0;
+  }
+  const long period = 2*n - 2;
+  i %= period;
+  if(i < 0) {
+    i += period;
+  }
+  return (i < n)?i:period-i;
+}
+
+static int nextPowerOf2(long n)
+{
+  int p = 1;
+  while(p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+//------------------------------------------------------------------------------
+
+F_Dft::F_Dft()
+{
+  nScales = 3;
+  nOrientations = 4;
+  minWavelength = 3.0;
+  scaleFactor = 2.0;
+
+  string config_tmp;
+  if(Config::Instance()->getParameter("dft_scales", config_tmp)) {
+    nScales = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("dft_orientations", config_tmp)) {
+    nOrientations = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("dft_min_wavelength", config_tmp)) {
+    minWavelength = atof(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("dft_scale_factor", config_tmp)) {
+    scaleFactor = atof(config_tmp.c_str());
+  }
+
+  if(nScales <= 0 || nOrientations <= 0 || minWavelength < 2.0 || scaleFactor <= 1.0) {
+    printf("[F_Dft] Error : invalid filter bank (%d scales, %d orientations, min wavelength %g, scale factor %g)\n",
+           nScales, nOrientations, minWavelength, scaleFactor);
+    exit(-1);
+  }
 }
 
 F_Dft::~F_Dft()
 {
+  for(map<ulong, float*>::iterator it = features.begin();
+      it != features.end(); ++it) {
+    delete[] it->second;
+  }
 }
 
-bool F_Dft::getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice, int supernodeId)
+int F_Dft::getSizeFeatureVectorForOneSupernode()
+{
+  return nScales*nOrientations;
+}
+
+float* F_Dft::createFilters(int paddedWidth, int paddedHeight)
 {
-  /*
-  int featId = 0;
-  for(int i = 0; i < n_rows; ++i) {
-    for(int j = 0; j < n_cols; ++j) {
-      n[featId].value = mag.at<double>(j,i);
-      ++featId;
-      //printf("%d ", featId);
+  const ulong planeSize = (ulong)paddedWidth*paddedHeight;
+  const int nFilters = nScales*nOrientations;
+  float* filters = new float[nFilters*planeSize];
+
+  // bandwidth of about 2 octaves and angular spread such that the
+  // orientations cover the half circle (same parameters as Kovesi's phase
+  // congruency code)
+  const double sigmaOnf = 0.55;
+  const double logSigmaOnf = 2.0*log(sigmaOnf)*log(sigmaOnf);
+  const double thetaSigma = M_PI/nOrientations/1.5;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int y = 0; y < paddedHeight; ++y) {
+    const double fy = ((y < paddedHeight/2)?y:y-paddedHeight)/(double)paddedHeight;
+    for(int x = 0; x < paddedWidth; ++x) {
+      const double fx = ((x < paddedWidth/2)?x:x-paddedWidth)/(double)paddedWidth;
+      const ulong idx = (ulong)y*paddedWidth + x;
+      const double radius = sqrt(fx*fx + fy*fy);
+      const double theta = atan2(-fy, fx);
+      const double sinTheta = sin(theta);
+      const double cosTheta = cos(theta);
+
+      for(int o = 0; o < nOrientations; ++o) {
+        // filters only keep one half of the spectrum so that the inverse
+        // transform is an analytic signal
+        const double angle = o*M_PI/nOrientations;
+        const double ds = sinTheta*cos(angle) - cosTheta*sin(angle);
+        const double dc = cosTheta*cos(angle) + sinTheta*sin(angle);
+        const double dTheta = fabs(atan2(ds, dc));
+        const double spread = exp(-dTheta*dTheta/(2.0*thetaSigma*thetaSigma));
+
+        double wavelength = minWavelength;
+        for(int s = 0; s < nScales; ++s) {
+          double radial = 0;
+          if(radius > 0) {
+            const double l = log(radius*wavelength);
+            radial = exp(-l*l/logSigmaOnf);
+          }
+          filters[(s*nOrientations + o)*planeSize + idx] = radial*spread;
+          wavelength *= scaleFactor;
+        }
+      }
     }
   }
-  */
+  return filters;
+}
 
-  double mean = 0;
-  for(int i = 0; i < n_rows; ++i) {
-    for(int j = 0; j < n_cols; ++j) {
-      mean += mag.at<double>(j,i);
+const float* F_Dft::getFeatures(Slice_P* slice)
+{
+  float* feat = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(dftFeatures)
+#endif
+  {
+    map<ulong, float*>::iterator it = features.find(slice->getId());
+    if(it != features.end()) {
+      feat = it->second;
+    } else {
+      feat = computeFeatures(slice);
+      features[slice->getId()] = feat;
     }
   }
-  mean /= n_cols*n_rows;
+  return feat;
+}
 
-  double variance = 0;
-  for(int i = 0; i < n_rows; ++i) {
-    for(int j = 0; j < n_cols; ++j) {
-      double t = mag.at<double>(j,i) - mean;
-      variance += t*t;
+float* F_Dft::computeFeatures(Slice_P* slice)
+{
+  const long width = slice->getWidth();
+  const long height = slice->getHeight();
+  const long depth = slice->getDepth();
+  const ulong sliceSize = width*height;
+  const int paddedWidth = nextPowerOf2(width);
+  const int paddedHeight = nextPowerOf2(height);
+  const ulong planeSize = (ulong)paddedWidth*paddedHeight;
+  const int nFilters = getSizeFeatureVectorForOneSupernode();
+  const ulong nSupernodes = slice->getNbSupernodes();
+
+  const uchar* data = 0;
+  if(slice->getType() == SLICEP_SLICE3D) {
+    data = slice->getRawData();
+  }
+
+  // runs of voxels for each plane : (sid, offset in the padded plane, length)
+  vector<vector<ulong> > runs(depth);
+  ulong* counts = new ulong[nSupernodes];
+  for(ulong i = 0; i < nSupernodes; ++i) {
+    counts[i] = 0;
+  }
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    const vector<lineContainer*>& lines = it->second->getLines();
+    for(vector<lineContainer*>::const_iterator itL = lines.begin();
+        itL != lines.end(); ++itL) {
+      vector<ulong>& planeRuns = runs[(*itL)->coord.z];
+      planeRuns.push_back(it->first);
+      planeRuns.push_back((*itL)->coord.y*paddedWidth + (*itL)->coord.x);
+      planeRuns.push_back((*itL)->length);
+      counts[it->first] += (*itL)->length;
+    }
+    const vector<node*>& nodes = it->second->getNodes();
+    for(vector<node*>::const_iterator itN = nodes.begin();
+        itN != nodes.end(); ++itN) {
+      vector<ulong>& planeRuns = runs[(*itN)->z];
+      planeRuns.push_back(it->first);
+      planeRuns.push_back((*itN)->y*paddedWidth + (*itN)->x);
+      planeRuns.push_back(1);
+      ++counts[it->first];
     }
   }
-  variance /= n_cols*n_rows;
 
-  n[0].value = mean;
-  n[1].value = variance;
+  PRINT_MESSAGE("[F_Dft] Computing %d log-Gabor responses on %dx%d planes for %ld supernodes\n",
+                nFilters, paddedWidth, paddedHeight, nSupernodes);
+
+  float* filters = createFilters(paddedWidth, paddedHeight);
+  float* twiddlesX = createTwiddles(paddedWidth);
+  float* twiddlesY = createTwiddles(paddedHeight);
+  float* spectrum = new float[2*planeSize];
+  double* sums = new double[nSupernodes*nFilters];
+  for(ulong i = 0; i < nSupernodes*nFilters; ++i) {
+    sums[i] = 0;
+  }
 
+  // the inverse transform is not normalized
+  const double norm = 1.0/planeSize;
+
+  for(long z = 0; z < depth; ++z) {
+    if(runs[z].empty()) {
+      continue;
+    }
+
+    // mirrored borders limit the artifacts due to the periodicity of the DFT
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for(int y = 0; y < paddedHeight; ++y) {
+      const long sy = reflect(y, height);
+      float* row = spectrum + 2*(ulong)y*paddedWidth;
+      for(int x = 0; x < paddedWidth; ++x) {
+        const long sx = reflect(x, width);
+        if(data) {
+          row[2*x] = data[z*sliceSize + sy*width + sx];
+        } else {
+          row[2*x] = slice->getIntensity(sx, sy, z);
+        }
+        row[2*x+1] = 0;
+      }
+    }
+    fft2d(spectrum, paddedWidth, paddedHeight, twiddlesX, twiddlesY, false);
+
+    const vector<ulong>& planeRuns = runs[z];
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+    {
+      float* response = new float[2*planeSize];
+
+      // each filter writes to its own entry of the sums
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+      for(int f = 0; f < nFilters; ++f) {
+        const float* filter = filters + f*planeSize;
+        for(ulong i = 0; i < planeSize; ++i) {
+          response[2*i] = spectrum[2*i]*filter[i];
+          response[2*i+1] = spectrum[2*i+1]*filter[i];
+        }
+        fft2d(response, paddedWidth, paddedHeight, twiddlesX, twiddlesY, true);
+
+        for(ulong r = 0; r < planeRuns.size(); r += 3) {
+          const float* p = response + 2*planeRuns[r+1];
+          const ulong length = planeRuns[r+2];
+          double sum = 0;
+          for(ulong i = 0; i < length; ++i) {
+            sum += sqrt(p[2*i]*p[2*i] + p[2*i+1]*p[2*i+1]);
+          }
+          sums[planeRuns[r]*nFilters + f] += sum*norm;
+        }
+      }
+
+      delete[] response;
+    }
+  }
+
+  float* feat = new float[nSupernodes*nFilters];
+  for(ulong sid = 0; sid < nSupernodes; ++sid) {
+    for(int f = 0; f < nFilters; ++f) {
+      feat[sid*nFilters + f] = (counts[sid] == 0)?0:sums[sid*nFilters + f]/counts[sid];
+    }
+  }
+
+  delete[] filters;
+  delete[] twiddlesX;
+  delete[] twiddlesY;
+  delete[] spectrum;
+  delete[] sums;
+  delete[] counts;
+  return feat;
+}
+
+bool F_Dft::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
+{
+  const float* feat = getFeatures(slice) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); ++i) {
+    x[i].value = feat[i];
+  }
   return true;
 }
 
-int F_Dft::getSizeFeatureVectorForOneSupernode()
+bool F_Dft::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, int supernodeId)
 {
-  //return n_rows*n_cols;
-  return 2;
-}
\ No newline at end of file
+  const float* feat = getFeatures(slice3d) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); ++i) {
+    x[i].value = feat[i];
+  }
+  return true;
+}
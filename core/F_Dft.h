@@ -12,18 +12,41 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #ifndef F_Dft_H
 #define F_Dft_H
 
-#include "opencv2/core/core.hpp"
-#include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/highgui/highgui.hpp"
-
 // SliceMe
 #include "Feature.h"
 #include "oSVM.h"
 #include "Slice.h"
+#include "Slice3d.h"
+
+#include <map>
 
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Local spectral features computed with a bank of log-Gabor filters.
+ * Each plane of the slice is transformed once with a 2d FFT (mirrored
+ * borders, padded to a power of two), multiplied by every filter of the
+ * bank in the frequency domain and transformed back. The amplitude of the
+ * complex response is the local energy of the plane for the scale and the
+ * orientation of the filter. The feature vector of a supernode is the mean
+ * amplitude over its voxels for every filter (scale major order).
+ *
+ * 3d volumes are processed plane by plane so that only one plane of
+ * responses has to be kept in memory. The FFTs are multithreaded with
+ * OpenMP (rows and columns are transformed in parallel, filters are
+ * processed in parallel).
+ *
+ * Options (configuration file) :
+ * dft_scales         number of scales (default 3)
+ * dft_orientations   number of orientations (default 4)
+ * dft_min_wavelength wavelength of the smallest scale in pixels (default 3)
+ * dft_scale_factor   ratio between the wavelengths of successive scales
+ *                    (default 2)
+ */
 class F_Dft : public Feature
 {
  public:	
@@ -31,20 +54,48 @@ class F_Dft : public Feature
   /**
    * Constructor
    */
-  F_Dft(const char* image_name,
-        int _n_rows, int _n_cols);
+  F_Dft();
 
   ~F_Dft();
 
-  bool getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice, int supernodeId);
-
   int getSizeFeatureVectorForOneSupernode();
 
+  /**
+   * Extract a feature vector for a given supernode in a 2d slice
+   */
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice* slice,
+                                       const int supernodeId);
+
+  /**
+   * Extract a feature vector for a given supernode in a 3d volume
+   */
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice3d* slice3d,
+                                       const int supernodeId);
+
  private:
-  cv::Mat mag;
-  int n_cols;
-  int n_rows;
 
+  /**
+   * Returns the features of all the supernodes of the given slice
+   */
+  const float* getFeatures(Slice_P* slice);
+
+  float* computeFeatures(Slice_P* slice);
+
+  /**
+   * Transfer functions of the filters for a padded plane of size
+   * paddedWidth x paddedHeight (nScales*nOrientations planes).
+   */
+  float* createFilters(int paddedWidth, int paddedHeight);
+
+  int nScales;
+  int nOrientations;
+  double minWavelength;
+  double scaleFactor;
+
+  // features for each slice id
+  std::map<ulong, float*> features;
 };
 
 #endif // F_Dft_H
@@ -15,21 +15,9 @@
 
 #include "F_Filter.h"
 #include "Config.h"
-#include "utils_ITK.h"
-
-#include "itkRescaleIntensityImageFilter.h"
-#include "itkCastImageFilter.h"
-#include "itkVectorIndexSelectionCastImageFilter.h"
-#include "itkHessianRecursiveGaussianImageFilter.h"
-#include "itkSymmetricEigenAnalysisImageFilter.h"
-#include "itkGradientMagnitudeRecursiveGaussianImageFilter.h"
-#include "itkLaplacianRecursiveGaussianImageFilter.h"
-#include "itkSubtractImageFilter.h"
-#include "itkStructureTensorRecursiveGaussianImageFilter.h"
-#include "itkSmoothingRecursiveGaussianImageFilter.h"
-#include "itkThresholdImageFilter.h"
-#include "itkGradientRecursiveGaussianImageFilter.h"
-#include "itkImageFileWriter.h"
+#include "FilterBank.h"
+
+#include <float.h>
 
 //------------------------------------------------------------------------------
 
@@ -49,7 +37,6 @@ static const double scales[numScales] = {1.0, 1.414, 2, 2.828, 4, 5.656, 8};
 
 static const int channelCounts[numFeatures] = {1, 1, nDim, nDim};
 
-#define OUTPUT_FILTER_IMAGES 0
 
 //------------------------------------------------------------------------------
 
@@ -61,8 +48,14 @@ F_Filter::F_Filter(Slice_P& slice)
     sizeFV += channelCounts[i];
   }
   sizeFV *= numScales;
+
+  averageOverSupernode = false;
+  string config_tmp;
+  if(Config::Instance()->getParameter("filter_average_supernode", config_tmp)) {
+    averageOverSupernode = config_tmp.c_str()[0] == '1';
+  }
+
   precomputeFeatures(slice);
-  //createSupernodeBasedFeatures(slice);
 }
 
 
@@ -78,244 +71,193 @@ F_Filter::~F_Filter()
   */
 }
 
-void F_Filter::precomputeFeatures(Slice_P& slice)
+/**
+ * Accumulates the responses of the filter bank for every supernode (at the
+ * center or averaged over the supernode) and keeps track of the range of
+ * every feature over the whole volume.
+ */
+class FilterFeatureReducer : public FilterBankReducer
 {
-  typedef uchar TInputPixelType;
-  typedef itk::Image< TInputPixelType, nDim > InputImageType;
-  typedef itk::Image<float,nDim> FloatImageType;
-  typedef itk::SymmetricSecondRankTensor<float,nDim> MatrixPixelType;
-  typedef itk::Image<MatrixPixelType,nDim>  MatrixImageType;
-  typedef itk::Vector<float,nDim> VectorPixelType;
-  typedef itk::Image<VectorPixelType,nDim> VectorImageType;
-  typedef itk::Image<uchar,nDim> OutputImageType;
-  typedef itk::RescaleIntensityImageFilter<FloatImageType,OutputImageType> RescaleFilterType;
-  //typedef itk::PercentileRescaleIntensityImageFilter<FloatImageType,OutputImageType> RescaleFilterType;
-  typedef itk::VectorIndexSelectionCastImageFilter<VectorImageType,FloatImageType> VectorElementSelectionFilter;
-
-  RescaleFilterType::Pointer rescaleFilter = RescaleFilterType::New();
-  rescaleFilter->ReleaseDataFlagOn();
-  rescaleFilter->SetOutputMinimum(0);
-  rescaleFilter->SetOutputMaximum(255);
-  // for PercentileRescaleIntensityImageFilter
-  //rescaleFilter->SetPercentiles(1e-6, 1 - 1e-6);  
-  //rescaleFilter->SetVerbose(1);
-
-  InputImageType::Pointer inputImage =
-    ImportFilterFromRawData<uchar, InputImageType>(slice.getRawData(),
-                            slice.getWidth(), slice.getHeight(), slice.getDepth());
-
-  InputImageType::RegionType region = inputImage->GetLargestPossibleRegion();
-  InputImageType::SizeType size = region.GetSize();
-  ulong imageSize = size[0]*size[1]*(ulong)size[2];
-
-  printf("[F_Filter] Loading input image (%d,%d,%d) %ld\n", slice.getWidth(), slice.getHeight(), slice.getDepth(), imageSize);
-
-  // allocate memory to store features
-  uchar* node_features = new uchar[imageSize];
-
-  uchar** supernode_features = new uchar*[sizeFV];
-  ulong nSupernodes = slice.getNbSupernodes();
-  node n;
-  for(int i = 0; i < sizeFV; i++) {
-    supernode_features[i] = new uchar[nSupernodes];
-  }
-  features = supernode_features; // keep supernode features in memory
-
-  printf("[F_Filter] Computing features at %d scales\n", numScales);
+ public:
+  FilterFeatureReducer(Slice3d& slice3d, int _sizeFV, bool _averageOverSupernode)
+  {
+    sizeFV = _sizeFV;
+    averageOverSupernode = _averageOverSupernode;
+    nSupernodes = slice3d.getNbSupernodes();
+    values = new double[nSupernodes*sizeFV];
+    for(ulong i = 0; i < nSupernodes*sizeFV; ++i) {
+      values[i] = 0;
+    }
+    minValues = new float[sizeFV];
+    maxValues = new float[sizeFV];
+    for(int f = 0; f < sizeFV; ++f) {
+      minValues[f] = FLT_MAX;
+      maxValues[f] = -FLT_MAX;
+    }
 
-  int featIdx = 0;
-  int featType = 0;
-
-  // gradient magnitude
-  for(int sc = 0; sc < numScales; ++sc) {
-
-    {  // braces: for using scopes to induce memory deallocation via destructor
-      typedef itk::GradientMagnitudeRecursiveGaussianImageFilter<InputImageType,FloatImageType> GradMagFilter;
-      GradMagFilter::Pointer gradmagFilter = GradMagFilter::New();
-      gradmagFilter->SetSigma(scales[sc]);
-      gradmagFilter->SetInput(inputImage);
-      rescaleFilter->SetInput(gradmagFilter->GetOutput());
-      rescaleFilter->GetOutput()->GetPixelContainer()->SetImportPointer(node_features, imageSize, false);
-      rescaleFilter->Update();
-      
-      createSupernodeBasedFeatures(slice, node_features, featIdx);
-
-#if OUTPUT_FILTER_IMAGES
-      typedef itk::ImageFileWriter<OutputImageType> WriterType;
-      WriterType::Pointer writer = WriterType::New();
-      stringstream sout;
-      sout << "gradient_" << sc << ".tif";
-      printf("[F_Filter] Writing image %s\n", sout.str().c_str());
-      writer->SetFileName(sout.str().c_str());
-      writer->SetInput(rescaleFilter->GetOutput());
-      writer->Update();
-#endif     
- 
-      ++featIdx;
+    // centers of the supernodes indexed by plane
+    centers = new vector<pair<sidType, ulong> >[slice3d.depth];
+    node n;
+    const map<sidType, supernode* >& _supernodes = slice3d.getSupernodes();
+    for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+        it != _supernodes.end(); it++) {
+      it->second->getCenter(n);
+      centers[n.z].push_back(pair<sidType, ulong>(it->first, n.y*(ulong)slice3d.width + n.x));
     }
   }
 
-  // LoG
-  for(int sc = 0; sc < numScales; ++sc) {
-
-    {  // braces: for using scopes to induce memory deallocation via destructor
-      typedef itk::LaplacianRecursiveGaussianImageFilter<InputImageType,FloatImageType> LaplacianFilter;
-      LaplacianFilter::Pointer laplacianFilter = LaplacianFilter::New();
-      laplacianFilter->SetSigma(scales[sc]);
-      laplacianFilter->SetInput(inputImage);
-      rescaleFilter->SetInput(laplacianFilter->GetOutput());
-      rescaleFilter->GetOutput()->GetPixelContainer()->SetImportPointer(node_features, imageSize, false);
-      rescaleFilter->Update();
-
-      createSupernodeBasedFeatures(slice, node_features, featIdx);
-      
-#if OUTPUT_FILTER_IMAGES
-      typedef itk::ImageFileWriter<OutputImageType> WriterType;
-      WriterType::Pointer writer = WriterType::New();
-      stringstream sout;
-      sout << "log_" << sc << ".tif";
-      printf("[F_Filter] Writing image %s\n", sout.str().c_str());
-      writer->SetFileName(sout.str().c_str());
-      writer->SetInput(rescaleFilter->GetOutput());
-      writer->Update();
-#endif     
- 
-      ++featIdx;
+  ~FilterFeatureReducer()
+  {
+    delete[] values;
+    delete[] minValues;
+    delete[] maxValues;
+    delete[] centers;
+  }
+
+  /**
+   * Rescale the features to [0, 255] using the range of the responses over
+   * the whole volume.
+   */
+  void getFeatures(Slice3d& slice3d, uchar** features)
+  {
+    const map<sidType, supernode* >& _supernodes = slice3d.getSupernodes();
+    for(int f = 0; f < sizeFV; ++f) {
+      double range = maxValues[f] - minValues[f];
+      double scale = (range > 0)?255.0/range:0;
+      for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+          it != _supernodes.end(); it++) {
+        double v = values[it->first*sizeFV + f];
+        if(averageOverSupernode) {
+          v /= it->second->size();
+        }
+        v = (v - minValues[f])*scale;
+        if(v < 0) {
+          v = 0;
+        } else if(v > 255) {
+          v = 255;
+        }
+        features[f][it->first] = (uchar)v;
+      }
     }
   }
 
-  // hessian
-  featType = 2;
-  for(int sc = 0; sc < numScales; ++sc) {
-    typedef itk::HessianRecursiveGaussianImageFilter<InputImageType,MatrixImageType> HessianFilterType;
-    HessianFilterType::Pointer hessianFilter = HessianFilterType::New();
-    hessianFilter->SetSigma(scales[sc]);
-    hessianFilter->SetInput(inputImage);
-    hessianFilter->Update();
-
-    // Eigenvalues of Hessian
-    typedef itk::SymmetricEigenAnalysisImageFilter<MatrixImageType,VectorImageType> EigvalFilter;
-    EigvalFilter::Pointer eigvalFilter = EigvalFilter::New();
-    eigvalFilter->SetDimension(nDim);
-
-#if 0  // whether to compute eigenvalues for smoothed hessian (as in structure tensor)
-    typedef itk::RecursiveGaussianImageFilter<MatrixImageType,MatrixImageType> SmoothingFilter;
-    SmoothingFilter::Pointer smoothingFilters[nDim];
-    for(int i=0; i<nDim; i++) {
-      smoothingFilters[i] = SmoothingFilter::New();
-      smoothingFilters[i]->ReleaseDataFlagOn();
-      smoothingFilters[i]->SetSigma(scales[sc]);
-      smoothingFilters[i]->SetDirection(i);
-      if(i == 0)	smoothingFilters[i]->SetInput(hessianFilter->GetOutput());
-      else		smoothingFilters[i]->SetInput(smoothingFilters[i-1]->GetOutput());
+  void reduce(FilterBank& bank, const FilterBankSlab& slab)
+  {
+    // index of the features corresponding to the channels of the filter bank
+    const int sc = slab.scaleIdx;
+    int channels[2 + 2*nDim];
+    int featIdxs[2 + 2*nDim];
+    int n = 0;
+    channels[n] = FB_GRADIENT_MAG;
+    featIdxs[n++] = sc;
+    channels[n] = FB_LOG;
+    featIdxs[n++] = numScales + sc;
+    for(int e = 0; e < nDim; ++e) {
+      channels[n] = FB_HESSIAN_EIG_1 + e;
+      featIdxs[n++] = 2*numScales + sc*nDim + e;
     }
-    eigvalFilter->SetInput(smoothingFilters[nDim-1]->GetOutput());
-#else
-    eigvalFilter->SetInput(hessianFilter->GetOutput());
+    for(int e = 0; e < nDim; ++e) {
+      channels[n] = FB_STENSOR_EIG_1 + e;
+      featIdxs[n++] = (2+nDim)*numScales + sc*nDim + e;
+    }
+
+    const ulong sliceSize = bank.getSliceSize();
+    const ulong cSize = (slab.z1 - slab.z0)*sliceSize;
+    for(int c = 0; c < n; ++c) {
+      const float* response = slab.channels[channels[c]];
+      const int f = featIdxs[c];
+
+      float minValue = FLT_MAX;
+      float maxValue = -FLT_MAX;
+      for(ulong i = 0; i < cSize; ++i) {
+        if(response[i] < minValue) {
+          minValue = response[i];
+        }
+        if(response[i] > maxValue) {
+          maxValue = response[i];
+        }
+      }
+#ifdef WITH_OPENMP
+#pragma omp critical(filterFeatureRange)
 #endif
+      {
+        if(minValue < minValues[f]) {
+          minValues[f] = minValue;
+        }
+        if(maxValue > maxValues[f]) {
+          maxValues[f] = maxValue;
+        }
+      }
 
-    hessianFilter->ReleaseDataFlagOn();
-						
-    for(int ch = 0; ch<channelCounts[featType]; ch++) {
-      assert(featIdx < sizeFV);
-      VectorElementSelectionFilter::Pointer vectorElementFilter = VectorElementSelectionFilter::New();
-      vectorElementFilter->ReleaseDataFlagOn();
-      vectorElementFilter->SetIndex(2-ch);  // reverse order, so largest eigenvalue first
-      vectorElementFilter->SetInput(eigvalFilter->GetOutput());
-      rescaleFilter->SetInput(vectorElementFilter->GetOutput());
-      rescaleFilter->GetOutput()->GetPixelContainer()->SetImportPointer(node_features, imageSize, false);
-      rescaleFilter->Update();
-     
-      createSupernodeBasedFeatures(slice, node_features, featIdx);
-
-#if OUTPUT_FILTER_IMAGES
-      typedef itk::ImageFileWriter<OutputImageType> WriterType;
-      WriterType::Pointer writer = WriterType::New();
-      stringstream sout;
-      sout << "eig_" << sc << "_" << ch << ".tif";
-      printf("[F_Filter] Writing image %s\n", sout.str().c_str());
-      writer->SetFileName(sout.str().c_str());
-      writer->SetInput(rescaleFilter->GetOutput());
-      writer->Update();
-#endif     
- 
-      ++featIdx;
+      for(long z = slab.z0; z < slab.z1; ++z) {
+        const float* plane = response + (z - slab.z0)*sliceSize;
+        if(averageOverSupernode) {
+          const vector<FilterBankRun>& runs = bank.getRuns(z);
+          for(vector<FilterBankRun>::const_iterator itR = runs.begin();
+              itR != runs.end(); ++itR) {
+            const float* p = plane + itR->y*bank.getWidth() + itR->x;
+            double sum = 0;
+            for(int k = 0; k < itR->length; ++k) {
+              sum += p[k];
+            }
+            // supernodes can span several slabs
+            double& value = values[itR->sid*sizeFV + f];
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+            value += sum;
+          }
+        } else {
+          for(vector<pair<sidType, ulong> >::const_iterator itC = centers[z].begin();
+              itC != centers[z].end(); ++itC) {
+            values[itC->first*sizeFV + f] = plane[itC->second];
+          }
+        }
+      }
     }
   }
 
-  // structure tensor
-  featType = 3;
-  printf("[F_Filter] Eigenvalues of structure tensor...\n");
-
-  // Threshold filter used mainly because the <...>RecursiveGaussianFilter in ITK is very imprecise
-  // and result in negative values where they should be strictly >= 0.
-  typedef itk::ThresholdImageFilter<FloatImageType> ThresholdFilter;
-  ThresholdFilter::Pointer zeroMinThresholdFilter = ThresholdFilter::New();
-  zeroMinThresholdFilter->ReleaseDataFlagOn();
-  zeroMinThresholdFilter->ThresholdBelow(0);
-  zeroMinThresholdFilter->SetOutsideValue(0);
-
-  for(int sc = 0; sc < numScales; ++sc) {
-
-    typedef itk::StructureTensorRecursiveGaussianImageFilter<InputImageType, MatrixImageType> STensorFilterType;
-    STensorFilterType::Pointer stensorFilter = STensorFilterType::New();
-    stensorFilter->SetSigma(scales[sc]);
-    //stensorFilter->SetRho(scales[sc]);
-    stensorFilter->SetSigma(scales[sc]);
-    stensorFilter->SetInput(inputImage);
-
-    typedef itk::SymmetricEigenAnalysisImageFilter<MatrixImageType,VectorImageType> EigvalFilter;
-    EigvalFilter::Pointer eigvalFilter = EigvalFilter::New();
-    eigvalFilter->SetDimension(nDim);
-    eigvalFilter->SetInput(stensorFilter->GetOutput());
-    stensorFilter->ReleaseDataFlagOn();
-						
-    for(int ch = 0; ch < channelCounts[featType]; ch++) {
-      VectorElementSelectionFilter::Pointer vectorElementFilter = VectorElementSelectionFilter::New();
-      vectorElementFilter->ReleaseDataFlagOn();
-      vectorElementFilter->SetIndex(2-ch);  // reverse order, so largest eigenvalue first
-      vectorElementFilter->SetInput(eigvalFilter->GetOutput());
-      zeroMinThresholdFilter->SetInput(vectorElementFilter->GetOutput());
-      rescaleFilter->GetOutput()->GetPixelContainer()->SetImportPointer(node_features, imageSize, false);
-      rescaleFilter->SetInput(zeroMinThresholdFilter->GetOutput());
-      rescaleFilter->Update();
-
-      createSupernodeBasedFeatures(slice, node_features, featIdx);
-
-      ++featIdx;
-    }
+ private:
+  int sizeFV;
+  bool averageOverSupernode;
+  ulong nSupernodes;
+  // nSupernodes*sizeFV responses (sum over the supernode if averaging)
+  double* values;
+  float* minValues;
+  float* maxValues;
+  vector<pair<sidType, ulong> >* centers;
+};
+
+void F_Filter::precomputeFeatures(Slice_P& slice)
+{
+  if(slice.getType() != SLICEP_SLICE3D) {
+    printf("[F_Filter] Error : filter features are only implemented for 3d volumes\n");
+    exit(-1);
   }
+  Slice3d& slice3d = static_cast<Slice3d&>(slice);
 
-  // switch pointers
-  delete[] node_features;
-}
+  printf("[F_Filter] Loading input image (%d,%d,%d) %ld\n", slice.getWidth(), slice.getHeight(),
+         slice.getDepth(), slice.getSize());
 
-void F_Filter::createSupernodeBasedFeatures(Slice_P& slice, uchar* node_features, int featIdx)
-{
-  node n;
-  const ulong size_slice = slice.getWidth() * slice.getHeight();
-  const map<sidType, supernode* >& _supernodes = slice.getSupernodes();
-  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-      it != _supernodes.end(); it++) {
-
-    // use response at the center of every supernode
-    it->second->getCenter(n);
-    ulong cubeIdx = n.z*size_slice + n.y*slice.getWidth() + n.x;
-    features[featIdx][it->first] = node_features[cubeIdx];
-
-    // could also average
-    /*
-      nodeIterator ni = s->getIterator();
-      ni.goToBegin();
-      while(!ni.isAtEnd()) {
-      ni.get(n);
-      ni.next();
-
-      pValue = features[n.z*size_slice + n.y*slice3d.width + n.x];   
-      }
-    */
+  ulong nSupernodes = slice.getNbSupernodes();
+  features = new uchar*[sizeFV];
+  for(int i = 0; i < sizeFV; i++) {
+    features[i] = new uchar[nSupernodes];
+  }
+
+  printf("[F_Filter] Computing features at %d scales\n", numScales);
 
+  // gradient magnitude, LoG and eigenvalues of the Hessian and of the
+  // structure tensor are computed from the same derivatives, one slab at a
+  // time. Responses are never stored for the whole volume.
+  FilterBank bank(slice3d, scales, numScales);
+  FilterFeatureReducer reducer(slice3d, sizeFV, averageOverSupernode);
+  int channelMask = FB_CHANNEL(FB_GRADIENT_MAG) | FB_CHANNEL(FB_LOG);
+  for(int e = 0; e < nDim; ++e) {
+    channelMask |= FB_CHANNEL(FB_HESSIAN_EIG_1 + e) | FB_CHANNEL(FB_STENSOR_EIG_1 + e);
   }
+  bank.run(channelMask, &reducer);
+  reducer.getFeatures(slice3d, features);
 }
 
 int F_Filter::getSizeFeatureVectorForOneSupernode()
@@ -34,8 +34,6 @@ class F_Filter : public Feature
 
   ~F_Filter();
 
-  void createSupernodeBasedFeatures(Slice_P& slice, uchar* node_features, int featIdx);
-
   int getSizeFeatureVectorForOneSupernode();
 
   bool getFeatureVector(osvm_node *n,
@@ -67,6 +65,10 @@ class F_Filter : public Feature
 private:
   uchar** features;
   int sizeFV;
+
+  // average the filter responses over the supernodes instead of sampling
+  // them at the center (filter_average_supernode in the config file)
+  bool averageOverSupernode;
 };
 
 #endif // F_Filter_H
\ No newline at end of file
@@ -54,9 +54,12 @@ class F_Glcm : public Feature
                                        const int supernodeId);
 
  private:
-  double valToIdx;
   int maxIntensity;
   int nItensityLevels;
+
+  // output energy, contrast, homogeneity, entropy and correlation instead
+  // of the co-occurrence matrix (glcm_haralick in the config file)
+  bool useHaralickFeatures;
 };
 
 #endif // F_Glcm_H
\ No newline at end of file
@@ -14,224 +14,173 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include "F_GradientStats.h"
+#include "FilterBank.h"
 #include "Histogram.h"
 #include "utils.h"
 #include "Config.h"
 
 // standard libraries
-#include <cv.h>
-#include <dirent.h>
-#include <highgui.h>
-#include <math.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 
-// ITK Header Files
-#include "itkImage.h"
-#include "itkRecursiveGaussianImageFilter.h"
-#include "itkImportImageFilter.h"
-#include "itkCastImageFilter.h"
-#include "itkGradientMagnitudeRecursiveGaussianImageFilter.h"
-
 using namespace std;
 
 //-----------------------------------------------------------------------------
 
+// resolution of the histograms used to compute the range of the gradient
+#define GRADIENT_RANGE_BINS 65536
+
 /**
- * @param direction : 0=X, 1=Y, 2=Z
+ * Histogram of the gradient over the whole volume for every scale. The range
+ * of the histogram is given by the bound of the gradient for 8-bit data.
  */
-template <typename TInputPixelType, typename TOutputPixelType>
-void gaussianFilter(unsigned char* rawData, long nx, long ny, long nz, long nc,
-                    int direction,
-                    TOutputPixelType*& output1d)
+class GradientRangeReducer : public FilterBankReducer
 {
-  typedef TInputPixelType  PixelType;
-
-  PixelType * data1d = reinterpret_cast< PixelType * >(rawData);
+ public:
+  GradientRangeReducer(FilterBank& bank, int _channel)
+  {
+    channel = _channel;
+    nScales = bank.getNbScales();
+    lowerBounds = new double[nScales];
+    binWidths = new double[nScales];
+    counts = new ulong[nScales*GRADIENT_RANGE_BINS];
+    for(ulong i = 0; i < (ulong)nScales*GRADIENT_RANGE_BINS; ++i) {
+      counts[i] = 0;
+    }
+    for(int s = 0; s < nScales; ++s) {
+      double bound = bank.getGradientBound(s);
+      if(channel == FB_GRADIENT_MAG) {
+        lowerBounds[s] = 0;
+        binWidths[s] = sqrt(3.0)*bound/GRADIENT_RANGE_BINS;
+      } else {
+        lowerBounds[s] = -bound;
+        binWidths[s] = 2.0*bound/GRADIENT_RANGE_BINS;
+      }
+    }
+  }
 
-  ulong pagesz = nx*ny*nz;		
-  unsigned long int numberOfPixels = pagesz*nc;
-  long offsets = 0;
-  const unsigned int Dimension = 3;
-		
-  typedef itk::Image< TInputPixelType, Dimension > InputImageType;
-  typedef itk::Image< TOutputPixelType, Dimension > OutputImageType;
-  typedef itk::ImportImageFilter< TInputPixelType, Dimension > ImportFilterType;
-		
-  typename ImportFilterType::Pointer importFilter = ImportFilterType::New();
-		
-  typename ImportFilterType::SizeType size;
-  size[0] = nx;
-  size[1] = ny;
-  size[2] = nz;
-		
-  typename ImportFilterType::IndexType start;
-  start.Fill( 0 );
-		
-  typename ImportFilterType::RegionType region;
-  region.SetIndex( start );
-  region.SetSize(  size  );
-		
-  importFilter->SetRegion( region );
-  region.SetSize( size );
-		
-  typename InputImageType::PointType origin;
-  origin.Fill( 0.0 );
-		
-  importFilter->SetOrigin( origin );
-		
-  typename ImportFilterType::SpacingType spacing;
-  spacing.Fill( 1.0 );
-  importFilter->SetSpacing( spacing );
-		
-  const bool importImageFilterWillOwnTheBuffer = false;
-		
-  typedef itk::CastImageFilter< InputImageType, OutputImageType> CastImageFilterType;
-  typename CastImageFilterType::Pointer castImageFilter = CastImageFilterType::New();
-		
-  typedef itk::RecursiveGaussianImageFilter<OutputImageType, OutputImageType> GaussianImageFilterType;
-  typename GaussianImageFilterType::Pointer gaussianImageFilter = GaussianImageFilterType::New();
+  ~GradientRangeReducer()
+  {
+    delete[] lowerBounds;
+    delete[] binWidths;
+    delete[] counts;
+  }
 
+  /**
+   * Value of the idx-th smallest response at the given scale (up to the
+   * width of a bin).
+   */
+  float getValue(int scaleIdx, ulong idx)
+  {
+    const ulong* scaleCounts = counts + (ulong)scaleIdx*GRADIENT_RANGE_BINS;
+    ulong n = 0;
+    int b = 0;
+    for(; b < GRADIENT_RANGE_BINS - 1; ++b) {
+      n += scaleCounts[b];
+      if(n > idx) {
+        break;
+      }
+    }
+    return lowerBounds[scaleIdx] + (b+0.5)*binWidths[scaleIdx];
+  }
 
-  try
-    {
-      output1d = new TOutputPixelType [numberOfPixels];
+  void reduce(FilterBank& bank, const FilterBankSlab& slab)
+  {
+    const float* response = slab.channels[channel];
+    const ulong cSize = (slab.z1 - slab.z0)*bank.getSliceSize();
+    const double lowerBound = lowerBounds[slab.scaleIdx];
+    const double binWidth = binWidths[slab.scaleIdx];
+    ulong* localCounts = new ulong[GRADIENT_RANGE_BINS];
+    for(int b = 0; b < GRADIENT_RANGE_BINS; ++b) {
+      localCounts[b] = 0;
     }
-  catch(...)
-    {
-      std::cerr << "[GaussianFilter] Error while allocating memory." << std::endl;
-      return;
+    for(ulong i = 0; i < cSize; ++i) {
+      int b = (int)((response[i] - lowerBound)/binWidth);
+      if(b < 0) {
+        b = 0;
+      } else if(b >= GRADIENT_RANGE_BINS) {
+        b = GRADIENT_RANGE_BINS - 1;
+      }
+      ++localCounts[b];
     }
-				
-  const bool filterWillDeleteTheInputBuffer = false;
-				
-  for(long ch=0; ch<nc; ch++)
-    {
-      offsets = ch*pagesz;
-					
-      TOutputPixelType *p = output1d+offsets;
-					
-      importFilter->SetImportPointer( data1d+offsets, pagesz, importImageFilterWillOwnTheBuffer );
-					
-      castImageFilter->SetInput( importFilter->GetOutput() );
-      try
-        {
-          castImageFilter->Update();
-        }
-      catch( itk::ExceptionObject & excp)
-        {
-          std::cerr << "Error while running this filter." << std::endl;
-          std::cerr << excp << std::endl;
-          return;
-        }
 
-      // set parameters
-      gaussianImageFilter->SetInput( castImageFilter->GetOutput() );					
-      gaussianImageFilter->SetDirection(direction);
-      gaussianImageFilter->SetFirstOrder();
-      gaussianImageFilter->SetSigma(3);
-					
-      gaussianImageFilter->GetOutput()->GetPixelContainer()->SetImportPointer( p, pagesz, filterWillDeleteTheInputBuffer);
-					
-      try
-        {
-          gaussianImageFilter->Update();
-        }
-      catch( itk::ExceptionObject & excp)
-        {
-          std::cerr << "Error while running this filter." << std::endl;
-          std::cerr << excp << std::endl;
-          return;
-        }
-					
+    ulong* scaleCounts = counts + (ulong)slab.scaleIdx*GRADIENT_RANGE_BINS;
+#ifdef WITH_OPENMP
+#pragma omp critical(gradientRange)
+#endif
+    {
+      for(int b = 0; b < GRADIENT_RANGE_BINS; ++b) {
+        scaleCounts[b] += localCounts[b];
+      }
     }
-}
-
-template <typename TInputPixelType, typename TOutputPixelType>
-void gradientMagnitude(unsigned char* rawData, long nx, long ny, long nz, long nc,
-                       float gaussianVariance, TOutputPixelType*& output1d)
-{
-  typedef TInputPixelType  PixelType;
-	
-  PixelType * data1d = reinterpret_cast< PixelType * >(rawData);
-  ulong pagesz = nx*ny*nz;
-  unsigned long int numberOfPixels = pagesz*nc;
-  long offsets = 0;
-  const unsigned int Dimension = 3;
-		
-  typedef itk::Image< TInputPixelType, Dimension > InputImageType;
-  typedef itk::Image< TOutputPixelType, Dimension > OutputImageType;
-  typedef itk::ImportImageFilter< TInputPixelType, Dimension > ImportFilterType;
-		
-  typename ImportFilterType::Pointer importFilter = ImportFilterType::New();
-		
-  typename ImportFilterType::SizeType size;
-  size[0] = nx;
-  size[1] = ny;
-  size[2] = nz;
-		
-  typename ImportFilterType::IndexType start;
-  start.Fill( 0 );
-		
-  typename ImportFilterType::RegionType region;
-  region.SetIndex( start );
-  region.SetSize(  size  );
-		
-  importFilter->SetRegion( region );	
-  region.SetSize( size );
-		
-  typename InputImageType::PointType origin;
-  origin.Fill( 0.0 );
-		
-  importFilter->SetOrigin( origin );
-		
-  typename ImportFilterType::SpacingType spacing;
-  spacing.Fill( 1.0 );	
-  importFilter->SetSpacing( spacing );
-		
-  const bool importImageFilterWillOwnTheBuffer = false;
-		
-  typedef itk::GradientMagnitudeRecursiveGaussianImageFilter<InputImageType, OutputImageType> GradientType;
-  typename GradientType::Pointer gradientFilter = GradientType::New();
+    delete[] localCounts;
+  }
 
-  gradientFilter->SetSigma(gaussianVariance);
+ private:
+  int channel;
+  int nScales;
+  double* lowerBounds;
+  double* binWidths;
+  ulong* counts;
+};
 
-  try
-    {
-      output1d = new TOutputPixelType [numberOfPixels];
-    }
-  catch(...)
-    {
-      std::cerr << "[F_GradientStats] Error while allocating memory." << std::endl;
-      return;
-    }
-				
-  const bool filterWillDeleteTheInputBuffer = false;
-				
-  for(long ch=0; ch<nc; ch++)
-    {
-      offsets = ch*pagesz;
-      TOutputPixelType *p = output1d+offsets;
-					
-      importFilter->SetImportPointer( data1d+offsets, pagesz, importImageFilterWillOwnTheBuffer );
-      gradientFilter->SetInput( importFilter->GetOutput() );
+/**
+ * Histogram of the gradient inside every supernode.
+ */
+class GradientHistogramReducer : public FilterBankReducer
+{
+ public:
+  GradientHistogramReducer(int _channel, int _nBinsPerScale,
+                           const float* _minGradientValue,
+                           const float* _maxGradientValue,
+                           float* _histograms)
+  {
+    channel = _channel;
+    nBinsPerScale = _nBinsPerScale;
+    minGradientValue = _minGradientValue;
+    maxGradientValue = _maxGradientValue;
+    histograms = _histograms;
+  }
 
-      gradientFilter->GetOutput()->GetPixelContainer()->SetImportPointer( p, pagesz, filterWillDeleteTheInputBuffer);
-					
-      try
-        {
-          gradientFilter->Update();
-        }
-      catch( itk::ExceptionObject & excp)
-        {
-          std::cerr << "[F_GradientStats] Error ehile running this filter." << std::endl;
-          std::cerr << excp << std::endl;
-          return;
+  void reduce(FilterBank& bank, const FilterBankSlab& slab)
+  {
+    const int sc = slab.scaleIdx;
+    const int nBins = nBinsPerScale*bank.getNbScales();
+    const float* response = slab.channels[channel];
+    const double valToIdx = nBins/(double)(maxGradientValue[sc]-minGradientValue[sc]);
+    for(long z = slab.z0; z < slab.z1; ++z) {
+      const float* plane = response + (z - slab.z0)*bank.getSliceSize();
+      const vector<FilterBankRun>& runs = bank.getRuns(z);
+      for(vector<FilterBankRun>::const_iterator itR = runs.begin();
+          itR != runs.end(); ++itR) {
+        const float* p = plane + itR->y*bank.getWidth() + itR->x;
+        float* hist = histograms + (ulong)itR->sid*nBins + sc*nBinsPerScale;
+        for(int k = 0; k < itR->length; ++k) {
+          int idx = (int)((p[k] - minGradientValue[sc])*valToIdx+0.5f); // rounding
+          if(idx < 0) {
+            idx = 0;
+          }
+          if(idx >= nBinsPerScale) {
+            idx = nBinsPerScale - 1;
+          }
+          // supernodes can span several slabs
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+          hist[idx]++;
         }
-
+      }
     }
-}
+  }
+
+ private:
+  int channel;
+  int nBinsPerScale;
+  const float* minGradientValue;
+  const float* maxGradientValue;
+  float* histograms;
+};
 
 //--------------------------------------------------------------------- METHODS
 
@@ -250,21 +199,17 @@ F_GradientStats::F_GradientStats(Slice3d& slice3d,
 
   minGradientValue = new float[numScales];
   maxGradientValue = new float[numScales];
-  fGradientCube = new float*[numScales];
 
   nBinsPerScale = 10;
-  computeGradientCube(slice3d,
-                      gradientType);
+  computeHistograms(slice3d,
+                    gradientType);
 }
 
 F_GradientStats::~F_GradientStats()
 {
-  for(int s = 0; s < numScales; ++s) {
-    delete[] fGradientCube[s];
-  }
   delete[] minGradientValue;
   delete[] maxGradientValue;
-  delete[] fGradientCube;
+  delete[] histograms;
 }
 
 int F_GradientStats::getSizeFeatureVectorForOneSupernode()
@@ -278,89 +223,65 @@ bool F_GradientStats::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice
   return false;
 }
 
-void F_GradientStats::computeGradientCube(Slice3d& slice3d, eGradientType gradientType)
+void F_GradientStats::computeHistograms(Slice3d& slice3d, eGradientType gradientType)
 {
   ulong cubeSize = slice3d.width*slice3d.height*(ulong)slice3d.depth;
   PRINT_MESSAGE("[F_GradientStats] Computing gradient (type = %d) for cube containing %ld voxels\n",
                 (int)gradientType, cubeSize);
 
-  for(int s = 0; s < numScales; ++s) {
-    if(gradientType == GRADIENT_MAG) {
-      gradientMagnitude<unsigned char, float>(slice3d.raw_data,
-                                              (long)slice3d.width,(long)slice3d.height,(long)slice3d.depth,(long)slice3d.nChannels,
-                                              scales[s], fGradientCube[s]);
-    } else {
-      gaussianFilter<unsigned char, float>(slice3d.raw_data,
-                                           (long)slice3d.width,(long)slice3d.height,(long)slice3d.depth,(long)slice3d.nChannels,
-                                           (int)gradientType,
-                                           fGradientCube[s]);
-    }
-
-    minGradientValue[s] = fGradientCube[s][0];
-    maxGradientValue[s] = fGradientCube[s][0];
+  int channel;
+  switch(gradientType) {
+  case GRADIENT_X:
+    channel = FB_GRADIENT_X;
+    break;
+  case GRADIENT_Y:
+    channel = FB_GRADIENT_Y;
+    break;
+  case GRADIENT_Z:
+    channel = FB_GRADIENT_Z;
+    break;
+  default:
+    channel = FB_GRADIENT_MAG;
+    break;
+  }
 
-#if 0
-    for(sizeSliceType i = 0; i < cubeSize; i++) {
-      if(minGradientValue[s] > fGradientCube[s][i])
-        minGradientValue[s] = fGradientCube[s][i];
-      if(maxGradientValue[s] < fGradientCube[s][i])
-        maxGradientValue[s] = fGradientCube[s][i];
-    }
-#else
-    ulong idx_min = 0.01*cubeSize;
-    ulong idx_max = 0.99*cubeSize; 
+  FilterBank bank(slice3d, scales, numScales);
 
-    vector<float> vfGradientCube(cubeSize);
-    for(sizeSliceType i = 0; i < cubeSize; i++) {
-      vfGradientCube[i] = fGradientCube[s][i];
-    }
+  // first pass : range of the gradient (1st and 99th percentiles)
+  GradientRangeReducer rangeReducer(bank, channel);
+  bank.run(FB_CHANNEL(channel), &rangeReducer);
 
-    nth_element(vfGradientCube.begin(), vfGradientCube.begin()+idx_min, vfGradientCube.end());
-    minGradientValue[s] = vfGradientCube[idx_min];                                                                                           
-                                                                                                                                 
-    nth_element(vfGradientCube.begin(), vfGradientCube.begin()+idx_max, vfGradientCube.end());
-    maxGradientValue[s] = vfGradientCube[idx_max];                                                                                            
-#endif
+  ulong idx_min = 0.01*cubeSize;
+  ulong idx_max = 0.99*cubeSize;
+  for(int s = 0; s < numScales; ++s) {
+    minGradientValue[s] = rangeReducer.getValue(s, idx_min);
+    maxGradientValue[s] = rangeReducer.getValue(s, idx_max);
 
     PRINT_MESSAGE("[F_GradientStats] minGradientValue scale %f : %f\n", scales[s], minGradientValue[s]);
     PRINT_MESSAGE("[F_GradientStats] maxGradientValue scale %f : %f\n", scales[s], maxGradientValue[s]);
   }
+
+  // second pass : histograms of the supernodes
+  const ulong nBins = nBinsPerScale*numScales;
+  const ulong nSupernodes = slice3d.getNbSupernodes();
+  histograms = new float[nSupernodes*nBins];
+  for(ulong i = 0; i < nSupernodes*nBins; ++i) {
+    histograms[i] = 0;
+  }
+  GradientHistogramReducer histogramReducer(channel, nBinsPerScale,
+                                            minGradientValue, maxGradientValue,
+                                            histograms);
+  bank.run(FB_CHANNEL(channel), &histogramReducer);
 }
 
 bool F_GradientStats::getFeatureVectorForOneSupernode(osvm_node *x,
                                                       Slice3d* slice3d,
                                                       const int supernodeId)
 {
-  Histogram hist(nBinsPerScale*numScales);
-
-  supernode* s = slice3d->getSupernode(supernodeId);
-  float value;
-  const ulong size_slice = slice3d->width * slice3d->height;
-  node n;
-  int idx;
-  nodeIterator ni = s->getIterator();
-  ni.goToBegin();
-  while(!ni.isAtEnd()) {
-    ni.get(n);
-    ni.next();
-
-    for(int sc = 0; sc < numScales; ++sc) {
-      double valToIdx = hist.nBins/(double)(maxGradientValue[sc]-minGradientValue[sc]);
-      value = fGradientCube[sc][n.z*size_slice + n.y*slice3d->width + n.x];
-      value -= minGradientValue[sc];
-      idx = (int)(value*valToIdx+0.5f); // rounding
-      if(idx < 0) {
-        idx = 0;
-      }
-      if(idx >= nBinsPerScale) {
-        idx = nBinsPerScale - 1;
-      }
-      hist.histData[(sc*nBinsPerScale) + idx]++;
-    }
-  }
-
-  for(int i = 0; i < hist.nBins; i++) {
-    x[i].value = hist.histData[i];
+  const int nBins = nBinsPerScale*numScales;
+  const float* hist = histograms + (ulong)supernodeId*nBins;
+  for(int i = 0; i < nBins; i++) {
+    x[i].value = hist[i];
   }
 
   return true;
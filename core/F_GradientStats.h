@@ -67,8 +67,12 @@ class F_GradientStats : public Feature
 
  private:
 
-  void computeGradientCube(Slice3d& slice3d,
-                           eGradientType gradientType);
+  /**
+   * Compute the histograms of all the supernodes. The gradient is computed
+   * slab by slab by FilterBank and never stored for the whole volume.
+   */
+  void computeHistograms(Slice3d& slice3d,
+                         eGradientType gradientType);
 
   float* minGradientValue;
   float* maxGradientValue;
@@ -76,9 +80,9 @@ class F_GradientStats : public Feature
   int nBinsPerScale;
 
   /**
-   * Cube containing the gradient
+   * nSupernodes histograms of nBinsPerScale*numScales bins
    */
-  float** fGradientCube;
+  float* histograms;
 };
 
 #endif // F_GRADIENTSTATS_H
\ No newline at end of file
@@ -15,6 +15,7 @@
 
 #include "F_Histogram.h"
 #include "Config.h"
+#include "SupernodeStats.h"
 
 F_Histogram::F_Histogram(int _nb_bins,
                          int _max_pixel_value,
@@ -63,6 +64,11 @@ F_Histogram::F_Histogram(int _nb_bins,
   }
 
   assert(!(normalize_l1_norm && normalize_l2_norm));
+
+  // grayscale histograms of all the supernodes are computed in one pass
+  if(!useColorImage) {
+    SupernodeStats::request(STATS_HISTOGRAM, nBinsPerSupernode, max_pixel_value);
+  }
 }
 
 int F_Histogram::getSizeFeatureVectorForOneSupernode()
@@ -92,56 +98,60 @@ bool F_Histogram::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, in
   int idx;
   node n;
   int offset = 0;
-  nodeIterator ni = s->getIterator();
-  ni.goToBegin();
-  while(!ni.isAtEnd()) {
-    ni.get(n);
-    ni.next();
-    offset = 0;
-    for(int c=0;c<nChannels;c++) {
-      value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
-      idx = value*valToBin;
-      hist.histData[offset+idx]++;
-      offset += nBinsPerSupernode;
+  if(!useColorImage) {
+    getGrayscaleHistogram(slice, supernodeId, hist);
+  } else {
+    nodeIterator ni = s->getIterator();
+    ni.goToBegin();
+    while(!ni.isAtEnd()) {
+      ni.get(n);
+      ni.next();
+      offset = 0;
+      for(int c=0;c<nChannels;c++) {
+        value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
+        idx = value*valToBin;
+        hist.histData[offset+idx]++;
+        offset += nBinsPerSupernode;
+      }
     }
-  }
 
-  double binValue = 1.0/(double)s->neighbors.size();
-  if(histoType == INCLUDE_NEIGHBORS) {
-    for(vector < supernode* >::iterator itN = s->neighbors.begin();
-        itN != s->neighbors.end();itN++) {
-      sn = *itN;
-      nodeIterator ni = sn->getIterator();
-      ni.goToBegin();
-      while(!ni.isAtEnd()) {
-        ni.get(n);
-        ni.next();
-        offset = 0;
-        for(int c=0;c<nChannels;c++) {
-          value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
-          idx = value*valToBin;
-          hist.histData[offset+idx]+=binValue;
-          offset += nBinsPerSupernode;
+    double binValue = 1.0/(double)s->neighbors.size();
+    if(histoType == INCLUDE_NEIGHBORS) {
+      for(vector < supernode* >::iterator itN = s->neighbors.begin();
+          itN != s->neighbors.end();itN++) {
+        sn = *itN;
+        nodeIterator ni = sn->getIterator();
+        ni.goToBegin();
+        while(!ni.isAtEnd()) {
+          ni.get(n);
+          ni.next();
+          offset = 0;
+          for(int c=0;c<nChannels;c++) {
+            value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
+            idx = value*valToBin;
+            hist.histData[offset+idx]+=binValue;
+            offset += nBinsPerSupernode;
+          }
         }
       }
     }
-  }
-  else if(histoType == INCLUDE_NEIGHBORS_IN_SEPARATE_BINS) {
-    for(vector < supernode* >::iterator itN = s->neighbors.begin();
-        itN != s->neighbors.end();itN++) {
-      sn = *itN;
-      nodeIterator ni = sn->getIterator();
-      ni.goToBegin();
-      while(!ni.isAtEnd()) {
-        ni.get(n);
-        ni.next();
-
-        offset = nBinsPerSupernode*nChannels;
-        for(int c=0;c<nChannels;c++) {
-          value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
-          idx = value*valToBin;
-          hist.histData[offset+idx]+=binValue;
-          offset += nBinsPerSupernode;
+    else if(histoType == INCLUDE_NEIGHBORS_IN_SEPARATE_BINS) {
+      for(vector < supernode* >::iterator itN = s->neighbors.begin();
+          itN != s->neighbors.end();itN++) {
+        sn = *itN;
+        nodeIterator ni = sn->getIterator();
+        ni.goToBegin();
+        while(!ni.isAtEnd()) {
+          ni.get(n);
+          ni.next();
+
+          offset = nBinsPerSupernode*nChannels;
+          for(int c=0;c<nChannels;c++) {
+            value = (int)(((uchar*)(_img->imageData + n.y*_img->widthStep))[n.x*_img->nChannels+c]);
+            idx = value*valToBin;
+            hist.histData[offset+idx]+=binValue;
+            offset += nBinsPerSupernode;
+          }
         }
       }
     }
@@ -226,38 +236,23 @@ bool F_Histogram::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d
   int idx;
   const ulong size_slice = slice3d->width * slice3d->height;
   node n;
-  nodeIterator ni = s->getIterator();
-  ni.goToBegin();
-  while(!ni.isAtEnd()) {
-    ni.get(n);
-    ni.next();
-    for(int c=0;c<nChannels;c++) {
-      value = raw_data[n.z*size_slice + n.y*slice3d->width + n.x + c];
-      idx = value*valToIdx;
-      hist.histData[idx]++;
-    }
-  }
-
-  double binValue = 1.0/(double)s->neighbors.size();
-  if(histoType == INCLUDE_NEIGHBORS) {
-    for(vector < supernode* >::iterator itN = s->neighbors.begin();
-        itN != s->neighbors.end();itN++) {
-      sn = *itN;
-      nodeIterator ni = sn->getIterator();
-      ni.goToBegin();
-      while(!ni.isAtEnd()) {
-        ni.get(n);
-        ni.next();
-        
-        for(int c=0;c<nChannels;c++) {
-          value = raw_data[n.z*size_slice + n.y*slice3d->width + n.x + c];
-          idx = value*valToIdx;
-          hist.histData[idx]+=binValue;
-        }
+  if(!useColorImage) {
+    getGrayscaleHistogram(slice3d, supernodeId, hist);
+  } else {
+    nodeIterator ni = s->getIterator();
+    ni.goToBegin();
+    while(!ni.isAtEnd()) {
+      ni.get(n);
+      ni.next();
+      for(int c=0;c<nChannels;c++) {
+        value = raw_data[n.z*size_slice + n.y*slice3d->width + n.x + c];
+        idx = value*valToIdx;
+        hist.histData[idx]++;
       }
     }
-  } else{
-    if(histoType == INCLUDE_NEIGHBORS_IN_SEPARATE_BINS) {
+
+    double binValue = 1.0/(double)s->neighbors.size();
+    if(histoType == INCLUDE_NEIGHBORS) {
       for(vector < supernode* >::iterator itN = s->neighbors.begin();
           itN != s->neighbors.end();itN++) {
         sn = *itN;
@@ -266,11 +261,30 @@ bool F_Histogram::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d
         while(!ni.isAtEnd()) {
           ni.get(n);
           ni.next();
-          
+        
           for(int c=0;c<nChannels;c++) {
             value = raw_data[n.z*size_slice + n.y*slice3d->width + n.x + c];
             idx = value*valToIdx;
-            hist.histData[nBinsPerSupernode+idx]+=binValue;
+            hist.histData[idx]+=binValue;
+          }
+        }
+      }
+    } else{
+      if(histoType == INCLUDE_NEIGHBORS_IN_SEPARATE_BINS) {
+        for(vector < supernode* >::iterator itN = s->neighbors.begin();
+            itN != s->neighbors.end();itN++) {
+          sn = *itN;
+          nodeIterator ni = sn->getIterator();
+          ni.goToBegin();
+          while(!ni.isAtEnd()) {
+            ni.get(n);
+            ni.next();
+          
+            for(int c=0;c<nChannels;c++) {
+              value = raw_data[n.z*size_slice + n.y*slice3d->width + n.x + c];
+              idx = value*valToIdx;
+              hist.histData[nBinsPerSupernode+idx]+=binValue;
+            }
           }
         }
       }
@@ -328,3 +342,31 @@ bool F_Histogram::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d
 
   return true;
 }
+
+void F_Histogram::getGrayscaleHistogram(Slice_P* slice, int supernodeId, Histogram& hist)
+{
+  // histograms of all the supernodes are computed in one pass from the
+  // shared bin index volume
+  SupernodeStats* stats = slice->getIntensityStats(STATS_HISTOGRAM, nBinsPerSupernode,
+                                                   max_pixel_value);
+  const float* h = stats->getHistogram(supernodeId);
+  for(int i = 0; i < nBinsPerSupernode; i++) {
+    hist.histData[i] = h[i];
+  }
+
+  if(histoType != INCLUDE_NEIGHBORS && histoType != INCLUDE_NEIGHBORS_IN_SEPARATE_BINS) {
+    return;
+  }
+
+  // neighbor histograms are summed instead of re-scanning their voxels
+  supernode* s = slice->getSupernode(supernodeId);
+  double binValue = 1.0/(double)s->neighbors.size();
+  int offset = (histoType == INCLUDE_NEIGHBORS_IN_SEPARATE_BINS)?nBinsPerSupernode:0;
+  for(vector < supernode* >::iterator itN = s->neighbors.begin();
+      itN != s->neighbors.end();itN++) {
+    const float* hn = stats->getHistogram((*itN)->id);
+    for(int i = 0; i < nBinsPerSupernode; i++) {
+      hist.histData[offset+i] += hn[i]*binValue;
+    }
+  }
+}
@@ -64,6 +64,13 @@ class F_Histogram : public Feature
                                        Slice3d* slice3d,
                                        const int supernodeId);
 
+ private:
+  /**
+   * Histogram of the first channel of a supernode (and its neighbors) built
+   * from the histograms cached by the slice.
+   */
+  void getGrayscaleHistogram(Slice_P* slice, int supernodeId, Histogram& hist);
+
  public:
   int nChannels;
   int nBinsPerSupernode;
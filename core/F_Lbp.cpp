@@ -12,78 +12,365 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #include "F_Lbp.h"
 #include "Config.h"
 
-#define LBP_N_BINS 256
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
 
-F_Lbp::~F_Lbp()
+#include <string.h>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// value of the entries of the mapping that are not computed yet
+#define LBP_UNKNOWN_BIN 255
+
+//------------------------------------------------------------------------------
+
+/**
+ * Returns true if the neighbors given by set form a connected set.
+ */
+static bool isConnected(uint set, const uint* adjacency, int nNeighbors)
 {
+  if(set == 0) {
+    return true;
+  }
+  uint component = set & (~set + 1);
+  uint previous = 0;
+  while(component != previous) {
+    previous = component;
+    for(int b = 0; b < nNeighbors; ++b) {
+      if(previous & (1 << b)) {
+        component |= adjacency[b] & set;
+      }
+    }
+  }
+  return component == set;
 }
 
-F_Lbp::F_Lbp()
+//------------------------------------------------------------------------------
+
+F_Lbp::F_Lbp(bool volume)
 {
+  mapping = 0;
+  initNeighborhood(volume);
 }
 
-int F_Lbp::getSizeFeatureVector()
+F_Lbp::~F_Lbp()
 {
-  return LBP_N_BINS;
+  if(mapping) {
+    delete[] mapping;
+  }
+  for(map<ulong, float*>::iterator it = histograms.begin();
+      it != histograms.end(); ++it) {
+    delete[] it->second;
+  }
 }
 
-bool F_Lbp::getFeatureVector(osvm_node *x, Slice* slice, int supernodeId)
+void F_Lbp::initNeighborhood(bool volume)
 {
-  supernode* s = slice->getSupernode(supernodeId);
-  double value, n_value;
-  node n;
-
-  const int w = slice->getWidth();
-  const int h = slice->getHeight();
-  const int z = 0;
-
-  int sizeFV = getSizeFeatureVector();
-  const int neighborhoodSize = 8;
-  int pattern;
-
-  // initialize feature vector
-  for(int i = 0; i < sizeFV; ++i) {
-    x[i].value = 0;
-  }
-
-  nodeIterator ni = s->getIterator();
-  ni.goToBegin();
-  while(!ni.isAtEnd()) {
-    ni.get(n);
-    ni.next();
-
-    value = slice->getIntensity(n.x, n.y, n.z);
-    pattern = 0;
-
-    // check if neighbors are part of the supernode.
-    int min_x = max(0, n.x - 1);
-    int max_x = min(w, n.x + 1);
-    int min_y = max(0, n.y - 1);
-    int max_y = min(h, n.y + 1);
-    int count = 0;
-    for(int _x = min_x; _x <= max_x; ++_x) {
-      for(int _y = min_y; _y <= max_y; ++_y) {
-        sidType nsid = slice->getSid(_x, _y, _z);
-        if(supernodeId == nsid) {
-          n_value = slice->getIntensity(_x, _y, _z);
-          pattern |= (value > n_value) << count;
-          ++count;
+  if(!volume) {
+    // 8-neighborhood in circular order
+    static const int ring[8][2] = {{-1,-1}, {0,-1}, {1,-1}, {1,0}, {1,1}, {0,1}, {-1,1}, {-1,0}};
+    nNeighbors = 8;
+    for(int k = 0; k < nNeighbors; ++k) {
+      offsets[k][0] = ring[k][0];
+      offsets[k][1] = ring[k][1];
+      offsets[k][2] = 0;
+    }
+    mapping = new uchar[1 << nNeighbors];
+    for(uint p = 0; p < (uint)(1 << nNeighbors); ++p) {
+      int nOnes = 0;
+      int nTransitions = 0;
+      for(int k = 0; k < nNeighbors; ++k) {
+        nOnes += (p >> k) & 1;
+        nTransitions += ((p >> k) & 1) != ((p >> ((k+1)%nNeighbors)) & 1);
+      }
+      mapping[p] = (nTransitions <= 2)?nOnes:nNeighbors+1;
+    }
+    return;
+  }
+
+  nNeighbors = 6;
+  string config_tmp;
+  if(Config::Instance()->getParameter("lbp_neighborhood", config_tmp)) {
+    nNeighbors = atoi(config_tmp.c_str());
+  }
+
+  if(nNeighbors == 6) {
+    static const int faces[6][3] = {{-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+    for(int k = 0; k < nNeighbors; ++k) {
+      for(int d = 0; d < 3; ++d) {
+        offsets[k][d] = faces[k][d];
+      }
+    }
+  } else if(nNeighbors == 26) {
+    int k = 0;
+    for(int dz = -1; dz <= 1; ++dz) {
+      for(int dy = -1; dy <= 1; ++dy) {
+        for(int dx = -1; dx <= 1; ++dx) {
+          if(dx != 0 || dy != 0 || dz != 0) {
+            offsets[k][0] = dx;
+            offsets[k][1] = dy;
+            offsets[k][2] = dz;
+            ++k;
+          }
         }
       }
     }
-    if(count == neighborhoodSize) {
-      // valid
-      ++x[pattern].value;
+  } else {
+    printf("[F_Lbp] Error : lbp_neighborhood should be 6 or 26 (%d)\n", nNeighbors);
+    exit(-1);
+  }
+
+  // two neighbors are adjacent if they are not opposite (6-neighborhood) or
+  // if they touch each other (26-neighborhood)
+  for(int k = 0; k < nNeighbors; ++k) {
+    adjacency[k] = 0;
+    for(int l = 0; l < nNeighbors; ++l) {
+      if(l == k) {
+        continue;
+      }
+      bool adjacent = true;
+      if(nNeighbors == 6) {
+        adjacent = (offsets[k][0] + offsets[l][0] != 0) ||
+          (offsets[k][1] + offsets[l][1] != 0) ||
+          (offsets[k][2] + offsets[l][2] != 0);
+      } else {
+        for(int d = 0; d < 3; ++d) {
+          if(abs(offsets[k][d] - offsets[l][d]) > 1) {
+            adjacent = false;
+          }
+        }
+      }
+      if(adjacent) {
+        adjacency[k] |= 1 << l;
+      }
+    }
+  }
+
+  // The 6-neighborhood mapping is filled here. The 26-neighborhood one
+  // (2^26 entries, 64MB) is filled lazily by getBin because testing the
+  // connectivity of all the patterns takes much longer than computing the
+  // histograms of a volume, which only contain a small subset of them.
+  mapping = new uchar[1 << nNeighbors];
+  if(nNeighbors == 6) {
+    for(uint p = 0; p < (uint)(1 << nNeighbors); ++p) {
+      mapping[p] = computeBin(p);
+    }
+  } else {
+    memset(mapping, LBP_UNKNOWN_BIN, 1 << nNeighbors);
+  }
+}
+
+int F_Lbp::getBin(uint pattern)
+{
+  // getBin is called from the parallel region of computeHistograms. The
+  // entries are read and written atomically, threads can still compute the
+  // same entry concurrently but they all store the same value.
+  uchar bin;
+#ifdef WITH_OPENMP
+#pragma omp atomic read
+#endif
+  bin = mapping[pattern];
+  if(bin == LBP_UNKNOWN_BIN) {
+    bin = computeBin(pattern);
+#ifdef WITH_OPENMP
+#pragma omp atomic write
+#endif
+    mapping[pattern] = bin;
+  }
+  return bin;
+}
+
+int F_Lbp::computeBin(uint pattern)
+{
+  int nOnes = 0;
+  for(int k = 0; k < nNeighbors; ++k) {
+    nOnes += (pattern >> k) & 1;
+  }
+  if(nOnes == 0 || nOnes == nNeighbors) {
+    return nOnes;
+  }
+  uint complement = ~pattern & ((1 << nNeighbors) - 1);
+  if(isConnected(pattern, adjacency, nNeighbors) &&
+     isConnected(complement, adjacency, nNeighbors)) {
+    return nOnes;
+  } else {
+    return nNeighbors+1;
+  }
+}
+
+int F_Lbp::getSizeFeatureVectorForOneSupernode()
+{
+  return nNeighbors+2;
+}
+
+const float* F_Lbp::getHistograms(Slice_P* slice)
+{
+  float* hist = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(lbpHistograms)
+#endif
+  {
+    map<ulong, float*>::iterator it = histograms.find(slice->getId());
+    if(it != histograms.end()) {
+      hist = it->second;
+    } else {
+      hist = computeHistograms(slice);
+      histograms[slice->getId()] = hist;
+    }
+  }
+  return hist;
+}
+
+float* F_Lbp::computeHistograms(Slice_P* slice)
+{
+  const long width = slice->getWidth();
+  const long height = slice->getHeight();
+  const long depth = slice->getDepth();
+  const ulong sliceSize = width*height;
+  const int nBins = getSizeFeatureVectorForOneSupernode();
+
+  // intensities
+  const uchar* data = 0;
+  uchar* localData = 0;
+  if(slice->getType() == SLICEP_SLICE3D) {
+    data = slice->getRawData();
+  } else {
+    // rows of 2d images can be padded and have several channels
+    localData = new uchar[sliceSize*depth];
+    for(long y = 0; y < height; ++y) {
+      for(long x = 0; x < width; ++x) {
+        localData[y*width + x] = (uchar)slice->getIntensity(x, y, 0);
+      }
+    }
+    data = localData;
+  }
+
+  // runs of voxels for each plane : (sid, offset in the plane, length)
+  vector<vector<ulong> > runs(depth);
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    const vector<lineContainer*>& lines = it->second->getLines();
+    for(vector<lineContainer*>::const_iterator itL = lines.begin();
+        itL != lines.end(); ++itL) {
+      vector<ulong>& planeRuns = runs[(*itL)->coord.z];
+      planeRuns.push_back(it->first);
+      planeRuns.push_back((*itL)->coord.y*width + (*itL)->coord.x);
+      planeRuns.push_back((*itL)->length);
+    }
+    const vector<node*>& nodes = it->second->getNodes();
+    for(vector<node*>::const_iterator itN = nodes.begin();
+        itN != nodes.end(); ++itN) {
+      vector<ulong>& planeRuns = runs[(*itN)->z];
+      planeRuns.push_back(it->first);
+      planeRuns.push_back((*itN)->y*width + (*itN)->x);
+      planeRuns.push_back(1);
+    }
+  }
+
+  const ulong nSupernodes = slice->getNbSupernodes();
+  float* hist = new float[nSupernodes*nBins];
+  for(ulong i = 0; i < nSupernodes*nBins; ++i) {
+    hist[i] = 0;
+  }
+
+  PRINT_MESSAGE("[F_Lbp] Computing %d-neighborhood patterns for %ld supernodes\n",
+                nNeighbors, nSupernodes);
+
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    uint* patterns = new uint[sliceSize];
+    float* localHist = new float[nBins];
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+    for(long z = 0; z < depth; ++z) {
+      // raster sweep : one bit per neighbor, borders are replicated
+      for(ulong i = 0; i < sliceSize; ++i) {
+        patterns[i] = 0;
+      }
+      const uchar* plane = data + z*sliceSize;
+      for(int k = 0; k < nNeighbors; ++k) {
+        const int dx = offsets[k][0];
+        long nz = z + offsets[k][2];
+        nz = (nz < 0)?0:((nz >= depth)?depth-1:nz);
+        for(long y = 0; y < height; ++y) {
+          long ny = y + offsets[k][1];
+          ny = (ny < 0)?0:((ny >= height)?height-1:ny);
+          const uchar* center = plane + y*width;
+          const uchar* neighbor = data + nz*sliceSize + ny*width;
+          uint* p = patterns + y*width;
+          const long x0 = (dx < 0)?1:0;
+          const long x1 = (dx > 0)?width-1:width;
+          for(long x = x0; x < x1; ++x) {
+            p[x] |= (uint)(neighbor[x+dx] >= center[x]) << k;
+          }
+          if(dx < 0) {
+            p[0] |= (uint)(neighbor[0] >= center[0]) << k;
+          } else if(dx > 0) {
+            p[width-1] |= (uint)(neighbor[width-1] >= center[width-1]) << k;
+          }
+        }
+      }
+
+      // accumulate the patterns of every run
+      const vector<ulong>& planeRuns = runs[z];
+      for(ulong r = 0; r < planeRuns.size(); r += 3) {
+        const ulong sid = planeRuns[r];
+        const uint* p = patterns + planeRuns[r+1];
+        const ulong length = planeRuns[r+2];
+        for(int b = 0; b < nBins; ++b) {
+          localHist[b] = 0;
+        }
+        for(ulong i = 0; i < length; ++i) {
+          ++localHist[getBin(p[i])];
+        }
+        // supernodes can span several planes
+        float* h = hist + sid*nBins;
+        for(int b = 0; b < nBins; ++b) {
+          if(localHist[b] != 0) {
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+            h[b] += localHist[b];
+          }
+        }
+      }
     }
+
+    delete[] patterns;
+    delete[] localHist;
+  }
+
+  if(localData) {
+    delete[] localData;
   }
+  return hist;
+}
 
+bool F_Lbp::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
+{
+  const float* hist = getHistograms(slice) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); ++i) {
+    x[i].value = hist[i];
+  }
   return true;
 }
 
-bool F_Lbp::getFeatureVector(osvm_node *x, Slice3d* slice3d, int supernodeId)
+bool F_Lbp::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, int supernodeId)
 {
-  assert(0);
+  const float* hist = getHistograms(slice3d) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); ++i) {
+    x[i].value = hist[i];
+  }
+  return true;
 }
@@ -12,6 +12,7 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #ifndef F_LBP_H
 #define F_LBP_H
 
@@ -20,41 +21,90 @@
 #include "Feature.h"
 #include "oSVM.h"
 
-//-------------------------------------------------------------------------TYPES
+#include <map>
 
 //-------------------------------------------------------------------------CLASS
 
+/**
+ * Histogram of rotation invariant uniform local binary patterns (riu2)
+ * for every supernode. A neighbor sets its bit if its intensity is greater
+ * or equal to the intensity of the center. Uniform patterns are mapped to
+ * the number of bits set (P+1 bins) and all the other patterns to a single
+ * bin, which gives P+2 bins for a neighborhood of size P.
+ *
+ * 2d slices use the 8-neighborhood (a pattern is uniform if it has at most
+ * 2 transitions along the circle). 3d volumes use the 6 or 26-neighborhood
+ * (option lbp_neighborhood in the config file); a pattern is uniform if
+ * both the neighbors that are set and the ones that are not set form
+ * connected sets on the neighborhood. The mapping is tabulated, the
+ * 26-neighborhood entries being computed the first time a pattern occurs.
+ *
+ * Codes are computed plane by plane in a single raster sweep over the
+ * intensities and accumulated into the histograms of all the supernodes
+ * using their runs, the first time a feature vector is requested for a
+ * slice.
+ */
 class F_Lbp : public Feature
 {
  public:	
 
-  F_Lbp();
-  ~F_Lbp();
+  /**
+   * @param volume true for 3d volumes (the size of the feature vector
+   * depends on the neighborhood)
+   */
+  F_Lbp(bool volume);
 
-  int getSizeFeatureVector();
+  ~F_Lbp();
 
-  bool getFeatureVector(osvm_node *x,
-                        Slice_P* slice,
-                        int supernodeId);
+  int getSizeFeatureVectorForOneSupernode();
 
   /**
    * Extract a feature vector for a given supernode in a 2d slice
    */
-  bool getFeatureVector(osvm_node *x,
-                        Slice* slice,
-                        const int supernodeId);
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice* slice,
+                                       const int supernodeId);
 
   /**
    * Extract a feature vector for a given supernode in a 3d volume
    */
-  bool getFeatureVector(osvm_node *x,
-                        Slice3d* slice3d,
-                        const int supernodeId);
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice3d* slice3d,
+                                       const int supernodeId);
 
  private:
-  int nItensityLevels;
-  int maxIntensity;
-  double* glcm_data;
+
+  /**
+   * Returns the histograms of all the supernodes of the given slice
+   */
+  const float* getHistograms(Slice_P* slice);
+
+  float* computeHistograms(Slice_P* slice);
+
+  /**
+   * Bin of the given pattern, looked up in the mapping
+   */
+  int getBin(uint pattern);
+
+  /**
+   * Bin of the given pattern for 3d neighborhoods (connectivity test)
+   */
+  int computeBin(uint pattern);
+
+  /**
+   * Initialize the neighborhood and the mapping from patterns to bins.
+   */
+  void initNeighborhood(bool volume);
+
+  int nNeighbors;
+  int offsets[26][3];
+  // neighbors adjacent to each neighbor (bit mask)
+  uint adjacency[26];
+  // mapping from patterns to bins (filled lazily for the 26-neighborhood)
+  uchar* mapping;
+
+  // histograms for each slice id
+  std::map<ulong, float*> histograms;
 };
 
 #endif // F_LBP_H
@@ -81,6 +81,9 @@ class F_LoadFromFile : public Feature
 
   eFeatureType getFeatureType() { return F_LOADFROMFILE; }
 
+  // the sparse structure is looked up with map::operator[]
+  bool isThreadSafe() { return !USE_SPARSE_STRUCTURE; }
+
   /**
    * Load all the features in a given cube.
    */
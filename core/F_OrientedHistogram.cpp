@@ -1,4 +1,3 @@
-
 /////////////////////////////////////////////////////////////////////////
 // This program is free software; you can redistribute it and/or       //
 // modify it under the terms of the GNU General Public License         //
@@ -13,16 +12,58 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #include "Config.h"
 #include "F_OrientedHistogram.h"
-#include "Histogram.h"
+#include "SupernodeShape.h"
+#include "SupernodeStats.h"
 #include "utils.h"
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include <math.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Polynomial approximation of atan2 (maximum error about 0.01 degree).
+ * Branch free so that loops calling it can be vectorized. Angles are
+ * truncated to degrees so an angle within 0.01 degree of a whole degree
+ * can fall in a different bin than with atan2.
+ */
+static inline float fastAtan2(float y, float x)
+{
+  const float ax = fabsf(x);
+  const float ay = fabsf(y);
+  const float mn = (ax < ay)?ax:ay;
+  const float mx = (ax < ay)?ay:ax;
+  const float a = mn/(mx + 1e-30f);
+  const float s = a*a;
+  float r = ((-0.0464964749f*s + 0.15931422f)*s - 0.327622764f)*s*a + a;
+  r = (ay > ax)?1.57079637f - r:r;
+  r = (x < 0)?3.14159274f - r:r;
+  r = (y < 0)?-r:r;
+  return r;
+}
+
+//------------------------------------------------------------------------------
+
 F_OrientedHistogram::F_OrientedHistogram(int _nOrientation)
 {
   nOrientation = _nOrientation;
 }
 
+F_OrientedHistogram::~F_OrientedHistogram()
+{
+  for(map<ulong, EdgeFeatures>::iterator it = features.begin();
+      it != features.end(); ++it) {
+    delete[] it->second.offsets;
+    delete[] it->second.values;
+  }
+}
+
 int F_OrientedHistogram::getSizeFeatureVector()
 {
   return nOrientation*nOrientation;
@@ -34,95 +75,170 @@ bool F_OrientedHistogram::getFeatureVector(osvm_node *x, Slice* slice, int sid,
   return false; // not tested yet, see supervoxel method
 }
 
-bool F_OrientedHistogram::getFeatureVector(osvm_node *x, Slice3d* slice3d, int sid, int nsid)
+void F_OrientedHistogram::getNeighbors(supernode* s, SupernodeShape* shape,
+                                       SupernodeStats* stats, double* cs,
+                                       float* vx, float* vy, float* vz,
+                                       float* intensities)
 {
-  node cs;
-  node cn;
-  node ct;
-  float v1[3];
-  float v2[3];
-  float v2p[3];
+  double ct[3];
+  shape->getCentroid(s->id, cs);
+  int k = 0;
+  for(vector<supernode*>::iterator itN = s->neighbors.begin();
+      itN != s->neighbors.end(); ++itN, ++k) {
+    shape->getCentroid((*itN)->id, ct);
+    vx[k] = cs[0] - ct[0];
+    vy[k] = cs[1] - ct[1];
+    vz[k] = cs[2] - ct[2];
+    intensities[k] = stats->getMean((*itN)->id);
+  }
+}
 
+void F_OrientedHistogram::computeHistogram(const double* cs, const double* cn,
+                                           int nNeighbors, const float* vx,
+                                           const float* vy, const float* vz,
+                                           const float* intensities,
+                                           int* bins, float* hist)
+{
   // B=(v1,vn,vn2) basis used to project vectors
   float B[9];
-  int angleXY;
-  int angleXZ;
-  int idx = 0;
-
-  supernode* s = slice3d->getSupernode(sid);
-  supernode* n = slice3d->getSupernode(nsid);
-  s->getCenter(cs);
-  n->getCenter(cn);
-
-  // compute vector sn
-  v1[0] = cs.x - cn.x;
-  v1[1] = cs.y - cn.y;
-  v1[2] = cs.z - cn.z;
-
-  // Compute B basis
-  B[0] = v1[0];
-  B[1] = v1[1];
-  B[2] = v1[2];
-  B[3] = -v1[1];
-  B[4] = v1[0];
+  B[0] = cs[0] - cn[0];
+  B[1] = cs[1] - cn[1];
+  B[2] = cs[2] - cn[2];
+  B[3] = -B[1];
+  B[4] = B[0];
   B[5] = 0;
   crossProduct(&B[0], &B[3], &B[6]);
 
-  Histogram hist(nOrientation*nOrientation);
-  float angleToIdx = (float)nOrientation/360.0f;
-
-  vector < supernode* >* lNeighbors = &(s->neighbors);
-  supernode* t;
-  for(vector < supernode* >::iterator itN = lNeighbors->begin();
-      itN != lNeighbors->end(); itN++)
-    {
-      //if(t->id == n->id)
-      //  continue;
-
-      t = *itN;
-      t->getCenter(ct);
-
-      // compute vector st
-      v2[0] = cs.x - ct.x;
-      v2[1] = cs.y - ct.y;
-      v2[2] = cs.z - ct.z;
-
-      // Project v2 in B
-      matMulVec_3(B, v2, v2p);
-      // compute angle in x-y plane
-      angleXY = atan2(v2p[1], v2p[0])*180.0/PI;
-      angleXY += 180.0;
-      // compute angle in x-z plane
-      angleXZ = atan2(v2p[2], v2p[0])*180.0/PI;
-      angleXZ += 180.0;
-
-      if(angleXY > 360.0 || angleXZ > 360.0)
-        {
-          printf("[F_OrientedHistogram] Error : angleXY=%d > 360.0 || angleXZ=%d > 360.0\n", angleXY, angleXZ);
-          exit(-1);
-        }
-
-      idx = (int)(angleXY*angleToIdx)*nOrientation
-        +(int)(angleXZ*angleToIdx);
-
-      if(idx >= hist.nBins)
-        idx = hist.nBins - 1;
-
-      if(hist.histData[idx] < 0.1)
-        hist.histData[idx] = slice3d->getAvgIntensity(t->id);
-      else
-        hist.histData[idx] = (hist.histData[idx]+slice3d->getAvgIntensity(t->id))/2;
-
-      if(t->id == n->id)
-        {
-          printf("[F_OrientedHistogram] v2p=(%f,%f,%f)\n", v2p[0],v2p[1],v2p[2]);
-          printf("[F_OrientedHistogram] angleXY=%d angleXZ=%d angleToIdx=%f idx=%d bin[idx]=%f\n",
-                 angleXY,angleXZ,angleToIdx,idx, hist.histData[idx]);
-        }
+  const int nBins = nOrientation*nOrientation;
+  const float angleToIdx = (float)nOrientation/360.0f;
+  const float radToDeg = 180.0f/PI;
+
+  // projection and binning of all the neighbors (vectorizable)
+  for(int k = 0; k < nNeighbors; ++k) {
+    const float p0 = B[0]*vx[k] + B[1]*vy[k] + B[2]*vz[k];
+    const float p1 = B[3]*vx[k] + B[4]*vy[k] + B[5]*vz[k];
+    const float p2 = B[6]*vx[k] + B[7]*vy[k] + B[8]*vz[k];
+    // angles are truncated to degrees
+    const int angleXY = (int)(fastAtan2(p1, p0)*radToDeg + 180.0f);
+    const int angleXZ = (int)(fastAtan2(p2, p0)*radToDeg + 180.0f);
+    const int idx = (int)(angleXY*angleToIdx)*nOrientation + (int)(angleXZ*angleToIdx);
+    bins[k] = (idx < nBins)?idx:nBins-1;
+  }
+
+  for(int i = 0; i < nBins; ++i) {
+    hist[i] = 0;
+  }
+  for(int k = 0; k < nNeighbors; ++k) {
+    float& h = hist[bins[k]];
+    if(h < 0.1) {
+      h = intensities[k];
+    } else {
+      h = (h + intensities[k])/2;
     }
+  }
+}
 
-  for(int i = 0;i < hist.nBins; i++)
-    x[i].value = hist.histData[i];
+bool F_OrientedHistogram::getFeatureVector(osvm_node *x, Slice3d* slice3d, int sid, int nsid)
+{
+  const EdgeFeatures& edgeFeatures = getFeatureVectors(slice3d);
 
+  supernode* s = slice3d->getSupernode(sid);
+  const int nNeighbors = s->neighbors.size();
+  int k = 0;
+  while(k < nNeighbors && s->neighbors[k]->id != (sidType)nsid) {
+    ++k;
+  }
+  if(k == nNeighbors) {
+    return false;
+  }
+
+  const int nBins = getSizeFeatureVector();
+  const float* hist = edgeFeatures.values + (edgeFeatures.offsets[sid] + k)*nBins;
+  for(int i = 0; i < nBins; i++) {
+    x[i].value = hist[i];
+  }
   return true;
-}
\ No newline at end of file
+}
+
+const F_OrientedHistogram::EdgeFeatures& F_OrientedHistogram::getFeatureVectors(Slice_P* slice)
+{
+  map<ulong, EdgeFeatures>::iterator it;
+#ifdef WITH_OPENMP
+#pragma omp critical(orientedHistograms)
+#endif
+  {
+    it = features.find(slice->getId());
+    if(it == features.end()) {
+      EdgeFeatures edgeFeatures;
+      edgeFeatures.values = computeFeatureVectors(slice, edgeFeatures.offsets);
+      it = features.insert(pair<ulong, EdgeFeatures>(slice->getId(), edgeFeatures)).first;
+    }
+  }
+  return it->second;
+}
+
+float* F_OrientedHistogram::computeFeatureVectors(Slice_P* slice, ulong*& offsets)
+{
+  SupernodeShape* shape = slice->getShape();
+  SupernodeStats* stats = slice->getIntensityStats(STATS_MOMENTS);
+
+  const ulong nSupernodes = slice->getNbSupernodes();
+  vector<supernode*> supernodes(nSupernodes, (supernode*)0);
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    supernodes[it->first] = it->second;
+  }
+
+  offsets = new ulong[nSupernodes+1];
+  offsets[0] = 0;
+  ulong maxNeighbors = 0;
+  for(ulong sid = 0; sid < nSupernodes; ++sid) {
+    ulong nNeighbors = supernodes[sid]?supernodes[sid]->neighbors.size():0;
+    offsets[sid+1] = offsets[sid] + nNeighbors;
+    maxNeighbors = max(maxNeighbors, nNeighbors);
+  }
+
+  const int nBins = getSizeFeatureVector();
+  float* values = new float[offsets[nSupernodes]*nBins];
+
+  PRINT_MESSAGE("[F_OrientedHistogram] Computing histograms for %ld edges\n",
+                offsets[nSupernodes]);
+
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    // buffers owned by each thread and reused for all its supernodes
+    float* vx = new float[4*maxNeighbors];
+    float* vy = vx + maxNeighbors;
+    float* vz = vy + maxNeighbors;
+    float* intensities = vz + maxNeighbors;
+    int* bins = new int[maxNeighbors];
+    double cs[3];
+    double cn[3];
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for(long sid = 0; sid < (long)nSupernodes; ++sid) {
+      supernode* s = supernodes[sid];
+      if(s == 0) {
+        continue;
+      }
+      // the neighbors of s are gathered once for all its edges
+      const int nNeighbors = s->neighbors.size();
+      getNeighbors(s, shape, stats, cs, vx, vy, vz, intensities);
+      for(int k = 0; k < nNeighbors; ++k) {
+        shape->getCentroid(s->neighbors[k]->id, cn);
+        computeHistogram(cs, cn, nNeighbors, vx, vy, vz, intensities, bins,
+                         values + (offsets[sid] + k)*nBins);
+      }
+    }
+
+    delete[] vx;
+    delete[] bins;
+  }
+
+  return values;
+}
@@ -18,16 +18,37 @@
 #include "Slice.h"
 #include "Slice3d.h"
 
+#include <map>
+
+class SupernodeShape;
+class SupernodeStats;
+
 //-------------------------------------------------------------------------TYPES
 
 //-------------------------------------------------------------------------CLASS
 
+/**
+ * Histogram of the neighbors of a supernode s oriented along the edge
+ * between s and one of its neighbors n. The vectors from s to its
+ * neighbors are projected on a basis built from the direction s-n and
+ * binned by their angles in the x-y and x-z planes of this basis
+ * (nOrientation*nOrientation bins). Each bin contains the mean intensity
+ * of the neighbors falling into it (running average).
+ *
+ * Centers and mean intensities are read from the geometry and statistics
+ * cached by the slice (Slice_P::getShape and Slice_P::getIntensityStats).
+ * The histograms of all the edges of a slice are computed in one parallel
+ * pass the first time a vector of this slice is requested and are kept
+ * until the feature is deleted.
+ */
 class F_OrientedHistogram
 {
  public:	
 
   F_OrientedHistogram(int _nOrientation);
 
+  ~F_OrientedHistogram();
+
   int getSizeFeatureVector();
 
   /**
@@ -44,8 +65,52 @@ class F_OrientedHistogram
                         Slice3d* slice3d,
                         int sid, int nsid);
 
+  /**
+   * Compute the feature vectors of all the directed edges of the slice in
+   * one pass (supernodes are processed in parallel). The vector of the
+   * edge between sid and its k-th neighbor starts at
+   * (offsets[sid] + k)*getSizeFeatureVector().
+   * @param offsets array of nSupernodes+1 entries allocated by this function
+   * @return array allocated by this function
+   */
+  float* computeFeatureVectors(Slice_P* slice, ulong*& offsets);
+
  private:
+
+  struct EdgeFeatures
+  {
+    ulong* offsets;
+    float* values;
+  };
+
+  /**
+   * Returns the feature vectors of all the edges of the given slice
+   * (computed by computeFeatureVectors the first time).
+   */
+  const EdgeFeatures& getFeatureVectors(Slice_P* slice);
+
+  /**
+   * Compute the histogram of the edge (s, n).
+   * @param vx, vy, vz vectors from the neighbors of s to s
+   * @param intensities mean intensity of the neighbors of s
+   * @param bins buffer of nNeighbors entries
+   */
+  void computeHistogram(const double* cs, const double* cn,
+                        int nNeighbors, const float* vx, const float* vy,
+                        const float* vz, const float* intensities,
+                        int* bins, float* hist);
+
+  /**
+   * Gather the vectors from the neighbors of s to s and their intensities.
+   */
+  void getNeighbors(supernode* s, SupernodeShape* shape, SupernodeStats* stats,
+                    double* cs, float* vx, float* vy, float* vz,
+                    float* intensities);
+
   int nOrientation;
+
+  // feature vectors of the edges for each slice id
+  std::map<ulong, EdgeFeatures> features;
 };
 
 #endif // F_ORIENTEDHISTOGRAM_H
@@ -31,6 +31,9 @@ class F_Precomputed : public Feature
 
   ~F_Precomputed();
 
+  // the precomputed vectors are looked up with map::operator[]
+  bool isThreadSafe() { return false; }
+
  protected:
 
   int getSizeFeatureVectorForOneSupernode();
@@ -0,0 +1,72 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "F_Shape.h"
+#include "SupernodeShape.h"
+
+#include <math.h>
+
+//------------------------------------------------------------------------------
+
+F_Shape::F_Shape(bool volume)
+{
+  nDims = volume?3:2;
+}
+
+int F_Shape::getSizeFeatureVectorForOneSupernode()
+{
+  return 3*nDims + 2;
+}
+
+void F_Shape::getFeatures(osvm_node *x, Slice_P* slice, const int supernodeId)
+{
+  SupernodeShape* shape = slice->getShape();
+  const double sliceSize[3] = {(double)slice->getWidth(), (double)slice->getHeight(),
+                               (double)slice->getDepth()};
+  double centroid[3];
+  double eigenValues[3];
+  int bbMin[3];
+  int bbMax[3];
+  shape->getCentroid(supernodeId, centroid);
+  shape->getCovarianceEigenValues(supernodeId, eigenValues);
+  shape->getBoundingBox(supernodeId, bbMin, bbMax);
+  const double volume = shape->getVolume(supernodeId);
+
+  int f = 0;
+  for(int d = 0; d < nDims; ++d) {
+    x[f++].value = centroid[d]/sliceSize[d];
+  }
+  for(int d = 0; d < nDims; ++d) {
+    x[f++].value = (volume == 0)?0:(bbMax[d] - bbMin[d] + 1);
+  }
+  x[f++].value = volume;
+  // for 2d slices, the last eigenvalue is the variance along z (0)
+  for(int d = 0; d < nDims; ++d) {
+    x[f++].value = sqrt(eigenValues[d]);
+  }
+  x[f++].value = (volume == 0)?0:shape->getSurface(supernodeId)/volume;
+}
+
+bool F_Shape::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
+{
+  getFeatures(x, slice, supernodeId);
+  return true;
+}
+
+bool F_Shape::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, int supernodeId)
+{
+  getFeatures(x, slice3d, supernodeId);
+  return true;
+}
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef F_SHAPE_H
+#define F_SHAPE_H
+
+#include "Slice.h"
+#include "Slice3d.h"
+#include "Feature.h"
+#include "oSVM.h"
+
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Position and shape of every supernode :
+ * - centroid normalized by the size of the slice
+ * - extent of the bounding box
+ * - volume (area for 2d slices)
+ * - square root of the eigenvalues of the covariance matrix of the voxel
+ *   coordinates (standard deviations along the principal axes)
+ * - surface to volume ratio (perimeter to area for 2d slices)
+ * Each group has one value per dimension of the slice. The geometry is
+ * shared through Slice_P::getShape.
+ */
+class F_Shape : public Feature
+{
+ public:	
+
+  /**
+   * @param volume true for 3d volumes (the size of the feature vector
+   * depends on the number of dimensions)
+   */
+  F_Shape(bool volume);
+
+  int getSizeFeatureVectorForOneSupernode();
+
+  /**
+   * Extract a feature vector for a given supernode in a 2d slice
+   */
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice* slice,
+                                       const int supernodeId);
+
+  /**
+   * Extract a feature vector for a given supernode in a 3d volume
+   */
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice3d* slice3d,
+                                       const int supernodeId);
+
+ private:
+
+  void getFeatures(osvm_node *x, Slice_P* slice, const int supernodeId);
+
+  int nDims;
+};
+
+#endif // F_SHAPE_H
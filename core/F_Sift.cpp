@@ -14,9 +14,14 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include "F_Sift.h"
-#include "highgui.h"
+#include "Config.h"
+#include "SupernodeShape.h"
 
-F_Sift::F_Sift(const char* image_name,
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+F_Sift::F_Sift(Slice_P* slice,
                int aoctaves,
                int alevels,
                int aomin)
@@ -26,32 +31,15 @@ F_Sift::F_Sift(const char* image_name,
   omin = aomin;
   //scale = omin; // default scale. Use setScale to change it.
 
-  // Extract image data and convert it to floats
-  // see std::istream& extractPgm(std::istream& in, PgmBuffer& buffer) in sift.cpp
-  IplImage* img = cvLoadImage(image_name,0);
-  im_pt = new VL::pixel_t[img->width*img->height];
-  uchar pValue;
-  int idx = 0;
-  for(int y=0;y<img->height;y++)
-    for(int x=0;x<img->width;x++)
-      {
-        pValue = (((uchar*)(img->imageData + y*img->widthStep))[x*img->nChannels]);
-        im_pt[idx] = pValue/255.0f; 
-        idx++;
-      }
-
-  float sigman = .5;
-  //sigma0 = 1.6 * powf(2.0f, 1.0f / levels);
   // sigma0 is the value used to smooth the first image at the bottom of the pyramid.
   // sigma0=1.2 is the value given in the SIFT paper
   sigma0 = 1.2f;
 
-  PRINT_MESSAGE("[F_Sift] w=%d h=%d s=%f %f octaves=%d levels=%d omin=%d\n",
-                img->width, img->height, 
-                sigman, sigma0,
+  PRINT_MESSAGE("[F_Sift] w=%d h=%d s=%f octaves=%d levels=%d omin=%d\n",
+                slice->getWidth(), slice->getHeight(), sigma0,
                 octaves, levels,
                 omin);
-  
+
   for(int o = 0;o<octaves;o++)
     {
       for(int l = 0;l<levels;l++)
@@ -63,20 +51,81 @@ F_Sift::F_Sift(const char* image_name,
         }
     }
 
-  sift = new VL::Sift(im_pt, img->width, img->height, 
-                      sigman, sigma0,
-                      octaves, levels,
-                      omin, -1, levels+1);
+  nPoolingPoints = 1;
+  string config_tmp;
+  if(Config::Instance()->getParameter("sift_pooling", config_tmp)) {
+    nPoolingPoints = atoi(config_tmp.c_str());
+    if(nPoolingPoints < 1) {
+      printf("[F_Sift] Error : sift_pooling should be greater than 0 (%d)\n", nPoolingPoints);
+      exit(-1);
+    }
+  }
 
-  cvReleaseImage(&img);
+  // the scale space of 2d slices is also used for pixel based features.
+  // Volumes are processed plane by plane in computeDescriptors.
+  im_pt = 0;
+  sift = 0;
+  if(slice->getDepth() == 1) {
+    im_pt = getPlanePixels(slice, 0);
+    sift = createSift(im_pt, slice->getWidth(), slice->getHeight());
+  }
 
   descr_pt = new VL::float_t[F_Sift::desc_size];
 }
 
 F_Sift::~F_Sift()
 {
-  delete[] im_pt;
+  if(sift) {
+    delete sift;
+  }
+  if(im_pt) {
+    delete[] im_pt;
+  }
   delete[] descr_pt;
+  for(map<ulong, float*>::iterator it = descriptors.begin();
+      it != descriptors.end(); ++it) {
+    delete[] it->second;
+  }
+}
+
+VL::pixel_t* F_Sift::getPlanePixels(Slice_P* slice, int z)
+{
+  const int width = slice->getWidth();
+  const int height = slice->getHeight();
+  VL::pixel_t* pixels = new VL::pixel_t[width*height];
+  if(slice->getType() == SLICEP_SLICE3D) {
+    const uchar* plane = slice->getRawData() + (ulong)z*width*height;
+    for(int i = 0; i < width*height; i++) {
+      pixels[i] = plane[i]/255.0f;
+    }
+  } else {
+    // 2d images are loaded in color (BGR) : use the same luminance as
+    // cvLoadImage(name, 0), i.e. (1868*B + 9617*G + 4899*R)/2^14 rounded
+    IplImage* img = static_cast<Slice*>(slice)->img;
+    int idx = 0;
+    for(int y = 0; y < height; y++) {
+      const uchar* row = (uchar*)(img->imageData + y*img->widthStep);
+      for(int x = 0; x < width; x++) {
+        const uchar* p = row + x*img->nChannels;
+        int value = p[0];
+        if(img->nChannels >= 3) {
+          value = (p[0]*1868 + p[1]*9617 + p[2]*4899 + (1 << 13)) >> 14;
+        }
+        pixels[idx] = value/255.0f;
+        idx++;
+      }
+    }
+  }
+  return pixels;
+}
+
+VL::Sift* F_Sift::createSift(const VL::pixel_t* pixels, int width, int height)
+{
+  float sigman = .5;
+  return new VL::Sift(pixels, width, height,
+                      sigman, sigma0,
+                      octaves, levels,
+                      omin, -1, levels+1);
 }
 
 void F_Sift::setScales(vector<float>& _scales)
@@ -89,44 +138,181 @@ void F_Sift::addScale(float _scale)
   scales.push_back(_scale);
 }
 
-bool F_Sift::getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice, int supernodeId)
+void F_Sift::computeSupernodeDescriptor(VL::Sift* planeSift,
+                                        const vector<float>& p,
+                                        float scale, VL::float_t* d, float* out)
 {
   VL::float_t angle = 0;
+  const int nPoints = p.size()/2;
+  for(int j = 0; j < nPoints; j++) {
+    VL::Sift::Keypoint k = planeSift->getKeypoint(p[2*j], p[2*j+1], scale);
+    planeSift->computeKeypointDescriptor(d, k, angle);
+    for(int b = 0; b < desc_size; b++) {
+      out[b] += d[b];
+    }
+  }
+  for(int b = 0; b < desc_size; b++) {
+    out[b] /= nPoints;
+  }
+}
 
-  supernode* s = slice->getSupernode(supernodeId);
+void F_Sift::computePlaneDescriptors(VL::Sift* planeSift,
+                                     const vector<sidType>& sids,
+                                     const vector<vector<float> >& points,
+                                     float* _descriptors, bool parallel)
+{
+  const int fvSize = getSizeFeatureVectorForOneSupernode();
+  const long nSids = sids.size();
+  if(nSids == 0) {
+    return;
+  }
+  VL::float_t* d = new VL::float_t[desc_size];
+
+  // scales are processed one after the other because planeSift computes
+  // the gradient of an octave when it is not the octave used by the
+  // previous call. The first supernode of each scale triggers this
+  // computation, the other ones only read the gradient.
+  for(int s = 0; s < (int)scales.size(); s++) {
+    computeSupernodeDescriptor(planeSift, points[0], scales[s], d,
+                               _descriptors + (ulong)sids[0]*fvSize + s*desc_size);
 
-  /*
-  vector<node*>* v = &(s->nodes);
-  int n = v->size();
-  int pValue;
-  int idx;
-  for(vector < node* >::iterator iPt = v->begin();
-      iPt != v->end();iPt++)
+#ifdef WITH_OPENMP
+#pragma omp parallel if(parallel)
+#endif
     {
-      pValue = (int)(((uchar*)(slice.img->imageData + (*iPt)->y*slice.img->widthStep))[(*iPt)->x*slice.img->nChannels]);
-      idx = (pValue*hist.nBins)/max_pixel_value;
-      hist.histData[idx]++;
+      VL::float_t* dt = new VL::float_t[desc_size];
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+      for(long i = 1; i < nSids; i++) {
+        computeSupernodeDescriptor(planeSift, points[i], scales[s], dt,
+                                   _descriptors + (ulong)sids[i]*fvSize + s*desc_size);
+      }
+      delete[] dt;
     }
-  */
+  }
 
-  node center;
-  s->getCenter(center);
+  delete[] d;
+}
 
-  int offset = 0;
-  for(vector<float>::iterator itScale = scales.begin();
-      itScale != scales.end(); itScale++)
-    {
-      VL::Sift::Keypoint k = sift->getKeypoint(center.x,center.y,*itScale);
+float* F_Sift::computeDescriptors(Slice_P* slice)
+{
+  const ulong nSupernodes = slice->getNbSupernodes();
+  const int fvSize = getSizeFeatureVectorForOneSupernode();
+  const int depth = slice->getDepth();
+  float* _descriptors = new float[nSupernodes*fvSize];
+  for(ulong i = 0; i < nSupernodes*fvSize; i++) {
+    _descriptors[i] = 0;
+  }
 
-      //printf("computeKeypointDescriptor %d\n", F_Sift::desc_size);
-      sift->computeKeypointDescriptor(descr_pt, k, angle);
+  // keypoints of each supernode grouped by the plane of the centroid
+  vector<vector<sidType> > sids(depth);
+  vector<vector<vector<float> > > points(depth);
+  SupernodeShape* shape = slice->getShape();
+  double centroid[3];
+  vector<float> candidates;
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    shape->getCentroid(it->first, centroid);
+    int z = (int)(centroid[2] + 0.5);
+    z = (z >= depth)?depth-1:z;
+    sids[z].push_back(it->first);
+    points[z].push_back(vector<float>());
+    vector<float>& p = points[z].back();
+    p.push_back(centroid[0]);
+    p.push_back(centroid[1]);
 
-      for(int i=0;i<desc_size;i++)
-        n[offset+i].value = descr_pt[i];
+    if(nPoolingPoints > 1) {
+      // middle of the runs lying in the plane of the centroid
+      candidates.clear();
+      const vector<lineContainer*>& lines = it->second->getLines();
+      for(vector<lineContainer*>::const_iterator itL = lines.begin();
+          itL != lines.end(); ++itL) {
+        if((int)(*itL)->coord.z == z) {
+          candidates.push_back((*itL)->coord.x + ((*itL)->length - 1)/2.0f);
+          candidates.push_back((*itL)->coord.y);
+        }
+      }
+      const vector<node*>& nodes = it->second->getNodes();
+      for(vector<node*>::const_iterator itN = nodes.begin();
+          itN != nodes.end(); ++itN) {
+        if((int)(*itN)->z == z) {
+          candidates.push_back((*itN)->x);
+          candidates.push_back((*itN)->y);
+        }
+      }
+      const int nCandidates = candidates.size()/2;
+      const int nPoints = min(nPoolingPoints - 1, nCandidates);
+      for(int i = 0; i < nPoints; i++) {
+        const int c = (i*nCandidates)/nPoints;
+        p.push_back(candidates[2*c]);
+        p.push_back(candidates[2*c+1]);
+      }
+    }
+  }
 
-      offset += desc_size;
+  PRINT_MESSAGE("[F_Sift] Computing descriptors for %ld supernodes\n", nSupernodes);
+
+  if(sift) {
+    // 2d slice : the scale space built in the constructor is shared by the
+    // threads
+    computePlaneDescriptors(sift, sids[0], points[0], _descriptors, true);
+  } else {
+    // 3d volume : planes are processed in parallel, each with its own
+    // scale space (VL::Sift objects are not thread-safe while the gradient
+    // of an octave is computed)
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for(int z = 0; z < depth; z++) {
+      if(sids[z].empty()) {
+        continue;
+      }
+      VL::pixel_t* pixels = getPlanePixels(slice, z);
+      VL::Sift* planeSift = createSift(pixels, slice->getWidth(), slice->getHeight());
+      computePlaneDescriptors(planeSift, sids[z], points[z], _descriptors, false);
+      delete planeSift;
+      delete[] pixels;
+    }
+  }
+
+  return _descriptors;
+}
+
+const float* F_Sift::getDescriptors(Slice_P* slice)
+{
+  float* desc = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(siftDescriptors)
+#endif
+  {
+    map<ulong, float*>::iterator it = descriptors.find(slice->getId());
+    if(it != descriptors.end()) {
+      desc = it->second;
+    } else {
+      desc = computeDescriptors(slice);
+      descriptors[slice->getId()] = desc;
     }
+  }
+  return desc;
+}
 
+bool F_Sift::getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice, int supernodeId)
+{
+  const float* desc = getDescriptors(slice) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); i++) {
+    n[i].value = desc[i];
+  }
+  return true;
+}
+
+bool F_Sift::getFeatureVectorForOneSupernode(osvm_node *n, Slice3d* slice3d, int supernodeId)
+{
+  const float* desc = getDescriptors(slice3d) + (ulong)supernodeId*getSizeFeatureVectorForOneSupernode();
+  for(int i = 0; i < getSizeFeatureVectorForOneSupernode(); i++) {
+    n[i].value = desc[i];
+  }
   return true;
 }
 
@@ -154,4 +340,4 @@ bool F_Sift::getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice,
 int F_Sift::getSizeFeatureVectorForOneSupernode()
 {
   return desc_size*scales.size();
-}
\ No newline at end of file
+}
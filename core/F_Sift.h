@@ -15,14 +15,38 @@
 #ifndef F_SIFT_H
 #define F_SIFT_H
 
-#include "cv.h"
 #include "sift.hpp"
 
 // SliceMe
 #include "Feature.h"
 #include "oSVM.h"
 #include "Slice.h"
+#include "Slice3d.h"
 
+#include <map>
+#include <vector>
+
+/**
+ * SIFT descriptors computed at the centroid of every supernode for a set of
+ * scales (one descriptor of 128 values per scale).
+ *
+ * Descriptors of all the supernodes are computed in a batch the first time
+ * a feature vector is requested for a slice. The scale space is built from
+ * the grayscale intensities of each plane (only the plane containing the
+ * centroid is used for 3d volumes). Planes of 3d volumes are processed in
+ * parallel, each thread holding the scale space of the plane it processes.
+ * For 2d slices, the scale space built in the constructor is shared by all
+ * the threads : VL::Sift computes the gradient of an octave the first time
+ * a descriptor of this octave is requested, so for each scale a first
+ * descriptor is computed sequentially and the other supernodes are then
+ * processed in parallel, only reading the pyramid and the gradient.
+ *
+ * Options (configuration file) :
+ * sift_pooling number of keypoints averaged for each supernode (default 1,
+ *              the centroid only). Additional keypoints are taken at the
+ *              middle of runs of the supernode lying in the plane of the
+ *              centroid.
+ */
 class F_Sift : public Feature
 {
  public:	
@@ -36,7 +60,7 @@ class F_Sift : public Feature
    * will cause the base of the pyramid to be
    * two, three, ... times larger than the input image.
    */
-  F_Sift(const char* image_name,
+  F_Sift(Slice_P* slice,
          int aoctaves,
          int alevels,
          int aomin);
@@ -46,6 +70,8 @@ class F_Sift : public Feature
 
   bool getFeatureVectorForOneSupernode(osvm_node *n, Slice* slice, int supernodeId);
 
+  bool getFeatureVectorForOneSupernode(osvm_node *n, Slice3d* slice3d, int supernodeId);
+
   bool getFeatureVectorForOneSupernode(osvm_node *n,
                                        Slice* slice,
                                        const int x,
@@ -56,6 +82,46 @@ class F_Sift : public Feature
   void setScales(vector<float>& _scales);
 
  private:
+
+  /**
+   * Grayscale intensities of the plane z of the given slice in [0,1].
+   * Color images are converted with the luminance used by cvLoadImage.
+   * @return buffer allocated by this function
+   */
+  VL::pixel_t* getPlanePixels(Slice_P* slice, int z);
+
+  /**
+   * Build the scale space of the given image.
+   * @param pixels must be kept alive as long as the returned object is used
+   */
+  VL::Sift* createSift(const VL::pixel_t* pixels, int width, int height);
+
+  /**
+   * Returns the descriptors of all the supernodes of the given slice
+   */
+  const float* getDescriptors(Slice_P* slice);
+
+  float* computeDescriptors(Slice_P* slice);
+
+  /**
+   * Compute the descriptors of the supernodes sids from the keypoint
+   * locations given by points (x,y pairs for each supernode).
+   * planeSift is modified and must not be used by other threads.
+   * @param parallel process the supernodes of each scale in parallel
+   */
+  void computePlaneDescriptors(VL::Sift* planeSift,
+                               const std::vector<sidType>& sids,
+                               const std::vector<std::vector<float> >& points,
+                               float* descriptors, bool parallel);
+
+  /**
+   * Average of the descriptors at the keypoint locations p for one scale
+   * @param d buffer of desc_size values
+   */
+  void computeSupernodeDescriptor(VL::Sift* planeSift,
+                                  const std::vector<float>& p,
+                                  float scale, VL::float_t* d, float* out);
+
   VL::pixel_t* im_pt; // image data
   VL::float_t* descr_pt; //descriptor data
 
@@ -63,6 +129,10 @@ class F_Sift : public Feature
   int levels;
   int omin;
   vector<float> scales;
+  int nPoolingPoints;
+
+  // descriptors for each slice id
+  std::map<ulong, float*> descriptors;
 
   static const int desc_size = 128;
 
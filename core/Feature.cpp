@@ -7,8 +7,10 @@
 #include "F_Glcm.h"
 #include "F_ColorHistogram.h"
 #include "F_Histogram.h"
+#include "F_Lbp.h"
 #include "F_LoadFromFile.h"
 #include "F_Position.h"
+#include "F_Shape.h"
 #include "oSVM.h"
 
 #include <deque>
@@ -50,6 +52,16 @@ Feature::Feature()
   }
 }
 
+int Feature::getPrecomputedSizeForOneSupernode(int featureSize)
+{
+  bool _includeNeighbors = true;
+  string config_tmp;
+  if(Config::Instance()->getParameter("include_neighbors", config_tmp)) {
+    _includeNeighbors = config_tmp.c_str()[0] == '1';
+  }
+  return _includeNeighbors ? featureSize/DEFAULT_FEATURE_DISTANCE : featureSize;
+}
+
 Feature::~Feature()
 {
   if(mean != 0) {
@@ -139,6 +151,14 @@ Feature* Feature::getFeature(Slice* slice,
       _feature = new F_Glcm;
       break;
 
+    case F_LBP:
+      _feature = new F_Lbp(false);
+      break;
+
+    case F_SHAPE:
+      _feature = new F_Shape(false);
+      break;
+
     case F_POSITION:
       _feature = new F_Position;
       break;      
@@ -199,16 +219,14 @@ Feature* Feature::getFeature(Slice* slice,
 
         int omin = 0;
 
-        _feature = new F_Sift(slice->getName().c_str(),octaves,levels,omin);
+        _feature = new F_Sift(slice,octaves,levels,omin);
         break;
       }
 #endif
 
     case F_DFT:
-      {
-        _feature = new F_Dft(slice->getName().c_str(), 800, 600);
-        break;
-      }
+      _feature = new F_Dft;
+      break;
 
     case F_HISTOGRAM:
       {
@@ -349,6 +367,18 @@ Feature* Feature::getFeature(Slice3d* slice3d,
       feat = new F_Glcm;
       break;
 
+    case F_LBP:
+      feat = new F_Lbp(true);
+      break;
+
+    case F_DFT:
+      feat = new F_Dft;
+      break;
+
+    case F_SHAPE:
+      feat = new F_Shape(true);
+      break;
+
 #ifdef USE_ITK
 
     case F_FILTER:
@@ -365,6 +395,26 @@ Feature* Feature::getFeature(Slice3d* slice3d,
 
 #endif
 
+#ifdef USE_SIFT
+    case F_SIFT:
+      {
+        int octaves = 3;
+        string paramOctaves;
+        if(Config::Instance()->getParameter("sift_octaves", paramOctaves)) {
+          octaves = atoi(paramOctaves.c_str());
+        }
+
+        int levels = 2;
+        string paramLevels;
+        if(Config::Instance()->getParameter("sift_levels", paramLevels)) {
+          levels = atoi(paramLevels.c_str());
+        }
+
+        feat = new F_Sift(slice3d,octaves,levels,0);
+        break;
+      }
+#endif
+
     default:
       printf("[Feature] Error in getFeature(Slice3d): unknown feature type %d\n", feature_type);
       exit(-1);
@@ -44,6 +44,14 @@ class Feature
     return fvSize;
   }
 
+  /**
+   * Size of the feature vector of a single supernode given the size of
+   * precomputed vectors (inverse of getSizeFeatureVector : vectors only
+   * include DEFAULT_FEATURE_DISTANCE rings of neighbors if
+   * include_neighbors is set).
+   */
+  static int getPrecomputedSizeForOneSupernode(int featureSize);
+
   //-------------------------------------
 
   virtual int getSizeFeatureVectorForOneSupernode() { return 0; }
@@ -145,6 +153,20 @@ class Feature
 
   virtual eFeatureType getFeatureType() { return F_UNKNOWN; }
 
+  /**
+   * Returns true if getFeatureVectorForOneSupernode can be called
+   * concurrently for different supernodes of a slice.
+   */
+  virtual bool isThreadSafe() { return true; }
+
+  /**
+   * Compute the feature vectors of all the supernodes of the slice
+   * (nSupernodes*getSizeFeatureVectorForOneSupernode() values, row sid).
+   * Returns false if the feature does not provide a batched computation,
+   * in which case output is left untouched.
+   */
+  virtual bool getFeatureMatrix(Slice_P* slice, float* output) { return false; }
+
   static void initSVMNode(osvm_node*& x, int d);
 
   static void precomputeFeatures(Slice_P* slice, Feature* feature, float**& output);
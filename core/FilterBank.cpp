@@ -0,0 +1,531 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "FilterBank.h"
+#include "Config.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+// integration scale of the structure tensor
+#define FB_STENSOR_SIGMA 1.0
+
+//------------------------------------------------------------------------------
+
+/**
+ * Sampled Gaussian kernels of order 0, 1 and 2. Filters are applied as
+ * correlations : out[i] = sum_j k[j]*in[i+j] with j in [-radius, radius].
+ * Kernels are normalized so that the response to 1, x and x^2/2 is 1.
+ */
+static void createGaussianKernels(double sigma, int radius,
+                                  float* k0, float* k1, float* k2)
+{
+  int size = 2*radius+1;
+  double* g = new double[size];
+  double sum0 = 0;
+  for(int j = -radius; j <= radius; ++j) {
+    g[j+radius] = exp(-j*j/(2.0*sigma*sigma));
+    sum0 += g[j+radius];
+  }
+
+  double sum1 = 0;
+  double mean2 = 0;
+  for(int j = -radius; j <= radius; ++j) {
+    k0[j+radius] = g[j+radius]/sum0;
+    sum1 += j*j*g[j+radius];
+    mean2 += (j*j/(sigma*sigma) - 1.0)*g[j+radius];
+  }
+  mean2 /= size;
+
+  double sum2 = 0;
+  for(int j = -radius; j <= radius; ++j) {
+    if(k1) {
+      k1[j+radius] = (sum1 > 0)?j*g[j+radius]/sum1:0;
+    }
+    double v = (j*j/(sigma*sigma) - 1.0)*g[j+radius] - mean2;
+    sum2 += 0.5*j*j*v;
+  }
+  if(k2) {
+    for(int j = -radius; j <= radius; ++j) {
+      double v = (j*j/(sigma*sigma) - 1.0)*g[j+radius] - mean2;
+      k2[j+radius] = (sum2 != 0)?v/sum2:0;
+    }
+  }
+  delete[] g;
+}
+
+/**
+ * Filter along z. in contains the planes [inZ0, inZ1[ of the volume and out
+ * receives the planes [z0, z1[. Planes outside of the input are replicated.
+ */
+template<typename T>
+static void convolveZ(const T* in, long inZ0, long inZ1, ulong sliceSize,
+                      const float* k, int radius, long z0, long z1, float* out)
+{
+  for(long z = z0; z < z1; ++z) {
+    float* pOut = out + (z-z0)*sliceSize;
+    for(ulong i = 0; i < sliceSize; ++i) {
+      pOut[i] = 0;
+    }
+    for(int j = -radius; j <= radius; ++j) {
+      long zz = z + j;
+      if(zz < inZ0) {
+        zz = inZ0;
+      } else if(zz >= inZ1) {
+        zz = inZ1 - 1;
+      }
+      const T* pIn = in + (zz-inZ0)*sliceSize;
+      const float w = k[j+radius];
+      for(ulong i = 0; i < sliceSize; ++i) {
+        pOut[i] += w*pIn[i];
+      }
+    }
+  }
+}
+
+/**
+ * Filter along y for nz planes of size width*height.
+ */
+static void convolveY(const float* in, long width, long height, long nz,
+                      const float* k, int radius, float* out)
+{
+  const ulong sliceSize = width*height;
+  for(long z = 0; z < nz; ++z) {
+    const float* pIn = in + z*sliceSize;
+    for(long y = 0; y < height; ++y) {
+      float* pOut = out + z*sliceSize + y*width;
+      for(long x = 0; x < width; ++x) {
+        pOut[x] = 0;
+      }
+      for(int j = -radius; j <= radius; ++j) {
+        long yy = y + j;
+        if(yy < 0) {
+          yy = 0;
+        } else if(yy >= height) {
+          yy = height - 1;
+        }
+        const float* pRow = pIn + yy*width;
+        const float w = k[j+radius];
+        for(long x = 0; x < width; ++x) {
+          pOut[x] += w*pRow[x];
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Filter along x for nRows rows of the given width. row is a temporary
+ * buffer of width+2*radius values.
+ */
+static void convolveX(const float* in, long width, long nRows,
+                      const float* k, int radius, float* row, float* out)
+{
+  for(long r = 0; r < nRows; ++r) {
+    const float* pIn = in + r*width;
+    float* pOut = out + r*width;
+    // replicate borders
+    for(int j = 0; j < radius; ++j) {
+      row[j] = pIn[0];
+      row[radius+width+j] = pIn[width-1];
+    }
+    for(long x = 0; x < width; ++x) {
+      row[radius+x] = pIn[x];
+      pOut[x] = 0;
+    }
+    for(int j = 0; j <= 2*radius; ++j) {
+      const float w = k[j];
+      const float* pRow = row + j;
+      for(long x = 0; x < width; ++x) {
+        pOut[x] += w*pRow[x];
+      }
+    }
+  }
+}
+
+/**
+ * Eigenvalues of a symmetric 3x3 matrix sorted in decreasing order.
+ */
+static inline void computeEigenValues(double a11, double a22, double a33,
+                                      double a12, double a13, double a23,
+                                      float& e1, float& e2, float& e3)
+{
+  double p1 = a12*a12 + a13*a13 + a23*a23;
+  double q = (a11 + a22 + a33)/3.0;
+  double p2 = (a11-q)*(a11-q) + (a22-q)*(a22-q) + (a33-q)*(a33-q) + 2.0*p1;
+  if(p2 < 1e-20) {
+    e1 = e2 = e3 = q;
+    return;
+  }
+  double p = sqrt(p2/6.0);
+  double b11 = (a11-q)/p;
+  double b22 = (a22-q)/p;
+  double b33 = (a33-q)/p;
+  double b12 = a12/p;
+  double b13 = a13/p;
+  double b23 = a23/p;
+  double r = 0.5*(b11*(b22*b33 - b23*b23) - b12*(b12*b33 - b23*b13) + b13*(b12*b23 - b22*b13));
+  if(r < -1.0) {
+    r = -1.0;
+  } else if(r > 1.0) {
+    r = 1.0;
+  }
+  double phi = acos(r)/3.0;
+  double l1 = q + 2.0*p*cos(phi);
+  double l3 = q + 2.0*p*cos(phi + (2.0*M_PI/3.0));
+  e1 = l1;
+  e2 = 3.0*q - l1 - l3;
+  e3 = l3;
+}
+
+//------------------------------------------------------------------------------
+
+FilterBank::FilterBank(Slice3d& slice3d, const double* _scales, int _nScales)
+{
+  raw_data = slice3d.raw_data;
+  width = slice3d.width;
+  height = slice3d.height;
+  depth = slice3d.depth;
+  sliceSize = width*height;
+
+  nScales = _nScales;
+  scales = new double[nScales];
+  for(int s = 0; s < nScales; ++s) {
+    scales[s] = _scales[s];
+  }
+
+  slabDepth = 8;
+  string config_tmp;
+  if(Config::Instance()->getParameter("filter_bank_slab_depth", config_tmp)) {
+    slabDepth = atoi(config_tmp.c_str());
+    if(slabDepth < 1) {
+      slabDepth = 1;
+    }
+  }
+
+  createKernels();
+  buildRunIndex(slice3d);
+}
+
+FilterBank::~FilterBank()
+{
+  for(int o = 0; o < 3; ++o) {
+    for(int s = 0; s < nScales; ++s) {
+      delete[] kernels[o][s];
+    }
+    delete[] kernels[o];
+  }
+  delete[] radii;
+  delete[] scales;
+  delete[] stKernel;
+  delete[] runs;
+}
+
+void FilterBank::buildRunIndex(Slice3d& slice3d)
+{
+  runs = new vector<FilterBankRun>[depth];
+  FilterBankRun run;
+  const map<sidType, supernode* >& _supernodes = slice3d.getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    run.sid = it->first;
+
+    const vector<lineContainer*>& lines = it->second->getLines();
+    for(vector<lineContainer*>::const_iterator itL = lines.begin();
+        itL != lines.end(); ++itL) {
+      run.x = (*itL)->coord.x;
+      run.y = (*itL)->coord.y;
+      run.length = (*itL)->length;
+      runs[(*itL)->coord.z].push_back(run);
+    }
+
+    const vector<node*>& nodes = it->second->getNodes();
+    for(vector<node*>::const_iterator itN = nodes.begin();
+        itN != nodes.end(); ++itN) {
+      run.x = (*itN)->x;
+      run.y = (*itN)->y;
+      run.length = 1;
+      runs[(*itN)->z].push_back(run);
+    }
+  }
+}
+
+void FilterBank::createKernels()
+{
+  radii = new int[nScales];
+  for(int o = 0; o < 3; ++o) {
+    kernels[o] = new float*[nScales];
+  }
+  for(int s = 0; s < nScales; ++s) {
+    radii[s] = (int)ceil(3.0*scales[s]);
+    if(radii[s] < 1) {
+      radii[s] = 1;
+    }
+    int size = 2*radii[s]+1;
+    for(int o = 0; o < 3; ++o) {
+      kernels[o][s] = new float[size];
+    }
+    createGaussianKernels(scales[s], radii[s], kernels[0][s], kernels[1][s], kernels[2][s]);
+  }
+
+  stRadius = (int)ceil(3.0*FB_STENSOR_SIGMA);
+  stKernel = new float[2*stRadius+1];
+  createGaussianKernels(FB_STENSOR_SIGMA, stRadius, stKernel, 0, 0);
+}
+
+double FilterBank::getGradientBound(int scaleIdx)
+{
+  // smoothing kernels are positive and sum to 1
+  double l1 = 0;
+  for(int j = 0; j <= 2*radii[scaleIdx]; ++j) {
+    l1 += fabs(kernels[1][scaleIdx][j]);
+  }
+  return 255.0*l1;
+}
+
+void FilterBank::run(int channelMask, FilterBankReducer* reducer)
+{
+  long nSlabs = (depth + slabDepth - 1)/slabDepth;
+  long nTasks = nSlabs*nScales;
+
+  PRINT_MESSAGE("[FilterBank] Processing %ld slabs of %ld planes at %d scales\n",
+                nSlabs, slabDepth, nScales);
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for(long t = 0; t < nTasks; ++t) {
+    int scaleIdx = t/nSlabs;
+    long z0 = (t%nSlabs)*slabDepth;
+    long z1 = min(z0 + slabDepth, depth);
+    processSlab(scaleIdx, z0, z1, channelMask, reducer);
+  }
+}
+
+void FilterBank::processSlab(int scaleIdx, long z0, long z1, int channelMask,
+                             FilterBankReducer* reducer)
+{
+  const int radius = radii[scaleIdx];
+  const float* k0 = kernels[0][scaleIdx];
+  const float* k1 = kernels[1][scaleIdx];
+  const float* k2 = kernels[2][scaleIdx];
+
+  const int stMask = FB_CHANNEL(FB_STENSOR_EIG_1) | FB_CHANNEL(FB_STENSOR_EIG_2) |
+    FB_CHANNEL(FB_STENSOR_EIG_3);
+  const int hessianMask = FB_CHANNEL(FB_LOG) | FB_CHANNEL(FB_HESSIAN_EIG_1) |
+    FB_CHANNEL(FB_HESSIAN_EIG_2) | FB_CHANNEL(FB_HESSIAN_EIG_3);
+  const int gradientMask = FB_CHANNEL(FB_GRADIENT_X) | FB_CHANNEL(FB_GRADIENT_Y) |
+    FB_CHANNEL(FB_GRADIENT_Z) | FB_CHANNEL(FB_GRADIENT_MAG) | stMask;
+  const bool needST = channelMask & stMask;
+  const bool needHessian = channelMask & hessianMask;
+  const bool needGradient = channelMask & gradientMask;
+
+  // derivatives are computed on [gz0, gz1[ (halo needed by the smoothing
+  // of the structure tensor)
+  const long gz0 = needST?max(0L, z0 - stRadius):z0;
+  const long gz1 = needST?min(depth, z1 + stRadius):z1;
+  const ulong gSize = (gz1-gz0)*sliceSize;
+  const ulong cOffset = (z0-gz0)*sliceSize;
+  const ulong cSize = (z1-z0)*sliceSize;
+  const long gRows = (gz1-gz0)*height;
+
+  float* row = new float[width + 2*max(radius, stRadius)];
+  float* tmp = new float[gSize];
+  float* dx = 0;
+  float* dy = 0;
+  float* dz = 0;
+  float* dxx = 0;
+  float* dyy = 0;
+  float* dzz = 0;
+  float* dxy = 0;
+  float* dxz = 0;
+  float* dyz = 0;
+
+  // shared separable passes : z, then y, then x
+  float* zb = new float[gSize];
+  convolveZ(raw_data, 0, depth, sliceSize, k0, radius, gz0, gz1, zb);
+  convolveY(zb, width, height, gz1-gz0, k0, radius, tmp);
+  if(needGradient) {
+    dx = new float[gSize];
+    convolveX(tmp, width, gRows, k1, radius, row, dx);
+  }
+  if(needHessian) {
+    dxx = new float[gSize];
+    convolveX(tmp, width, gRows, k2, radius, row, dxx);
+  }
+  if(needGradient || needHessian) {
+    convolveY(zb, width, height, gz1-gz0, k1, radius, tmp);
+    if(needGradient) {
+      dy = new float[gSize];
+      convolveX(tmp, width, gRows, k0, radius, row, dy);
+    }
+    if(needHessian) {
+      dxy = new float[gSize];
+      convolveX(tmp, width, gRows, k1, radius, row, dxy);
+    }
+  }
+  if(needHessian) {
+    convolveY(zb, width, height, gz1-gz0, k2, radius, tmp);
+    dyy = new float[gSize];
+    convolveX(tmp, width, gRows, k0, radius, row, dyy);
+  }
+
+  if(needGradient || needHessian) {
+    convolveZ(raw_data, 0, depth, sliceSize, k1, radius, gz0, gz1, zb);
+    convolveY(zb, width, height, gz1-gz0, k0, radius, tmp);
+    if(needGradient) {
+      dz = new float[gSize];
+      convolveX(tmp, width, gRows, k0, radius, row, dz);
+    }
+    if(needHessian) {
+      dxz = new float[gSize];
+      convolveX(tmp, width, gRows, k1, radius, row, dxz);
+      convolveY(zb, width, height, gz1-gz0, k1, radius, tmp);
+      dyz = new float[gSize];
+      convolveX(tmp, width, gRows, k0, radius, row, dyz);
+    }
+  }
+
+  if(needHessian) {
+    convolveZ(raw_data, 0, depth, sliceSize, k2, radius, gz0, gz1, zb);
+    convolveY(zb, width, height, gz1-gz0, k0, radius, tmp);
+    dzz = new float[gSize];
+    convolveX(tmp, width, gRows, k0, radius, row, dzz);
+  }
+  delete[] zb;
+
+  // channels
+  FilterBankSlab slab;
+  slab.scaleIdx = scaleIdx;
+  slab.z0 = z0;
+  slab.z1 = z1;
+  for(int c = 0; c < FB_NB_CHANNELS; ++c) {
+    slab.channels[c] = 0;
+  }
+  float* allocated[FB_NB_CHANNELS];
+  int nAllocated = 0;
+
+  if(needGradient) {
+    slab.channels[FB_GRADIENT_X] = dx + cOffset;
+    slab.channels[FB_GRADIENT_Y] = dy + cOffset;
+    slab.channels[FB_GRADIENT_Z] = dz + cOffset;
+  }
+
+  if(channelMask & FB_CHANNEL(FB_GRADIENT_MAG)) {
+    float* mag = new float[cSize];
+    allocated[nAllocated++] = mag;
+    const float* gx = slab.channels[FB_GRADIENT_X];
+    const float* gy = slab.channels[FB_GRADIENT_Y];
+    const float* gz = slab.channels[FB_GRADIENT_Z];
+    for(ulong i = 0; i < cSize; ++i) {
+      mag[i] = sqrt(gx[i]*gx[i] + gy[i]*gy[i] + gz[i]*gz[i]);
+    }
+    slab.channels[FB_GRADIENT_MAG] = mag;
+  }
+
+  if(channelMask & FB_CHANNEL(FB_LOG)) {
+    float* laplacian = new float[cSize];
+    allocated[nAllocated++] = laplacian;
+    for(ulong i = 0; i < cSize; ++i) {
+      laplacian[i] = dxx[cOffset+i] + dyy[cOffset+i] + dzz[cOffset+i];
+    }
+    slab.channels[FB_LOG] = laplacian;
+  }
+
+  if(channelMask & (FB_CHANNEL(FB_HESSIAN_EIG_1) | FB_CHANNEL(FB_HESSIAN_EIG_2) |
+                    FB_CHANNEL(FB_HESSIAN_EIG_3))) {
+    float* eig[3];
+    for(int e = 0; e < 3; ++e) {
+      eig[e] = new float[cSize];
+      allocated[nAllocated++] = eig[e];
+      slab.channels[FB_HESSIAN_EIG_1+e] = eig[e];
+    }
+    for(ulong i = 0; i < cSize; ++i) {
+      ulong j = cOffset + i;
+      computeEigenValues(dxx[j], dyy[j], dzz[j], dxy[j], dxz[j], dyz[j],
+                         eig[0][i], eig[1][i], eig[2][i]);
+    }
+  }
+
+  if(needST) {
+    // smoothed outer product of the gradient
+    const float* g[3] = {dx, dy, dz};
+    float* st[6];
+    float* prod = tmp;
+    float* stz = new float[cSize];
+    float* sty = new float[cSize];
+    int p = 0;
+    for(int a = 0; a < 3; ++a) {
+      for(int b = a; b < 3; ++b) {
+        for(ulong i = 0; i < gSize; ++i) {
+          prod[i] = g[a][i]*g[b][i];
+        }
+        st[p] = new float[cSize];
+        convolveZ(prod, gz0, gz1, sliceSize, stKernel, stRadius, z0, z1, stz);
+        convolveY(stz, width, height, z1-z0, stKernel, stRadius, sty);
+        convolveX(sty, width, (z1-z0)*height, stKernel, stRadius, row, st[p]);
+        ++p;
+      }
+    }
+    delete[] stz;
+    delete[] sty;
+
+    // st = [xx, xy, xz, yy, yz, zz]
+    float* eig[3];
+    for(int e = 0; e < 3; ++e) {
+      eig[e] = new float[cSize];
+      allocated[nAllocated++] = eig[e];
+      slab.channels[FB_STENSOR_EIG_1+e] = eig[e];
+    }
+    for(ulong i = 0; i < cSize; ++i) {
+      computeEigenValues(st[0][i], st[3][i], st[5][i], st[1][i], st[2][i], st[4][i],
+                         eig[0][i], eig[1][i], eig[2][i]);
+      // the structure tensor is positive semi-definite
+      for(int e = 0; e < 3; ++e) {
+        if(eig[e][i] < 0) {
+          eig[e][i] = 0;
+        }
+      }
+    }
+    for(int i = 0; i < 6; ++i) {
+      delete[] st[i];
+    }
+  }
+
+  reducer->reduce(*this, slab);
+
+  for(int a = 0; a < nAllocated; ++a) {
+    delete[] allocated[a];
+  }
+  delete[] dx;
+  delete[] dy;
+  delete[] dz;
+  delete[] dxx;
+  delete[] dyy;
+  delete[] dzz;
+  delete[] dxy;
+  delete[] dxz;
+  delete[] dyz;
+  delete[] tmp;
+  delete[] row;
+}
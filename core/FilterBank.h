@@ -0,0 +1,173 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef FILTER_BANK_H
+#define FILTER_BANK_H
+
+// SliceMe
+#include "globalsE.h"
+#include "Slice3d.h"
+
+#include <vector>
+
+//-------------------------------------------------------------------------TYPES
+
+// responses computed by FilterBank. Eigenvalues are sorted in decreasing
+// order (largest eigenvalue first).
+enum eFilterBankChannel
+{
+  FB_GRADIENT_X = 0,
+  FB_GRADIENT_Y,
+  FB_GRADIENT_Z,
+  FB_GRADIENT_MAG,
+  FB_LOG,
+  FB_HESSIAN_EIG_1,
+  FB_HESSIAN_EIG_2,
+  FB_HESSIAN_EIG_3,
+  FB_STENSOR_EIG_1,
+  FB_STENSOR_EIG_2,
+  FB_STENSOR_EIG_3,
+  FB_NB_CHANNELS
+};
+
+#define FB_CHANNEL(c) (1 << (c))
+
+/**
+ * Run of voxels along the x axis that belongs to one supernode.
+ */
+struct FilterBankRun
+{
+  sidType sid;
+  int x;
+  int y;
+  int length;
+};
+
+/**
+ * Responses of the filter bank for the planes [z0, z1[ of the volume at one
+ * scale. Each requested channel contains (z1-z0)*width*height values; the
+ * other channels are set to 0.
+ */
+struct FilterBankSlab
+{
+  int scaleIdx;
+  long z0;
+  long z1;
+  float* channels[FB_NB_CHANNELS];
+};
+
+class FilterBank;
+
+/**
+ * Receives the responses of the filter bank slab by slab. reduce is called
+ * from several threads at the same time (one slab each) so implementations
+ * have to synchronize the accumulation of quantities shared across slabs.
+ */
+class FilterBankReducer
+{
+ public:
+  virtual ~FilterBankReducer() {}
+
+  virtual void reduce(FilterBank& bank, const FilterBankSlab& slab) = 0;
+};
+
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Gaussian derivative filter bank for 3d volumes.
+ * The volume is processed in slabs of planes along the z axis (with a halo
+ * corresponding to the support of the filters) so that the memory needed is
+ * bounded by the size of a slab instead of the size of the volume. Slabs
+ * and scales are processed in parallel. All the channels are derived from
+ * the same separable derivative passes: gradient, Laplacian of Gaussian and
+ * eigenvalues of the Hessian and of the structure tensor. Borders are
+ * handled by replicating the voxels on the border of the volume.
+ *
+ * Responses are never stored for the full volume : reducers accumulate
+ * the quantities they need (usually per supernode, see getRuns).
+ *
+ * Options (configuration file) :
+ * filter_bank_slab_depth number of planes processed by each task (default 8)
+ */
+class FilterBank
+{
+ public:
+
+  FilterBank(Slice3d& slice3d, const double* _scales, int _nScales);
+
+  ~FilterBank();
+
+  /**
+   * Bound on the absolute value of the first order derivatives of a volume
+   * of 8-bit intensities.
+   */
+  double getGradientBound(int scaleIdx);
+
+  long getDepth() { return depth; }
+
+  long getHeight() { return height; }
+
+  int getNbScales() { return nScales; }
+
+  /**
+   * Runs of voxels contained in plane z
+   */
+  const std::vector<FilterBankRun>& getRuns(long z) { return runs[z]; }
+
+  double getScale(int scaleIdx) { return scales[scaleIdx]; }
+
+  ulong getSliceSize() { return sliceSize; }
+
+  long getWidth() { return width; }
+
+  /**
+   * Compute the channels given by channelMask (combination of FB_CHANNEL)
+   * at all the scales and pass them to the reducer.
+   */
+  void run(int channelMask, FilterBankReducer* reducer);
+
+ private:
+
+  void buildRunIndex(Slice3d& slice3d);
+
+  void createKernels();
+
+  void processSlab(int scaleIdx, long z0, long z1, int channelMask,
+                   FilterBankReducer* reducer);
+
+  const uchar* raw_data;
+  long width;
+  long height;
+  long depth;
+  ulong sliceSize;
+
+  int nScales;
+  double* scales;
+
+  // kernels of order 0, 1 and 2 for each scale (2*radius+1 coefficients)
+  int* radii;
+  float** kernels[3];
+
+  // smoothing applied to the structure tensor
+  int stRadius;
+  float* stKernel;
+
+  long slabDepth;
+
+  // runs of voxels for each plane
+  std::vector<FilterBankRun>* runs;
+};
+
+#endif // FILTER_BANK_H
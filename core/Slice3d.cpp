@@ -14,8 +14,15 @@
 
 
 // standard libraries
+#include <algorithm>
 #include <sstream>
 #include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Third-party libraries
 #include "LKM.h"
@@ -145,6 +152,8 @@ void Slice3d::init()
   raw_data = 0;
   includeOtherLabel = true;
   delete_raw_data = true;
+  mapped_size = 0;
+  supervoxelHash = 0;
   cubeness = SUPERVOXEL_DEFAULT_CUBENESS;
 
   start_x = 0;
@@ -167,10 +176,24 @@ Slice3d::~Slice3d()
   }
   
   if(delete_raw_data && raw_data) {
-    delete[] raw_data;
+    freeRawData();
   }
 }
 
+void Slice3d::freeRawData()
+{
+#ifndef _WIN32
+  if(mapped_size) {
+    munmap(raw_data, mapped_size);
+    mapped_size = 0;
+    raw_data = 0;
+    return;
+  }
+#endif
+  delete[] raw_data;
+  raw_data = 0;
+}
+
 uchar Slice3d::at(int x, int y, int z)
 {
   return raw_data[z*sliceSize+y*width+x];
@@ -238,14 +261,16 @@ void Slice3d::loadSupervoxels(const char* imageDir, const int voxel_step, const
     int height;
     int depth;
     PRINT_MESSAGE("[Slice3d] Loading supervoxels from nrrd file %s\n", soutSupervoxels_nrrd.str().c_str());
+    if(!importRawNRRDCube(soutSupervoxels_nrrd.str().c_str(), outputData, width, height, depth)) {
 #ifdef USE_ITK
-    importNRRDCube_uint(soutSupervoxels_nrrd.str().c_str(), outputData, width, height, depth);
+      importNRRDCube_uint(soutSupervoxels_nrrd.str().c_str(), outputData, width, height, depth);
 #else
-    PRINT_MESSAGE("[Slice3d] Set USE_ITK to true to import NRRD cubes\n");
-    exit(-1);
+      PRINT_MESSAGE("[Slice3d] Set USE_ITK to true to import compressed NRRD cubes\n");
+      exit(-1);
 #endif
-    importSupervoxelsFromBuffer((const uint*)outputData, width, height, depth);
-    delete[] outputData;
+    }
+    // buffer is owned by the slice from now on
+    importSupervoxelsFromBuffer((sidType*)outputData, width, height, depth);
   } else {
     stringstream soutSupervoxels;
     soutSupervoxels << imageDir << "supervoxels_" << voxel_step << "_" << cubeness;
@@ -460,10 +485,16 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
 
   if(loadNeighbors) {
     PRINT_MESSAGE("[Slice3d] Indexing neighbors...\n");
+    computeSupervoxelHash(_klabels);
 
+    string graphCacheFilename = getGraphCacheFilename();
     stringstream sout_neighbors;
     sout_neighbors << inputDir << "neighbors_" << supernode_step << "_" << cubeness;
-    if(fileExists(sout_neighbors.str().c_str())) {
+    if(fileExists(graphCacheFilename) &&
+       importNeighborsFromGraphCache(graphCacheFilename.c_str())) {
+      PRINT_MESSAGE("[Slice3d] Neighbors loaded from %s\n", graphCacheFilename.c_str());
+    } else if(fileExists(sout_neighbors.str().c_str())) {
+      // text file written by previous versions
       PRINT_MESSAGE("[Slice3d] Loading neighbors from %s\n", sout_neighbors.str().c_str());
       ifstream ifs(sout_neighbors.str().c_str());
       string line;
@@ -480,6 +511,9 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
         }
       }
       ifs.close();
+
+      PRINT_MESSAGE("[Slice3d] Exporting neighbors to %s\n", graphCacheFilename.c_str());
+      exportGraphCache(graphCacheFilename.c_str(), false);
     } else {
       const int nh_size = 1; // neighborhood size
       sidType nsid;
@@ -526,37 +560,514 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
         }
       }
 
-      PRINT_MESSAGE("Exporting neighbors to %s\n", sout_neighbors.str().c_str());
-      ofstream ofs(sout_neighbors.str().c_str());
-      for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
-          it != mSupervoxels->end(); it++) {
-        s = it->second;
-        stringstream sout;
-        sout << s->id;
-        for(vector < supernode* >::iterator itN = s->neighbors.begin();
-            itN != s->neighbors.end();itN++) {
-          supernode* ns = *itN;
-          sout << " " << ns->id;
-        }
-        ofs << sout.str() << endl;
-      }
-      ofs.close();
-
+      PRINT_MESSAGE("[Slice3d] Exporting neighbors to %s\n", graphCacheFilename.c_str());
+      exportGraphCache(graphCacheFilename.c_str(), false);
     }
 
     maxDegree = -1;
     int d;
+    ulong nEntries = 0;
     for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
         it != mSupervoxels->end(); it++) {
       d = it->second->neighbors.size();
+      nEntries += d;
       if(maxDegree < d) {
         maxDegree = d;
       }
-    }    
+    }
+    nbEdges = nEntries/2;
     PRINT_MESSAGE("[Slice3d] %ld undirected edges created. Maximum degree = %d\n", nbEdges, maxDegree);
   }
 }
 
+//------------------------------------------------------------------------------
+// Binary graph cache
+//
+// Layout (all values in native byte order) :
+// GraphCacheHeader
+//   (supervoxelHash is a hash of the supervoxel labels, see
+//    computeSupervoxelHash)
+// sidType sids[nSupernodes]               (increasing order)
+// ulong offsets[nSupernodes+1]            (CSR offsets into the neighbor list)
+// neighbors (neighborsSize bytes, padded to a multiple of 8 bytes)
+//   - sidType[nEntries] if GRAPH_CACHE_VARINT is not set
+//   - zigzag varints of the difference between consecutive neighbor ids
+//     (the first one is relative to the supervoxel id) otherwise
+// if GRAPH_CACHE_EDGE_INDICES is set, one int per entry (-1 if missing) for
+//   int gradientIdxs[nEntries]
+//   int orientationIdxs[nEntries]
+//   int distanceIdxs[nEntries]
+//------------------------------------------------------------------------------
+
+#define GRAPH_CACHE_MAGIC 0x43475653 // "SVGC"
+#define GRAPH_CACHE_VERSION 3
+#define GRAPH_CACHE_VARINT 1
+#define GRAPH_CACHE_EDGE_INDICES 2
+
+struct GraphCacheHeader
+{
+  uint magic;
+  uint version;
+  uint flags;
+  int width;
+  int height;
+  int depth;
+  int supernode_step;
+  double cubeness;
+  ulong supervoxelHash;
+  ulong nSupernodes;
+  ulong nEntries;
+  ulong neighborsSize;
+  int nGradientLevels;
+  int nOrientations;
+  int nDistances;
+  float maxIntensityGradient;
+};
+
+static inline ulong alignGraphCacheSize(ulong size)
+{
+  return (size + 7) & ~((ulong)7);
+}
+
+/**
+ * 64-bit FNV-1a hash of the supervoxel labels. Planes are hashed in
+ * parallel and the hashes of the planes are then combined in order.
+ * The adjacency only depends on the labels, so this detects graph caches
+ * computed for other supervoxels with the same dimensions and parameters.
+ */
+void Slice3d::computeSupervoxelHash(sidType** _klabels)
+{
+  const ulong fnvOffset = 14695981039346656037UL;
+  const ulong fnvPrime = 1099511628211UL;
+  const ulong planeSize = width*height*sizeof(sidType);
+  ulong* planeHashes = new ulong[depth];
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int z = 0; z < depth; ++z) {
+    const uchar* ptr = (const uchar*)_klabels[z];
+    ulong h = fnvOffset;
+    for(ulong i = 0; i < planeSize; ++i) {
+      h = (h ^ ptr[i])*fnvPrime;
+    }
+    planeHashes[z] = h;
+  }
+
+  ulong h = fnvOffset;
+  for(int z = 0; z < depth; ++z) {
+    for(int b = 0; b < 8; ++b) {
+      h = (h ^ ((planeHashes[z] >> (8*b)) & 0xff))*fnvPrime;
+    }
+  }
+  delete[] planeHashes;
+  supervoxelHash = h;
+}
+
+/**
+ * Map a whole file in memory (read only).
+ * Returns 0 if the file can not be read.
+ */
+static const char* mapGraphCache(const char* filename, ulong& size)
+{
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if(fd == -1) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  size = st.st_size;
+  void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    return 0;
+  }
+  return (const char*)data;
+#else
+  ifstream ifs(filename, ios::binary);
+  if(ifs.fail()) {
+    return 0;
+  }
+  ifs.seekg(0, ios::end);
+  size = ifs.tellg();
+  ifs.seekg(0, ios::beg);
+  char* data = new char[size];
+  ifs.read(data, size);
+  return data;
+#endif
+}
+
+static void unmapGraphCache(const char* data, ulong size)
+{
+#ifndef _WIN32
+  munmap((void*)data, size);
+#else
+  delete[] data;
+#endif
+}
+
+/**
+ * Check header and size of a mapped graph cache.
+ */
+static bool checkGraphCache(const char* data, ulong size, const GraphCacheHeader& expected)
+{
+  if(size < sizeof(GraphCacheHeader)) {
+    return false;
+  }
+  const GraphCacheHeader* header = (const GraphCacheHeader*)data;
+  if(header->magic != GRAPH_CACHE_MAGIC || header->version != GRAPH_CACHE_VERSION ||
+     header->width != expected.width || header->height != expected.height ||
+     header->depth != expected.depth || header->supernode_step != expected.supernode_step ||
+     header->cubeness != expected.cubeness || header->supervoxelHash != expected.supervoxelHash ||
+     header->nSupernodes != expected.nSupernodes) {
+    return false;
+  }
+  ulong expectedSize = sizeof(GraphCacheHeader)
+    + alignGraphCacheSize(sizeof(sidType)*header->nSupernodes)
+    + sizeof(ulong)*(header->nSupernodes+1)
+    + alignGraphCacheSize(header->neighborsSize);
+  if(header->flags & GRAPH_CACHE_EDGE_INDICES) {
+    expectedSize += 3*sizeof(int)*header->nEntries;
+  }
+  return size >= expectedSize;
+}
+
+string Slice3d::getGraphCacheFilename()
+{
+  stringstream sout;
+  sout << inputDir << "neighbors_" << supernode_step << "_" << cubeness << ".bin";
+  return sout.str();
+}
+
+void Slice3d::exportGraphCache(const char* filename, bool includeEdgeIndices,
+                               int nGradientLevels, int nOrientations,
+                               int nDistances)
+{
+  ulong nSupernodes = mSupervoxels->size();
+  sidType* sids = new sidType[nSupernodes];
+  ulong* offsets = new ulong[nSupernodes+1];
+  vector<uchar> varints;
+
+  ulong nEntries = 0;
+  ulong i = 0;
+  for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+      it != mSupervoxels->end(); it++, ++i) {
+    sids[i] = it->first;
+    offsets[i] = nEntries;
+    nEntries += it->second->neighbors.size();
+  }
+  offsets[nSupernodes] = nEntries;
+
+  GraphCacheHeader header;
+  memset(&header, 0, sizeof(GraphCacheHeader));
+  header.magic = GRAPH_CACHE_MAGIC;
+  header.version = GRAPH_CACHE_VERSION;
+  header.flags = COMPRESS_GRAPH_CACHE?GRAPH_CACHE_VARINT:0;
+  header.width = width;
+  header.height = height;
+  header.depth = depth;
+  header.supernode_step = supernode_step;
+  header.cubeness = cubeness;
+  header.supervoxelHash = supervoxelHash;
+  header.nSupernodes = nSupernodes;
+  header.nEntries = nEntries;
+  if(includeEdgeIndices) {
+    header.flags |= GRAPH_CACHE_EDGE_INDICES;
+    header.nGradientLevels = nGradientLevels;
+    header.nOrientations = nOrientations;
+    header.nDistances = nDistances;
+    header.maxIntensityGradient = MAX_INTENSITY_GRADIENT;
+  }
+
+  sidType* neighbors = 0;
+  if(COMPRESS_GRAPH_CACHE) {
+    varints.reserve(nEntries*2);
+    for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+        it != mSupervoxels->end(); it++) {
+      long previous = it->first;
+      for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+          itN != it->second->neighbors.end(); itN++) {
+        long delta = (long)(*itN)->id - previous;
+        previous = (*itN)->id;
+        ulong v = ((ulong)delta << 1) ^ (ulong)(delta >> (8*sizeof(long)-1));
+        while(v >= 0x80) {
+          varints.push_back((uchar)(v | 0x80));
+          v >>= 7;
+        }
+        varints.push_back((uchar)v);
+      }
+    }
+    header.neighborsSize = varints.size();
+  } else {
+    neighbors = new sidType[nEntries];
+    ulong idx = 0;
+    for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+        it != mSupervoxels->end(); it++) {
+      for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+          itN != it->second->neighbors.end(); itN++) {
+        neighbors[idx++] = (*itN)->id;
+      }
+    }
+    header.neighborsSize = sizeof(sidType)*nEntries;
+  }
+
+  ofstream ofs(filename, ios::binary);
+  if(ofs.fail()) {
+    printf("[Slice3d] Error : could not write graph cache to %s\n", filename);
+    delete[] sids;
+    delete[] offsets;
+    delete[] neighbors;
+    return;
+  }
+
+  const char padding[8] = {0,0,0,0,0,0,0,0};
+  ofs.write((const char*)&header, sizeof(GraphCacheHeader));
+  ofs.write((const char*)sids, sizeof(sidType)*nSupernodes);
+  ofs.write(padding, alignGraphCacheSize(sizeof(sidType)*nSupernodes) - sizeof(sidType)*nSupernodes);
+  ofs.write((const char*)offsets, sizeof(ulong)*(nSupernodes+1));
+  if(COMPRESS_GRAPH_CACHE) {
+    if(!varints.empty()) {
+      ofs.write((const char*)&varints[0], varints.size());
+    }
+  } else {
+    ofs.write((const char*)neighbors, header.neighborsSize);
+  }
+  ofs.write(padding, alignGraphCacheSize(header.neighborsSize) - header.neighborsSize);
+
+  if(includeEdgeIndices) {
+    int* idxs = new int[nEntries];
+    for(int t = 0; t < 3; ++t) {
+      ulong idx = 0;
+      for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+          it != mSupervoxels->end(); it++) {
+        for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+            itN != it->second->neighbors.end(); itN++) {
+          map<ulong, int>::iterator itIdx;
+          int value = -1;
+          if(t == 0) {
+            itIdx = gradientIdxs.find(getEdgeId(it->first, (*itN)->id));
+            if(itIdx != gradientIdxs.end()) {
+              value = itIdx->second;
+            }
+          } else if(t == 1) {
+            itIdx = orientationIdxs.find(getDirectedEdgeId(it->first, (*itN)->id));
+            if(itIdx != orientationIdxs.end()) {
+              value = itIdx->second;
+            }
+          } else {
+            itIdx = distanceIdxs.find(getEdgeId(it->first, (*itN)->id));
+            if(itIdx != distanceIdxs.end()) {
+              value = itIdx->second;
+            }
+          }
+          idxs[idx++] = value;
+        }
+      }
+      ofs.write((const char*)idxs, sizeof(int)*nEntries);
+    }
+    delete[] idxs;
+  }
+  ofs.close();
+
+  delete[] sids;
+  delete[] offsets;
+  delete[] neighbors;
+}
+
+bool Slice3d::importNeighborsFromGraphCache(const char* filename)
+{
+  if(mSupervoxels->size() == 0) {
+    return false;
+  }
+
+  ulong size = 0;
+  const char* data = mapGraphCache(filename, size);
+  if(data == 0) {
+    return false;
+  }
+
+  GraphCacheHeader expected;
+  expected.width = width;
+  expected.height = height;
+  expected.depth = depth;
+  expected.supernode_step = supernode_step;
+  expected.cubeness = cubeness;
+  expected.supervoxelHash = supervoxelHash;
+  expected.nSupernodes = mSupervoxels->size();
+  if(!checkGraphCache(data, size, expected)) {
+    PRINT_MESSAGE("[Slice3d] Graph cache %s does not match current volume\n", filename);
+    unmapGraphCache(data, size);
+    return false;
+  }
+
+  const GraphCacheHeader* header = (const GraphCacheHeader*)data;
+  ulong nSupernodes = header->nSupernodes;
+  const sidType* sids = (const sidType*)(data + sizeof(GraphCacheHeader));
+  const ulong* offsets = (const ulong*)((const char*)sids +
+                                        alignGraphCacheSize(sizeof(sidType)*nSupernodes));
+  const char* neighbors = (const char*)(offsets + nSupernodes + 1);
+  const uchar* varints = (const uchar*)neighbors;
+  const uchar* varintsEnd = varints + header->neighborsSize;
+
+  // direct lookup table to avoid searching the map for every neighbor
+  sidType maxSid = mSupervoxels->rbegin()->first;
+  vector<supernode*> supernodes(maxSid+1, (supernode*)0);
+  for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+      it != mSupervoxels->end(); it++) {
+    supernodes[it->first] = it->second;
+  }
+
+  bool valid = true;
+  for(ulong i = 0; i < nSupernodes && valid; ++i) {
+    if(sids[i] < 0 || sids[i] > maxSid || supernodes[sids[i]] == 0 ||
+       offsets[i] > offsets[i+1] || offsets[i+1] > header->nEntries) {
+      valid = false;
+      break;
+    }
+    supernode* s = supernodes[sids[i]];
+    s->neighbors.reserve(offsets[i+1] - offsets[i]);
+    long previous = sids[i];
+    for(ulong e = offsets[i]; e < offsets[i+1]; ++e) {
+      long nsid;
+      if(header->flags & GRAPH_CACHE_VARINT) {
+        ulong v = 0;
+        int shift = 0;
+        while(varints < varintsEnd && (*varints & 0x80)) {
+          v |= ((ulong)(*varints & 0x7f)) << shift;
+          shift += 7;
+          ++varints;
+        }
+        if(varints == varintsEnd) {
+          valid = false;
+          break;
+        }
+        v |= ((ulong)*varints) << shift;
+        ++varints;
+        nsid = previous + (long)((v >> 1) ^ (~(v & 1) + 1));
+        previous = nsid;
+      } else {
+        nsid = ((const sidType*)neighbors)[e];
+      }
+      if(nsid < 0 || nsid > maxSid || supernodes[nsid] == 0) {
+        valid = false;
+        break;
+      }
+      s->neighbors.push_back(supernodes[nsid]);
+    }
+  }
+
+  unmapGraphCache(data, size);
+
+  if(!valid) {
+    printf("[Slice3d] Error : graph cache %s is corrupted\n", filename);
+    for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+        it != mSupervoxels->end(); it++) {
+      it->second->neighbors.clear();
+    }
+  }
+  return valid;
+}
+
+bool Slice3d::importEdgeIndicesFromGraphCache(const char* filename, int nGradientLevels,
+                                              int nOrientations, int nDistances)
+{
+  ulong size = 0;
+  const char* data = mapGraphCache(filename, size);
+  if(data == 0) {
+    return false;
+  }
+
+  GraphCacheHeader expected;
+  expected.width = width;
+  expected.height = height;
+  expected.depth = depth;
+  expected.supernode_step = supernode_step;
+  expected.cubeness = cubeness;
+  expected.supervoxelHash = supervoxelHash;
+  expected.nSupernodes = mSupervoxels->size();
+  const GraphCacheHeader* header = (const GraphCacheHeader*)data;
+  if(!checkGraphCache(data, size, expected) ||
+     !(header->flags & GRAPH_CACHE_EDGE_INDICES) ||
+     header->nGradientLevels != nGradientLevels ||
+     header->nOrientations != nOrientations ||
+     header->nDistances != nDistances ||
+     header->maxIntensityGradient != MAX_INTENSITY_GRADIENT) {
+    unmapGraphCache(data, size);
+    return false;
+  }
+
+  // check that the neighbors stored in the cache are the ones in memory
+  ulong nSupernodes = header->nSupernodes;
+  const sidType* sids = (const sidType*)(data + sizeof(GraphCacheHeader));
+  const ulong* offsets = (const ulong*)((const char*)sids +
+                                        alignGraphCacheSize(sizeof(sidType)*nSupernodes));
+  ulong i = 0;
+  for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+      it != mSupervoxels->end(); it++, ++i) {
+    if(sids[i] != it->first ||
+       offsets[i+1] - offsets[i] != it->second->neighbors.size()) {
+      unmapGraphCache(data, size);
+      return false;
+    }
+  }
+
+  const int* gradients = (const int*)((const char*)(offsets + nSupernodes + 1) +
+                                      alignGraphCacheSize(header->neighborsSize));
+  const int* orientations = gradients + header->nEntries;
+  const int* distances = orientations + header->nEntries;
+  ulong idx = 0;
+  for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+      it != mSupervoxels->end(); it++) {
+    for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+        itN != it->second->neighbors.end(); itN++, ++idx) {
+      if(it->first > (*itN)->id) {
+        ulong edgeId = getEdgeId(it->first, (*itN)->id);
+        if(gradients[idx] != -1) {
+          gradientIdxs[edgeId] = gradients[idx];
+        }
+        if(distances[idx] != -1) {
+          distanceIdxs[edgeId] = distances[idx];
+        }
+      }
+      if(orientations[idx] != -1) {
+        orientationIdxs[getDirectedEdgeId(it->first, (*itN)->id)] = orientations[idx];
+      }
+    }
+  }
+
+  unmapGraphCache(data, size);
+  return true;
+}
+
+void Slice3d::precomputeEdgeIndices(int nGradientLevels, int nOrientations, int nDistances)
+{
+  string graphCacheFilename = getGraphCacheFilename();
+  bool useCache = loadNeighbors && gradientIdxs.size() == 0 &&
+    orientationIdxs.size() == 0 && distanceIdxs.size() == 0;
+
+  if(useCache && fileExists(graphCacheFilename) &&
+     importEdgeIndicesFromGraphCache(graphCacheFilename.c_str(), nGradientLevels,
+                                     nOrientations, nDistances)) {
+    PRINT_MESSAGE("[Slice3d] Edge indices loaded from %s\n", graphCacheFilename.c_str());
+    return;
+  }
+
+  precomputeGradientIndices(nGradientLevels);
+  precomputeOrientationIndices(nOrientations);
+  if(nDistances > 0) {
+    precomputeDistanceIndices(nDistances);
+  }
+
+  if(useCache) {
+    PRINT_MESSAGE("[Slice3d] Exporting edge indices to %s\n", graphCacheFilename.c_str());
+    exportGraphCache(graphCacheFilename.c_str(), true, nGradientLevels,
+                     nOrientations, nDistances);
+  }
+}
+
 uchar* Slice3d::createNodeLabelVolume()
 {
   ulong sliceSize = width*height;
@@ -692,6 +1203,40 @@ void Slice3d::importSupervoxelsFromBuffer(const uint* buffer, int _width, int _h
 #endif
 }
 
+void Slice3d::importSupervoxelsFromBuffer(sidType* buffer, int _width, int _height, int _depth)
+{
+#ifndef USE_REVERSE_INDEXING
+  sidType** klabels = 0;
+#endif
+
+  printf("[Slice3d] Importing supervoxel labels from buffer. size = (%d,%d,%d) =? (%d,%d,%d), supernode_step=%d\n",
+         width, height, depth, _width, _height, _depth, supernode_step);
+
+  assert(_width == width);
+  assert(_height == height);
+  assert(_depth == depth);
+
+  if(klabels != 0) {
+    printf("[Slice3d] Error in importSupervoxels : supervoxels have already been generated\n");
+    delete[] buffer;
+    return;
+  }
+
+  // slices point directly into the buffer
+  klabels = new sidType*[depth];
+  ulong sliceSize = width*height;
+  for(int z=0; z<depth; z++) {
+    klabels[z] = buffer + z*sliceSize;
+  }
+
+  createIndexingStructures(klabels);
+
+#ifndef USE_REVERSE_INDEXING
+  delete[] buffer;
+  delete[] klabels;
+#endif
+}
+
 void Slice3d::importSupervoxels(const char* filename)
 {
 #ifndef USE_REVERSE_INDEXING
@@ -856,143 +1401,154 @@ void Slice3d::loadFromDir(const char* dir, int nImgs)
   loadFromDir(dir, start, end);
 }
 
-void Slice3d::loadFromDir(const char* dir, const node& start, const node& end)
+/**
+ * Decode the first nImgs images listed in files into raw_data (one slice of
+ * width*height bytes per image). Images are decoded in parallel and written
+ * directly at their final location, each thread only holds one decoded
+ * image at a time. Images that can not be loaded are replaced by black slices.
+ * Returns the number of images loaded successfully.
+ */
+static int decodeSlices(const vector<string>& files, int nImgs,
+                        int width, int height, uchar* raw_data)
 {
   const int bytes_per_pixel = 1;
-  IplImage* img;
-  IplImage* gray_img;
-  int nImgs = end.z-start.z;
-
-  // load files
-  vector<string> files;
-  getFilesInDir(dir, files, start.z, "png", true);
-  if(files.size() == 0) {
-    getFilesInDir(dir, files, start.z, "tif", true);
-  }
-
-  int nValidImgs = 0;
-  for(vector<string>::iterator itFile = files.begin();
-      itFile != files.end(); itFile++) {
-    if(width == UNITIALIZED_SIZE) {
-      IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
-      if(!img_slice)
-        continue;
-
-      width = img_slice->width;
-      height = img_slice->height;
-
-      cvReleaseImage(&img_slice);
-    }
-
-    nValidImgs++;
-  }
-
-  if(nImgs != -1) {
-    if(nImgs > nValidImgs) {
-      printf("[Slice3d] Warning : nImgs=%d > nValidImgs=%d\n", nImgs, nValidImgs);
-      nImgs = nValidImgs;
-    }
-  }
-  else {
-    nImgs = nValidImgs;
-  }
-
-  // ask for enough memory for the texels and make sure we got it before proceeding
-  depth = nImgs; //files.size();
-
-  if(!isDirectory(dir)) {
-    PRINT_MESSAGE("[Slice3d] Loading data from file %s\n", dir);
-    importData(dir);
-    return;
-  }
-
-  stringstream sVolDataFile;
-  sVolDataFile << dir;
-  sVolDataFile << "/volumedata";
-
-  if(fileExists(sVolDataFile.str().c_str())) {
-    PRINT_MESSAGE("[Slice3d] Loading data from %s\n", sVolDataFile.str().c_str());
-    importData(sVolDataFile.str().c_str());
-    return;
-  }
-
-  ulong n = width*height*sizeof(char);
-  raw_data = new uchar[n*depth];
+  const ulong n = ((ulong)width)*height*sizeof(char);
+  int nLoadedImgs = 0;
 
-  PRINT_MESSAGE("[Slice3d] Loading %d %dx%d images (%ld pixels) from directory %s\n",
-                nImgs, width, height, n, dir);
-  int d = 0;
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nLoadedImgs)
+#endif
   for(int iImage = 0; iImage < nImgs; iImage++)
     {
-      string image = files[iImage];
+      uchar* ptr_slice = raw_data + iImage*n;
 
       // Load image in black and white
       // Do no handle 3d cubes in color for now !
-      IplImage* img_slice = cvLoadImage(image.c_str(),0);
+      IplImage* img_slice = cvLoadImage(files[iImage].c_str(),0);
 
       if(!img_slice) {
-	PRINT_MESSAGE("[Slice3d] Warning : image %s not loaded properly\n", image.c_str());
+        PRINT_MESSAGE("[Slice3d] Warning : image %s not loaded properly\n", files[iImage].c_str());
+        memset(ptr_slice, 0, n);
         continue;
       }
 
+      // header pointing to the final location of the slice in raw_data
+      IplImage* img = cvCreateImageHeader(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
+      cvSetData(img, ptr_slice, width*bytes_per_pixel);
+
       if(img_slice->width != width || img_slice->height != height)
         {
           PRINT_MESSAGE("[Slice3d] Warning : (img_slice->width != width || img_slice->height != height)\n");
           if(img_slice->nChannels != bytes_per_pixel)
             {
-              gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
+              IplImage* gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
               cvCvtColor(img_slice,gray_img,CV_RGB2GRAY);
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
               cvResize(gray_img,img);
               cvReleaseImage(&gray_img);
             }
           else
             {
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
               cvResize(img_slice,img);
             }
-
-          memcpy(raw_data+(d*n),img->imageData,n);
-          cvReleaseImage(&img);
-          cvReleaseImage(&img_slice);
         }
       else
         {
-          img = img_slice;
-
           if(img_slice->nChannels != bytes_per_pixel)
             {
-              // FIXME
-              printf("[Slice3d] img_slice->nChannels %d\n", img_slice->nChannels);
-              exit(-1);
+              cvCvtColor(img_slice,img,CV_RGB2GRAY);
             }
-
-          if(img->widthStep != img->width)
+          else
             {
-              int i = 0;
-              for(int y = 0; y < img->height ; y++)
-                for(int x = 0; x < img->width ; x++)
-                  {
-                    raw_data[d*n+i] = ((uchar*)(img->imageData + img->widthStep*y))[x*img->nChannels];
-                    i++;
-                  }
+              // takes care of padded rows (widthStep != width)
+              cvCopy(img_slice,img);
             }
-          else
-            memcpy(raw_data+(d*n),img->imageData,n);
-
-          cvReleaseImage(&img);
         }
-      ++d;
+
+      cvReleaseImageHeader(&img);
+      cvReleaseImage(&img_slice);
+      ++nLoadedImgs;
+    }
+
+  return nLoadedImgs;
+}
+
+/**
+ * Get the size of the first readable image and the number of images
+ * following it. Only image headers are read.
+ */
+static int probeSlices(const vector<string>& files, int& width, int& height)
+{
+  int nValidImgs = 0;
+  for(vector<string>::const_iterator itFile = files.begin();
+      itFile != files.end(); itFile++) {
+    if(width == UNITIALIZED_SIZE) {
+      if(!getImageSize(itFile->c_str(), width, height)) {
+        width = UNITIALIZED_SIZE;
+        continue;
+      }
     }
+    nValidImgs++;
+  }
+  return nValidImgs;
+}
+
+void Slice3d::loadFromDir(const char* dir, const node& start, const node& end)
+{
+  int nImgs = end.z-start.z;
+
+  if(!isDirectory(dir)) {
+    PRINT_MESSAGE("[Slice3d] Loading data from file %s\n", dir);
+    importData(dir);
+    return;
+  }
+
+  stringstream sVolDataFile;
+  sVolDataFile << dir;
+  sVolDataFile << "/volumedata";
+
+  if(fileExists(sVolDataFile.str().c_str())) {
+    PRINT_MESSAGE("[Slice3d] Loading data from %s\n", sVolDataFile.str().c_str());
+    importData(sVolDataFile.str().c_str());
+    return;
+  }
+
+  // load files
+  vector<string> files;
+  getFilesInDir(dir, files, start.z, "png", true);
+  if(files.size() == 0) {
+    getFilesInDir(dir, files, start.z, "tif", true);
+  }
+
+  int nValidImgs = probeSlices(files, width, height);
+
+  if(nImgs != -1) {
+    if(nImgs > nValidImgs) {
+      printf("[Slice3d] Warning : nImgs=%d > nValidImgs=%d\n", nImgs, nValidImgs);
+      nImgs = nValidImgs;
+    }
+  }
+  else {
+    nImgs = nValidImgs;
+  }
+
+  // ask for enough memory for the texels and make sure we got it before proceeding
+  depth = nImgs; //files.size();
+
+  ulong n = width*height*sizeof(char);
+  raw_data = new uchar[n*depth];
+
+  PRINT_MESSAGE("[Slice3d] Loading %d %dx%d images (%ld pixels) from directory %s\n",
+                nImgs, width, height, n, dir);
+  int nLoadedImgs = decodeSlices(files, nImgs, width, height, raw_data);
+  if(nLoadedImgs != nImgs) {
+    printf("[Slice3d] Warning : %d images out of %d could not be loaded\n",
+           nImgs - nLoadedImgs, nImgs);
+  }
 }
 
 void Slice3d::loadFromDir(const char* dir, uchar*& raw_data,
                           int& width, int& height, int* nImgs)
 {
-  const int bytes_per_pixel = 1;
-  IplImage* img;
-  IplImage* gray_img;
-
   // load files
   vector<string> files;
   getFilesInDir(dir, files,"png", true);
@@ -1000,29 +1556,20 @@ void Slice3d::loadFromDir(const char* dir, uchar*& raw_data,
     getFilesInDir(dir, files,"tif", true);
   }
 
-  width = -1;
-  int nValidImgs = 0;
+  // only keep images
+  vector<string> imageFiles;
   for(vector<string>::iterator itFile = files.begin();
       itFile != files.end(); itFile++)
     {
       if((itFile->c_str()[0] != '.') && ( (getExtension(*itFile) == "png") || (getExtension(*itFile) == "tif")) )
         {
-          if(width == -1)
-            {
-              IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
-              if(!img_slice)
-                continue;
-
-              width = img_slice->width;
-              height = img_slice->height;
-
-              cvReleaseImage(&img_slice);
-            }
-
-          nValidImgs++;
+          imageFiles.push_back(*itFile);
         }
     }
 
+  width = UNITIALIZED_SIZE;
+  int nValidImgs = probeSlices(imageFiles, width, height);
+
   if(*nImgs != -1)
     {
       if(*nImgs > nValidImgs)
@@ -1035,71 +1582,11 @@ void Slice3d::loadFromDir(const char* dir, uchar*& raw_data,
     *nImgs = nValidImgs;
 
   // ask for enough memory for the texels and make sure we got it before proceeding
-  uint n = width*height*sizeof(char);
+  ulong n = width*height*sizeof(char);
   raw_data = new uchar[n*(*nImgs)];
 
   printf("[PixelData] Loading %d images from directory %s, width=%d, height=%d\n", *nImgs, dir, width, height);
-  int d = 0;
-  for(int iImage = 0; d < *nImgs; iImage++)
-    {
-      string image = files[iImage];
-
-      // Load image in black and white
-      // Do no handle 3d cubes in color for now !
-      IplImage* img_slice = cvLoadImage(image.c_str(),0);
-
-      if(!img_slice)
-        continue;
-
-      if(img_slice->width != width || img_slice->height != height)
-        {
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvCvtColor(img_slice,gray_img,CV_RGB2GRAY);
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(gray_img,img);
-              cvReleaseImage(&gray_img);
-            }
-          else
-            {
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(img_slice,img);
-            }
-
-          memcpy(raw_data+(d*n),img->imageData,n);
-          cvReleaseImage(&img);
-          cvReleaseImage(&img_slice);
-        }
-      else
-        {
-          img = img_slice;
-
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              // FIXME
-              printf("[Slice3d] img_slice->nChannels %d\n", img_slice->nChannels);
-              exit(-1);
-            }
-
-          if(img->widthStep != img->width)
-            {
-              int i = 0;
-              for(int y = 0; y < img->height ; y++)
-                for(int x = 0; x < img->width ; x++)
-                  {
-                    raw_data[d*n+i] = ((uchar*)(img->imageData + img->widthStep*y))[x*img->nChannels];
-                    i++;
-                  }
-            }
-          else
-            memcpy(raw_data+(d*n),img->imageData,n);
-
-          cvReleaseImage(&img);
-        }
-
-      d++;
-    }
+  decodeSlices(imageFiles, *nImgs, width, height, raw_data);
 }
 
 
@@ -1114,16 +1601,20 @@ bool Slice3d::importData(const char* filename,
   if(ext == "nrrd" || ext == "mha")
     {
       printf("[Slice3d] Import NRRD/MHA Cube\n");
+      // uncompressed uchar cubes are read directly into raw_data
+      if(ext == "mha" ||
+         !importRawNRRDCube(filename, raw_data, width, height, depth)) {
 #ifdef USE_ITK
-      importCube(filename,
-                 raw_data,
-                 width,
-                 height,
-                 depth);
+        importCube(filename,
+                   raw_data,
+                   width,
+                   height,
+                   depth);
 #else
-      printf("[Slice3d] Error can not import NRRD Cube without ITK\n");
-      return false;
+        printf("[Slice3d] Error can not import NRRD Cube without ITK\n");
+        return false;
 #endif
+      }
     }
   else
     {
@@ -1184,9 +1675,34 @@ bool Slice3d::importData(const char* filename,
 	      depth = idepth;
 	    }
 
-	  ifstream ifs(filename,ios::binary);
 	  ulong n = ((ulong)width)*height*depth*sizeof(char);
 
+#ifndef _WIN32
+	  if(MMAP_RAW_DATA)
+	    {
+	      // private mapping : in-place modifications (e.g. rescaleRawData)
+	      // are not written back to the file.
+	      int fd = open(filename, O_RDONLY);
+	      struct stat st;
+	      if(fd != -1 && fstat(fd, &st) == 0 && (ulong)st.st_size >= n)
+		{
+		  void* data = mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		  if(data != MAP_FAILED)
+		    {
+		      close(fd);
+		      PRINT_MESSAGE("[Slice3d] Mapped %s in memory\n", filename);
+		      raw_data = (uchar*)data;
+		      mapped_size = n;
+		      return true;
+		    }
+		}
+	      if(fd != -1)
+		close(fd);
+	      printf("[Slice3d] Failed to map %s in memory. Reading file instead\n", filename);
+	    }
+#endif
+
+	  ifstream ifs(filename,ios::binary);
 	  raw_data = new uchar[n];
 	  ifs.read((char*)raw_data,n);
 	  ifs.close();
@@ -1937,7 +2453,7 @@ void Slice3d::resize(sizeSliceType w, sizeSliceType h, sizeSliceType d, map<sidT
   depth = d;
   sliceSize = new_sliceSize;
 
-  delete[] raw_data;
+  freeRawData();
   raw_data = new_raw_data;
 
   createIndexingStructures(new_klabels, true);
@@ -1952,6 +2468,176 @@ void Slice3d::resize(sizeSliceType w, sizeSliceType h, sizeSliceType d, map<sidT
 #endif
 }
 
+Slice3d* Slice3d::extractROI(const node& start, const node& end, int nHaloLayers,
+                             vector<sidType>& sid_mapping,
+                             vector<bool>& isCoreSupernode)
+{
+#ifndef USE_REVERSE_INDEXING
+  printf("[Slice3d] USE_REVERSE_INDEXING has to be defined to extract a region of interest\n");
+  exit(-1);
+#endif
+
+  // collect supernodes intersecting the region of interest.
+  // The value indicates if the supernode belongs to the region (true) or to
+  // the halo (false).
+  map<sidType, bool> roiSupernodes;
+  const int x0 = max(0, (int)start.x);
+  const int y0 = max(0, (int)start.y);
+  const int z0 = max(0, (int)start.z);
+  const int x1 = min((int)width, (int)end.x);
+  const int y1 = min((int)height, (int)end.y);
+  const int z1 = min((int)depth, (int)end.z);
+  sidType previousSid = -1;
+  for(int z = z0; z < z1; ++z) {
+    for(int y = y0; y < y1; ++y) {
+      const sidType* ptrLabels = klabels[z] + y*width;
+      for(int x = x0; x < x1; ++x) {
+        // consecutive voxels often belong to the same supernode
+        if(ptrLabels[x] != previousSid) {
+          previousSid = ptrLabels[x];
+          roiSupernodes[previousSid] = true;
+        }
+      }
+    }
+  }
+
+  // add halo
+  vector<supernode*> frontier;
+  for(map<sidType, bool>::iterator it = roiSupernodes.begin();
+      it != roiSupernodes.end(); ++it) {
+    frontier.push_back((*mSupervoxels)[it->first]);
+  }
+  for(int h = 0; h < nHaloLayers; ++h) {
+    vector<supernode*> nextFrontier;
+    for(vector<supernode*>::iterator it = frontier.begin();
+        it != frontier.end(); ++it) {
+      for(vector<supernode*>::iterator itN = (*it)->neighbors.begin();
+          itN != (*it)->neighbors.end(); ++itN) {
+        if(roiSupernodes.find((*itN)->id) == roiSupernodes.end()) {
+          roiSupernodes[(*itN)->id] = false;
+          nextFrontier.push_back(*itN);
+        }
+      }
+    }
+    frontier.swap(nextFrontier);
+  }
+
+  // supernodes are renumbered in increasing order of their global id
+  sid_mapping.clear();
+  isCoreSupernode.clear();
+  map<sidType, sidType> globalToLocal;
+  for(map<sidType, bool>::iterator it = roiSupernodes.begin();
+      it != roiSupernodes.end(); ++it) {
+    globalToLocal[it->first] = sid_mapping.size();
+    sid_mapping.push_back(it->first);
+    isCoreSupernode.push_back(it->second);
+  }
+  const sidType nROISupernodes = sid_mapping.size();
+
+  PRINT_MESSAGE("[Slice3d] Extracting region of interest (%d,%d,%d)-(%d,%d,%d) : %d supernodes (%d in halo)\n",
+                x0, y0, z0, x1, y1, z1, nROISupernodes,
+                nROISupernodes - (int)count(isCoreSupernode.begin(), isCoreSupernode.end(), true));
+
+  Slice3d* roi = new Slice3d(raw_data, width, height, depth, supernode_step,
+                             nChannels, loadNeighbors);
+  roi->cubeness = cubeness;
+  roi->nLabels = nLabels;
+  roi->inputDir = inputDir;
+  roi->max_distance = max_distance;
+  roi->minPercentToAssignLabel = minPercentToAssignLabel;
+  roi->includeOtherLabel = includeOtherLabel;
+  roi->supernodeLabelsLoaded = supernodeLabelsLoaded;
+  roi->mSupervoxels = new map<sidType, supernode*>;
+
+  for(sidType sid = 0; sid < nROISupernodes; ++sid) {
+    supernode* s = (*mSupervoxels)[sid_mapping[sid]];
+    supernode* rs = new supernode;
+    rs->id = sid;
+
+    // inference only needs the features and the edges of the halo so the
+    // geometry is only copied for supernodes intersecting the region.
+    if(isCoreSupernode[sid]) {
+      const vector<lineContainer*>& lines = s->getLines();
+      for(vector<lineContainer*>::const_iterator itL = lines.begin();
+          itL != lines.end(); ++itL) {
+        rs->addLine(new lineContainer(**itL));
+      }
+      const vector<node*>& nodes = s->getNodes();
+      for(vector<node*>::const_iterator itNode = nodes.begin();
+          itNode != nodes.end(); ++itNode) {
+        rs->addNode(new node(**itNode));
+      }
+    }
+
+    if(s->data) {
+      if(s->data->prob_estimates && nLabels > 0) {
+        rs->setData(s->data->label, nLabels, s->data->prob_estimates);
+      } else {
+        rs->setLabel(s->data->label);
+      }
+    }
+
+    (*roi->mSupervoxels)[sid] = rs;
+  }
+
+  // neighbors, features and edge indices
+  roi->nbEdges = 0;
+  roi->maxDegree = 0;
+  roi->feature_size = 0;
+  for(sidType sid = 0; sid < nROISupernodes; ++sid) {
+    const sidType gsid = sid_mapping[sid];
+    supernode* s = (*mSupervoxels)[gsid];
+    supernode* rs = (*roi->mSupervoxels)[sid];
+
+    for(vector<supernode*>::iterator itN = s->neighbors.begin();
+        itN != s->neighbors.end(); ++itN) {
+      map<sidType, sidType>::iterator itLocal = globalToLocal.find((*itN)->id);
+      if(itLocal == globalToLocal.end()) {
+        continue;
+      }
+      const sidType nsid = itLocal->second;
+      rs->neighbors.push_back((*roi->mSupervoxels)[nsid]);
+
+      map<ulong, int>::iterator itIdx = orientationIdxs.find(getDirectedEdgeId(gsid, (*itN)->id));
+      if(itIdx != orientationIdxs.end()) {
+        roi->orientationIdxs[roi->getDirectedEdgeId(sid, nsid)] = itIdx->second;
+      }
+
+      // undirected quantities are set once
+      if(sid > nsid) {
+        continue;
+      }
+      ++roi->nbEdges;
+      itIdx = gradientIdxs.find(getEdgeId(gsid, (*itN)->id));
+      if(itIdx != gradientIdxs.end()) {
+        roi->gradientIdxs[roi->getEdgeId(sid, nsid)] = itIdx->second;
+      }
+      itIdx = distanceIdxs.find(getEdgeId(gsid, (*itN)->id));
+      if(itIdx != distanceIdxs.end()) {
+        roi->distanceIdxs[roi->getEdgeId(sid, nsid)] = itIdx->second;
+      }
+    }
+
+    if(roi->maxDegree < (int)rs->neighbors.size()) {
+      roi->maxDegree = rs->neighbors.size();
+    }
+
+    map<sidType, osvm_node*>::iterator itF = features.find(gsid);
+    if(itF != features.end()) {
+      int fvSize = 0;
+      while(itF->second[fvSize].index != -1) {
+        ++fvSize;
+      }
+      osvm_node* n = new osvm_node[fvSize + 1];
+      memcpy(n, itF->second, (fvSize + 1)*sizeof(osvm_node));
+      roi->features[sid] = n;
+      roi->feature_size = fvSize;
+    }
+  }
+
+  return roi;
+}
+
 void Slice3d::exportProbabilities(const char* filename, int nClasses,
                                   float* pbs)
 {
@@ -128,6 +128,47 @@ class Slice3d : public Slice_P
    */
   void createIndexingStructures(sidType** _klabels, bool force = false);
 
+  /**
+   * Write neighbors (and optionally the gradient, orientation and distance
+   * indices) to a binary graph cache. See Slice3d.cpp for the file layout.
+   */
+  void exportGraphCache(const char* filename, bool includeEdgeIndices,
+                        int nGradientLevels = 0, int nOrientations = 0,
+                        int nDistances = 0);
+
+  /**
+   * Compute supervoxelHash from the supervoxel labels (klabels[z] holds
+   * the labels of plane z)
+   */
+  void computeSupervoxelHash(sidType** _klabels);
+
+  /**
+   * Path of the binary graph cache used by createIndexingStructures
+   */
+  string getGraphCacheFilename();
+
+  /**
+   * Load neighbors from a binary graph cache.
+   * Returns false if the cache does not match the current volume and
+   * supervoxel parameters.
+   */
+  bool importNeighborsFromGraphCache(const char* filename);
+
+  /**
+   * Load gradient, orientation and distance indices from a binary graph
+   * cache. Returns false if the cache was created with different parameters.
+   */
+  bool importEdgeIndicesFromGraphCache(const char* filename, int nGradientLevels,
+                                       int nOrientations, int nDistances);
+
+  /**
+   * Precompute gradient, orientation and distance indices (nDistances = 0
+   * if distances are not used). Indices are loaded from the graph cache if
+   * it was created with the same parameters, otherwise they are computed
+   * and added to the cache.
+   */
+  void precomputeEdgeIndices(int nGradientLevels, int nOrientations, int nDistances);
+
   void createOverlayAnnotationImage(const char* filename, int imageId);
 
   void createReverseIndexing(sidType**& _klabels);
@@ -160,6 +201,13 @@ class Slice3d : public Slice_P
 
   void importSupervoxelsFromBuffer(const uint* buffer, int _width, int _height, int _depth);
 
+  /**
+   * Import supervoxels from a buffer of width*height*depth labels.
+   * The slice takes ownership of the buffer (allocated with new[]) and uses
+   * it in place instead of copying it.
+   */
+  void importSupervoxelsFromBuffer(sidType* buffer, int _width, int _height, int _depth);
+
   void init();
 
   /**
@@ -281,6 +329,23 @@ class Slice3d : public Slice_P
   void resize(sizeSliceType w, sizeSliceType h, sizeSliceType d,
               map<sidType, sidType>* sid_mapping);
 
+  /**
+   * Create a slice made of the supernodes intersecting the box [start, end[
+   * and of their neighbors up to nHaloLayers edges away.
+   * Supernodes are renumbered from 0 in increasing order of their global
+   * id so that pairwise terms keep the same orientation, and
+   * sid_mapping[local_sid] = global_sid. Precomputed features and edge
+   * indices are copied, supervoxels are not recomputed.
+   * isCoreSupernode[local_sid] is false for supernodes only added as halo.
+   * Halo supernodes have no geometry (no lines or nodes), only features,
+   * labels and edges.
+   * Raw data is shared with this slice and getSid can not be called on the
+   * returned slice. Caller is responsible for freeing memory.
+   */
+  Slice3d* extractROI(const node& start, const node& end, int nHaloLayers,
+                      vector<sidType>& sid_mapping,
+                      vector<bool>& isCoreSupernode);
+
   void generateSupervoxels(const double _cubeness = 20);
 
   int getIntensity(int x, int y, int z = 0);
@@ -338,6 +403,11 @@ class Slice3d : public Slice_P
 
   void setDeleteRawData(bool _val) { delete_raw_data = _val; }
 
+  /**
+   * Free raw_data (allocated with new or mapped with mmap)
+   */
+  void freeRawData();
+
   // no need to free memory as functions in Supernode will not reallocate memory.
   void unloadSupernodeLabels() { supernodeLabelsLoaded = false; }
 
@@ -353,6 +423,11 @@ class Slice3d : public Slice_P
   bool supernodeLabelsLoaded;
   bool loadNeighbors;
   bool delete_raw_data;
+  // size of raw_data if it was mapped with mmap (0 otherwise)
+  ulong mapped_size;
+  // hash of the supervoxel labels used to validate the graph cache,
+  // computed once by createIndexingStructures
+  ulong supervoxelHash;
   int start_x;
   int start_y;
   int start_z;
@@ -19,6 +19,9 @@
 #include "utils.h"
 #include "globalsE.h"
 #include "oSVM.h"
+#include "SupernodeGlcm.h"
+#include "SupernodeShape.h"
+#include "SupernodeStats.h"
 
 #include <fstream>
 #include <deque>
@@ -28,8 +31,15 @@
 
 ulong Slice_P::generateId()
 {
+  // slices can be created concurrently (e.g. regions of interest extracted
+  // by the workers of predict_server)
   static ulong id = 0;
-  return id++;
+  ulong newId;
+#ifdef WITH_OPENMP
+#pragma omp critical(sliceId)
+#endif
+  newId = id++;
+  return newId;
 }
 
 //------------------------------------------------------------------------------
@@ -38,6 +48,7 @@ Slice_P::Slice_P()
 {
   max_distance = -1;
   id = Slice_P::generateId();
+  shape = 0;
 }
 
 Slice_P::~Slice_P()
@@ -46,6 +57,21 @@ Slice_P::~Slice_P()
       it != features.end(); ++it) {
     delete[] it->second;
   }
+  for(vector<SupernodeStats*>::iterator it = intensityStats.begin();
+      it != intensityStats.end(); ++it) {
+    delete *it;
+  }
+  for(map<pair<int, int>, uchar*>::iterator it = binIndexVolumes.begin();
+      it != binIndexVolumes.end(); ++it) {
+    delete[] it->second;
+  }
+  for(vector<SupernodeGlcm*>::iterator it = glcms.begin();
+      it != glcms.end(); ++it) {
+    delete *it;
+  }
+  if(shape) {
+    delete shape;
+  }
 }
 
 ulong Slice_P::getId()
@@ -58,6 +84,118 @@ ulong Slice_P::getId()
   }
 }
 
+SupernodeStats* Slice_P::getIntensityStats(int flags, int nBins, int maxValue)
+{
+  SupernodeStats* stats = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(intensityStats)
+#endif
+  {
+    for(vector<SupernodeStats*>::iterator it = intensityStats.begin();
+        it != intensityStats.end(); ++it) {
+      if((*it)->hasQuantities(flags, nBins, maxValue)) {
+        stats = *it;
+        break;
+      }
+    }
+
+    if(stats == 0) {
+      // previous instances are kept as they might still be used
+      int allFlags = flags | SupernodeStats::getRequestedFlags();
+      if(!(flags & STATS_HISTOGRAM) && (allFlags & STATS_HISTOGRAM)) {
+        nBins = SupernodeStats::getRequestedBins();
+        maxValue = SupernodeStats::getRequestedMaxValue();
+      }
+      stats = new SupernodeStats(allFlags, nBins, maxValue);
+      stats->compute(this);
+      intensityStats.push_back(stats);
+    }
+  }
+  return stats;
+}
+
+const uchar* Slice_P::getBinIndexVolume(int nBins, int maxValue)
+{
+  uchar* binIdxs = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(binIndexVolumes)
+#endif
+  {
+    pair<int, int> key(nBins, maxValue);
+    map<pair<int, int>, uchar*>::iterator itV = binIndexVolumes.find(key);
+    if(itV != binIndexVolumes.end()) {
+      binIdxs = itV->second;
+    } else {
+      const ulong width = getWidth();
+      const ulong size_slice = width*getHeight();
+      const long depth = getDepth();
+      binIdxs = new uchar[size_slice*depth];
+      if(getType() == SLICEP_SLICE3D) {
+        const uchar* raw_data = getRawData();
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+        for(long z = 0; z < depth; ++z) {
+          SupernodeStats::computeBinIndices(raw_data + z*size_slice, size_slice,
+                                            nBins, maxValue, binIdxs + z*size_slice);
+        }
+      } else {
+        // rows of 2d images can be padded and have several channels
+        uchar* intensities = new uchar[size_slice];
+        for(ulong y = 0; y < (ulong)getHeight(); ++y) {
+          for(ulong x = 0; x < width; ++x) {
+            intensities[y*width + x] = (uchar)getIntensity(x, y, 0);
+          }
+        }
+        SupernodeStats::computeBinIndices(intensities, size_slice,
+                                          nBins, maxValue, binIdxs);
+        delete[] intensities;
+      }
+      binIndexVolumes[key] = binIdxs;
+    }
+  }
+  return binIdxs;
+}
+
+SupernodeGlcm* Slice_P::getGlcm(int nLevels, int maxValue)
+{
+  SupernodeGlcm* glcm = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(glcms)
+#endif
+  {
+    for(vector<SupernodeGlcm*>::iterator it = glcms.begin();
+        it != glcms.end(); ++it) {
+      if((*it)->getNbLevels() == nLevels && (*it)->getMaxValue() == maxValue) {
+        glcm = *it;
+        break;
+      }
+    }
+
+    if(glcm == 0) {
+      glcm = new SupernodeGlcm(nLevels, maxValue);
+      glcm->compute(this);
+      glcms.push_back(glcm);
+    }
+  }
+  return glcm;
+}
+
+SupernodeShape* Slice_P::getShape()
+{
+#ifdef WITH_OPENMP
+#pragma omp critical(supernodeShape)
+#endif
+  {
+    if(shape == 0) {
+      SupernodeShape* _shape = new SupernodeShape;
+      _shape->compute(this);
+      shape = _shape;
+    }
+  }
+  return shape;
+}
+
 labelType Slice_P::getSupernodeLabel(sidType sid)
 {
   supernode* s = getSupernode(sid);
@@ -360,6 +498,18 @@ void Slice_P::precomputeFeatures(Feature* feature)
 
     const map<sidType, supernode* >& _supernodes = getSupernodes();
     printf("[Slice_P] precomputing features for %ld nodes\n", _supernodes.size());
+
+    // features providing a batched (parallel) computation fill a matrix
+    // first. Vectors including the neighbors are still computed one by one.
+    float* matrix = 0;
+    if(fvSize == feature->getSizeFeatureVectorForOneSupernode()) {
+      matrix = new float[getNbSupernodes()*fvSize];
+      if(!feature->getFeatureMatrix(this, matrix)) {
+        delete[] matrix;
+        matrix = 0;
+      }
+    }
+
     for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
         it != _supernodes.end(); it++) {
       //printf("-");
@@ -369,7 +519,13 @@ void Slice_P::precomputeFeatures(Feature* feature)
         n[i].index = i+1;
       n[i].index = -1;
 
-      feature->getFeatureVector(n, this, it->first);
+      if(matrix) {
+        const float* row = matrix + (ulong)it->first*fvSize;
+        for(i = 0; i < fvSize; i++)
+          n[i].value = row[i];
+      } else {
+        feature->getFeatureVector(n, this, it->first);
+      }
 
 #if USE_SPARSE_VECTORS
       osvm_node* n_sparse = 0;
@@ -380,6 +536,9 @@ void Slice_P::precomputeFeatures(Feature* feature)
       features[it->first] = n;
 #endif
     }
+    if(matrix) {
+      delete[] matrix;
+    }
   } else {
     printf("[Slice_P]::precomputeFeatures : Features were already precomputed\n");
   }
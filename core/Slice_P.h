@@ -40,6 +40,9 @@ enum eSlicePType
   };
 
 class Feature;
+class SupernodeGlcm;
+class SupernodeShape;
+class SupernodeStats;
 
 //------------------------------------------------------------------------------
 
@@ -187,6 +190,34 @@ class Slice_P
 
   inline int getFeatureSize() { return feature_size; }
 
+  /**
+   * Returns intensity statistics for all the supernodes. Statistics are
+   * computed in one pass the first time this function is called, including
+   * all the quantities registered with SupernodeStats::request.
+   * @param flags combination of STATS_MOMENTS, STATS_MINMAX, STATS_HISTOGRAM
+   */
+  SupernodeStats* getIntensityStats(int flags, int nBins = 0, int maxValue = 255);
+
+  /**
+   * Returns a volume of the same size as the slice containing the bin index
+   * of every voxel for a histogram of nBins bins covering [0, maxValue].
+   * The volume is computed once and shared by all the features.
+   */
+  const uchar* getBinIndexVolume(int nBins, int maxValue);
+
+  /**
+   * Returns the gray level co-occurrence matrices of all the supernodes
+   * (computed the first time this function is called).
+   * @param nLevels number of quantized intensity levels
+   */
+  SupernodeGlcm* getGlcm(int nLevels, int maxValue = 255);
+
+  /**
+   * Returns the geometry (moments, bounding box, surface) of all the
+   * supernodes (computed the first time this function is called).
+   */
+  SupernodeShape* getShape();
+
 #if USE_SPARSE_VECTORS
   inline int getFeatureSize(int id) { return feature_sizes[id]; }
 #endif
@@ -329,6 +360,19 @@ class Slice_P
   map<ulong, int> orientationIdxs;
   map<ulong, int> distanceIdxs;
 
+  // statistics computed by getIntensityStats
+  vector<SupernodeStats*> intensityStats;
+
+  // bin index volumes computed by getBinIndexVolume, indexed by
+  // (number of bins, maximum value)
+  map<pair<int, int>, uchar*> binIndexVolumes;
+
+  // co-occurrence matrices computed by getGlcm
+  vector<SupernodeGlcm*> glcms;
+
+  // geometry computed by getShape
+  SupernodeShape* shape;
+
  public:
   string inputDir;
 
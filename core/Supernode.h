@@ -315,6 +315,13 @@ class supernode
    */
   nodeIterator getIterator() { return nodeIterator(&lines, &nodes); }
 
+  /**
+   * Run-length encoded lines (empty if nodes are stored individually)
+   */
+  const vector<lineContainer*>& getLines() { return lines; }
+
+  const vector<node*>& getNodes() { return nodes; }
+
  private:
   vector<lineContainer*> lines;
   vector<node*> nodes;
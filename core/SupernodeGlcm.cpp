@@ -0,0 +1,291 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "SupernodeGlcm.h"
+
+#include <algorithm>
+#include <math.h>
+
+// SliceMe
+#include "Slice_P.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+// number of planes processed by each task
+#define GLCM_SLAB_DEPTH 4
+
+//------------------------------------------------------------------------------
+
+SupernodeGlcm::SupernodeGlcm(int _nLevels, int _maxValue)
+{
+  nLevels = _nLevels;
+  maxValue = _maxValue;
+  nSupernodes = 0;
+  matrices = 0;
+  rows = 0;
+}
+
+SupernodeGlcm::~SupernodeGlcm()
+{
+  if(matrices) {
+    delete[] matrices;
+  }
+}
+
+void SupernodeGlcm::buildRowIndex(Slice_P* slice)
+{
+  rows = new vector<GlcmRun>[depth*height];
+  GlcmRun run;
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    run.sid = it->first;
+
+    const vector<lineContainer*>& lines = it->second->getLines();
+    for(vector<lineContainer*>::const_iterator itL = lines.begin();
+        itL != lines.end(); ++itL) {
+      run.x = (*itL)->coord.x;
+      run.length = (*itL)->length;
+      rows[(*itL)->coord.z*height + (*itL)->coord.y].push_back(run);
+    }
+
+    const vector<node*>& nodes = it->second->getNodes();
+    for(vector<node*>::const_iterator itN = nodes.begin();
+        itN != nodes.end(); ++itN) {
+      run.x = (*itN)->x;
+      run.length = 1;
+      rows[(*itN)->z*height + (*itN)->y].push_back(run);
+    }
+  }
+
+  for(long r = 0; r < depth*height; ++r) {
+    sort(rows[r].begin(), rows[r].end(), compareRuns);
+  }
+}
+
+bool SupernodeGlcm::compareRuns(const GlcmRun& a, const GlcmRun& b)
+{
+  return a.x < b.x;
+}
+
+void SupernodeGlcm::accumulate(uint* matrix, const uchar* binIdxs, const GlcmRun& run,
+                               long y, long z, int dx, int dy, int dz)
+{
+  const long ty = y + dy;
+  const long tz = z + dz;
+  if(ty < 0 || ty >= height || tz >= depth) {
+    return;
+  }
+
+  // interval covered by the neighbors of the run
+  const long start = run.x + dx;
+  const long end = start + run.length;
+
+  // runs of a row are disjoint, so they are also sorted by end : look for
+  // the first run ending after start
+  const vector<GlcmRun>& target = rows[tz*height + ty];
+  long lo = 0;
+  long hi = target.size();
+  while(lo < hi) {
+    long mid = (lo + hi)/2;
+    if(target[mid].x + target[mid].length <= start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  const ulong sliceSize = width*height;
+  const uchar* srcBins = binIdxs + z*sliceSize + y*width;
+  const uchar* dstBins = binIdxs + tz*sliceSize + ty*width;
+  for(long t = lo; t < (long)target.size() && target[t].x < end; ++t) {
+    if(target[t].sid != run.sid) {
+      continue;
+    }
+    long o0 = max(start, (long)target[t].x);
+    long o1 = min(end, (long)(target[t].x + target[t].length));
+    for(long u = o0; u < o1; ++u) {
+      int a = srcBins[u - dx];
+      int b = dstBins[u];
+      ++matrix[a*nLevels + b];
+      ++matrix[b*nLevels + a];
+    }
+  }
+}
+
+void SupernodeGlcm::compute(Slice_P* slice)
+{
+  width = slice->getWidth();
+  height = slice->getHeight();
+  depth = slice->getDepth();
+  nSupernodes = slice->getNbSupernodes();
+
+  const uchar* binIdxs = slice->getBinIndexVolume(nLevels, maxValue);
+  buildRowIndex(slice);
+
+  const ulong matrixSize = nLevels*nLevels;
+  const ulong totalSize = nSupernodes*matrixSize;
+  matrices = new uint[totalSize];
+  for(ulong i = 0; i < totalSize; ++i) {
+    matrices[i] = 0;
+  }
+
+  // 13 forward offsets. Each pair is counted in both orders so that the
+  // result is the same as visiting the full neighborhood of every voxel.
+  const int nOffsets = 13;
+  int offsets[nOffsets][3];
+  int o = 0;
+  for(int dy = -1; dy <= 1; ++dy) {
+    for(int dx = -1; dx <= 1; ++dx) {
+      offsets[o][0] = dx;
+      offsets[o][1] = dy;
+      offsets[o][2] = 1;
+      ++o;
+    }
+  }
+  for(int dx = -1; dx <= 1; ++dx) {
+    offsets[o][0] = dx;
+    offsets[o][1] = 1;
+    offsets[o][2] = 0;
+    ++o;
+  }
+  offsets[o][0] = 1;
+  offsets[o][1] = 0;
+  offsets[o][2] = 0;
+
+  const long nSlabs = (depth + GLCM_SLAB_DEPTH - 1)/GLCM_SLAB_DEPTH;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    // Each slab is accumulated in a buffer holding only the matrices of the
+    // supernodes it contains (slot gives their position, -1 if absent),
+    // which is then added to the final matrices. Only supernodes crossing
+    // a slab boundary are written by several threads.
+    vector<int> slot(nSupernodes, -1);
+    vector<sidType> slabSids;
+    vector<uint> local;
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+    for(long s = 0; s < nSlabs; ++s) {
+      long z0 = s*GLCM_SLAB_DEPTH;
+      long z1 = min((s+1)*GLCM_SLAB_DEPTH, depth);
+      for(long r = z0*height; r < z1*height; ++r) {
+        for(vector<GlcmRun>::const_iterator itR = rows[r].begin();
+            itR != rows[r].end(); ++itR) {
+          if(slot[itR->sid] == -1) {
+            slot[itR->sid] = (int)slabSids.size();
+            slabSids.push_back(itR->sid);
+          }
+        }
+      }
+      local.assign(slabSids.size()*matrixSize, 0);
+
+      for(long z = z0; z < z1; ++z) {
+        for(long y = 0; y < height; ++y) {
+          const vector<GlcmRun>& row = rows[z*height + y];
+          for(vector<GlcmRun>::const_iterator itR = row.begin();
+              itR != row.end(); ++itR) {
+            uint* m = &local[(ulong)slot[itR->sid]*matrixSize];
+            for(int i = 0; i < nOffsets; ++i) {
+              accumulate(m, binIdxs, *itR, y, z,
+                         offsets[i][0], offsets[i][1], offsets[i][2]);
+            }
+          }
+        }
+      }
+
+      for(ulong k = 0; k < slabSids.size(); ++k) {
+        uint* dst = matrices + (ulong)slabSids[k]*matrixSize;
+        const uint* src = &local[k*matrixSize];
+        for(ulong i = 0; i < matrixSize; ++i) {
+          if(src[i] == 0) {
+            continue;
+          }
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+          dst[i] += src[i];
+        }
+        slot[slabSids[k]] = -1;
+      }
+      slabSids.clear();
+    }
+  }
+
+  delete[] rows;
+  rows = 0;
+}
+
+void SupernodeGlcm::getHaralickFeatures(sidType sid, double* features)
+{
+  const uint* m = getMatrix(sid);
+  double total = 0;
+  for(int i = 0; i < nLevels*nLevels; ++i) {
+    total += m[i];
+  }
+  for(int f = 0; f < GLCM_N_HARALICK; ++f) {
+    features[f] = 0;
+  }
+  if(total == 0) {
+    return;
+  }
+
+  // the matrix is symmetric so both marginals are equal
+  double mean = 0;
+  double var = 0;
+  for(int i = 0; i < nLevels; ++i) {
+    for(int j = 0; j < nLevels; ++j) {
+      mean += i*m[i*nLevels + j];
+    }
+  }
+  mean /= total;
+  for(int i = 0; i < nLevels; ++i) {
+    for(int j = 0; j < nLevels; ++j) {
+      var += (i-mean)*(i-mean)*m[i*nLevels + j];
+    }
+  }
+  var /= total;
+
+  double energy = 0;
+  double contrast = 0;
+  double homogeneity = 0;
+  double entropy = 0;
+  double correlation = 0;
+  for(int i = 0; i < nLevels; ++i) {
+    for(int j = 0; j < nLevels; ++j) {
+      double p = m[i*nLevels + j]/total;
+      if(p == 0) {
+        continue;
+      }
+      energy += p*p;
+      contrast += (i-j)*(i-j)*p;
+      homogeneity += p/(1.0 + abs(i-j));
+      entropy -= p*log(p);
+      correlation += (i-mean)*(j-mean)*p;
+    }
+  }
+
+  features[0] = energy;
+  features[1] = contrast;
+  features[2] = homogeneity;
+  features[3] = entropy;
+  features[4] = (var > 0)?correlation/var:0;
+}
@@ -0,0 +1,116 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SUPERNODE_GLCM_H
+#define SUPERNODE_GLCM_H
+
+// SliceMe
+#include "globalsE.h"
+#include "Supernode.h"
+
+#include <vector>
+
+class Slice_P;
+
+//-------------------------------------------------------------------------TYPES
+
+// number of statistics returned by getHaralickFeatures
+#define GLCM_N_HARALICK 5
+
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Gray level co-occurrence matrices of all the supernodes of a slice.
+ * Pairs of neighboring voxels (26-neighborhood in 3d, 8-neighborhood in 2d)
+ * belonging to the same supernode are counted in both orders.
+ *
+ * Intensities are quantized once (Slice_P::getBinIndexVolume) and the
+ * volume is swept plane by plane using the runs of the supernodes, so no
+ * per-voxel lookup of the supernode id is needed. Slabs of planes are processed
+ * in parallel. Each slab is accumulated in a buffer holding only the
+ * matrices of its supernodes, which is then added atomically to the final
+ * matrices, so the extra memory does not grow with the number of threads
+ * times the number of supernodes of the slice.
+ *
+ * Features should call Slice_P::getGlcm so that the matrices are shared.
+ */
+class SupernodeGlcm
+{
+ public:
+
+  /**
+   * @param _nLevels number of quantized intensity levels
+   * @param _maxValue intensity corresponding to the last level
+   */
+  SupernodeGlcm(int _nLevels, int _maxValue = 255);
+
+  ~SupernodeGlcm();
+
+  void compute(Slice_P* slice);
+
+  /**
+   * Statistics of the normalized matrix : energy, contrast, homogeneity,
+   * entropy and correlation.
+   */
+  void getHaralickFeatures(sidType sid, double* features);
+
+  /**
+   * nLevels*nLevels co-occurrence counts
+   */
+  const uint* getMatrix(sidType sid) { return matrices + (ulong)sid*nLevels*nLevels; }
+
+  int getMaxValue() { return maxValue; }
+
+  int getNbLevels() { return nLevels; }
+
+ private:
+
+  /**
+   * Run of voxels along the x axis
+   */
+  struct GlcmRun
+  {
+    int x;
+    int length;
+    sidType sid;
+  };
+
+  void buildRowIndex(Slice_P* slice);
+
+  static bool compareRuns(const GlcmRun& a, const GlcmRun& b);
+
+  /**
+   * Count the pairs made of a voxel of the given run (row y of plane z) and
+   * its neighbor at offset (dx, dy, dz) in matrix (matrix of run.sid).
+   */
+  void accumulate(uint* matrix, const uchar* binIdxs, const GlcmRun& run,
+                  long y, long z, int dx, int dy, int dz);
+
+  int nLevels;
+  int maxValue;
+  ulong nSupernodes;
+
+  long width;
+  long height;
+  long depth;
+
+  // nSupernodes*nLevels*nLevels
+  uint* matrices;
+
+  // runs sorted along x for each row (z*height + y)
+  std::vector<GlcmRun>* rows;
+};
+
+#endif // SUPERNODE_GLCM_H
@@ -0,0 +1,279 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "SupernodeShape.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+
+// SliceMe
+#include "Slice_P.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+SupernodeShape::SupernodeShape()
+{
+  nSupernodes = 0;
+  volumes = 0;
+  surfaces = 0;
+  moments = 0;
+  boundingBoxes = 0;
+}
+
+SupernodeShape::~SupernodeShape()
+{
+  if(volumes) {
+    delete[] volumes;
+    delete[] surfaces;
+    delete[] moments;
+    delete[] boundingBoxes;
+  }
+}
+
+bool SupernodeShape::compareRuns(const ShapeRun& a, const ShapeRun& b)
+{
+  if(a.z != b.z) {
+    return a.z < b.z;
+  }
+  if(a.y != b.y) {
+    return a.y < b.y;
+  }
+  return a.x < b.x;
+}
+
+ulong SupernodeShape::getOverlap(const vector<ShapeRun>& runs,
+                                 const ShapeRun& run, int y, int z)
+{
+  ShapeRun key;
+  key.x = run.x;
+  key.y = y;
+  key.z = z;
+  key.length = 0;
+  vector<ShapeRun>::const_iterator it = lower_bound(runs.begin(), runs.end(),
+                                                    key, compareRuns);
+  // runs are merged so at most one run of the row starts before run.x
+  if(it != runs.begin()) {
+    vector<ShapeRun>::const_iterator itP = it - 1;
+    if(itP->y == y && itP->z == z) {
+      it = itP;
+    }
+  }
+
+  const int end = run.x + run.length;
+  ulong overlap = 0;
+  for(; it != runs.end() && it->y == y && it->z == z && it->x < end; ++it) {
+    const int a = max(it->x, run.x);
+    const int b = min(it->x + it->length, end);
+    if(b > a) {
+      overlap += b - a;
+    }
+  }
+  return overlap;
+}
+
+void SupernodeShape::computeSupernode(supernode* s, bool volume)
+{
+  const sidType sid = s->id;
+
+  vector<ShapeRun> runs;
+  ShapeRun run;
+  const vector<lineContainer*>& lines = s->getLines();
+  for(vector<lineContainer*>::const_iterator itL = lines.begin();
+      itL != lines.end(); ++itL) {
+    run.x = (*itL)->coord.x;
+    run.y = (*itL)->coord.y;
+    run.z = (*itL)->coord.z;
+    run.length = (*itL)->length;
+    runs.push_back(run);
+  }
+  const vector<node*>& nodes = s->getNodes();
+  for(vector<node*>::const_iterator itN = nodes.begin();
+      itN != nodes.end(); ++itN) {
+    run.x = (*itN)->x;
+    run.y = (*itN)->y;
+    run.z = (*itN)->z;
+    run.length = 1;
+    runs.push_back(run);
+  }
+
+  // merge adjacent runs so that faces along x are only found at both ends
+  sort(runs.begin(), runs.end(), compareRuns);
+  ulong nRuns = 0;
+  for(ulong r = 0; r < runs.size(); ++r) {
+    if(nRuns > 0) {
+      ShapeRun& last = runs[nRuns-1];
+      if(last.z == runs[r].z && last.y == runs[r].y &&
+         last.x + last.length >= runs[r].x) {
+        last.length = max(last.length, runs[r].x + runs[r].length - last.x);
+        continue;
+      }
+    }
+    runs[nRuns++] = runs[r];
+  }
+  runs.resize(nRuns);
+
+  ulong vol = 0;
+  ulong surface = 0;
+  double* m = moments + sid*9;
+  int* bb = boundingBoxes + sid*6;
+  for(int i = 0; i < 9; ++i) {
+    m[i] = 0;
+  }
+  if(runs.empty()) {
+    for(int i = 0; i < 6; ++i) {
+      bb[i] = 0;
+    }
+  } else {
+    bb[0] = bb[1] = bb[2] = INT_MAX;
+    bb[3] = bb[4] = bb[5] = INT_MIN;
+  }
+
+  for(vector<ShapeRun>::const_iterator it = runs.begin(); it != runs.end(); ++it) {
+    // closed forms of the sums of x and x^2 over the run
+    const double l = it->length;
+    const double x0 = it->x;
+    const double y = it->y;
+    const double z = it->z;
+    const double sx = l*x0 + l*(l-1)/2.0;
+    const double sxx = l*x0*x0 + x0*l*(l-1) + (l-1)*l*(2*l-1)/6.0;
+    m[0] += sx;
+    m[1] += l*y;
+    m[2] += l*z;
+    m[3] += sxx;
+    m[4] += l*y*y;
+    m[5] += l*z*z;
+    m[6] += sx*y;
+    m[7] += sx*z;
+    m[8] += l*y*z;
+    vol += it->length;
+
+    bb[0] = min(bb[0], it->x);
+    bb[1] = min(bb[1], it->y);
+    bb[2] = min(bb[2], it->z);
+    bb[3] = max(bb[3], it->x + it->length - 1);
+    bb[4] = max(bb[4], it->y);
+    bb[5] = max(bb[5], it->z);
+
+    surface += 2;
+    surface += 2*it->length - getOverlap(runs, *it, it->y - 1, it->z)
+      - getOverlap(runs, *it, it->y + 1, it->z);
+    if(volume) {
+      surface += 2*it->length - getOverlap(runs, *it, it->y, it->z - 1)
+        - getOverlap(runs, *it, it->y, it->z + 1);
+    }
+  }
+
+  volumes[sid] = vol;
+  surfaces[sid] = surface;
+}
+
+void SupernodeShape::compute(Slice_P* slice)
+{
+  nSupernodes = slice->getNbSupernodes();
+  volumes = new ulong[nSupernodes];
+  surfaces = new ulong[nSupernodes];
+  moments = new double[nSupernodes*9];
+  boundingBoxes = new int[nSupernodes*6];
+
+  const bool volume = slice->getDepth() > 1;
+  vector<supernode*> supernodes;
+  supernodes.reserve(nSupernodes);
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    supernodes.push_back(it->second);
+  }
+
+  PRINT_MESSAGE("[SupernodeShape] Computing geometry of %ld supernodes\n", nSupernodes);
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for(long i = 0; i < (long)supernodes.size(); ++i) {
+    computeSupernode(supernodes[i], volume);
+  }
+}
+
+void SupernodeShape::getCentroid(sidType sid, double* centroid)
+{
+  const double* m = moments + (ulong)sid*9;
+  const double vol = volumes[sid];
+  for(int i = 0; i < 3; ++i) {
+    centroid[i] = (vol == 0)?0:m[i]/vol;
+  }
+}
+
+void SupernodeShape::getBoundingBox(sidType sid, int* bbMin, int* bbMax)
+{
+  const int* bb = boundingBoxes + (ulong)sid*6;
+  for(int i = 0; i < 3; ++i) {
+    bbMin[i] = bb[i];
+    bbMax[i] = bb[i+3];
+  }
+}
+
+void SupernodeShape::getCovarianceEigenValues(sidType sid, double* eigenValues)
+{
+  const double* m = moments + (ulong)sid*9;
+  const double vol = volumes[sid];
+  if(vol == 0) {
+    eigenValues[0] = eigenValues[1] = eigenValues[2] = 0;
+    return;
+  }
+  const double cx = m[0]/vol;
+  const double cy = m[1]/vol;
+  const double cz = m[2]/vol;
+  const double a11 = m[3]/vol - cx*cx;
+  const double a22 = m[4]/vol - cy*cy;
+  const double a33 = m[5]/vol - cz*cz;
+  const double a12 = m[6]/vol - cx*cy;
+  const double a13 = m[7]/vol - cx*cz;
+  const double a23 = m[8]/vol - cy*cz;
+
+  // closed form for symmetric 3x3 matrices
+  const double p1 = a12*a12 + a13*a13 + a23*a23;
+  const double q = (a11 + a22 + a33)/3.0;
+  const double p2 = (a11-q)*(a11-q) + (a22-q)*(a22-q) + (a33-q)*(a33-q) + 2.0*p1;
+  if(p2 < 1e-20) {
+    eigenValues[0] = eigenValues[1] = eigenValues[2] = q;
+    return;
+  }
+  const double p = sqrt(p2/6.0);
+  const double b11 = (a11-q)/p;
+  const double b22 = (a22-q)/p;
+  const double b33 = (a33-q)/p;
+  const double b12 = a12/p;
+  const double b13 = a13/p;
+  const double b23 = a23/p;
+  double r = 0.5*(b11*(b22*b33 - b23*b23) - b12*(b12*b33 - b23*b13) + b13*(b12*b23 - b22*b13));
+  r = (r < -1.0)?-1.0:((r > 1.0)?1.0:r);
+  const double phi = acos(r)/3.0;
+  eigenValues[0] = q + 2.0*p*cos(phi);
+  eigenValues[2] = q + 2.0*p*cos(phi + (2.0*M_PI/3.0));
+  eigenValues[1] = 3.0*q - eigenValues[0] - eigenValues[2];
+  for(int i = 0; i < 3; ++i) {
+    // rounding errors
+    if(eigenValues[i] < 0) {
+      eigenValues[i] = 0;
+    }
+  }
+}
@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SUPERNODE_SHAPE_H
+#define SUPERNODE_SHAPE_H
+
+// SliceMe
+#include "globalsE.h"
+#include "Supernode.h"
+
+#include <vector>
+
+class Slice_P;
+
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Geometry of all the supernodes of a slice : volume, first and second
+ * order moments of the voxel coordinates, bounding box and number of
+ * boundary faces (faces shared with a voxel that does not belong to the
+ * supernode or lying on the border of the volume). Faces along z are only
+ * counted for volumes with more than one plane, so 2d slices get their
+ * perimeter.
+ *
+ * Everything is computed from the runs of the supernodes (lineContainer
+ * and isolated nodes) without visiting individual voxels. The runs of each
+ * supernode are sorted and merged, and the faces along y and z are given
+ * by the overlap of the runs of adjacent rows. Supernodes are processed in
+ * parallel.
+ *
+ * Features should call Slice_P::getShape so that the geometry is shared.
+ */
+class SupernodeShape
+{
+ public:
+
+  SupernodeShape();
+
+  ~SupernodeShape();
+
+  void compute(Slice_P* slice);
+
+  /**
+   * Center of mass (x, y, z)
+   */
+  void getCentroid(sidType sid, double* centroid);
+
+  /**
+   * Eigenvalues of the covariance matrix of the voxel coordinates sorted
+   * in decreasing order.
+   */
+  void getCovarianceEigenValues(sidType sid, double* eigenValues);
+
+  /**
+   * Inclusive bounding box (x, y, z)
+   */
+  void getBoundingBox(sidType sid, int* bbMin, int* bbMax);
+
+  ulong getSurface(sidType sid) { return surfaces[sid]; }
+
+  ulong getVolume(sidType sid) { return volumes[sid]; }
+
+ private:
+
+  /**
+   * Run of voxels along the x axis
+   */
+  struct ShapeRun
+  {
+    int x;
+    int y;
+    int z;
+    int length;
+  };
+
+  static bool compareRuns(const ShapeRun& a, const ShapeRun& b);
+
+  /**
+   * Number of voxels of the run that are covered by the runs of the row
+   * (y, z). runs must be sorted.
+   */
+  static ulong getOverlap(const std::vector<ShapeRun>& runs,
+                          const ShapeRun& run, int y, int z);
+
+  void computeSupernode(supernode* s, bool volume);
+
+  ulong nSupernodes;
+
+  ulong* volumes;
+  ulong* surfaces;
+  // sums of x, y, z, xx, yy, zz, xy, xz, yz for each supernode
+  double* moments;
+  // min x, y, z and max x, y, z for each supernode
+  int* boundingBoxes;
+};
+
+#endif // SUPERNODE_SHAPE_H
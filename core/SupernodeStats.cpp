@@ -0,0 +1,257 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "SupernodeStats.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include <limits.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// SliceMe
+#include "Slice_P.h"
+#include "Slice3d.h"
+
+//------------------------------------------------------------------------------
+
+int SupernodeStats::requestedFlags = 0;
+int SupernodeStats::requestedBins = 0;
+int SupernodeStats::requestedMaxValue = 255;
+
+//------------------------------------------------------------------------------
+
+SupernodeStats::SupernodeStats(int _flags, int _nBins, int _maxValue)
+{
+  flags = _flags;
+  nBins = (flags & STATS_HISTOGRAM)?_nBins:0;
+  maxValue = _maxValue;
+  nSupernodes = 0;
+  counts = 0;
+  means = 0;
+  m2s = 0;
+  minValues = 0;
+  maxValues = 0;
+  histograms = 0;
+}
+
+SupernodeStats::~SupernodeStats()
+{
+  if(counts) {
+    delete[] counts;
+    delete[] means;
+    delete[] m2s;
+  }
+  if(minValues) {
+    delete[] minValues;
+    delete[] maxValues;
+  }
+  if(histograms) {
+    delete[] histograms;
+  }
+}
+
+void SupernodeStats::allocate(ulong _nSupernodes)
+{
+  nSupernodes = _nSupernodes;
+  // counts are also used by the histogram normalization
+  counts = new ulong[nSupernodes];
+  means = new double[nSupernodes];
+  m2s = new double[nSupernodes];
+  for(ulong i = 0; i < nSupernodes; ++i) {
+    counts[i] = 0;
+    means[i] = 0;
+    m2s[i] = 0;
+  }
+  if(flags & STATS_MINMAX) {
+    minValues = new int[nSupernodes];
+    maxValues = new int[nSupernodes];
+    for(ulong i = 0; i < nSupernodes; ++i) {
+      minValues[i] = INT_MAX;
+      maxValues[i] = INT_MIN;
+    }
+  }
+  if(flags & STATS_HISTOGRAM) {
+    histograms = new float[nSupernodes*nBins];
+    for(ulong i = 0; i < nSupernodes*nBins; ++i) {
+      histograms[i] = 0;
+    }
+  }
+}
+
+void SupernodeStats::compute(Slice_P* slice, const uchar* data)
+{
+  // moments are always accumulated (needed for the counts)
+  flags |= STATS_MOMENTS;
+  allocate(slice->getNbSupernodes());
+
+  // bin indices are precomputed for the whole slice
+  const uchar* binIdxs = 0;
+  uchar* localBinIdxs = 0;
+  if(flags & STATS_HISTOGRAM) {
+    if(data) {
+      localBinIdxs = new uchar[slice->getSize()];
+      computeBinIndices(data, slice->getSize(), nBins, maxValue, localBinIdxs);
+      binIdxs = localBinIdxs;
+    } else {
+      binIdxs = slice->getBinIndexVolume(nBins, maxValue);
+    }
+  }
+
+  // store supernodes in a vector so that they can be processed in parallel
+  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
+  vector<supernode*> lSupernodes;
+  lSupernodes.reserve(_supernodes.size());
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    lSupernodes.push_back(it->second);
+  }
+  long nNodes = lSupernodes.size();
+
+  if(slice->getType() == SLICEP_SLICE3D) {
+    Slice3d* slice3d = static_cast<Slice3d*>(slice);
+    const uchar* raw_data = (data)?data:slice3d->raw_data;
+    const ulong size_slice = slice3d->width*slice3d->height;
+    const ulong width = slice3d->width;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+    for(long i = 0; i < nNodes; ++i) {
+      supernode* s = lSupernodes[i];
+      ulong sid = s->id;
+      float* hist = (binIdxs)?histograms + sid*nBins:0;
+
+      const vector<lineContainer*>& lines = s->getLines();
+      for(vector<lineContainer*>::const_iterator itL = lines.begin();
+          itL != lines.end(); ++itL) {
+        const lineContainer* l = *itL;
+        ulong offset = l->coord.z*size_slice + l->coord.y*width + l->coord.x;
+        const uchar* run = raw_data + offset;
+        for(uint k = 0; k < l->length; ++k) {
+          add(sid, run[k]);
+        }
+        if(hist) {
+          const uchar* binRun = binIdxs + offset;
+          for(uint k = 0; k < l->length; ++k) {
+            hist[binRun[k]]++;
+          }
+        }
+      }
+
+      const vector<node*>& nodes = s->getNodes();
+      for(vector<node*>::const_iterator itN = nodes.begin();
+          itN != nodes.end(); ++itN) {
+        const node* n = *itN;
+        ulong offset = n->z*size_slice + n->y*width + n->x;
+        add(sid, raw_data[offset]);
+        if(hist) {
+          hist[binIdxs[offset]]++;
+        }
+      }
+    }
+  } else {
+    if(data) {
+      printf("[SupernodeStats] Error : external data is only supported for 3d volumes\n");
+      exit(-1);
+    }
+    const ulong width = slice->getWidth();
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+    for(long i = 0; i < nNodes; ++i) {
+      supernode* s = lSupernodes[i];
+      ulong sid = s->id;
+      float* hist = (binIdxs)?histograms + sid*nBins:0;
+      node n;
+      nodeIterator ni = s->getIterator();
+      ni.goToBegin();
+      while(!ni.isAtEnd()) {
+        ni.get(n);
+        ni.next();
+        add(sid, slice->getIntensity(n.x, n.y, n.z));
+        if(hist) {
+          hist[binIdxs[n.y*width + n.x]]++;
+        }
+      }
+    }
+  }
+
+  if(localBinIdxs) {
+    delete[] localBinIdxs;
+  }
+}
+
+void SupernodeStats::computeBinIndices(const uchar* data, ulong size,
+                                       int nBins, int maxValue, uchar* binIdxs)
+{
+  if(nBins > 256) {
+    printf("[SupernodeStats] Error : number of bins (%d) should not be greater than 256\n", nBins);
+    exit(-1);
+  }
+
+  ulong i = 0;
+#ifdef __SSE2__
+  // (v*mul)>>16 with mul = ceil(2^16*nBins/maxValue) is equal to
+  // v*nBins/maxValue for every 8-bit value v as long as maxValue <= 255.
+  if(maxValue <= 255 && nBins < maxValue) {
+    int mul = ((nBins << 16) + maxValue - 1)/maxValue;
+    const __m128i vMul = _mm_set1_epi16((short)mul);
+    const __m128i vMaxIdx = _mm_set1_epi16((short)(nBins - 1));
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+      __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(v, zero), vMul);
+      __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(v, zero), vMul);
+      lo = _mm_min_epi16(lo, vMaxIdx);
+      hi = _mm_min_epi16(hi, vMaxIdx);
+      _mm_storeu_si128((__m128i*)(binIdxs + i), _mm_packus_epi16(lo, hi));
+    }
+  }
+#endif
+  for(; i < size; ++i) {
+    binIdxs[i] = (uchar)getBinIndex(data[i], nBins, maxValue);
+  }
+}
+
+bool SupernodeStats::hasQuantities(int _flags, int _nBins, int _maxValue)
+{
+  if((flags & _flags) != _flags) {
+    return false;
+  }
+  if((_flags & STATS_HISTOGRAM) && (nBins != _nBins || maxValue != _maxValue)) {
+    return false;
+  }
+  return true;
+}
+
+void SupernodeStats::request(int _flags, int _nBins, int _maxValue)
+{
+#ifdef WITH_OPENMP
+#pragma omp critical(supernodeStatsRequest)
+#endif
+  {
+    requestedFlags |= _flags;
+    if(_flags & STATS_HISTOGRAM) {
+      requestedBins = _nBins;
+      requestedMaxValue = _maxValue;
+    }
+  }
+}
@@ -0,0 +1,165 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SUPERNODE_STATS_H
+#define SUPERNODE_STATS_H
+
+// SliceMe
+#include "globalsE.h"
+#include "Supernode.h"
+
+class Slice_P;
+
+//-------------------------------------------------------------------------TYPES
+
+// quantities accumulated by SupernodeStats
+#define STATS_MOMENTS 1   // count, mean and variance
+#define STATS_MINMAX 2    // minimum and maximum intensity
+#define STATS_HISTOGRAM 4 // histogram of the intensities
+
+//-------------------------------------------------------------------------CLASS
+
+/**
+ * Intensity statistics of all the supernodes of a slice computed in a
+ * single pass over the voxels. Supernodes are processed in parallel and
+ * runs of voxels (lineContainer) are read directly from the raw data of
+ * 3d volumes. Mean and variance are accumulated in double precision with
+ * Welford's algorithm. Histograms are accumulated from the bin index
+ * volume shared by the slice (see Slice_P::getBinIndexVolume).
+ *
+ * Features should not create their own instance but call
+ * Slice_P::getIntensityStats so that the statistics are shared. The
+ * quantities needed by a feature should be registered with request (in the
+ * constructor of the feature) so that the first pass computes all of them.
+ */
+class SupernodeStats
+{
+ public:
+
+  /**
+   * @param _nBins number of bins of the histogram
+   * @param _maxValue intensity corresponding to the last bin
+   */
+  SupernodeStats(int _flags, int _nBins = 0, int _maxValue = 255);
+
+  ~SupernodeStats();
+
+  /**
+   * Accumulate statistics for all the supernodes of the given slice.
+   * @param data if not null, volume of the same size as the slice to use
+   * instead of the intensities (only for 3d volumes).
+   */
+  void compute(Slice_P* slice, const uchar* data = 0);
+
+  /**
+   * Returns true if the quantities given by _flags were computed.
+   */
+  bool hasQuantities(int _flags, int _nBins = 0, int _maxValue = 255);
+
+  ulong getCount(sidType sid) { return counts[sid]; }
+
+  int getFlags() { return flags; }
+
+  const float* getHistogram(sidType sid) { return histograms + (ulong)sid*nBins; }
+
+  int getMax(sidType sid) { return maxValues[sid]; }
+
+  double getMean(sidType sid) { return means[sid]; }
+
+  int getMin(sidType sid) { return minValues[sid]; }
+
+  int getNbBins() { return nBins; }
+
+  double getSum(sidType sid) { return means[sid]*counts[sid]; }
+
+  double getSumOfSquares(sidType sid) {
+    return m2s[sid] + means[sid]*means[sid]*counts[sid];
+  }
+
+  /**
+   * Population variance
+   */
+  double getVariance(sidType sid) {
+    return (counts[sid] == 0)?0:m2s[sid]/counts[sid];
+  }
+
+  static int getRequestedBins() { return requestedBins; }
+
+  static int getRequestedFlags() { return requestedFlags; }
+
+  static int getRequestedMaxValue() { return requestedMaxValue; }
+
+  /**
+   * Register quantities that will be needed by a feature.
+   */
+  static void request(int _flags, int _nBins = 0, int _maxValue = 255);
+
+  /**
+   * Bin of the given intensity for a histogram of nBins bins covering
+   * [0, maxValue]. maxValue falls into the last bin.
+   */
+  static inline int getBinIndex(int value, int nBins, int maxValue) {
+    int idx = value*nBins/maxValue;
+    return (idx >= nBins)?nBins-1:idx;
+  }
+
+  /**
+   * Compute the bin index of size intensities (SSE2 if available).
+   * nBins should not be greater than 256.
+   */
+  static void computeBinIndices(const uchar* data, ulong size,
+                                int nBins, int maxValue, uchar* binIdxs);
+
+ private:
+
+  void allocate(ulong _nSupernodes);
+
+  inline void add(ulong sid, int value) {
+    if(flags & STATS_MOMENTS) {
+      ulong n = ++counts[sid];
+      double delta = value - means[sid];
+      means[sid] += delta/n;
+      m2s[sid] += delta*(value - means[sid]);
+    }
+    if(flags & STATS_MINMAX) {
+      if(value < minValues[sid]) {
+        minValues[sid] = value;
+      }
+      if(value > maxValues[sid]) {
+        maxValues[sid] = value;
+      }
+    }
+  }
+
+  int flags;
+  int nBins;
+  int maxValue;
+  ulong nSupernodes;
+
+  ulong* counts;
+  double* means;
+  // sum of squared differences to the mean
+  double* m2s;
+  int* minValues;
+  int* maxValues;
+  // nSupernodes*nBins
+  float* histograms;
+
+  static int requestedFlags;
+  static int requestedBins;
+  static int requestedMaxValue;
+};
+
+#endif // SUPERNODE_STATS_H
@@ -0,0 +1,663 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "gi_BP.h"
+
+#include <cmath>
+#include <float.h>
+#include <queue>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// SliceMe
+#include "Config.h"
+#include "globalsE.h"
+#include "utils.h"
+
+#include "inference_globals.h"
+
+//------------------------------------------------------------------------------
+
+#define MAX_POTENTIAL 5.0
+
+#define BP_DEFAULT_TOLERANCE 1e-7
+
+//------------------------------------------------------------------------------
+
+GI_BP::GI_BP(Slice_P* _slice,
+             const EnergyParam* _param,
+             double* _smw,
+             labelType* _groundTruthLabels,
+             double* _lossPerLabel,
+             Feature* _feature,
+             map<sidType, nodeCoeffType>* _nodeCoeffs,
+             map<sidType, edgeCoeffType>* _edgeCoeffs)
+{
+  GraphInference::init();
+  slice = _slice;
+  param = _param;
+  smw = _smw;
+  lossPerLabel = _lossPerLabel;
+  groundTruthLabels = _groundTruthLabels;
+  feature = _feature;
+  nodeCoeffs = _nodeCoeffs;
+  edgeCoeffs = _edgeCoeffs;
+
+  schedule = BP_SCHEDULE_SEQUENTIAL;
+  sumProduct = false;
+  damping = 0;
+  tolerance = BP_DEFAULT_TOLERANCE;
+  messagesComputed = false;
+
+  string config_tmp;
+  if(Config::Instance()->getParameter("bp_schedule", config_tmp)) {
+    schedule = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("bp_sumprod", config_tmp)) {
+    sumProduct = config_tmp.c_str()[0] == '1';
+  }
+  if(Config::Instance()->getParameter("bp_damping", config_tmp)) {
+    damping = atof(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("bp_tolerance", config_tmp)) {
+    tolerance = atof(config_tmp.c_str());
+  }
+
+  kernel = createPairwiseKernel(param);
+  createGraph();
+  computeUnaryPotentials();
+  computePairwisePotentials();
+}
+
+GI_BP::~GI_BP()
+{
+  delete kernel;
+  delete[] offsets;
+  delete[] sources;
+  delete[] targets;
+  delete[] reverseEntries;
+  delete[] edgeIds;
+  delete[] edgeClasses;
+  if(edgeWeights) {
+    delete[] edgeWeights;
+  }
+  delete[] pairwisePotentials;
+  delete[] unaryPotentials;
+  delete[] messages;
+  delete[] newMessages;
+  delete[] beliefs;
+}
+
+void GI_BP::createGraph()
+{
+  nNodes = slice->getNbSupernodes();
+  nStates = param->nClasses;
+
+  const map<int, supernode* >& _supernodes = slice->getSupernodes();
+
+  offsets = new ulong[nNodes+1];
+  nEntries = 0;
+  for(int sid = 0; sid < nNodes; ++sid) {
+    offsets[sid] = nEntries;
+    map<int, supernode* >::const_iterator its = _supernodes.find(sid);
+    if(param->includeLocalEdges && its != _supernodes.end()) {
+      nEntries += its->second->neighbors.size();
+    }
+  }
+  offsets[nNodes] = nEntries;
+
+  sources = new sidType[nEntries];
+  targets = new sidType[nEntries];
+  reverseEntries = new ulong[nEntries];
+  edgeIds = new ulong[nEntries];
+  edgeClasses = new int[nEntries/2 + 1];
+  // endpoints of the undirected edges (largest sid first)
+  sidType* edgeSources = new sidType[nEntries/2 + 1];
+  sidType* edgeTargets = new sidType[nEntries/2 + 1];
+  edgeWeights = 0;
+  if(edgeCoeffs) {
+    edgeWeights = new float[nEntries/2 + 1];
+  }
+
+  // position of the next entry to be filled for each node
+  ulong* next = new ulong[nNodes];
+  for(int sid = 0; sid < nNodes; ++sid) {
+    next[sid] = offsets[sid];
+  }
+
+  nEdgeClasses = kernel->getNbEdgeClasses();
+
+  // undirected edges are numbered in the same order as in
+  // GraphInference::computeEnergy so that edgeCoeffs can be used
+  ulong edgeId = 0;
+  if(param->includeLocalEdges) {
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      sidType sid = its->first;
+      for(vector<supernode*>::iterator itN = its->second->neighbors.begin();
+          itN != its->second->neighbors.end(); itN++) {
+        sidType nsid = (*itN)->id;
+        // set edges once
+        if(sid < nsid) {
+          continue;
+        }
+
+        ulong e = next[sid]++;
+        ulong re = next[nsid]++;
+        sources[e] = sid;
+        targets[e] = nsid;
+        sources[re] = nsid;
+        targets[re] = sid;
+        reverseEntries[e] = re;
+        reverseEntries[re] = e;
+        edgeIds[e] = edgeId;
+        edgeIds[re] = edgeId;
+
+        edgeSources[edgeId] = sid;
+        edgeTargets[edgeId] = nsid;
+        if(edgeWeights) {
+          edgeWeights[edgeId] = (*edgeCoeffs)[edgeId];
+        }
+        ++edgeId;
+      }
+    }
+  }
+  delete[] next;
+
+  kernel->computeEdgeClasses(slice, edgeId, edgeSources, edgeTargets, edgeClasses);
+  delete[] edgeSources;
+  delete[] edgeTargets;
+
+  pairwisePotentials = new potentialType[nEdgeClasses*nStates*nStates];
+  unaryPotentials = new potentialType[nNodes*nStates];
+  messages = new potentialType[nEntries*nStates];
+  newMessages = new potentialType[nEntries*nStates];
+  beliefs = new potentialType[nNodes*nStates];
+
+  INFERENCE_PRINT("[gi_BP] %d nodes, %ld directed edges, %d edge classes\n",
+                  nNodes, nEntries, nEdgeClasses);
+}
+
+void GI_BP::computeUnaryPotentials()
+{
+  bool useLossFunction = lossPerLabel!=0;
+
+  string config_tmp;
+  int loss_function = 0;
+  if(Config::Instance()->getParameter("loss_function", config_tmp)) {
+    loss_function = atoi(config_tmp.c_str());
+  }
+
+  scale = 0; // used to store the maximum potential
+  const map<int, supernode* >& _supernodes = slice->getSupernodes();
+  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+      its != _supernodes.end(); its++) {
+    sidType sid = its->first;
+    potentialType* buf = unaryPotentials + sid*nStates;
+
+    if(param->nClasses != 2) {
+      for(int i = 0; i < nStates; i++) {
+        buf[i] = computeUnaryPotential(slice, sid, i);
+      }
+    } else {
+      // Only 2 classes.
+      buf[T_FOREGROUND] = 0;
+      buf[T_BACKGROUND] = computeUnaryPotential(slice, sid, T_BACKGROUND);
+    }
+
+    if(nodeCoeffs) {
+      for(int i = 0; i < nStates; i++) {
+        buf[i] *= (*nodeCoeffs)[sid];
+      }
+    }
+
+    if(useLossFunction) {
+      for(int s = 0; s < nStates; s++) {
+        if(s != groundTruthLabels[sid]) {
+          // add loss of the ground truth label
+          double _loss = 0;
+          if(loss_function == LOSS_NODE_BASED) {
+            _loss = lossPerLabel[sid];
+          } else {
+            _loss = lossPerLabel[groundTruthLabels[sid]];
+          }
+          if(nodeCoeffs) {
+            _loss *= (*nodeCoeffs)[sid];
+          }
+          buf[s] += _loss;
+        }
+      }
+    }
+
+    for(int i = 0; i < nStates; i++) {
+      if(fabs(buf[i]) > scale) {
+        scale = fabs(buf[i]);
+      }
+    }
+  }
+}
+
+void GI_BP::computePairwisePotentials()
+{
+  int nPairwiseStates = nStates*nStates;
+  double maxPotential = scale;
+
+  if(param->includeLocalEdges) {
+    kernel->computeTables(smw, pairwisePotentials);
+
+    double maxWeight = 1;
+    if(edgeWeights) {
+      maxWeight = 0;
+      for(ulong edgeId = 0; edgeId < nEntries/2; ++edgeId) {
+        if(fabs(edgeWeights[edgeId]) > maxWeight) {
+          maxWeight = fabs(edgeWeights[edgeId]);
+        }
+      }
+    }
+    for(int p = 0; p < nEdgeClasses*nPairwiseStates; ++p) {
+      if(fabs(pairwisePotentials[p]*maxWeight) > maxPotential) {
+        maxPotential = fabs(pairwisePotentials[p]*maxWeight);
+      }
+    }
+  }
+
+  scale = 1;
+  if(maxPotential != 0) {
+    scale = MAX_POTENTIAL/maxPotential;
+  }
+  INFERENCE_PRINT("[gi_BP] maxPotential=%g, scale=%g\n", maxPotential, scale);
+
+  for(int i = 0; i < nNodes*nStates; ++i) {
+    unaryPotentials[i] *= scale;
+  }
+  if(param->includeLocalEdges) {
+    for(int p = 0; p < nEdgeClasses*nPairwiseStates; ++p) {
+      pairwisePotentials[p] *= scale;
+    }
+  }
+}
+
+bool GI_BP::isCompatible(const EnergyParam* _param)
+{
+  return (_param->nClasses == param->nClasses &&
+          _param->includeLocalEdges == param->includeLocalEdges &&
+          _param->nGradientLevels == param->nGradientLevels &&
+          _param->nOrientations == param->nOrientations &&
+          _param->nDistances == param->nDistances);
+}
+
+void GI_BP::updateParameters(const EnergyParam* _param,
+                             double* _smw,
+                             labelType* _groundTruthLabels,
+                             double* _lossPerLabel)
+{
+  if(!isCompatible(_param)) {
+    printf("[gi_BP] Error : parameters are not compatible with the current graph\n");
+    exit(-1);
+  }
+
+  param = _param;
+  smw = _smw;
+  groundTruthLabels = _groundTruthLabels;
+  lossPerLabel = _lossPerLabel;
+
+  computeUnaryPotentials();
+  computePairwisePotentials();
+  messagesComputed = false;
+}
+
+void GI_BP::resetMessages()
+{
+  for(ulong i = 0; i < nEntries*nStates; ++i) {
+    messages[i] = 0;
+  }
+  for(int i = 0; i < nNodes*nStates; ++i) {
+    beliefs[i] = unaryPotentials[i];
+  }
+}
+
+void GI_BP::computeBeliefs()
+{
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int sid = 0; sid < nNodes; ++sid) {
+    potentialType* b = beliefs + sid*nStates;
+    const potentialType* u = unaryPotentials + sid*nStates;
+    for(int c = 0; c < nStates; ++c) {
+      b[c] = u[c];
+    }
+    for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+      // incoming message
+      const potentialType* m = messages + reverseEntries[e]*nStates;
+      for(int c = 0; c < nStates; ++c) {
+        b[c] += m[c];
+      }
+    }
+  }
+}
+
+double GI_BP::computeMessage(ulong e, const potentialType* cavity, potentialType* out)
+{
+  const potentialType* table = pairwisePotentials + edgeClasses[edgeIds[e]]*nStates*nStates;
+  double w = (edgeWeights)?edgeWeights[edgeIds[e]]:1.0;
+  // tables are indexed by label(max sid)*nStates + label(min sid)
+  bool sourceIsMax = sources[e] > targets[e];
+  int strideSource = sourceIsMax?nStates:1;
+  int strideTarget = sourceIsMax?1:nStates;
+
+  double maxValue = -DBL_MAX;
+  for(int ct = 0; ct < nStates; ++ct) {
+    double v = -DBL_MAX;
+    if(sumProduct) {
+      // log-sum-exp
+      double m = -DBL_MAX;
+      for(int cs = 0; cs < nStates; ++cs) {
+        double t = cavity[cs] + w*table[cs*strideSource + ct*strideTarget];
+        if(t > m) {
+          m = t;
+        }
+      }
+      double sum = 0;
+      for(int cs = 0; cs < nStates; ++cs) {
+        sum += exp(cavity[cs] + w*table[cs*strideSource + ct*strideTarget] - m);
+      }
+      v = m + log(sum);
+    } else {
+      for(int cs = 0; cs < nStates; ++cs) {
+        double t = cavity[cs] + w*table[cs*strideSource + ct*strideTarget];
+        if(t > v) {
+          v = t;
+        }
+      }
+    }
+    out[ct] = v;
+    if(v > maxValue) {
+      maxValue = v;
+    }
+  }
+
+  // normalize and compute the change with respect to the current message
+  const potentialType* old = messages + e*nStates;
+  double residual = 0;
+  for(int ct = 0; ct < nStates; ++ct) {
+    out[ct] -= maxValue;
+    double d = fabs(out[ct] - old[ct]);
+    if(d > residual) {
+      residual = d;
+    }
+  }
+  return residual;
+}
+
+double GI_BP::propagateSequential(size_t maxiter)
+{
+  potentialType* cavity = new potentialType[nStates];
+  potentialType* msg = new potentialType[nStates];
+  double maxResidual = 0;
+  size_t iter = 0;
+  for(; iter < maxiter; ++iter) {
+    maxResidual = 0;
+    for(int sid = 0; sid < nNodes; ++sid) {
+      potentialType* b = beliefs + sid*nStates;
+      for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+        const potentialType* in = messages + reverseEntries[e]*nStates;
+        for(int c = 0; c < nStates; ++c) {
+          cavity[c] = b[c] - in[c];
+        }
+        double residual = computeMessage(e, cavity, msg);
+        if(residual > maxResidual) {
+          maxResidual = residual;
+        }
+
+        // update message and belief of the target node
+        potentialType* m = messages + e*nStates;
+        potentialType* bt = beliefs + targets[e]*nStates;
+        for(int c = 0; c < nStates; ++c) {
+          bt[c] += msg[c] - m[c];
+          m[c] = msg[c];
+        }
+      }
+    }
+    if(maxResidual < tolerance) {
+      break;
+    }
+  }
+  INFERENCE_PRINT("[gi_BP] Sequential schedule : %ld iterations, residual=%g\n", iter, maxResidual);
+
+  delete[] cavity;
+  delete[] msg;
+  return maxResidual;
+}
+
+double GI_BP::propagateParallel(size_t maxiter)
+{
+  double maxResidual = 0;
+  size_t iter = 0;
+  for(; iter < maxiter; ++iter) {
+    maxResidual = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+    {
+      potentialType* cavity = new potentialType[nStates];
+      double threadResidual = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+      for(int sid = 0; sid < nNodes; ++sid) {
+        const potentialType* b = beliefs + sid*nStates;
+        for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+          const potentialType* in = messages + reverseEntries[e]*nStates;
+          for(int c = 0; c < nStates; ++c) {
+            cavity[c] = b[c] - in[c];
+          }
+          potentialType* msg = newMessages + e*nStates;
+          double residual = computeMessage(e, cavity, msg);
+          if(damping > 0) {
+            const potentialType* old = messages + e*nStates;
+            for(int c = 0; c < nStates; ++c) {
+              msg[c] = damping*old[c] + (1.0-damping)*msg[c];
+            }
+            residual *= (1.0-damping);
+          }
+          if(residual > threadResidual) {
+            threadResidual = residual;
+          }
+        }
+      }
+
+#ifdef WITH_OPENMP
+#pragma omp critical
+#endif
+      {
+        if(threadResidual > maxResidual) {
+          maxResidual = threadResidual;
+        }
+      }
+      delete[] cavity;
+    }
+
+    potentialType* t = messages;
+    messages = newMessages;
+    newMessages = t;
+    computeBeliefs();
+
+    if(maxResidual < tolerance) {
+      break;
+    }
+  }
+  INFERENCE_PRINT("[gi_BP] Parallel schedule : %ld iterations, residual=%g\n", iter, maxResidual);
+  return maxResidual;
+}
+
+double GI_BP::propagateResidual(size_t maxiter)
+{
+  // newMessages contains the next value of each message and residuals the
+  // corresponding change. Messages with the largest change are sent first.
+  double* residuals = new double[nEntries];
+  potentialType* cavity = new potentialType[nStates];
+  priority_queue< pair<double, ulong> > queue;
+
+  for(int sid = 0; sid < nNodes; ++sid) {
+    const potentialType* b = beliefs + sid*nStates;
+    for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+      const potentialType* in = messages + reverseEntries[e]*nStates;
+      for(int c = 0; c < nStates; ++c) {
+        cavity[c] = b[c] - in[c];
+      }
+      residuals[e] = computeMessage(e, cavity, newMessages + e*nStates);
+      queue.push(pair<double, ulong>(residuals[e], e));
+    }
+  }
+
+  ulong maxUpdates = maxiter*nEntries;
+  ulong nUpdates = 0;
+  double maxResidual = 0;
+  while(!queue.empty() && nUpdates < maxUpdates) {
+    pair<double, ulong> top = queue.top();
+    queue.pop();
+    ulong e = top.second;
+    if(top.first != residuals[e]) {
+      // outdated entry
+      continue;
+    }
+    maxResidual = top.first;
+    if(maxResidual < tolerance) {
+      break;
+    }
+
+    // send message e
+    sidType target = targets[e];
+    potentialType* m = messages + e*nStates;
+    const potentialType* msg = newMessages + e*nStates;
+    potentialType* bt = beliefs + target*nStates;
+    for(int c = 0; c < nStates; ++c) {
+      bt[c] += msg[c] - m[c];
+      m[c] = msg[c];
+    }
+    residuals[e] = 0;
+    ++nUpdates;
+
+    // update messages sent by the target node (except the one sent back)
+    for(ulong e2 = offsets[target]; e2 < offsets[target+1]; ++e2) {
+      if(e2 == reverseEntries[e]) {
+        continue;
+      }
+      const potentialType* in = messages + reverseEntries[e2]*nStates;
+      for(int c = 0; c < nStates; ++c) {
+        cavity[c] = bt[c] - in[c];
+      }
+      residuals[e2] = computeMessage(e2, cavity, newMessages + e2*nStates);
+      queue.push(pair<double, ulong>(residuals[e2], e2));
+    }
+  }
+  INFERENCE_PRINT("[gi_BP] Residual schedule : %ld updates, residual=%g\n", nUpdates, maxResidual);
+
+  delete[] residuals;
+  delete[] cavity;
+  return maxResidual;
+}
+
+double GI_BP::propagate(size_t maxiter)
+{
+  resetMessages();
+
+  double residual = 0;
+  switch(schedule) {
+  case BP_SCHEDULE_PARALLEL:
+    residual = propagateParallel(maxiter);
+    break;
+  case BP_SCHEDULE_RESIDUAL:
+    residual = propagateResidual(maxiter);
+    break;
+  default:
+    residual = propagateSequential(maxiter);
+    break;
+  }
+  messagesComputed = true;
+  return residual;
+}
+
+double GI_BP::run(labelType* inferredLabels,
+                  int id,
+                  size_t maxiter,
+                  labelType* nodeLabelsGroundTruth,
+                  bool computeEnergyAtEachIteration,
+                  double* _loss)
+{
+  string paramMSRC;
+  Config::Instance()->getParameter("msrc", paramMSRC);
+  bool useMSRC = paramMSRC.c_str()[0] == '1';
+  bool replaceVoidMSRC = false;
+  labelType voidLabel = 0;
+  labelType moutainLabel = 0;
+  labelType horseLabel = 0;
+  if(lossPerLabel == 0 && useMSRC) {
+    Config::Instance()->getParameter("msrc_replace_void", paramMSRC);
+    replaceVoidMSRC = paramMSRC.c_str()[0] == '1';
+    voidLabel = classIdxToLabel[0];
+    moutainLabel = classIdxToLabel[4161600];
+    horseLabel = classIdxToLabel[8323328];
+  }
+
+  propagate(maxiter);
+
+  for(int sid = 0; sid < nNodes; ++sid) {
+    const potentialType* b = beliefs + sid*nStates;
+    int label = -1;
+    for(int c = 0; c < nStates; ++c) {
+      if(replaceVoidMSRC && (c == voidLabel || c == moutainLabel || c == horseLabel)) {
+        continue;
+      }
+      if(label == -1 || b[c] > b[label]) {
+        label = c;
+      }
+    }
+    inferredLabels[sid] = label;
+  }
+
+  if(_loss) {
+    *_loss = 0;
+  }
+
+  return GraphInference::computeEnergy(inferredLabels);
+}
+
+void GI_BP::getMarginals(float* marginals,
+                         const int label)
+{
+  if(!messagesComputed) {
+    propagate(INFERENCE_MAX_ITER);
+  }
+
+  for(int sid = 0; sid < nNodes; ++sid) {
+    const potentialType* b = beliefs + sid*nStates;
+    double m = b[0];
+    for(int c = 1; c < nStates; ++c) {
+      if(b[c] > m) {
+        m = b[c];
+      }
+    }
+    double sum = 0;
+    for(int c = 0; c < nStates; ++c) {
+      sum += exp(b[c] - m);
+    }
+    marginals[sid] = exp(b[label] - m)/sum;
+  }
+}
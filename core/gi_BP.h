@@ -0,0 +1,174 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef GI_BP_H
+#define GI_BP_H
+
+// SliceMe
+#include "Feature.h"
+#include "Slice_P.h"
+
+#include "graphInference.h"
+#include "energyParam.h"
+#include "pairwiseKernel.h"
+
+#include <map>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// message update schedules
+#define BP_SCHEDULE_SEQUENTIAL 0
+#define BP_SCHEDULE_PARALLEL 1
+#define BP_SCHEDULE_RESIDUAL 2
+
+//------------------------------------------------------------------------------
+
+/**
+ * Loopy belief propagation working directly on the supernode adjacency.
+ * Messages are stored in log domain in a flat array indexed by directed
+ * edge (CSR order). The graph structure is built once and the potentials
+ * can be updated with updateParameters so that the same instance can be
+ * used for several calls to run.
+ *
+ * Options (configuration file) :
+ * bp_schedule 0=sequential, 1=parallel (synchronous, OpenMP),
+ *             2=residual (priority queue)
+ * bp_sumprod  1 to run sum-product instead of max-product
+ * bp_damping  damping factor in [0,1[ for the parallel schedule
+ * bp_tolerance convergence threshold on the maximum message change
+ */
+class GI_BP : public GraphInference
+{
+ public:
+
+  /**
+   * Constructor for SSVM framework
+   */
+  GI_BP(Slice_P* _slice,
+        const EnergyParam* _param,
+        double* _smw,
+        labelType* _groundTruthLabels,
+        double* _lossPerLabel,
+        Feature* _feature,
+        std::map<sidType, nodeCoeffType>* _nodeCoeffs,
+        std::map<sidType, edgeCoeffType>* _edgeCoeffs);
+
+  ~GI_BP();
+
+  /**
+   * Marginal probability of the given label for each supernode.
+   * Same format as GI_libDAI::getMarginals (normalized beliefs).
+   * Messages are computed if run was not called before.
+   */
+  void getMarginals(float* marginals,
+                    const int label);
+
+  /**
+   * Returns true if the instance can be reused with the given parameters,
+   * i.e. the size of the potential tables does not change.
+   */
+  bool isCompatible(const EnergyParam* _param);
+
+  double run(labelType* inferredLabels,
+             int id,
+             size_t maxiter,
+             labelType* nodeLabelsGroundTruth = 0,
+             bool computeEnergyAtEachIteration = false,
+             double* _loss = 0);
+
+  void setSchedule(int _schedule) { schedule = _schedule; }
+
+  void setSumProduct(bool _val) { sumProduct = _val; }
+
+  /**
+   * Recompute the potentials for new weights and loss. The graph
+   * structure is kept.
+   */
+  void updateParameters(const EnergyParam* _param,
+                        double* _smw,
+                        labelType* _groundTruthLabels,
+                        double* _lossPerLabel);
+
+ private:
+
+  void createGraph();
+
+  void computeBeliefs();
+
+  /**
+   * Compute the message sent along the directed edge e from the cavity
+   * distribution of the source node (belief minus the message coming from
+   * the target node). Returns the maximum absolute change with respect to
+   * the current message.
+   */
+  double computeMessage(ulong e, const potentialType* cavity, potentialType* out);
+
+  void computeUnaryPotentials();
+
+  void computePairwisePotentials();
+
+  double propagate(size_t maxiter);
+
+  double propagateParallel(size_t maxiter);
+
+  double propagateResidual(size_t maxiter);
+
+  double propagateSequential(size_t maxiter);
+
+  void resetMessages();
+
+  int nNodes;
+  int nStates;
+
+  // CSR representation of the graph. Each undirected edge appears twice.
+  ulong nEntries;
+  ulong* offsets;
+  sidType* sources;
+  sidType* targets;
+  ulong* reverseEntries;
+  // index of the undirected edge (same order as the edges in computeEnergy)
+  ulong* edgeIds;
+
+  // class of each undirected edge (combination of gradient, orientation
+  // and distance indices) and optional coefficient
+  int* edgeClasses;
+  float* edgeWeights;
+  int nEdgeClasses;
+  PairwiseKernel* kernel;
+
+  // nEdgeClasses tables of nStates*nStates scores indexed by
+  // label(max sid)*nStates + label(min sid)
+  potentialType* pairwisePotentials;
+  // nNodes*nStates scores
+  potentialType* unaryPotentials;
+  // nEntries*nStates log messages. Entry e contains the message sent by
+  // sources[e] to targets[e]
+  potentialType* messages;
+  potentialType* newMessages;
+  // nNodes*nStates log beliefs
+  potentialType* beliefs;
+
+  // potentials are rescaled so that the maximum potential is equal to
+  // MAX_POTENTIAL (same as GI_libDAI)
+  double scale;
+
+  int schedule;
+  bool sumProduct;
+  double damping;
+  double tolerance;
+  bool messagesComputed;
+};
+
+#endif // GI_BP_H
@@ -12,19 +12,19 @@
 // Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
 /////////////////////////////////////////////////////////////////////////
 
+
 #include "gi_ICM.h"
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 // SliceMe
 #include "Config.h"
 #include "utils.h"
 
 #include "inference_globals.h"
 
-#if USE_GSL
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
-#endif
-
 //------------------------------------------------------------------------------
 
 GI_ICM::GI_ICM(Slice_P* _slice, 
@@ -41,11 +41,149 @@ GI_ICM::GI_ICM(Slice_P* _slice,
   smw = _smw;
   lossPerLabel = _lossPerLabel;
   groundTruthLabels = _groundTruthLabels;
-  lossPerLabel = _lossPerLabel;
   feature = _feature;
   nodeCoeffs = _nodeCoeffs;
+
+  kernel = createPairwiseKernel(param);
+  createGraph();
+  colorGraph();
+}
+
+GI_ICM::~GI_ICM()
+{
+  delete kernel;
+  delete[] offsets;
+  delete[] neighbors;
+  delete[] tableIdxs;
+  delete[] pairwisePotentials;
+  delete[] colorOffsets;
+  delete[] coloredNodes;
+}
+
+void GI_ICM::createGraph()
+{
+  nNodes = slice->getNbSupernodes();
+  nStates = param->nClasses;
+
+  const map<int, supernode* >& _supernodes = slice->getSupernodes();
+
+  offsets = new ulong[nNodes+1];
+  ulong nEntries = 0;
+  for(int sid = 0; sid < nNodes; ++sid) {
+    offsets[sid] = nEntries;
+    map<int, supernode* >::const_iterator its = _supernodes.find(sid);
+    if(param->includeLocalEdges && its != _supernodes.end()) {
+      nEntries += its->second->neighbors.size();
+    }
+  }
+  offsets[nNodes] = nEntries;
+
+  // each edge class has 2 tables (one per orientation)
+  nTables = 2*kernel->getNbEdgeClasses();
+
+  neighbors = new sidType[nEntries];
+  tableIdxs = new int[nEntries];
+  if(param->includeLocalEdges) {
+    // endpoints of the edge of each entry (largest sid first)
+    sidType* edgeSources = new sidType[nEntries];
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      sidType sid = its->first;
+      ulong e = offsets[sid];
+      for(vector<supernode*>::iterator itN = its->second->neighbors.begin();
+          itN != its->second->neighbors.end(); itN++, e++) {
+        sidType nsid = (*itN)->id;
+        neighbors[e] = nsid;
+        edgeSources[e] = max(sid, nsid);
+        // used as a temporary buffer for the target of the edge
+        tableIdxs[e] = min(sid, nsid);
+      }
+    }
+    int* edgeClasses = new int[nEntries];
+    kernel->computeEdgeClasses(slice, nEntries, edgeSources, tableIdxs, edgeClasses);
+    for(ulong e = 0; e < nEntries; ++e) {
+      // weights are indexed by label(max sid)*nClasses + label(min sid)
+      tableIdxs[e] = 2*edgeClasses[e] + ((edgeSources[e] == neighbors[e])?1:0);
+    }
+    delete[] edgeClasses;
+    delete[] edgeSources;
+  }
+
+  pairwisePotentials = new potentialType[nTables*nStates*nStates];
+}
+
+void GI_ICM::colorGraph()
+{
+  int* colors = new int[nNodes];
+  // last node that used a given color as a neighbor
+  vector<int> marks;
+  nColors = 0;
+  for(int sid = 0; sid < nNodes; ++sid) {
+    for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+      sidType nsid = neighbors[e];
+      if(nsid < sid) {
+        marks[colors[nsid]] = sid;
+      }
+    }
+    int c = 0;
+    while(c < nColors && marks[c] == sid) {
+      ++c;
+    }
+    if(c == nColors) {
+      marks.push_back(-1);
+      ++nColors;
+    }
+    colors[sid] = c;
+  }
+
+  colorOffsets = new int[nColors+1];
+  for(int c = 0; c <= nColors; ++c) {
+    colorOffsets[c] = 0;
+  }
+  for(int sid = 0; sid < nNodes; ++sid) {
+    ++colorOffsets[colors[sid]+1];
+  }
+  for(int c = 0; c < nColors; ++c) {
+    colorOffsets[c+1] += colorOffsets[c];
+  }
+  coloredNodes = new sidType[nNodes];
+  int* next = new int[nColors];
+  for(int c = 0; c < nColors; ++c) {
+    next[c] = colorOffsets[c];
+  }
+  for(int sid = 0; sid < nNodes; ++sid) {
+    coloredNodes[next[colors[sid]]++] = sid;
+  }
+  delete[] next;
+  delete[] colors;
+
+  INFERENCE_PRINT("[GI_ICM] %d nodes, %d colors\n", nNodes, nColors);
 }
 
+void GI_ICM::computePairwisePotentials()
+{
+  if(!param->includeLocalEdges) {
+    return;
+  }
+
+  int nPairwiseStates = nStates*nStates;
+  double* allScores = new double[nTables/2*nPairwiseStates];
+  kernel->computeTables(smw, allScores);
+  for(int ec = 0; ec < nTables/2; ++ec) {
+    const double* scores = allScores + ec*nPairwiseStates;
+    // rows indexed by the label of the node with the largest id
+    potentialType* t0 = pairwisePotentials + (2*ec)*nPairwiseStates;
+    // rows indexed by the label of the node with the smallest id
+    potentialType* t1 = pairwisePotentials + (2*ec+1)*nPairwiseStates;
+    for(int ci = 0; ci < nStates; ++ci) {
+      for(int cj = 0; cj < nStates; ++cj) {
+        t0[ci*nStates + cj] = scores[ci*nStates + cj];
+        t1[ci*nStates + cj] = scores[cj*nStates + ci];
+      }
+    }
+  }
+  delete[] allScores;
+}
 
 double GI_ICM::run(labelType* inferredLabels,
                    int id,
@@ -74,125 +212,129 @@ double GI_ICM::run(labelType* inferredLabels,
     printf("[GI_ICM] Do not replace void labels\n");
   }
 
-  double *buf = new double[param->nClasses];
-  int sid = 0;
-  double maxScore = 0;
-  double totalScore_old = 0;
-  double totalScore = 10;
-  supernode *s;
-  node cs;
-
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
-
-  const map<int, supernode* >& _supernodes = slice->getSupernodes();
+  computePairwisePotentials();
 
-  // random selection
-  int maxIter = 10;
-  for(int iter = 0; iter < maxIter && (totalScore - totalScore_old) > 1.0; ++iter) {
-    
-    printf("[GI_ICM] Iteration %d/%d\n", iter, maxIter);
+  // score of each label for each node given the labels of its neighbors
+  potentialType* scores = new potentialType[nNodes*nStates];
 
-    totalScore_old = totalScore;
-    totalScore = 0;
-
-    // Select a pixel at random
-    //int sid = gsl_rng_uniform_int(r, nSupernodes);
+  // node coefficients are copied to a dense array so that the map is not
+  // accessed from several threads
+  nodeCoeffType* coeffs = 0;
+  if(nodeCoeffs) {
+    coeffs = new nodeCoeffType[nNodes];
+    for(int sid = 0; sid < nNodes; ++sid) {
+      map<sidType, nodeCoeffType>::const_iterator itCoeff = nodeCoeffs->find(sid);
+      coeffs[sid] = (itCoeff != nodeCoeffs->end())?itCoeff->second:0;
+    }
+  }
 
-    int nLabelsChanged = 0;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int sid = 0; sid < nNodes; ++sid) {
+    potentialType* buf = scores + sid*nStates;
+    double coeff = 1.0;
+    if(coeffs) {
+      coeff = coeffs[sid];
+    }
 
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      sid = its->first;
-      s = its->second;
+    if(param->nClasses != 2) {
+      for(int c = 0; c < nStates; c++) {
+        buf[c] = computeUnaryPotential(slice, sid, c)*coeff;
+      }
+    } else {
+      // Only 2 classes.
+      buf[T_FOREGROUND] = 0;
+      buf[T_BACKGROUND] = computeUnaryPotential(slice, sid, T_BACKGROUND)*coeff;
+    }
 
-      if(param->nOrientations > 1) {
-        s->getCenter(cs);
+    if(useLossFunction) {
+      for(int c = 0; c < nStates; c++) {
+        if(c != groundTruthLabels[sid]) {
+          // add loss of the ground truth label
+          buf[c] += lossPerLabel[groundTruthLabels[sid]]*coeff;
+        }
       }
+    }
 
-      if(param->nClasses != 2) {
+    // add pairwise potential
+    for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+      const potentialType* t = pairwisePotentials + tableIdxs[e]*nStates*nStates;
+      labelType nLabel = inferredLabels[neighbors[e]];
+      for(int c = 0; c < nStates; c++) {
+        buf[c] += t[c*nStates + nLabel];
+      }
+    }
+  }
 
-        for(int c = 0; c < (int)param->nClasses; c++) {
-          double unaryPotential = computeUnaryPotential(slice, sid, i);
-          buf[c] = unaryPotential;
+  labelType* oldLabels = new labelType[nNodes];
+  ulong nLabelsChanged = 1;
+  uint iter = 0;
+  for(; iter < maxiter && nLabelsChanged > 0; ++iter) {
+    nLabelsChanged = 0;
 
-          // add pairwise potential
-          if(param->includeLocalEdges) {
-            vector < supernode* >* lNeighbors = &(s->neighbors);
-            for(vector < supernode* >::iterator itN = lNeighbors->begin();
-                itN != lNeighbors->end(); itN++) {
-              double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                               c, inferredLabels[(*itN)->id]);
-              buf[c] += pairwisePotential;
+    for(int color = 0; color < nColors; ++color) {
+      // nodes of the same color are not connected so they can be
+      // updated independently
+#ifdef WITH_OPENMP
+#pragma omp parallel for reduction(+:nLabelsChanged)
+#endif
+      for(int i = colorOffsets[color]; i < colorOffsets[color+1]; ++i) {
+        sidType sid = coloredNodes[i];
+        const potentialType* buf = scores + sid*nStates;
+        labelType label = inferredLabels[sid];
+        oldLabels[sid] = label;
+        double maxScore = buf[label];
+        for(int c = 0; c < nStates; c++) {
+          if(!replaceVoidMSRC || (c != voidLabel && c != moutainLabel && c != horseLabel)) {
+            if(maxScore < buf[c]) {
+              maxScore = buf[c];
+              label = c;
             }
           }
-
         }
-      } else {
-        buf[T_FOREGROUND] = 0;
-
-        const int c = T_BACKGROUND;
-        double unaryPotential = computeUnaryPotential(slice, sid, c);
-        buf[c] = unaryPotential;
-
-        // add pairwise potential
-        if(param->includeLocalEdges) {
-          vector < supernode* >* lNeighbors = &(s->neighbors);
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                             c, inferredLabels[(*itN)->id]);
-
-            buf[c] += pairwisePotential;
-          }
+        if(label != inferredLabels[sid]) {
+          inferredLabels[sid] = label;
+          ++nLabelsChanged;
         }
-
       }
 
-      if(useLossFunction) {
-        // loss function
-        for(int s = 0; s < (int)param->nClasses; s++) {
-          if(s != groundTruthLabels[sid]) {
-            // add loss of the ground truth label
-            buf[s] = buf[s] + lossPerLabel[groundTruthLabels[sid]];
-          }
+      // propagate the changes to the neighbors (which all have a
+      // different color)
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+      for(int i = colorOffsets[color]; i < colorOffsets[color+1]; ++i) {
+        sidType sid = coloredNodes[i];
+        labelType oldLabel = oldLabels[sid];
+        labelType newLabel = inferredLabels[sid];
+        if(oldLabel == newLabel) {
+          continue;
         }
-
-        // loss function : -1 if correct label (same as adding +1 to all incorrect labels)
-        //buf[groundTruthLabels[sid]] = std::exp(std::log(buf[groundTruthLabels[sid]])-1);
-      }
-
-      // pick max
-      //bool initialized = false;
-      maxScore = buf[inferredLabels[sid]];
-      for(int s = 0; s < (int)param->nClasses; s++) {
-        if(!replaceVoidMSRC || (s != voidLabel && s != moutainLabel && s != horseLabel)) {
-          //if(!initialized || maxScore < buf[s]) {
-          if(maxScore < buf[s]) {
-            printf("[GI_ICM] Changing sid %d label %d - > %d score %g -> %g\n", sid, inferredLabels[sid], s, maxScore, buf[s]);
-            computeEnergy(inferredLabels);
-            maxScore = buf[s];
-            inferredLabels[sid] = s;
-            printf("[GI_ICM] Iteration %d/%d %g\n", iter, maxIter, computeEnergy(inferredLabels));
-            ++nLabelsChanged;
-            //initialized = true;
+        for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+          sidType nsid = neighbors[e];
+          // table seen from the neighbor : rows and columns are swapped
+          const potentialType* t = pairwisePotentials + (tableIdxs[e]^1)*nStates*nStates;
+          potentialType* nbuf = scores + nsid*nStates;
+          for(int c = 0; c < nStates; c++) {
+            double delta = t[c*nStates + newLabel] - t[c*nStates + oldLabel];
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+            nbuf[c] += delta;
           }
         }
       }
-      totalScore += maxScore;
     }
-    printf("[GI_ICM] Iteration %d/%d. Total score = %g. nLabelsChanged = %d\n", iter, maxIter,
-           totalScore, nLabelsChanged);
+
+    INFERENCE_PRINT("[GI_ICM] Iteration %d/%ld. nLabelsChanged = %ld\n", iter, maxiter,
+                    nLabelsChanged);
   }
+  INFERENCE_PRINT("[GI_ICM] %d iterations\n", iter);
 
-  // cleaning  
-  delete[] n;
-  delete[] buf;
+  // cleaning
+  delete[] coeffs;
+  delete[] oldLabels;
+  delete[] scores;
   return computeEnergy(inferredLabels);
 }
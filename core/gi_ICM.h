@@ -20,12 +20,20 @@
 
 #include "graphInference.h"
 #include "energyParam.h"
+#include "pairwiseKernel.h"
 
 #include <map>
 #include <vector>
 
 //------------------------------------------------------------------------------
 
+/**
+ * Iterated conditional modes.
+ * The supernode graph is colored once so that the nodes of a given color
+ * form an independent set and can be updated in parallel. The score of
+ * each label is kept for every node and updated incrementally when a
+ * neighbor changes label. Labels passed to run are used as initialization.
+ */
 class GI_ICM : public GraphInference
 {
  public:
@@ -40,6 +48,8 @@ class GI_ICM : public GraphInference
          Feature* _feature,
          std::map<sidType, nodeCoeffType>* _nodeCoeffs);
 
+  ~GI_ICM();
+
   double run(labelType* inferredLabels,
              int id,
              size_t maxiter,
@@ -49,6 +59,34 @@ class GI_ICM : public GraphInference
 
  private:
 
+  /**
+   * Greedy coloring of the supernode graph.
+   */
+  void colorGraph();
+
+  void createGraph();
+
+  void computePairwisePotentials();
+
+  int nNodes;
+  int nStates;
+
+  // CSR adjacency. tableIdxs[e] is the index of the pairwise table used
+  // for the entry e, oriented so that the rows correspond to the labels
+  // of the node owning the entry.
+  ulong* offsets;
+  sidType* neighbors;
+  int* tableIdxs;
+  int nTables;
+  PairwiseKernel* kernel;
+
+  // nTables*nStates*nStates pairwise scores
+  potentialType* pairwisePotentials;
+
+  // nodes sorted by color
+  int nColors;
+  int* colorOffsets;
+  sidType* coloredNodes;
 };
 
 #endif // GI_ICM_H
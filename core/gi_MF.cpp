@@ -14,6 +14,13 @@
 
 #include "gi_MF.h"
 
+#include <cmath>
+#include <float.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 // SliceMe
 #include "Config.h"
 #include "globalsE.h"
@@ -25,7 +32,9 @@
 
 #define MAX_POTENTIAL 1.0
 
-#define EXP_DOMAIN 0
+#define MF_DEFAULT_DAMPING 0.5
+#define MF_DEFAULT_TOLERANCE 1e-4
+#define MF_DEFAULT_LEGACY_UPDATE 0
 
 //------------------------------------------------------------------------------
 
@@ -47,34 +56,30 @@ GI_MF::GI_MF(Slice_P* _slice,
   nodeCoeffs = _nodeCoeffs;
   believes = 0;
   ownBelievesBuffer = true;
-}
 
-GI_MF::~GI_MF()
-{
-  if(ownBelievesBuffer && believes) {
-    for(int c = 0; c < param->nClasses; ++c) {
-      delete[] believes[c];
-    }
-    delete[] believes;
+  damping = MF_DEFAULT_DAMPING;
+  tolerance = MF_DEFAULT_TOLERANCE;
+  legacyUpdate = MF_DEFAULT_LEGACY_UPDATE;
+  scale = 1.0;
+  string config_tmp;
+  if(Config::Instance()->getParameter("mf_legacy_update", config_tmp)) {
+    legacyUpdate = config_tmp.c_str()[0] == '1';
+  }
+  if(Config::Instance()->getParameter("mf_damping", config_tmp)) {
+    damping = atof(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("mf_tolerance", config_tmp)) {
+    tolerance = atof(config_tmp.c_str());
   }
-}
 
-double GI_MF::run(labelType* inferredLabels,
-                   int id,
-                   size_t maxiter,
-                   labelType* nodeLabelsGroundTruth,
-                   bool computenergyAtEachIteration,
-                   double* _loss)
-{
-  bool useLossFunction = lossPerLabel!=0;
   string paramMSRC;
   Config::Instance()->getParameter("msrc", paramMSRC);
   bool useMSRC = paramMSRC.c_str()[0] == '1';
-  bool replaceVoidMSRC = false;
-  labelType voidLabel = 0;
-  labelType moutainLabel = 0;
-  labelType horseLabel = 0;
-  if(!useLossFunction && useMSRC) {
+  replaceVoidMSRC = false;
+  voidLabel = 0;
+  moutainLabel = 0;
+  horseLabel = 0;
+  if(lossPerLabel == 0 && useMSRC) {
     Config::Instance()->getParameter("msrc_replace_void", paramMSRC);
     replaceVoidMSRC = paramMSRC.c_str()[0] == '1';
     voidLabel = classIdxToLabel[0];
@@ -86,173 +91,239 @@ double GI_MF::run(labelType* inferredLabels,
     printf("[GI_MF] Do not replace void labels\n");
   }
 
-  int sid = 0;
-  double maxScore = 0;
-  double totalScore_old = 0;
-  double totalScore = 10;
-  supernode *s;
+  kernel = createPairwiseKernel(param);
+  createGraph();
+}
+
+GI_MF::~GI_MF()
+{
+  delete kernel;
+  if(ownBelievesBuffer && believes) {
+    delete[] believes;
+  }
+  delete[] offsets;
+  delete[] neighbors;
+  delete[] tableIdxs;
+  delete[] pairwisePotentials;
+  delete[] unaryPotentials;
+}
+
+void GI_MF::createGraph()
+{
+  nNodes = slice->getNbSupernodes();
+  nStates = param->nClasses;
 
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
-  ulong nSupernodes = slice->getNbSupernodes();  
 
-  // check if memory was already allocated for believes
-  if(!believes) {
-    believes = new double*[nSupernodes];
-    for (uint k = 0; k < nSupernodes; ++k) {
-      believes[k] = new double[param->nClasses];
+  offsets = new ulong[nNodes+1];
+  ulong nEntries = 0;
+  for(int sid = 0; sid < nNodes; ++sid) {
+    offsets[sid] = nEntries;
+    map<int, supernode* >::const_iterator its = _supernodes.find(sid);
+    if(param->includeLocalEdges && its != _supernodes.end()) {
+      nEntries += its->second->neighbors.size();
     }
   }
+  offsets[nNodes] = nEntries;
 
-  double maxPotential;
-  computeNodePotentials(believes, maxPotential);
-    
-  double scale = 1.0;
-  if (fabs(maxPotential) > 1e-30) {
+  // each edge class has 2 tables (one per orientation)
+  nTables = 2*kernel->getNbEdgeClasses();
+
+  neighbors = new sidType[nEntries];
+  tableIdxs = new int[nEntries];
+  if(param->includeLocalEdges) {
+    // endpoints of the edge of each entry (largest sid first)
+    sidType* edgeSources = new sidType[nEntries];
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      sidType sid = its->first;
+      ulong e = offsets[sid];
+      for(vector<supernode*>::iterator itN = its->second->neighbors.begin();
+          itN != its->second->neighbors.end(); itN++, e++) {
+        sidType nsid = (*itN)->id;
+        neighbors[e] = nsid;
+        edgeSources[e] = max(sid, nsid);
+        // used as a temporary buffer for the target of the edge
+        tableIdxs[e] = min(sid, nsid);
+      }
+    }
+    int* edgeClasses = new int[nEntries];
+    kernel->computeEdgeClasses(slice, nEntries, edgeSources, tableIdxs, edgeClasses);
+    for(ulong e = 0; e < nEntries; ++e) {
+      // weights are indexed by label(max sid)*nClasses + label(min sid)
+      tableIdxs[e] = 2*edgeClasses[e] + ((edgeSources[e] == neighbors[e])?1:0);
+    }
+    delete[] edgeClasses;
+    delete[] edgeSources;
+  }
+
+  pairwisePotentials = new potentialType[nTables*nStates*nStates];
+  unaryPotentials = new potentialType[nNodes*nStates];
+}
+
+void GI_MF::computePotentials()
+{
+  int nPairwiseStates = nStates*nStates;
+  double* scores = new double[nTables/2*nPairwiseStates];
+  double maxPotential = 0;
+
+  if(param->includeLocalEdges) {
+    kernel->computeTables(smw, scores);
+  }
+
+  // unary terms (including loss)
+  double* buf = new double[nStates];
+  double* unaryScores = new double[nNodes*nStates];
+  for(int sid = 0; sid < nNodes; ++sid) {
+    double coeff = 1.0;
+    if(nodeCoeffs) {
+      coeff = (*nodeCoeffs)[sid];
+    }
+    if(param->nClasses != 2) {
+      for(int c = 0; c < nStates; c++) {
+        buf[c] = computeUnaryPotential(slice, sid, c)*coeff;
+      }
+    } else {
+      // Only 2 classes.
+      buf[T_FOREGROUND] = 0;
+      buf[T_BACKGROUND] = computeUnaryPotential(slice, sid, T_BACKGROUND)*coeff;
+    }
+    if(lossPerLabel) {
+      for(int c = 0; c < nStates; c++) {
+        if(c != groundTruthLabels[sid]) {
+          // add loss of the ground truth label
+          buf[c] += lossPerLabel[groundTruthLabels[sid]]*coeff;
+        }
+      }
+    }
+    for(int c = 0; c < nStates; c++) {
+      unaryScores[sid*nStates + c] = buf[c];
+      if(fabs(buf[c]) > maxPotential) {
+        maxPotential = fabs(buf[c]);
+      }
+    }
+  }
+  delete[] buf;
+
+  scale = 1.0;
+  if(fabs(maxPotential) > 1e-30) {
     scale = MAX_POTENTIAL/maxPotential;
   }
   INFERENCE_PRINT("[gi_MF] maxPotential=%g, scale=%g\n", maxPotential, scale);
 
-#if EXP_DOMAIN
-  INFERENCE_PRINT("[gi_MF] Computing in exp domain\n");
-  // go to exponential domain
-  for (uint sid = 0; sid < nSupernodes; ++sid) {
-    for(int c = 0; c < param->nClasses; ++c) {
-      believes[sid][c] = std::exp(believes[sid][c]*scale);
-    }
+  for(int i = 0; i < nNodes*nStates; ++i) {
+    unaryPotentials[i] = (potentialType)(unaryScores[i]*scale);
   }
-#else
-  INFERENCE_PRINT("[gi_MF] Computing in log domain\n");
-  // stay in log domain
-  for (uint sid = 0; sid < nSupernodes; ++sid) {
-    for(int c = 0; c < param->nClasses; ++c) {
-      believes[sid][c] *= scale;
+  delete[] unaryScores;
+
+  // Tables are stored with the label of the neighbor (cj) as the slowest
+  // index : t[cj*nStates + ci] is the score of the node owning the entry
+  // taking label ci while the neighbor takes label cj.
+  if(param->includeLocalEdges) {
+    for(int ec = 0; ec < nTables/2; ++ec) {
+      const double* s = scores + ec*nPairwiseStates;
+      // entries owned by the node with the largest id
+      potentialType* t0 = pairwisePotentials + (2*ec)*nPairwiseStates;
+      // entries owned by the node with the smallest id
+      potentialType* t1 = pairwisePotentials + (2*ec+1)*nPairwiseStates;
+      for(int ci = 0; ci < nStates; ++ci) {
+        for(int cj = 0; cj < nStates; ++cj) {
+          t0[cj*nStates + ci] = (potentialType)(s[ci*nStates + cj]*scale);
+          t1[cj*nStates + ci] = (potentialType)(s[cj*nStates + ci]*scale);
+        }
+      }
     }
   }
-#endif
+  delete[] scores;
+}
+
+double GI_MF::run(labelType* inferredLabels,
+                   int id,
+                   size_t maxiter,
+                   labelType* nodeLabelsGroundTruth,
+                   bool computenergyAtEachIteration,
+                   double* _loss)
+{
+  // check if memory was already allocated for believes
+  if(!believes) {
+    believes = new potentialType[2*nNodes*nStates];
+  }
 
-  //exportBelieves("believes0");
+  computePotentials();
 
-  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-      its != _supernodes.end(); its++) {
-    sid = its->first;
+  if(legacyUpdate) {
+    runSequential(inferredLabels, maxiter);
+  } else {
+    runParallel(inferredLabels, maxiter);
+  }
+
+  return computeEnergy(inferredLabels);
+}
+
+void GI_MF::runSequential(labelType* inferredLabels, size_t maxiter)
+{
+  potentialType* b = believes;
+  // unary scores without loss and node coefficients, stored in the second
+  // half of the belief buffer
+  potentialType* u = believes + nNodes*nStates;
+
+  // beliefs start from the scaled node potentials (including loss)
+  for(int i = 0; i < nNodes*nStates; ++i) {
+    b[i] = unaryPotentials[i];
+  }
+  for(int sid = 0; sid < nNodes; ++sid) {
+    potentialType* us = u + sid*nStates;
+    if(param->nClasses != 2) {
+      for(int c = 0; c < nStates; c++) {
+        us[c] = computeUnaryPotential(slice, sid, c)*scale;
+      }
+    } else {
+      us[T_FOREGROUND] = 0;
+      us[T_BACKGROUND] = computeUnaryPotential(slice, sid, T_BACKGROUND)*scale;
+    }
     inferredLabels[sid] = 0;
   }
 
-  // random selection
+  double totalScore_old = 0;
+  double totalScore = 10;
   for(uint iter = 0; iter < maxiter && (totalScore - totalScore_old) > 1.0; ++iter) {
-    
-    printf("[GI_MF] Iteration %d/%ld\n", iter, maxiter);
-
     totalScore_old = totalScore;
     totalScore = 0;
-
-    // Select a pixel at random
-    //int sid = gsl_rng_uniform_int(r, nSupernodes);
-
     int nLabelsChanged = 0;
-    double* bs = 0;
     double maxBelief = 0;
 
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      sid = its->first;
-      s = its->second;
-      bs = believes[sid];
-
-      if(param->nClasses != 2) {
-
-        for(int c = 0; c < (int)param->nClasses; c++) {
-          double unaryPotential = computeUnaryPotential(slice, sid, c) * scale;
-
-          double pairwiseBelief = 0;
-          if(param->includeLocalEdges) {
-            vector < supernode* >* lNeighbors = &(s->neighbors);
-            for(vector < supernode* >::iterator itN = lNeighbors->begin();
-                itN != lNeighbors->end(); itN++) {
-
-              // set edges once
-              if(its->first < (*itN)->id) {
-                continue;
-              }
-
-#if USE_LONG_RANGE_EDGES
-               double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                            c, inferredLabels[(*itN)->id]);
-#else
-               double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                   c, inferredLabels[(*itN)->id]);
-#endif
-               pairwisePotential *= scale;
-               pairwiseBelief += believes[(*itN)->id][c] * pairwisePotential;
-            }
-          }
-#if EXP_DOMAIN
-        bs[c] = exp(unaryPotential)*exp(pairwiseBelief);
-#else
-        bs[c] = unaryPotential + pairwiseBelief;
-#endif
-          if(maxBelief < bs[c]) {
-            maxBelief = bs[c];
-          }
-        }
-      } else {
-        int c = T_FOREGROUND;
-#if EXP_DOMAIN
-        bs[T_FOREGROUND] = 1;
-#else
-        bs[T_FOREGROUND] = 0;
-#endif
+    for(int sid = 0; sid < nNodes; ++sid) {
+      potentialType* bs = b + sid*nStates;
+      const potentialType* us = u + sid*nStates;
 
-        c = T_BACKGROUND;
-        double unaryPotential = computeUnaryPotential(slice, sid, c) * scale;
-        //printf("unaryPotential %d %g\n", sid, unaryPotential);
+      for(int c = 0; c < nStates; c++) {
+        if(param->nClasses == 2 && c == T_FOREGROUND) {
+          bs[c] = 0;
+          continue;
+        }
 
+        // beliefs of the neighbors with a smaller id (already updated
+        // during this sweep) weighted by the pairwise score of their label
         double pairwiseBelief = 0;
-        if(param->includeLocalEdges) {
-          vector < supernode* >* lNeighbors = &(s->neighbors);
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
-
-            // set edges once
-            if(its->first < (*itN)->id) {
-              continue;
-            }
-
-#if USE_LONG_RANGE_EDGES
-            double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                         c, inferredLabels[(*itN)->id]);
-#else
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                c, inferredLabels[(*itN)->id]);
-#endif
-            pairwisePotential *= scale;
-            pairwiseBelief += believes[(*itN)->id][c] * pairwisePotential;
-            //printf("pairwisePotential %d %d %d %g %g %g\n", sid, (*itN)->id, c, pairwisePotential, believes[(*itN)->id][c], pairwiseBelief);
+        for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+          sidType nsid = neighbors[e];
+          if(nsid > sid) {
+            continue;
           }
+          const potentialType* t = pairwisePotentials + tableIdxs[e]*nStates*nStates;
+          pairwiseBelief += b[nsid*nStates + c]*t[inferredLabels[nsid]*nStates + c];
         }
-#if EXP_DOMAIN
-        bs[c] = exp(unaryPotential)*exp(pairwiseBelief);
-#else
-        bs[c] = unaryPotential + pairwiseBelief;
-#endif
-        //printf("bs[%d] %g\n",c,bs[c]);
+        bs[c] = us[c] + pairwiseBelief;
         if(maxBelief < bs[c]) {
           maxBelief = bs[c];
         }
       }
 
-      if(useLossFunction) {
-        // loss function
-        for(int c = 0; c < (int)param->nClasses; c++) {
+      if(lossPerLabel) {
+        for(int c = 0; c < nStates; c++) {
           if(c != groundTruthLabels[sid]) {
-            double _loss = lossPerLabel[groundTruthLabels[sid]] * scale;
             // add loss of the ground truth label
-#if EXP_DOMAIN
-            bs[c] *= exp(_loss);
-#else
-            bs[c] += _loss;
-#endif
-
+            bs[c] += lossPerLabel[groundTruthLabels[sid]]*scale;
             if(maxBelief < bs[c]) {
               maxBelief = bs[c];
             }
@@ -261,46 +332,169 @@ double GI_MF::run(labelType* inferredLabels,
       }
 
       // pick max
-      maxScore = bs[inferredLabels[sid]];
-      for(int c = 0; c < (int)param->nClasses; c++) {
-        if(!replaceVoidMSRC || (c != voidLabel && c != moutainLabel && c != horseLabel)) {
-          if(maxScore < bs[c]) {
-            maxScore = bs[c];
-            inferredLabels[sid] = c;
-            ++nLabelsChanged;
-          }
+      double maxScore = bs[inferredLabels[sid]];
+      for(int c = 0; c < nStates; c++) {
+        if(replaceVoidMSRC && (c == voidLabel || c == moutainLabel || c == horseLabel)) {
+          continue;
+        }
+        if(maxScore < bs[c]) {
+          maxScore = bs[c];
+          inferredLabels[sid] = c;
+          ++nLabelsChanged;
         }
       }
       totalScore += maxScore;
     }
-    printf("[GI_MF] Iteration %d/%ld. Total score = %g. nLabelsChanged = %d\n", iter, maxiter,
-           totalScore, nLabelsChanged);
+    INFERENCE_PRINT("[GI_MF] Iteration %d/%ld. Total score = %g. nLabelsChanged = %d\n",
+                    iter, maxiter, totalScore, nLabelsChanged);
 
     if(maxBelief > MAX_POTENTIAL) {
       // normalize believes
-      printf("[GI_MF] Normalizing believes. maxBelief = %g\n", maxBelief);
-      for (uint sid = 0; sid < nSupernodes; ++sid) {
-        for(int c = 0; c < param->nClasses; ++c) {
-          believes[sid][c] /= maxBelief;
+      for(int i = 0; i < nNodes*nStates; ++i) {
+        b[i] /= maxBelief;
+      }
+    }
+  }
+}
+
+void GI_MF::runParallel(labelType* inferredLabels, size_t maxiter)
+{
+  potentialType* q = believes;
+  potentialType* qNew = believes + nNodes*nStates;
+
+  // initialize with the normalized unary terms
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int sid = 0; sid < nNodes; ++sid) {
+    const potentialType* u = unaryPotentials + sid*nStates;
+    potentialType* qi = q + sid*nStates;
+    potentialType m = u[0];
+    for(int c = 1; c < nStates; ++c) {
+      m = max(m, u[c]);
+    }
+    potentialType sum = 0;
+    for(int c = 0; c < nStates; ++c) {
+      qi[c] = exp(u[c] - m);
+      sum += qi[c];
+    }
+    for(int c = 0; c < nStates; ++c) {
+      qi[c] /= sum;
+    }
+  }
+
+  potentialType fDamping = (potentialType)damping;
+  uint iter = 0;
+  double maxChange = 0;
+  for(; iter < maxiter; ++iter) {
+    maxChange = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+    {
+      potentialType* acc = new potentialType[nStates];
+      double threadChange = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+      for(int sid = 0; sid < nNodes; ++sid) {
+        const potentialType* u = unaryPotentials + sid*nStates;
+        for(int c = 0; c < nStates; ++c) {
+          acc[c] = u[c];
+        }
+
+        // expected pairwise score under the beliefs of the neighbors. The
+        // inner loop is a contiguous axpy over the labels of sid so it is
+        // vectorized without reordering floating point sums.
+        for(ulong e = offsets[sid]; e < offsets[sid+1]; ++e) {
+          const potentialType* qj = q + neighbors[e]*nStates;
+          const potentialType* t = pairwisePotentials + tableIdxs[e]*nStates*nStates;
+          for(int cj = 0; cj < nStates; ++cj) {
+            const potentialType w = qj[cj];
+            const potentialType* col = t + cj*nStates;
+            for(int ci = 0; ci < nStates; ++ci) {
+              acc[ci] += col[ci]*w;
+            }
+          }
+        }
+
+        // normalize (log-sum-exp) and damp
+        potentialType m = acc[0];
+        for(int c = 1; c < nStates; ++c) {
+          m = max(m, acc[c]);
+        }
+        potentialType sum = 0;
+        for(int c = 0; c < nStates; ++c) {
+          acc[c] = exp(acc[c] - m);
+          sum += acc[c];
+        }
+        const potentialType* qi = q + sid*nStates;
+        potentialType* qi_new = qNew + sid*nStates;
+        potentialType invSum = 1.0/sum;
+        for(int c = 0; c < nStates; ++c) {
+          qi_new[c] = fDamping*qi[c] + (1.0f-fDamping)*acc[c]*invSum;
+          double d = fabs(qi_new[c] - qi[c]);
+          if(d > threadChange) {
+            threadChange = d;
+          }
+        }
+      }
+
+#ifdef WITH_OPENMP
+#pragma omp critical
+#endif
+      {
+        if(threadChange > maxChange) {
+          maxChange = threadChange;
         }
       }
+      delete[] acc;
     }
-    //exportBelieves("believes_last");
 
+    potentialType* t = q;
+    q = qNew;
+    qNew = t;
+
+    INFERENCE_PRINT("[GI_MF] Iteration %d/%ld. Max belief change = %g\n",
+                    iter, maxiter, maxChange);
+    if(maxChange < tolerance) {
+      break;
+    }
+  }
+  INFERENCE_PRINT("[GI_MF] %d iterations. Max belief change = %g\n", iter, maxChange);
+
+  // pick max
+  for(int sid = 0; sid < nNodes; ++sid) {
+    const potentialType* qi = q + sid*nStates;
+    int label = -1;
+    for(int c = 0; c < nStates; c++) {
+      if(replaceVoidMSRC && (c == voidLabel || c == moutainLabel || c == horseLabel)) {
+        continue;
+      }
+      if(label == -1 || qi[c] > qi[label]) {
+        label = c;
+      }
+    }
+    inferredLabels[sid] = label;
   }
 
-  // cleaning
-  return computeEnergy(inferredLabels);
+  // keep the final beliefs at the beginning of the buffer
+  if(q != believes) {
+    for(int i = 0; i < nNodes*nStates; ++i) {
+      believes[i] = q[i];
+    }
+  }
 }
 
 void GI_MF::exportBelieves(const char* filename)
 {
   ofstream ofs(filename);
-  ulong nSupernodes = slice->getNbSupernodes();
-  for (uint sid = 0; sid < nSupernodes; ++sid) {
+  for (int sid = 0; sid < nNodes; ++sid) {
     ofs << sid;
-    for(int c = 0; c < param->nClasses; ++c) {
-      ofs << " " << believes[sid][c];
+    for(int c = 0; c < nStates; ++c) {
+      ofs << " " << believes[sid*nStates + c];
     }
     ofs << endl;
   }
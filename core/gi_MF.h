@@ -20,12 +20,37 @@
 
 #include "graphInference.h"
 #include "energyParam.h"
+#include "pairwiseKernel.h"
 
 #include <map>
 #include <vector>
 
 //------------------------------------------------------------------------------
 
+/**
+ * Mean-field inference.
+ * Unary potentials are precomputed into a contiguous nNodes x nClasses
+ * matrix and the pairwise terms into one table per edge class (gradient,
+ * orientation and distance indices), stored over a CSR adjacency.
+ *
+ * Nodes are updated in parallel with damped Jacobi updates of normalized
+ * beliefs : every node uses the beliefs of all its neighbors from the
+ * previous iteration. Iterations stop when the maximum absolute change of
+ * a belief (a probability) is below mf_tolerance (default 1e-4) or after
+ * maxiter iterations.
+ *
+ * mf_legacy_update selects the update rule of the previous implementation
+ * instead (sequential sweeps in increasing order of node id, only using
+ * the neighbors with a smaller id, stopped when the total score improves
+ * by less than 1). It converges to a different fixed point, so labels can
+ * differ between the two rules.
+ *
+ * Options (configuration file) :
+ * mf_legacy_update 1 to use the previous sequential rule (default 0)
+ * mf_damping       weight of the previous beliefs in [0,1[ (default 0.5)
+ * mf_tolerance     convergence threshold on the maximum belief change
+ *                  (default 1e-4)
+ */
 class GI_MF : public GraphInference
 {
  public:
@@ -49,13 +74,63 @@ class GI_MF : public GraphInference
              bool computeEnergyAtEachIteration = false,
              double* _loss = 0);
 
-  void setBelieves(double** _b) { believes = _b; ownBelievesBuffer = false; }
+  /**
+   * Use an external buffer of at least 2*nNodes*nClasses potentials to store
+   * the beliefs. The buffer is not freed by the destructor.
+   */
+  void setBelieves(potentialType* _b) { believes = _b; ownBelievesBuffer = false; }
 
  private:
+  void createGraph();
+
+  void computePotentials();
+
+  /**
+   * Update rule of the previous implementation (mf_legacy_update).
+   * Beliefs are unnormalized log-domain scores updated in place in
+   * increasing order of node id.
+   */
+  void runSequential(labelType* inferredLabels, size_t maxiter);
+
+  /**
+   * Damped Jacobi updates of normalized beliefs.
+   */
+  void runParallel(labelType* inferredLabels, size_t maxiter);
+
   void exportBelieves(const char* filename);
 
+  int nNodes;
+  int nStates;
+
+  // CSR adjacency. tableIdxs[e] is the index of the pairwise table
+  // used for the entry e, oriented so that the rows correspond to the
+  // labels of the node owning the entry.
+  ulong* offsets;
+  sidType* neighbors;
+  int* tableIdxs;
+  int nTables;
+  PairwiseKernel* kernel;
+
+  // nTables*nStates*nStates scaled pairwise scores, indexed by
+  // label(neighbor)*nStates + label(node owning the entry)
+  potentialType* pairwisePotentials;
+  // nNodes*nStates scaled unary scores (including loss)
+  potentialType* unaryPotentials;
+  // scale applied to all the potentials
+  double scale;
+
   bool ownBelievesBuffer;
-  double** believes;
+  // 2*nNodes*nStates probabilities (current and next iteration)
+  potentialType* believes;
+
+  bool legacyUpdate;
+  double damping;
+  double tolerance;
+
+  bool replaceVoidMSRC;
+  labelType voidLabel;
+  labelType moutainLabel;
+  labelType horseLabel;
 };
 
 #endif // GI_MF_H
@@ -42,31 +42,15 @@ MRF::CostVal dCost(int pix, int i, void* ptr)
   return gi->unaryCosts[pix][i];
 }
 
+/**
+ * Only used if the pairwise cost depends on the gradient class of the edge.
+ * Other cases use a label-pair table (see createSmoothnessCost).
+ */
 MRF::CostVal fnCost(int pix1, int pix2, int i, int j, void* ptr)
 {
   GI_MRF* gi = (GI_MRF*) ptr;
-
-  if(!gi->param->includeLocalEdges)
-    return 1;
-
-  // compute index associated to edge (pix1, pix2)
-  int edgeIdx = pix1*gi->nNodes + pix2;
-  //INFERENCE_PRINT("edge %d %d %d %d\n",pix1,pix2,edgeIdx,gi->edgeIdxToEdgeType[edgeIdx]);
-  // compute index associated to the pair of labels (i,j)
-  int labelIdx;
-
-  MRF::CostVal cost;
-  if(gi->param->nGradientLevels == 0) {
-    if(i == j) // different labels
-      cost = gi->pairwiseCosts_Local[0][0];
-    else
-      cost = 0; // labels are the same
-  } else {
-    labelIdx = i*gi->param->nClasses + j;
-    cost = gi->pairwiseCosts_Local[gi->edgeIdxToGradientIdx[edgeIdx]][labelIdx];
-  }
-
-  return cost;
+  return gi->pairwiseCosts_Local[gi->getGradientClass(pix1, pix2)*gi->nPairwiseStates
+                                 + i*gi->param->nClasses + j];
 }
 
 //------------------------------------------------------------------------------
@@ -90,6 +74,10 @@ GI_MRF::GI_MRF(Slice_P* _slice,
 
   mrf = 0;
   useQPBO = false;
+  smoothCosts = 0;
+  edgeOffsets = 0;
+  edgeNeighbors = 0;
+  edgeGradientClasses = 0;
   nNodes = slice->getNbSupernodes(); // local nodes
   nEdges = slice->getNbEdges(); // edges between local nodes
 
@@ -106,18 +94,59 @@ GI_MRF::GI_MRF(Slice_P* _slice,
     nPairwiseStates = 0;
   }
 
+  cost = 0;
+  lossPerLabelRescaled = 0;
+  computeCosts();
+
+  createGraph();
+}
+
+GI_MRF::~GI_MRF()
+{
+  for(int i=0; i < nNodes; i++)
+    delete[] unaryCosts[i];
+  delete[] unaryCosts;
+
+  if(mrf)
+    delete mrf;
+  if(cost)
+    delete[] cost;
+  if(lossPerLabelRescaled)
+    delete[] lossPerLabelRescaled;
+
+  if(pairwiseCosts_Local)
+    delete[] pairwiseCosts_Local;
+  if(smoothCosts)
+    delete[] smoothCosts;
+  if(edgeOffsets)
+    delete[] edgeOffsets;
+  if(edgeNeighbors)
+    delete[] edgeNeighbors;
+  if(edgeGradientClasses)
+    delete[] edgeGradientClasses;
+
+  if(data)
+    delete data;
+  if(smooth)
+    delete smooth;
+  if(energy)
+    delete energy;
+}
+
+void GI_MRF::computeCosts()
+{
   // add +1 causes indices start at 1
   int sizePsi = (param->nOrientations*param->nGradientLevels*param->nClasses*param->nClasses) + (param->nGradientLevels==0 && param->includeLocalEdges) + param->nUnaryWeights + param->nScalingCoefficients;
   INFERENCE_PRINT("[GI_MRF] param->nOrientations=%d, param->nGradientLevels=%d, param->nClasses=%d, sizePsi = %d\n",
          param->nOrientations, param->nGradientLevels, param->nClasses, sizePsi);
 
-  double w_min = _smw[0];
-  double w_max = _smw[0];
+  double w_min = smw[0];
+  double w_max = smw[0];
   for(int i=1; i< sizePsi; i++) {
-    if(w_min > _smw[i])
-      w_min = _smw[i];
-    if(w_max < _smw[i])
-      w_max = _smw[i];
+    if(w_min > smw[i])
+      w_min = smw[i];
+    if(w_max < smw[i])
+      w_max = smw[i];
     }
   
   // negate : cost = -score
@@ -128,11 +157,13 @@ GI_MRF::GI_MRF(Slice_P* _slice,
   double t;
 #endif
 
-  cost = new energyType[sizePsi];
+  if(cost == 0) {
+    cost = new energyType[sizePsi];
+  }
   for(int i=0; i< sizePsi; i++) {
 
 #ifdef SHIFT_AND_RESCALE_W
-      t = -_smw[i]; // negate
+      t = -smw[i]; // negate
       t -= c_min;  //shift so that min value is 0
       if(c_diff != 0)
         t /= c_diff;  //rescale
@@ -141,7 +172,7 @@ GI_MRF::GI_MRF(Slice_P* _slice,
       // REMOVE THIS WITH DOUBLES !
       assert(cost[i]>=0);
 #else
-      cost[i] = -_smw[i]*MAX_COST;
+      cost[i] = -smw[i]*MAX_COST;
 #endif
     }
 
@@ -150,19 +181,21 @@ GI_MRF::GI_MRF(Slice_P* _slice,
 #ifdef DEBUG
   INFERENCE_PRINT("[gi_MRF] w\n");
   for(int i=0; i< sizePsi; i++)
-    if(_smw[i] != 0)
-      INFERENCE_PRINT("%d:%g ", i, _smw[i]);
+    if(smw[i] != 0)
+      INFERENCE_PRINT("%d:%g ", i, smw[i]);
   INFERENCE_PRINT("\n");
   INFERENCE_PRINT("[gi_MRF] cost\n");
   for(int i=0; i< sizePsi; i++)
-    if(_smw[i] != 0)
+    if(smw[i] != 0)
       INFERENCE_PRINT("%d:%g ", i, (double)cost[i]);
   INFERENCE_PRINT("\n");
 #endif
 
   if(lossPerLabel)
     {
-      lossPerLabelRescaled = new energyType[param->nClasses];
+      if(lossPerLabelRescaled == 0) {
+        lossPerLabelRescaled = new energyType[param->nClasses];
+      }
       for(int c=0; c < (int)param->nClasses; c++)
         {
 
@@ -192,44 +225,16 @@ GI_MRF::GI_MRF(Slice_P* _slice,
   else
     {
       INFERENCE_PRINT("[gi_MRF] No loss specified\n");
-      lossPerLabelRescaled = 0;
+      if(lossPerLabelRescaled) {
+        delete[] lossPerLabelRescaled;
+        lossPerLabelRescaled = 0;
+      }
     }
-
-  createGraph();
-}
-
-GI_MRF::~GI_MRF()
-{
-  for(int i=0; i < nNodes; i++)
-    delete[] unaryCosts[i];
-  delete[] unaryCosts;
-
-  if(mrf)
-    delete mrf;
-  if(cost)
-    delete[] cost;
-  if(lossPerLabelRescaled)
-    delete[] lossPerLabelRescaled;
-
-  if(pairwiseCosts_Local) {
-    for(int i=0; i < nPairwiseCosts_Local; i++)
-      delete[] pairwiseCosts_Local[i];
-    delete[] pairwiseCosts_Local;
-  } 
-
-  if(data)
-    delete data;
-  if(smooth)
-    delete smooth;
-  if(energy)
-    delete energy;
 }
 
 void GI_MRF::createGraph()
 {
   data = new DataCost(dCost);  
-  smooth = new SmoothnessCost(fnCost); 
-  energy = new EnergyFunction(data,smooth);
 
   // nNodes*nClasses table that contains unary costs for global and local nodes
   unaryCosts = new energyType*[nNodes];
@@ -237,13 +242,23 @@ void GI_MRF::createGraph()
     unaryCosts[i] = new energyType[param->nClasses];
 
   if(param->includeLocalEdges) {
-    pairwiseCosts_Local = new energyType*[nPairwiseCosts_Local];
-    for(int i=0; i < nPairwiseCosts_Local; i++)
-      pairwiseCosts_Local[i] = new energyType[nPairwiseStates];
+    pairwiseCosts_Local = new energyType[nPairwiseCosts_Local*nPairwiseStates];
   } else {
     pairwiseCosts_Local = 0;
   }
 
+  if(param->includeLocalEdges) {
+    createEdgeTable();
+  }
+
+  updateCosts();
+
+  createSmoothnessCost();
+  energy = new EnergyFunction(data,smooth);
+}
+
+void GI_MRF::updateCosts()
+{
   minUnaryCost = INT_MAX;
   minPairwiseCost = INT_MAX;
 
@@ -270,15 +285,17 @@ void GI_MRF::createGraph()
   if(minCost < 0) {
     INFERENCE_PRINT("[gi_MRF] min cost for local edges is negative (%g). Shifting all the values...\n", (double)minCost);
     // shift costs so that all values are positives !
-    for(int i=0; i < nPairwiseCosts_Local; i++)
-      for(int c=0; c < nPairwiseStates; c++) {
-        pairwiseCosts_Local[i][c] += offset;
-      }
+    for(int i=0; i < nPairwiseCosts_Local*nPairwiseStates; i++)
+      pairwiseCosts_Local[i] += offset;
   }
   else {
     INFERENCE_PRINT("[gi_MRF] min cost for local edges is positive (%g)\n",(double)minCost);
   }
 
+  if(smoothCosts) {
+    fillSmoothCosts();
+  }
+
 #ifdef DEBUG2
   INFERENCE_PRINT("[gi_MRF] Unary costs (%dx%d):\n",nNodes,param->nClasses);
   for(int i=0; i < nNodes; i++)
@@ -297,7 +314,7 @@ void GI_MRF::createGraph()
       INFERENCE_PRINT("%d:", i);
       for(int s=0; s < nPairwiseStates; s++)
         {
-          INFERENCE_PRINT(" %d:%e",s,(float)pairwiseCosts_Local[i][s]);
+          INFERENCE_PRINT(" %d:%e",s,(float)pairwiseCosts_Local[i*nPairwiseStates+s]);
         }
       INFERENCE_PRINT("\n");
     }
@@ -401,46 +418,79 @@ void GI_MRF::addLocalEdges()
   }
 }
 
-void GI_MRF::precomputeEdgeCosts()
+void GI_MRF::createEdgeTable()
 {
-  uint edgeIdx;
-  uint gradientIdx;
   int pix1, pix2; // pixel ids
-  int orientationIdx = 0;
+  orientationIdx = 0;
 
   // edges between local nodes
 
-  // Go over all the edges and compute the gradient
+  // Go over all the edges and store the gradient class of each edge in a
+  // CSR table (rows sorted by neighbor id) so that the smoothness callback
+  // does not have to search a map.
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
-  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-      its != _supernodes.end(); its++) {
-    vector < supernode* >* lNeighbors = &(its->second->neighbors);
-    pix1 = its->first;
+  if(param->nGradientLevels > 1) {
+    edgeOffsets = new ulong[nNodes+1];
+    ulong nEntries = 0;
+    for(int i = 0; i < nNodes; ++i) {
+      edgeOffsets[i] = nEntries;
+      map<int, supernode* >::const_iterator its = _supernodes.find(i);
+      if(its != _supernodes.end()) {
+        nEntries += its->second->neighbors.size();
+      }
+    }
+    edgeOffsets[nNodes] = nEntries;
+
+    edgeNeighbors = new sidType[nEntries];
+    edgeGradientClasses = new unsigned short[nEntries];
+    vector< pair<sidType, int> > row;
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      vector < supernode* >* lNeighbors = &(its->second->neighbors);
+      pix1 = its->first;
+
+      row.clear();
+      for(vector < supernode* >::iterator itN = lNeighbors->begin();
+          itN != lNeighbors->end(); itN++) {
+        pix2 = (*itN)->id;
+        row.push_back(pair<sidType, int>(pix2, slice->getGradientIdx(pix1,pix2)));
+        // the last orientation index is used for all the tables (see below)
+        if(pix1 > pix2) {
+          orientationIdx = slice->getOrientationIdx(pix1, pix2);
+        }
+      }
+      sort(row.begin(), row.end());
 
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
-      // set edges once
-      if(its->first < (*itN)->id) {
-        continue;
+      ulong e = edgeOffsets[pix1];
+      for(vector< pair<sidType, int> >::iterator itR = row.begin();
+          itR != row.end(); ++itR, ++e) {
+        edgeNeighbors[e] = itR->first;
+        edgeGradientClasses[e] = (unsigned short)itR->second;
+      }
+    }
+  } else if(param->nGradientLevels == 1) {
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      vector < supernode* >* lNeighbors = &(its->second->neighbors);
+      for(vector < supernode* >::iterator itN = lNeighbors->begin();
+          itN != lNeighbors->end(); itN++) {
+        if(its->first > (*itN)->id) {
+          orientationIdx = slice->getOrientationIdx(its->first, (*itN)->id);
+        }
       }
-        
-      pix2 = (*itN)->id;
-
-      gradientIdx = slice->getGradientIdx(pix1,pix2);
-      orientationIdx = slice->getOrientationIdx(pix1, pix2);
-        
-      edgeIdx = pix1*nNodes + pix2;
-      edgeIdxToGradientIdx[edgeIdx] = gradientIdx;
     }
   }
+}
 
+void GI_MRF::precomputeEdgeCosts()
+{
   if(param->nGradientLevels == 0) {
     if(param->includeLocalEdges) {
-      pairwiseCosts_Local[0][0] = cost[param->nUnaryWeights]; //param->nUnaryWeights = offset unary terms
-      INFERENCE_PRINT("pairwiseCosts_Local[0][0] %g\n", pairwiseCosts_Local[0][0]);
+      pairwiseCosts_Local[0] = cost[param->nUnaryWeights]; //param->nUnaryWeights = offset unary terms
+      INFERENCE_PRINT("pairwiseCosts_Local[0][0] %g\n", pairwiseCosts_Local[0]);
     }
     else {
-      pairwiseCosts_Local[0][0] = 0;
+      pairwiseCosts_Local[0] = 0;
     }
   } else {
     // Compute cost (param->nClasses*param->nClasses table) for each gradient
@@ -456,19 +506,83 @@ void GI_MRF::precomputeEdgeCosts()
             _idx = (dg*nPairwiseStates*param->nOrientations) + (orientationIdx*nPairwiseStates) + labelIdx;
             w_sum += cost[_idx+param->nUnaryWeights]; //param->nUnaryWeights = offset unary terms
           }
-          pairwiseCosts_Local[g][labelIdx] = w_sum;
-          //printf("pairwiseCosts_Local[%d][%d] %g\n", g, labelIdx, pairwiseCosts_Local[g][labelIdx]);
+          pairwiseCosts_Local[g*nPairwiseStates + labelIdx] = w_sum;
+          //printf("pairwiseCosts_Local[%d][%d] %g\n", g, labelIdx, pairwiseCosts_Local[g*nPairwiseStates + labelIdx]);
         }
       }
     }
   }
 
   // Shift pairwiseCosts_Local
-  for(int i=0; i < nPairwiseCosts_Local; i++)
-    for(int c=0; c < nPairwiseStates; c++) {
-      if(pairwiseCosts_Local[i][c] < minPairwiseCost)
-        minPairwiseCost = pairwiseCosts_Local[i][c];
+  for(int i=0; i < nPairwiseCosts_Local*nPairwiseStates; i++) {
+    if(pairwiseCosts_Local[i] < minPairwiseCost)
+      minPairwiseCost = pairwiseCosts_Local[i];
+  }
+}
+
+void GI_MRF::createSmoothnessCost()
+{
+  if(param->includeLocalEdges && param->nGradientLevels > 1) {
+    smooth = new SmoothnessCost(fnCost);
+    return;
+  }
+
+  // The pairwise term is the same for all the edges : pass a
+  // nClasses*nClasses table to the MRF library (edges are added with a
+  // weight of 1).
+  smoothCosts = new MRF::CostVal[param->nClasses*param->nClasses];
+  fillSmoothCosts();
+  smooth = new SmoothnessCost(smoothCosts);
+}
+
+void GI_MRF::fillSmoothCosts()
+{
+  int nClasses = param->nClasses;
+  for(int i = 0; i < nClasses; i++) {
+    for(int j = 0; j < nClasses; j++) {
+      if(!param->includeLocalEdges) {
+        smoothCosts[i*nClasses+j] = 0;
+      } else if(param->nGradientLevels == 0) {
+        // Potts model
+        smoothCosts[i*nClasses+j] = (i == j)?pairwiseCosts_Local[0]:0;
+      } else {
+        smoothCosts[i*nClasses+j] = pairwiseCosts_Local[i*nClasses+j];
+      }
     }
+  }
+}
+
+bool GI_MRF::isCompatible(const EnergyParam* _param)
+{
+  return (_param->nClasses == param->nClasses &&
+          _param->includeLocalEdges == param->includeLocalEdges &&
+          _param->nGradientLevels == param->nGradientLevels &&
+          _param->nOrientations == param->nOrientations &&
+          _param->nUnaryWeights == param->nUnaryWeights &&
+          _param->nScalingCoefficients == param->nScalingCoefficients);
+}
+
+void GI_MRF::updateParameters(const EnergyParam* _param,
+                              double* _smw,
+                              labelType* _groundTruthLabels,
+                              double* _lossPerLabel,
+                              Feature* _feature)
+{
+  if(!isCompatible(_param)) {
+    printf("[GI_MRF] Error : parameters are not compatible with the current graph\n");
+    exit(-1);
+  }
+
+  param = _param;
+  smw = _smw;
+  groundTruthLabels = _groundTruthLabels;
+  lossPerLabel = _lossPerLabel;
+  feature = _feature;
+
+  // neighbors and gradient classes do not change, only the cost arrays
+  // read by the MRF library have to be refreshed.
+  computeCosts();
+  updateCosts();
 }
 
 double GI_MRF::run(labelType* inferredLabels,
@@ -478,9 +592,12 @@ double GI_MRF::run(labelType* inferredLabels,
                    bool computeEnergyAtEachIteration,
                    double* _loss)
 {
-  if(mrf) {
-    INFERENCE_PRINT("[GI_MRF] MRF already instantiated\n");
-    exit(-1);
+  bool warmStart = (mrf != 0);
+  if(warmStart) {
+    // The MRF library reads the cost arrays through pointers so the
+    // instance created by the first call can be reused. Start from the
+    // labeling found by the previous call.
+    INFERENCE_PRINT("[GI_MRF] Reusing MRF instance\n");
   } else {
     // Assumes all the nodes have the same number of labels
     // Since the global nodes have less labels than the local nodes,
@@ -494,11 +611,13 @@ double GI_MRF::run(labelType* inferredLabels,
     }
   }
 
-  mrf->initialize();
-  mrf->clearAnswer();
+  if(!warmStart) {
+    mrf->initialize();
+    mrf->clearAnswer();
+  }
 
   if(useQPBO) {
-    INFERENCE_PRINT("[GI_MRF] setUseQPBO to true, %d edges\n", nEdges);
+    INFERENCE_PRINT("[GI_MRF] setUseQPBO to true, %ld edges\n", nEdges);
     ((Expansion*)mrf)->setUseQPBO(true,2*nEdges);
     INFERENCE_PRINT("[GI_MRF] setProbing to true\n");
     ((Expansion*)mrf)->setUseProbing(true);
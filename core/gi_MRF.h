@@ -23,6 +23,7 @@
 #include "GCoptimization.h"
 //#include "MaxProdBP.h"
 
+#include <algorithm>
 #include <map>
 #include <vector>
 
@@ -52,8 +53,50 @@ class GI_MRF : public GraphInference
   void createGraph();
 
   void addUnaryNodes();
+
+  /**
+   * Compute the cost vector from the weight vector and rescale the loss
+   */
+  void computeCosts();
+
+  /**
+   * Store the gradient class of each edge. Only called once per graph.
+   */
+  void createEdgeTable();
+
   void precomputeEdgeCosts();
 
+  /**
+   * Recompute unary and pairwise costs from the cost vector
+   */
+  void updateCosts();
+
+  /**
+   * Returns true if the instance can be reused with the given parameters,
+   * i.e. the size of the cost tables does not change.
+   */
+  bool isCompatible(const EnergyParam* _param);
+
+  /**
+   * Update weights and loss so that run can be called again on the same
+   * graph. The neighbor system and the MRF instance are kept and the next
+   * call to run starts from the previous labeling.
+   */
+  void updateParameters(const EnergyParam* _param,
+                        double* _smw,
+                        labelType* _groundTruthLabels,
+                        double* _lossPerLabel,
+                        Feature* _feature);
+
+  /**
+   * Create the smoothness term passed to the MRF library.
+   * A label-pair table is used if the pairwise cost does not depend on the
+   * edge, otherwise a callback that looks up the gradient class of the edge.
+   */
+  void createSmoothnessCost();
+
+  void fillSmoothCosts();
+
   double run(labelType* inferredLabels,
              int id,
              size_t maxiter,
@@ -64,16 +107,27 @@ class GI_MRF : public GraphInference
   energyType* lossPerLabelRescaled;
 
   int nNodes; // total number of nodes in the graph (local and global nodes)
-  int nEdges;
+  ulong nEdges;
 
   // Costs for graph nodes and edges are precomputed
   // and store in those 2 arrays for efficiency reasons
   energyType** unaryCosts;
-  energyType** pairwiseCosts_Local; // cost associated to each gradient : nPairwiseCosts*nPairwiseStates
+  // cost associated to each gradient : nPairwiseCosts_Local tables of
+  // nPairwiseStates label pairs stored contiguously
+  energyType* pairwiseCosts_Local;
   int nPairwiseCosts_Local;
   int nPairwiseStates;
 
-  map<uint,uint> edgeIdxToGradientIdx;
+  /**
+   * Gradient class of the edge (pix1,pix2).
+   * Neighbors of each node are stored in increasing order (CSR format) so
+   * the class is found with a binary search in the row of pix1.
+   */
+  inline int getGradientClass(int pix1, int pix2) {
+    const sidType* first = edgeNeighbors + edgeOffsets[pix1];
+    const sidType* last = edgeNeighbors + edgeOffsets[pix1+1];
+    return edgeGradientClasses[std::lower_bound(first, last, pix2) - edgeNeighbors];
+  }
 
   void setUseQPBO(bool _val) { useQPBO = _val; }
 
@@ -83,6 +137,15 @@ class GI_MRF : public GraphInference
   DataCost *data;
   SmoothnessCost *smooth;
 
+  // label-pair cost table passed to the MRF library when the pairwise term
+  // does not depend on the edge (nGradientLevels <= 1)
+  MRF::CostVal* smoothCosts;
+
+  // per-edge gradient classes (CSR format, both directions are stored)
+  ulong* edgeOffsets;
+  sidType* edgeNeighbors;
+  unsigned short* edgeGradientClasses;
+
   /**
    * Store the cost computed from the w vector
    */
@@ -91,5 +154,8 @@ class GI_MRF : public GraphInference
   energyType minUnaryCost;
   energyType minPairwiseCost;
 
+  // orientation used for the pairwise tables
+  int orientationIdx;
+
   bool useQPBO;
 };
\ No newline at end of file
@@ -0,0 +1,753 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "gi_hierarchical.h"
+
+// SliceMe
+#include "Config.h"
+#include "inference.h"
+#include "utils.h"
+
+#include "inference_globals.h"
+
+#include <algorithm>
+#include <deque>
+#include <float.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#include "gettimeofday.h"
+#else
+#include <sys/time.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+// stop coarsening when a level does not remove at least 10% of the nodes
+#define HIERARCHICAL_MIN_REDUCTION 0.9
+
+// minimum score improvement required to change a label during refinement
+#define HIERARCHICAL_EPSILON 1e-10
+
+// maximum number of fine supernodes merged into a coarse supernode
+#define HIERARCHICAL_DEFAULT_GROUP_SIZE 4
+
+//------------------------------------------------------------------------------
+
+struct coarseEdge
+{
+  float coeff;
+  map<int, float> gradientVotes;
+  // orientation from the coarse supernode with the largest id to the one
+  // with the smallest id and reverse
+  map<int, float> orientationVotes;
+  map<int, float> reverseOrientationVotes;
+  map<int, float> distanceVotes;
+
+  coarseEdge() { coeff = 0; }
+};
+
+static double getElapsedTime(const struct timeval& start)
+{
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)*1e-6;
+}
+
+static int getMajorityVote(const map<int, float>& votes)
+{
+  int idx = 0;
+  float maxVote = -1;
+  for(map<int, float>::const_iterator it = votes.begin();
+      it != votes.end(); ++it) {
+    if(it->second > maxVote) {
+      maxVote = it->second;
+      idx = it->first;
+    }
+  }
+  return idx;
+}
+
+//------------------------------------------------------------------------------
+
+Slice_Coarse::Slice_Coarse(Slice_P* _fineSlice,
+                           const EnergyParam* _param,
+                           map<sidType, nodeCoeffType>* fineNodeCoeffs,
+                           map<sidType, edgeCoeffType>* fineEdgeCoeffs,
+                           int maxMergeGradientIdx,
+                           int maxGroupSize)
+{
+  fineSlice = _fineSlice;
+  supernode_step = fineSlice->getSupernodeStep();
+  cubeness = fineSlice->getCubeness();
+  nLabels = fineSlice->getNbLabels();
+  feature_size = fineSlice->getFeatureSize();
+  inputDir = fineSlice->inputDir;
+
+  bool useGradients = _param->nGradientLevels > 0;
+  const map<sidType, supernode* >& fineSupernodes = fineSlice->getSupernodes();
+  int nFineNodes = fineSlice->getNbSupernodes();
+  parents.resize(nFineNodes, -1);
+
+  // grow a group from each unmatched supernode by repeatedly adding the
+  // unmatched neighbor of the group separated by the weakest boundary
+  sidType nCoarseNodes = 0;
+  // neighbors of the current group and gradient index of the boundary
+  vector< pair<int, sidType> > candidates;
+  for(map<sidType, supernode* >::const_iterator it = fineSupernodes.begin();
+      it != fineSupernodes.end(); ++it) {
+    sidType sid = it->first;
+    if(parents[sid] != -1) {
+      continue;
+    }
+
+    parents[sid] = nCoarseNodes;
+    children.push_back(vector<sidType>(1, sid));
+    vector<sidType>& group = children.back();
+    candidates.clear();
+    while((int)group.size() < maxGroupSize) {
+      // add the neighbors of the last member
+      sidType gsid = group.back();
+      supernode* gs = fineSlice->getSupernode(gsid);
+      for(vector<supernode*>::iterator itN = gs->neighbors.begin();
+          itN != gs->neighbors.end(); ++itN) {
+        sidType nsid = (*itN)->id;
+        if(parents[nsid] != -1) {
+          continue;
+        }
+#if USE_LONG_RANGE_EDGES
+        // only merge adjacent supernodes
+        if(fineSlice->getDistanceIdx(gsid, nsid) != 0) {
+          continue;
+        }
+#endif
+        int gradientIdx = useGradients?fineSlice->getGradientIdx(gsid, nsid):0;
+        if(maxMergeGradientIdx != -1 && gradientIdx > maxMergeGradientIdx) {
+          continue;
+        }
+        candidates.push_back(make_pair(gradientIdx, nsid));
+      }
+
+      // first unmatched candidate with the smallest gradient index
+      int bestCandidate = -1;
+      int bestGradientIdx = INT_MAX;
+      for(int c = 0; c < (int)candidates.size(); ++c) {
+        if(parents[candidates[c].second] == -1 &&
+           candidates[c].first < bestGradientIdx) {
+          bestGradientIdx = candidates[c].first;
+          bestCandidate = c;
+        }
+      }
+      if(bestCandidate == -1) {
+        break;
+      }
+      sidType bestSid = candidates[bestCandidate].second;
+      parents[bestSid] = nCoarseNodes;
+      group.push_back(bestSid);
+    }
+
+    supernode* s = new supernode;
+    s->id = nCoarseNodes;
+    supernodes[nCoarseNodes] = s;
+    ++nCoarseNodes;
+  }
+
+  // features and node coefficients
+  for(sidType cid = 0; cid < nCoarseNodes; ++cid) {
+    const vector<sidType>& c = children[cid];
+    osvm_node* n0 = fineSlice->getFeature(c[0]);
+    int fvSize = 0;
+    while(n0[fvSize].index != -1) {
+      ++fvSize;
+    }
+    osvm_node* n = new osvm_node[fvSize+1];
+    for(int f = 0; f <= fvSize; ++f) {
+      n[f].index = n0[f].index;
+      n[f].value = 0;
+    }
+    double coeffSum = 0;
+    for(vector<sidType>::const_iterator itC = c.begin(); itC != c.end(); ++itC) {
+      double coeff = fineNodeCoeffs?(*fineNodeCoeffs)[*itC]:1.0;
+      osvm_node* nc = fineSlice->getFeature(*itC);
+      for(int f = 0; f < fvSize; ++f) {
+        n[f].value += coeff*nc[f].value;
+      }
+      coeffSum += coeff;
+    }
+    if(coeffSum > 0) {
+      for(int f = 0; f < fvSize; ++f) {
+        n[f].value /= coeffSum;
+      }
+    }
+    features[cid] = n;
+    nodeCoeffs[cid] = coeffSum;
+  }
+
+  // accumulate the fine edges between different coarse supernodes
+  map<ulong, coarseEdge> coarseEdges;
+  ulong edgeId = 0;
+  for(map<sidType, supernode* >::const_iterator it = fineSupernodes.begin();
+      it != fineSupernodes.end(); ++it) {
+    for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+        itN != it->second->neighbors.end(); ++itN) {
+      // same edge order as in GraphInference::computeEnergy
+      if(it->first < (*itN)->id) {
+        continue;
+      }
+      sidType sid = it->first;
+      sidType nsid = (*itN)->id;
+      float coeff = fineEdgeCoeffs?(*fineEdgeCoeffs)[edgeId]:1.0f;
+      ++edgeId;
+
+      sidType cid = parents[sid];
+      sidType ncid = parents[nsid];
+      if(cid == ncid) {
+        continue;
+      }
+
+      sidType maxCid = max(cid, ncid);
+      sidType minCid = min(cid, ncid);
+      coarseEdge& e = coarseEdges[(ulong)maxCid*nCoarseNodes + minCid];
+      e.coeff += coeff;
+      if(useGradients) {
+        e.gradientVotes[fineSlice->getGradientIdx(sid, nsid)] += coeff;
+      }
+      if(cid > ncid) {
+        e.orientationVotes[fineSlice->getOrientationIdx(sid, nsid)] += coeff;
+        e.reverseOrientationVotes[fineSlice->getOrientationIdx(nsid, sid)] += coeff;
+      } else {
+        e.orientationVotes[fineSlice->getOrientationIdx(nsid, sid)] += coeff;
+        e.reverseOrientationVotes[fineSlice->getOrientationIdx(sid, nsid)] += coeff;
+      }
+#if USE_LONG_RANGE_EDGES
+      e.distanceVotes[fineSlice->getDistanceIdx(sid, nsid)] += coeff;
+#endif
+    }
+  }
+
+  for(map<ulong, coarseEdge>::iterator it = coarseEdges.begin();
+      it != coarseEdges.end(); ++it) {
+    sidType maxCid = it->first/nCoarseNodes;
+    sidType minCid = it->first%nCoarseNodes;
+    supernodes[maxCid]->addNeighbor(supernodes[minCid]);
+    supernodes[minCid]->addNeighbor(supernodes[maxCid]);
+
+    ulong coarseEdgeId = getEdgeId(maxCid, minCid);
+    if(useGradients) {
+      gradientIdxs[coarseEdgeId] = getMajorityVote(it->second.gradientVotes);
+    }
+#if USE_LONG_RANGE_EDGES
+    distanceIdxs[coarseEdgeId] = getMajorityVote(it->second.distanceVotes);
+#endif
+    orientationIdxs[getDirectedEdgeId(maxCid, minCid)] = getMajorityVote(it->second.orientationVotes);
+    orientationIdxs[getDirectedEdgeId(minCid, maxCid)] = getMajorityVote(it->second.reverseOrientationVotes);
+  }
+
+  // edge coefficients, indexed in the order used by computeEnergy
+  nbEdges = 0;
+  edgeId = 0;
+  for(map<sidType, supernode* >::const_iterator it = supernodes.begin();
+      it != supernodes.end(); ++it) {
+    nbEdges += it->second->neighbors.size();
+    for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+        itN != it->second->neighbors.end(); ++itN) {
+      if(it->first < (*itN)->id) {
+        continue;
+      }
+      edgeCoeffs[edgeId] = coarseEdges[(ulong)it->first*nCoarseNodes + (*itN)->id].coeff;
+      ++edgeId;
+    }
+  }
+}
+
+Slice_Coarse::~Slice_Coarse()
+{
+  for(map<sidType, supernode* >::iterator it = supernodes.begin();
+      it != supernodes.end(); ++it) {
+    delete it->second;
+  }
+}
+
+void Slice_Coarse::exportOverlay(const char* filename)
+{
+  fineSlice->exportOverlay(filename);
+}
+
+void Slice_Coarse::exportOverlay(const char* filename, labelType* labels)
+{
+  ulong nFineNodes = parents.size();
+  labelType* fineLabels = new labelType[nFineNodes];
+  for(ulong sid = 0; sid < nFineNodes; ++sid) {
+    fineLabels[sid] = labels[parents[sid]];
+  }
+  fineSlice->exportOverlay(filename, fineLabels);
+  delete[] fineLabels;
+}
+
+void Slice_Coarse::exportProbabilities(const char* filename, int nClasses,
+                                       float* pbs)
+{
+  printf("[Slice_Coarse] exportProbabilities is not supported\n");
+}
+
+void Slice_Coarse::exportSupernodeLabels(const char* filename, int nClasses,
+                                         labelType* labels,
+                                         int nLabels,
+                                         const map<labelType, ulong>* labelToClassIdx)
+{
+  ulong nFineNodes = parents.size();
+  labelType* fineLabels = new labelType[nFineNodes];
+  for(ulong sid = 0; sid < nFineNodes; ++sid) {
+    fineLabels[sid] = labels[parents[sid]];
+  }
+  fineSlice->exportSupernodeLabels(filename, nClasses, fineLabels,
+                                   nFineNodes, labelToClassIdx);
+  delete[] fineLabels;
+}
+
+void Slice_Coarse::generateSupernodeLabels(const char* fn_annotation,
+                                           bool includeBoundaryLabels,
+                                           bool useColorImages)
+{
+  printf("[Slice_Coarse] generateSupernodeLabels is not supported\n");
+}
+
+float Slice_Coarse::getAvgIntensity(sidType supernodeId)
+{
+  const vector<sidType>& c = children[supernodeId];
+  float avg = 0;
+  for(vector<sidType>::const_iterator it = c.begin(); it != c.end(); ++it) {
+    avg += fineSlice->getAvgIntensity(*it);
+  }
+  return avg/c.size();
+}
+
+float Slice_Coarse::getAvgIntensity(int supernodeId, int& r, int &g, int &b)
+{
+  const vector<sidType>& c = children[supernodeId];
+  float avg = 0;
+  int sr = 0;
+  int sg = 0;
+  int sb = 0;
+  for(vector<sidType>::const_iterator it = c.begin(); it != c.end(); ++it) {
+    avg += fineSlice->getAvgIntensity(*it, r, g, b);
+    sr += r;
+    sg += g;
+    sb += b;
+  }
+  r = sr/(int)c.size();
+  g = sg/(int)c.size();
+  b = sb/(int)c.size();
+  return avg/c.size();
+}
+
+probType Slice_Coarse::getProb(int sid, int label, int scale)
+{
+  const vector<sidType>& c = children[sid];
+  probType p = 0;
+  for(vector<sidType>::const_iterator it = c.begin(); it != c.end(); ++it) {
+    p += fineSlice->getProb(*it, label, scale);
+  }
+  return p/c.size();
+}
+
+//------------------------------------------------------------------------------
+
+GI_Hierarchical::GI_Hierarchical(Slice_P* _slice,
+                                 const EnergyParam* _param,
+                                 double* _smw,
+                                 labelType* _groundTruthLabels,
+                                 double* _lossPerLabel,
+                                 Feature* _feature,
+                                 map<sidType, nodeCoeffType>* _nodeCoeffs,
+                                 map<sidType, edgeCoeffType>* _edgeCoeffs)
+{
+  GraphInference::init();
+  slice = _slice;
+  param = _param;
+  smw = _smw;
+  lossPerLabel = _lossPerLabel;
+  groundTruthLabels = _groundTruthLabels;
+  feature = _feature;
+  nodeCoeffs = _nodeCoeffs;
+  edgeCoeffs = _edgeCoeffs;
+
+  int nMaxLevels = 3;
+  int maxMergeGradientIdx = -1;
+  int maxGroupSize = HIERARCHICAL_DEFAULT_GROUP_SIZE;
+  algoType = T_GI_BP;
+  margin = 0;
+  compareFlat = false;
+  string config_tmp;
+  if(Config::Instance()->getParameter("hierarchical_levels", config_tmp)) {
+    nMaxLevels = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("hierarchical_algo_type", config_tmp)) {
+    algoType = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("hierarchical_max_gradient", config_tmp)) {
+    maxMergeGradientIdx = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("hierarchical_margin", config_tmp)) {
+    margin = atof(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("hierarchical_group_size", config_tmp)) {
+    maxGroupSize = atoi(config_tmp.c_str());
+  }
+  if(Config::Instance()->getParameter("hierarchical_compare_flat", config_tmp)) {
+    compareFlat = config_tmp.c_str()[0] == '1';
+  }
+  if(maxGroupSize < 2) {
+    printf("[GI_Hierarchical] Error : hierarchical_group_size has to be at least 2\n");
+    exit(-1);
+  }
+  if(algoType == T_GI_HIERARCHICAL) {
+    printf("[GI_Hierarchical] Error : hierarchical_algo_type can not be %d\n",
+           T_GI_HIERARCHICAL);
+    exit(-1);
+  }
+
+  kernel = createPairwiseKernel(param);
+  pairwiseTables = new double[kernel->getNbEdgeClasses()*kernel->getNbPairwiseStates()];
+
+  Level level;
+  level.slice = slice;
+  level.nodeCoeffs = nodeCoeffs;
+  level.edgeCoeffs = edgeCoeffs;
+  level.groundTruthLabels = groundTruthLabels;
+  createLevel(level);
+  levels.push_back(level);
+
+  for(int l = 0; l < nMaxLevels; ++l) {
+    Level fine = levels.back();
+    Slice_Coarse* coarseSlice = new Slice_Coarse(fine.slice, param,
+                                                 fine.nodeCoeffs,
+                                                 fine.edgeCoeffs,
+                                                 maxMergeGradientIdx,
+                                                 maxGroupSize);
+    if(coarseSlice->getNbSupernodes() > HIERARCHICAL_MIN_REDUCTION*fine.nNodes) {
+      delete coarseSlice;
+      break;
+    }
+
+    Level coarse;
+    coarse.slice = coarseSlice;
+    coarse.nodeCoeffs = &coarseSlice->nodeCoeffs;
+    coarse.edgeCoeffs = &coarseSlice->edgeCoeffs;
+    coarse.groundTruthLabels = 0;
+    if(fine.groundTruthLabels) {
+      // majority label of the children
+      int nCoarseNodes = coarseSlice->getNbSupernodes();
+      coarse.groundTruthLabels = new labelType[nCoarseNodes];
+      vector<double> votes(param->nClasses);
+      for(sidType cid = 0; cid < nCoarseNodes; ++cid) {
+        fill(votes.begin(), votes.end(), 0);
+        const vector<sidType>& c = coarseSlice->getChildren(cid);
+        for(vector<sidType>::const_iterator it = c.begin(); it != c.end(); ++it) {
+          votes[fine.groundTruthLabels[*it]] += fine.nodeCoeffs?(*fine.nodeCoeffs)[*it]:1.0;
+        }
+        coarse.groundTruthLabels[cid] = max_element(votes.begin(), votes.end()) - votes.begin();
+      }
+    }
+    createLevel(coarse);
+    levels.push_back(coarse);
+
+    INFERENCE_PRINT("[GI_Hierarchical] Level %d : %d supernodes\n", l+1,
+                    coarse.nNodes);
+  }
+
+  // weights are owned by the caller and reset in the destructor
+  coarseParam = new EnergyParam(*param);
+  coarseParam->weights = smw;
+}
+
+GI_Hierarchical::~GI_Hierarchical()
+{
+  for(int l = 0; l < (int)levels.size(); ++l) {
+    delete[] levels[l].offsets;
+    delete[] levels[l].neighbors;
+    delete[] levels[l].edgeIds;
+    delete[] levels[l].edgeClasses;
+    if(l > 0) {
+      delete[] levels[l].groundTruthLabels;
+      delete static_cast<Slice_Coarse*>(levels[l].slice);
+    }
+  }
+  coarseParam->weights = 0;
+  delete coarseParam;
+  delete kernel;
+  delete[] pairwiseTables;
+}
+
+void GI_Hierarchical::createLevel(Level& level)
+{
+  Slice_P* s = level.slice;
+  level.nNodes = s->getNbSupernodes();
+  const map<sidType, supernode* >& _supernodes = s->getSupernodes();
+
+  // index of each undirected edge in the order used by computeEnergy
+  map<ulong, ulong> edgeIdxs;
+  ulong edgeId = 0;
+  ulong nEntries = 0;
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); ++it) {
+    nEntries += it->second->neighbors.size();
+    for(vector<supernode*>::iterator itN = it->second->neighbors.begin();
+        itN != it->second->neighbors.end(); ++itN) {
+      if(it->first < (*itN)->id) {
+        continue;
+      }
+      edgeIdxs[s->getEdgeId(it->first, (*itN)->id)] = edgeId;
+      ++edgeId;
+    }
+  }
+
+  level.offsets = new ulong[level.nNodes+1];
+  level.neighbors = new sidType[nEntries];
+  level.edgeIds = new ulong[nEntries];
+  level.edgeClasses = new int[nEntries];
+  // endpoints of the edge of each entry (largest sid first)
+  sidType* edgeSources = new sidType[nEntries];
+  sidType* edgeTargets = new sidType[nEntries];
+  ulong e = 0;
+  for(sidType sid = 0; sid < level.nNodes; ++sid) {
+    level.offsets[sid] = e;
+    supernode* sn = s->getSupernode(sid);
+    for(vector<supernode*>::iterator itN = sn->neighbors.begin();
+        itN != sn->neighbors.end(); ++itN) {
+      sidType nsid = (*itN)->id;
+      level.neighbors[e] = nsid;
+      level.edgeIds[e] = edgeIdxs[s->getEdgeId(sid, nsid)];
+      edgeSources[e] = max(sid, nsid);
+      edgeTargets[e] = min(sid, nsid);
+      ++e;
+    }
+  }
+  level.offsets[level.nNodes] = e;
+
+  kernel->computeEdgeClasses(s, nEntries, edgeSources, edgeTargets,
+                             level.edgeClasses);
+  delete[] edgeSources;
+  delete[] edgeTargets;
+}
+
+double GI_Hierarchical::computeLocalScore(const Level& level, sidType sid,
+                                          labelType label,
+                                          const labelType* labels)
+{
+  double score = 0;
+  if(param->nUnaryWeights != 1 || label != T_FOREGROUND) {
+    score = computeUnaryPotential(level.slice, sid, label);
+  }
+  if(lossPerLabel && level.groundTruthLabels &&
+     label != level.groundTruthLabels[sid]) {
+    score += lossPerLabel[level.groundTruthLabels[sid]];
+  }
+  if(level.nodeCoeffs) {
+    score *= (*level.nodeCoeffs)[sid];
+  }
+
+  if(!param->includeLocalEdges) {
+    return score;
+  }
+
+  // tables are indexed by label(max sid)*nClasses + label(min sid)
+  int nClasses = param->nClasses;
+  int nPairwiseStates = nClasses*nClasses;
+  for(ulong e = level.offsets[sid]; e < level.offsets[sid+1]; ++e) {
+    sidType nsid = level.neighbors[e];
+    const double* table = pairwiseTables + level.edgeClasses[e]*nPairwiseStates;
+    double w = (sid > nsid)?table[label*nClasses + labels[nsid]]:
+      table[labels[nsid]*nClasses + label];
+    if(level.edgeCoeffs) {
+      w *= (*level.edgeCoeffs)[level.edgeIds[e]];
+    }
+    score += w;
+  }
+  return score;
+}
+
+void GI_Hierarchical::computeMargins(const Level& level,
+                                     const labelType* labels,
+                                     double* margins)
+{
+  for(sidType sid = 0; sid < level.nNodes; ++sid) {
+    double score = computeLocalScore(level, sid, labels[sid], labels);
+    double maxOtherScore = -DBL_MAX;
+    for(int c = 0; c < (int)param->nClasses; ++c) {
+      if(c == labels[sid]) {
+        continue;
+      }
+      double s = computeLocalScore(level, sid, c, labels);
+      if(s > maxOtherScore) {
+        maxOtherScore = s;
+      }
+    }
+    margins[sid] = score - maxOtherScore;
+  }
+}
+
+ulong GI_Hierarchical::refine(const Level& level, labelType* labels,
+                              bool* active, size_t maxiter)
+{
+  deque<sidType> queue;
+  for(sidType sid = 0; sid < level.nNodes; ++sid) {
+    if(active[sid]) {
+      queue.push_back(sid);
+    }
+  }
+
+  // each node is visited at most maxiter times on average
+  ulong maxVisits = maxiter*(ulong)level.nNodes;
+  ulong nVisits = 0;
+  ulong nChanges = 0;
+  while(!queue.empty() && nVisits < maxVisits) {
+    sidType sid = queue.front();
+    queue.pop_front();
+    active[sid] = false;
+    ++nVisits;
+
+    labelType label = labels[sid];
+    labelType bestLabel = label;
+    double bestScore = computeLocalScore(level, sid, label, labels) + HIERARCHICAL_EPSILON;
+    for(int c = 0; c < (int)param->nClasses; ++c) {
+      if(c == label) {
+        continue;
+      }
+      double s = computeLocalScore(level, sid, c, labels);
+      if(s > bestScore) {
+        bestScore = s;
+        bestLabel = c;
+      }
+    }
+
+    if(bestLabel != label) {
+      labels[sid] = bestLabel;
+      ++nChanges;
+      for(ulong e = level.offsets[sid]; e < level.offsets[sid+1]; ++e) {
+        sidType nsid = level.neighbors[e];
+        if(!active[nsid]) {
+          active[nsid] = true;
+          queue.push_back(nsid);
+        }
+      }
+    }
+  }
+  return nChanges;
+}
+
+double GI_Hierarchical::run(labelType* inferredLabels,
+                            int id,
+                            size_t maxiter,
+                            labelType* nodeLabelsGroundTruth,
+                            bool computeEnergyAtEachIteration,
+                            double* _loss)
+{
+  int nLevels = levels.size();
+  const Level& coarsest = levels[nLevels-1];
+
+  struct timeval startTime;
+  gettimeofday(&startTime, NULL);
+
+  kernel->computeTables(smw, pairwiseTables);
+
+  // solve the coarsest level
+  labelType* labels = (nLevels == 1)?inferredLabels:new labelType[coarsest.nNodes];
+  GraphInference* gi = createGraphInferenceInstance(algoType, coarsest.slice,
+                                                    *coarseParam, feature,
+                                                    coarsest.groundTruthLabels,
+                                                    coarsest.groundTruthLabels?lossPerLabel:0,
+                                                    coarsest.nodeCoeffs,
+                                                    coarsest.edgeCoeffs);
+  gi->run(labels, id, maxiter);
+  delete gi;
+
+  // project the labels and refine boundary and uncertain regions
+  for(int l = nLevels-1; l > 0; --l) {
+    const Level& coarse = levels[l];
+    const Level& fine = levels[l-1];
+    Slice_Coarse* coarseSlice = static_cast<Slice_Coarse*>(coarse.slice);
+
+    double* margins = 0;
+    if(margin > 0) {
+      margins = new double[coarse.nNodes];
+      computeMargins(coarse, labels, margins);
+    }
+
+    labelType* fineLabels = (l == 1)?inferredLabels:new labelType[fine.nNodes];
+    bool* active = new bool[fine.nNodes];
+    for(sidType sid = 0; sid < fine.nNodes; ++sid) {
+      sidType cid = coarseSlice->getParent(sid);
+      fineLabels[sid] = labels[cid];
+      active[sid] = (margins && margins[cid] < margin);
+    }
+
+    ulong nActive = 0;
+    for(sidType sid = 0; sid < fine.nNodes; ++sid) {
+      if(!active[sid]) {
+        for(ulong e = fine.offsets[sid]; e < fine.offsets[sid+1]; ++e) {
+          if(fineLabels[fine.neighbors[e]] != fineLabels[sid]) {
+            active[sid] = true;
+            break;
+          }
+        }
+      }
+      if(active[sid]) {
+        ++nActive;
+      }
+    }
+
+    ulong nChanges = refine(fine, fineLabels, active, maxiter);
+
+    INFERENCE_PRINT("[GI_Hierarchical] Level %d : %ld/%d active supernodes, %ld label changes\n",
+                    l-1, nActive, fine.nNodes, nChanges);
+
+    delete[] labels;
+    delete[] active;
+    delete[] margins;
+    labels = fineLabels;
+  }
+
+  double energy = computeEnergy(inferredLabels);
+
+  if(compareFlat) {
+    double hierarchicalTime = getElapsedTime(startTime);
+
+    // same backend on the finest level only
+    gettimeofday(&startTime, NULL);
+    labelType* flatLabels = new labelType[levels[0].nNodes];
+    gi = createGraphInferenceInstance(algoType, slice, *coarseParam, feature,
+                                      groundTruthLabels, lossPerLabel,
+                                      nodeCoeffs, edgeCoeffs);
+    gi->run(flatLabels, id, maxiter);
+    delete gi;
+    double flatTime = getElapsedTime(startTime);
+    double flatEnergy = computeEnergy(flatLabels);
+
+    ulong nDifferentLabels = 0;
+    for(sidType sid = 0; sid < levels[0].nNodes; ++sid) {
+      if(flatLabels[sid] != inferredLabels[sid]) {
+        ++nDifferentLabels;
+      }
+    }
+    delete[] flatLabels;
+
+    printf("[GI_Hierarchical] %d levels : energy = %g, %g s. Flat (algo_type=%d) : energy = %g, %g s. %ld/%d labels differ\n",
+           nLevels, energy, hierarchicalTime, algoType, flatEnergy, flatTime,
+           nDifferentLabels, levels[0].nNodes);
+  }
+
+  return energy;
+}
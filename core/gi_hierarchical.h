@@ -0,0 +1,242 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef GI_HIERARCHICAL_H
+#define GI_HIERARCHICAL_H
+
+// SliceMe
+#include "Feature.h"
+#include "Slice_P.h"
+
+#include "graphInference.h"
+#include "energyParam.h"
+#include "pairwiseKernel.h"
+
+#include <map>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Slice whose supernodes are unions of adjacent supernodes of a finer
+ * slice. Groups of up to maxGroupSize supernodes are grown from each
+ * unmatched supernode by repeatedly adding the unmatched neighbor of the
+ * group separated by the weakest boundary (smallest gradient index).
+ * The features of a coarse supernode are the (coefficient weighted) mean
+ * of the features of its children and its node coefficient is the sum of
+ * the coefficients of its children, so that unary terms are preserved
+ * exactly. Edges between two coarse supernodes get the most frequent
+ * gradient/orientation/distance indices of the fine edges they replace
+ * and an edge coefficient equal to the sum of their coefficients.
+ * Image related functions are forwarded to the finest slice.
+ */
+class Slice_Coarse : public Slice_P
+{
+ public:
+
+  /**
+   * @param maxMergeGradientIdx supernodes separated by an edge whose
+   * gradient index is larger are not merged (-1 for no limit)
+   * @param maxGroupSize maximum number of fine supernodes in a coarse
+   * supernode
+   */
+  Slice_Coarse(Slice_P* _fineSlice,
+               const EnergyParam* _param,
+               map<sidType, nodeCoeffType>* fineNodeCoeffs,
+               map<sidType, edgeCoeffType>* fineEdgeCoeffs,
+               int maxMergeGradientIdx,
+               int maxGroupSize);
+
+  ~Slice_Coarse();
+
+  void exportOverlay(const char* filename);
+
+  void exportOverlay(const char* filename, labelType* labels);
+
+  void exportProbabilities(const char* filename, int nClasses,
+                           float* pbs);
+
+  void exportSupernodeLabels(const char* filename, int nClasses,
+                             labelType* labels,
+                             int nLabels,
+                             const map<labelType, ulong>* labelToClassIdx);
+
+  void generateSupernodeLabels(const char* fn_annotation,
+                               bool includeBoundaryLabels,
+                               bool useColorImages);
+
+  float getAvgIntensity(sidType supernodeId);
+
+  float getAvgIntensity(int supernodeId, int& r, int &g, int &b);
+
+  const vector<sidType>& getChildren(sidType sid) { return children[sid]; }
+
+  sidType getParent(sidType fineSid) { return parents[fineSid]; }
+
+  uchar* getRawData() { return fineSlice->getRawData(); }
+
+  int getIntensity(int x, int y, int z = 0) { return fineSlice->getIntensity(x, y, z); }
+
+  string getName() { return fineSlice->getName(); }
+
+  int getNbChannels() { return fineSlice->getNbChannels(); }
+
+  ulong getNbEdges() { return nbEdges; }
+
+  ulong getNbNodes() { return fineSlice->getNbNodes(); }
+
+  ulong getNbSupernodes() { return supernodes.size(); }
+
+  probType getProb(int sid, int label, int scale = 0);
+
+  sidType getSid(int x, int y, int z) { return parents[fineSlice->getSid(x, y, z)]; }
+
+  sizeSliceType getWidth() { return fineSlice->getWidth(); }
+  sizeSliceType getHeight() { return fineSlice->getHeight(); }
+  sizeSliceType getDepth() { return fineSlice->getDepth(); }
+  ulong getSize() { return fineSlice->getSize(); }
+
+  eSlicePType getType() { return fineSlice->getType(); }
+
+  map<sidType, supernode* >* getMutableSupernodes() { return &supernodes; }
+  const map<sidType, supernode* >& getSupernodes() { return supernodes; }
+
+  map<sidType, nodeCoeffType> nodeCoeffs;
+  map<sidType, edgeCoeffType> edgeCoeffs;
+
+ private:
+
+  Slice_P* fineSlice;
+
+  // coarse supernode containing each fine supernode
+  vector<sidType> parents;
+
+  // fine supernodes contained in each coarse supernode
+  vector< vector<sidType> > children;
+
+  map<sidType, supernode* > supernodes;
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Coarse-to-fine inference. A hierarchy of Slice_Coarse is built once in
+ * the constructor. run solves the coarsest level with any other backend,
+ * projects the labels to the next finer level and re-optimizes only the
+ * nodes lying on a label boundary or whose parent was uncertain (local
+ * margin below a threshold). The refinement is a worklist ICM on the full
+ * energy of the level : nodes are only revisited when one of their
+ * neighbors changes label.
+ *
+ * Options (configuration file) :
+ * hierarchical_levels     maximum number of coarse levels (default 3)
+ * hierarchical_algo_type  backend used at the coarsest level (default BP)
+ * hierarchical_max_gradient supernodes separated by an edge with a larger
+ *                         gradient index are never merged (default -1,
+ *                         no limit)
+ * hierarchical_margin     nodes whose parent has a local margin below this
+ *                         value are re-optimized (default 0, boundary only)
+ * hierarchical_group_size maximum number of supernodes merged into a coarse
+ *                         supernode at each level (default 4)
+ * hierarchical_compare_flat if 1, the backend is also run on the finest
+ *                         level alone and the energies, running times and
+ *                         number of different labels are printed
+ */
+class GI_Hierarchical : public GraphInference
+{
+ public:
+
+  GI_Hierarchical(Slice_P* _slice,
+                  const EnergyParam* _param,
+                  double* _smw,
+                  labelType* _groundTruthLabels,
+                  double* _lossPerLabel,
+                  Feature* _feature,
+                  map<sidType, nodeCoeffType>* _nodeCoeffs,
+                  map<sidType, edgeCoeffType>* _edgeCoeffs);
+
+  ~GI_Hierarchical();
+
+  int getNbLevels() { return levels.size(); }
+
+  double run(labelType* inferredLabels,
+             int id,
+             size_t maxiter,
+             labelType* nodeLabelsGroundTruth = 0,
+             bool computeEnergyAtEachIteration = false,
+             double* _loss = 0);
+
+ private:
+
+  /**
+   * One level of the hierarchy. Level 0 is the input slice.
+   * The adjacency is stored in CSR format and edgeIds gives the index of
+   * each undirected edge (same order as in computeEnergy) used to look up
+   * the edge coefficients. edgeClasses gives the pairwise table of each
+   * entry.
+   */
+  struct Level
+  {
+    Slice_P* slice;
+    map<sidType, nodeCoeffType>* nodeCoeffs;
+    map<sidType, edgeCoeffType>* edgeCoeffs;
+    labelType* groundTruthLabels;
+    int nNodes;
+    ulong* offsets;
+    sidType* neighbors;
+    ulong* edgeIds;
+    int* edgeClasses;
+  };
+
+  void createLevel(Level& level);
+
+  /**
+   * Score (unary + loss + pairwise given the labels of the neighbors) of
+   * assigning the given label to sid.
+   */
+  double computeLocalScore(const Level& level, sidType sid, labelType label,
+                           const labelType* labels);
+
+  /**
+   * Margin between the score of the current label of each node and the
+   * best score of the other labels.
+   */
+  void computeMargins(const Level& level, const labelType* labels,
+                      double* margins);
+
+  /**
+   * Worklist ICM started from the given active nodes.
+   * Returns the number of label changes.
+   */
+  ulong refine(const Level& level, labelType* labels, bool* active,
+               size_t maxiter);
+
+  vector<Level> levels;
+
+  PairwiseKernel* kernel;
+
+  // kernel->getNbEdgeClasses() tables of nClasses*nClasses scores
+  double* pairwiseTables;
+
+  // parameters used to instantiate the backend at the coarsest level. The
+  // weights are shared with smw.
+  EnergyParam* coarseParam;
+
+  int algoType;
+  double margin;
+  bool compareFlat;
+};
+
+#endif // GI_HIERARCHICAL_H
@@ -436,12 +436,11 @@ void GI_libDAI::computeEdgePotentials()
 {
   // Pairwise factors
   if(param->nGradientLevels > 0) {
-    int nPairwiseStates = param->nClasses*param->nClasses;
-    int gradientIdx;
-    int orientationIdx;
-    int idx;
-    int oidx;
-    supernode *s;
+    PairwiseKernel* kernel = createPairwiseKernel(param);
+    int nPairwiseStates = kernel->getNbPairwiseStates();
+    double* tables = new double[kernel->getNbEdgeClasses()*nPairwiseStates];
+    kernel->computeTables(smw, tables);
+
     const map<int, supernode* >& _supernodes = slice->getSupernodes();
     nEdgePotentials = slice->getNbEdges();
     INFERENCE_PRINT("[gi_libDAI] Allocating memory for %d edges and %d states\n",
@@ -450,53 +449,49 @@ void GI_libDAI::computeEdgePotentials()
       edgePotentials[k] = new Real[nPairwiseStates];
     }
 
-    uint edgeId = 0;
+    // endpoints of the undirected edges (largest sid first)
+    sidType* edgeSources = new sidType[nEdgePotentials];
+    sidType* edgeTargets = new sidType[nEdgePotentials];
+    uint nEdges = 0;
     for(map<int, supernode* >::const_iterator its = _supernodes.begin();
         its != _supernodes.end(); its++) {
-      s = its->second;
-      vector < supernode* >* lNeighbors = &(s->neighbors);
+      vector < supernode* >* lNeighbors = &(its->second->neighbors);
       for(vector < supernode* >::iterator itN = lNeighbors->begin();
           itN != lNeighbors->end(); itN++) {
-
         // set edges once
         if(its->first < (*itN)->id) {
           continue;
         }
-
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
-        orientationIdx = slice->getOrientationIdx(its->first,(*itN)->id);
-        oidx = orientationIdx*param->nClasses*param->nClasses;
-#if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
-        oidx += distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-#endif
-
-        map<uint, Real*>::iterator lookup = edgePotentials.find(edgeId);
-        if(lookup == edgePotentials.end()) {
-          edgePotentials[edgeId] = new Real[nPairwiseStates];
-        }
-
-        for(int p = 0; p < nPairwiseStates; p++ ) {
-          // w[0..nClasses-1] contains the unary weights
-          double w_sum = 0;
-          for(int i = 0; i <= gradientIdx; i++) {
-            idx = (i*param->nClasses*param->nClasses*param->nOrientations) + oidx + p;
-            w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-          }
-
-          if(edgeCoeffs) {
-            w_sum *= (*edgeCoeffs)[edgeId];
-          }
-
-          edgePotentials[edgeId][p] = w_sum;
-
-          if (fabs(w_sum) > maxPotential) {
-            maxPotential = fabs(w_sum);
-          }
+        edgeSources[nEdges] = its->first;
+        edgeTargets[nEdges] = (*itN)->id;
+        ++nEdges;
+      }
+    }
+    int* edgeClasses = new int[nEdges];
+    kernel->computeEdgeClasses(slice, nEdges, edgeSources, edgeTargets,
+                               edgeClasses);
+
+    for(uint edgeId = 0; edgeId < nEdges; ++edgeId) {
+      const double* table = tables + edgeClasses[edgeId]*nPairwiseStates;
+      double coeff = 1.0;
+      if(edgeCoeffs) {
+        coeff = (*edgeCoeffs)[edgeId];
+      }
+      Real* potentials = edgePotentials[edgeId];
+      for(int p = 0; p < nPairwiseStates; p++ ) {
+        double w_sum = table[p]*coeff;
+        potentials[p] = w_sum;
+        if (fabs(w_sum) > maxPotential) {
+          maxPotential = fabs(w_sum);
         }
-        ++edgeId;
       }
     }
+
+    delete[] edgeSources;
+    delete[] edgeTargets;
+    delete[] edgeClasses;
+    delete[] tables;
+    delete kernel;
   } else {
     // potts model
     double edgeWeight = fabs(smw[param->nUnaryWeights]);
@@ -21,6 +21,7 @@
 
 #include "graphInference.h"
 #include "energyParam.h"
+#include "pairwiseKernel.h"
 
 #include <dai/alldai.h>  // Include main libDAI header file
 #include <dai/bp.h>
@@ -32,7 +32,8 @@ GI_maxflow::GI_maxflow(Slice_P* _slice,
                        double* _lossPerLabel,
                        Feature* _feature,
                        map<sidType, nodeCoeffType>* _nodeCoeffs,
-                       map<sidType, edgeCoeffType>* _edgeCoeffs)
+                       map<sidType, edgeCoeffType>* _edgeCoeffs,
+                       bool _useParallelSolver)
 {
   GraphInference::init();
   slice = _slice;
@@ -44,6 +45,8 @@ GI_maxflow::GI_maxflow(Slice_P* _slice,
   nodeCoeffs = _nodeCoeffs;
   edgeCoeffs = _edgeCoeffs;
   g = 0;
+  pg = 0;
+  useParallelSolver = _useParallelSolver;
   unaryPotentials = 0;
   edgePotentials = 0;
   nUnaryPotentials = 0;
@@ -55,6 +58,9 @@ GI_maxflow::~GI_maxflow() {
   if(g) {
     delete g;
   }
+  if(pg) {
+    delete pg;
+  }
   if(unaryPotentials) {
     for(uint p = 0; p < nUnaryPotentials; p++) {
       delete[] unaryPotentials[p];
@@ -70,9 +76,18 @@ void GI_maxflow::createGraph()
 {
   if(g) {
     delete g;
+    g = 0;
+  }
+  if(pg) {
+    delete pg;
+    pg = 0;
   }
 
-  g = new GraphType(slice->getNbSupernodes(), slice->getNbUndirectedEdges());
+  if(useParallelSolver) {
+    pg = new ParallelMaxflow(slice->getNbSupernodes(), slice->getNbUndirectedEdges());
+  } else {
+    g = new GraphType(slice->getNbSupernodes(), slice->getNbUndirectedEdges());
+  }
   precomputeUnaryPotentials();
   if(param->includeLocalEdges) {
     precomputeEdgePotentials();
@@ -120,13 +135,24 @@ double GI_maxflow::run(labelType* inferredLabels,
                        bool computeEnergyAtEachIteration,
                        double* _loss)
 {
-  double flow = g->maxflow();
+  double flow = 0;
+  if(pg) {
+    flow = pg->maxflow();
+  } else {
+    flow = g->maxflow();
+  }
   INFERENCE_PRINT("[GI_maxflow] flow=%g\n", flow);
 
   const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
-    if(g->what_segment(it->first) == GraphType::SOURCE) {
+    bool isSource = false;
+    if(pg) {
+      isSource = (pg->what_segment(it->first) == ParallelMaxflow::SOURCE);
+    } else {
+      isSource = (g->what_segment(it->first) == GraphType::SOURCE);
+    }
+    if(isSource) {
       inferredLabels[it->first] = BACKGROUND;
     } else {
       inferredLabels[it->first] = FOREGROUND;
@@ -140,7 +166,9 @@ double GI_maxflow::run(labelType* inferredLabels,
 void GI_maxflow::addUnaryNodes()
 {
   const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
-  g->add_node(_supernodes.size());
+  if(g) {
+    g->add_node(_supernodes.size());
+  }
 
   // a node connected to source is BACKGROUND
   // a node connected to sink is FOREGROUND
@@ -150,8 +178,14 @@ void GI_maxflow::addUnaryNodes()
     //assert(sid==it->first); //sanity check
     sid = it->first;
     // source capacity is first
-    g->add_tweights(sid, unaryPotentials[sid][T_BACKGROUND],
-                    unaryPotentials[sid][T_FOREGROUND]);
+    if(pg) {
+      // same (single precision) capacities as the Boykov-Kolmogorov graph
+      pg->add_tweights(sid, (graph_cap_type)unaryPotentials[sid][T_BACKGROUND],
+                       (graph_cap_type)unaryPotentials[sid][T_FOREGROUND]);
+    } else {
+      g->add_tweights(sid, unaryPotentials[sid][T_BACKGROUND],
+                      unaryPotentials[sid][T_FOREGROUND]);
+    }
   }
 }
 
@@ -220,66 +254,56 @@ void GI_maxflow::precomputeEdgePotentials()
 
   // Pairwise factors
   if(param->nGradientLevels > 0) {
-    int nPairwiseStates = param->nClasses*param->nClasses;
-    double *score = new double[nPairwiseStates];
-    int gradientIdx;
-    int idx;
-    int oidx = 0;
-    supernode *s;
+    PairwiseKernel* kernel = createPairwiseKernel(param);
+    int nPairwiseStates = kernel->getNbPairwiseStates();
+    double* tables = new double[kernel->getNbEdgeClasses()*nPairwiseStates];
+    kernel->computeTables(smw, tables);
+
+    // endpoints of the undirected edges (largest sid first)
+    sidType* edgeSources = new sidType[nEdgePotentials];
+    sidType* edgeTargets = new sidType[nEdgePotentials];
+    int* edgeClasses = new int[nEdgePotentials];
     const map<int, supernode* >& _supernodes = slice->getSupernodes();
     ulong edgeId = 0;
     for(map<int, supernode* >::const_iterator its = _supernodes.begin();
         its != _supernodes.end(); its++) {
-      s= its->second;
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
+      vector < supernode* >* lNeighbors = &(its->second->neighbors);
       for(vector < supernode* >::iterator itN = lNeighbors->begin();
           itN != lNeighbors->end(); itN++) {
-        //INFERENCE_PRINT("GI_maxflow::addLocalEdges %d %d\n", its->first,(*itN)->id);
-
         // set edges once
         if(its->first < (*itN)->id) {
           continue;
         }
-
-        // get gradient index. Do not use any orientation index with maxflow
-        // as it's only used for the EM dataset
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
-#if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
-        oidx = distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-        //printf("distanceIdx %d/%d\n",distanceIdx,param->nDistances);
-#endif
-
-        for(int p = 0; p < nPairwiseStates; p++ ) {
-          // w[0..nClasses-1] contains the unary weights
-          double w_sum = 0;
-          for(int i = 0; i <= gradientIdx; i++) {
-            idx = (i*param->nClasses*param->nClasses) + oidx + p;
-            w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-          }
-
-          if(edgeCoeffs) {
-            w_sum *= (*edgeCoeffs)[edgeId];
-          }
-
-          score[p] = w_sum;
-          
-        }
-
-        double D = score[0] + score[3] - score[1] - score[2];
-        assert(D>=0); //submodularity condition
-
-        unaryPotentials[its->first][T_BACKGROUND] += (score[0] - score[2]); // A-C
-        unaryPotentials[(*itN)->id][T_FOREGROUND] += (score[3] - score[2]); // D-C
-
-        edgePotentials[edgeId] = D;
-
+        edgeSources[edgeId] = its->first;
+        edgeTargets[edgeId] = (*itN)->id;
         ++edgeId;
       }
     }
-    delete[] score;
     assert(edgeId == nEdgePotentials);
+    kernel->computeEdgeClasses(slice, nEdgePotentials, edgeSources, edgeTargets,
+                               edgeClasses);
+
+    for(edgeId = 0; edgeId < nEdgePotentials; ++edgeId) {
+      const double* score = tables + edgeClasses[edgeId]*nPairwiseStates;
+      double coeff = 1.0;
+      if(edgeCoeffs) {
+        coeff = (*edgeCoeffs)[edgeId];
+      }
+
+      double D = (score[0] + score[3] - score[1] - score[2])*coeff;
+      assert(D>=0); //submodularity condition
+
+      unaryPotentials[edgeSources[edgeId]][T_BACKGROUND] += (score[0] - score[2])*coeff; // A-C
+      unaryPotentials[edgeTargets[edgeId]][T_FOREGROUND] += (score[3] - score[2])*coeff; // D-C
+
+      edgePotentials[edgeId] = D;
+    }
+
+    delete[] edgeSources;
+    delete[] edgeTargets;
+    delete[] edgeClasses;
+    delete[] tables;
+    delete kernel;
   } else {
     assert(0);
     // potts model
@@ -305,7 +329,11 @@ void GI_maxflow::addLocalEdges()
         continue;
       }
 
-      g->add_edge(its->first, (*itN)->id, edgePotentials[edgeId], 0);
+      if(pg) {
+        pg->add_edge(its->first, (*itN)->id, (graph_cap_type)edgePotentials[edgeId], 0);
+      } else {
+        g->add_edge(its->first, (*itN)->id, edgePotentials[edgeId], 0);
+      }
       ++edgeId;
     }
   }
@@ -21,19 +21,24 @@
 #include "kgraph.h"
 #include "maxflow.h"
 
+#include "parallelMaxflow.h"
+
 // SliceMe
 #include "Feature.h"
 #include "Slice_P.h"
 
 #include "graphInference.h"
 #include "energyParam.h"
+#include "pairwiseKernel.h"
 
 // standard libraries
 #include <map>
 #include <vector>
 
-typedef double maxflow_cap_type;
-typedef maxflow::Graph<float,float,float> GraphType;
+typedef potentialType maxflow_cap_type;
+// capacities of the Boykov-Kolmogorov graph
+typedef float graph_cap_type;
+typedef maxflow::Graph<graph_cap_type,graph_cap_type,graph_cap_type> GraphType;
 
 
 //------------------------------------------------------------------------------
@@ -52,7 +57,8 @@ class GI_maxflow : public GraphInference
              double* _lossPerLabel,
              Feature* _feature,
              std::map<sidType, nodeCoeffType>* _nodeCoeffs,
-             std::map<sidType, edgeCoeffType>* _edgeCoeffs
+             std::map<sidType, edgeCoeffType>* _edgeCoeffs,
+             bool _useParallelSolver = false
              );
 
   ~GI_maxflow();
@@ -77,6 +83,10 @@ class GI_maxflow : public GraphInference
  private:
   GraphType* g;
 
+  // used instead of g if useParallelSolver is true
+  ParallelMaxflow* pg;
+  bool useParallelSolver;
+
   maxflow_cap_type** unaryPotentials;
   ulong nUnaryPotentials;
   maxflow_cap_type* edgePotentials;
@@ -86,6 +96,13 @@ class GI_maxflow : public GraphInference
 };
 
 
+/**
+ * Multi-object segmentation (background, boundary and foreground) solved
+ * with a 2-layer graph. The topology of the layered graph is created once
+ * and updateParameters only modifies the capacities (the residual graph
+ * is reparametrized so that the search trees can be reused by the next
+ * call to maxflow).
+ */
 class GI_multiobject : public GraphInference
 {
  public:
@@ -105,12 +122,6 @@ class GI_multiobject : public GraphInference
 
   ~GI_multiobject();
 
-  void addInterLayerEdges();
-
-  void addLocalEdges();
-
-  void addUnaryNodes();
-
   void createGraph();
 
   void precomputeEdgePotentials();
@@ -124,19 +135,52 @@ class GI_multiobject : public GraphInference
              bool computeEnergyAtEachIteration = false,
              double* _loss = 0);
 
+  /**
+   * Recompute the capacities for new weights and loss and update the
+   * residual graph. The topology of the graph is kept.
+   */
+  void updateParameters(const EnergyParam* _param,
+                        double* _smw,
+                        labelType* _groundTruthLabels,
+                        double* _lossPerLabel);
+
  private:
-  GraphType* g;
 
-  maxflow_cap_type** unaryPotentials;
-  ulong nUnaryPotentials;
+  void computePotentials();
+
+  /**
+   * Set the capacity of the given edge to newCap and update the residual
+   * capacities of the arcs and terminal edges so that the current flow
+   * stays valid.
+   */
+  void updateEdge(ulong edgeId, maxflow_cap_type newCap);
+
+  GraphType* g;
+  // arc corresponding to the first edge. Edges are stored in the order
+  // in which they were added so the arcs for edge e are firstArc + 2*e and
+  // firstArc + 2*e + 1
+  GraphType::arc_id firstArc;
+  bool maxflowComputed;
+
+  // nNodes*N_LAYERS*2 terminal weights (outside, inside)
+  maxflow_cap_type* unaryPotentials;
+  // terminal weights currently used in the graph (source - sink)
+  maxflow_cap_type* graphTWeights;
   maxflow_cap_type* edgePotentials;
+  // capacities currently used in the graph
+  maxflow_cap_type* graphEdgePotentials;
   ulong nEdgePotentials;
-  maxflow_cap_type* interLayer_edgePotentials;
-  ulong interLayer_nEdgePotentials;
 
   ulong nNodes;
   ulong nEdges;
 
+  // undirected edges of a layer (sources[e] > targets[e])
+  ulong nLayerEdges;
+  sidType* edgeSources;
+  sidType* edgeTargets;
+  int* edgeGradientIdxs;
+  int* edgeDistanceIdxs;
+
   std::vector<long> nextLayerEdgeId;
 
 };
@@ -15,6 +15,10 @@
 
 #include "gi_multiobject.h"
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 // SliceMe
 #include "Config.h"
 #include "utils.h"
@@ -31,6 +35,8 @@ using namespace std;
 #define OUTSIDE_LABEL 0
 #define INSIDE_LABEL 1
 
+#define UNARY_IDX(sid, label) (2*(sid) + (label))
+
 //------------------------------------------------------------------------------
 
 GI_multiobject::GI_multiobject(Slice_P* _slice,
@@ -52,10 +58,20 @@ GI_multiobject::GI_multiobject(Slice_P* _slice,
   nodeCoeffs = _nodeCoeffs;
   edgeCoeffs = _edgeCoeffs;
   g = 0;
+  firstArc = 0;
+  maxflowComputed = false;
+  unaryPotentials = 0;
+  graphTWeights = 0;
   edgePotentials = 0;
+  graphEdgePotentials = 0;
   nEdgePotentials = 0;
   nNodes = 0;
   nEdges = 0;
+  nLayerEdges = 0;
+  edgeSources = 0;
+  edgeTargets = 0;
+  edgeGradientIdxs = 0;
+  edgeDistanceIdxs = 0;
 
   createGraph();
 
@@ -69,13 +85,18 @@ GI_multiobject::~GI_multiobject() {
     delete g;
   }
   if(unaryPotentials) {
-    for(uint p = 0; p < nUnaryPotentials; p++) {
-      delete[] unaryPotentials[p];
-    }
     delete[] unaryPotentials;
+    delete[] graphTWeights;
   }
   if(edgePotentials) {
     delete[] edgePotentials;
+    delete[] graphEdgePotentials;
+  }
+  if(edgeSources) {
+    delete[] edgeSources;
+    delete[] edgeTargets;
+    delete[] edgeGradientIdxs;
+    delete[] edgeDistanceIdxs;
   }
 }
 
@@ -94,34 +115,207 @@ void GI_multiobject::createGraph()
   g = new GraphType(nNodes*N_LAYERS, nEdges);
 
   // allocate memory for unary and pairwise potentials
-  nUnaryPotentials = nNodes*N_LAYERS;
-  unaryPotentials = new maxflow_cap_type*[nUnaryPotentials];
-  for(uint p = 0; p < nUnaryPotentials; p++) {
-    unaryPotentials[p] = new maxflow_cap_type[param->nClasses];
+  unaryPotentials = new maxflow_cap_type[nNodes*N_LAYERS*2];
+  graphTWeights = new maxflow_cap_type[nNodes*N_LAYERS];
+  nEdgePotentials = nEdges;
+  edgePotentials = new maxflow_cap_type[nEdgePotentials];
+  graphEdgePotentials = new maxflow_cap_type[nEdgePotentials];
 
-    for(int c = 0; c < param->nClasses; ++c) {
-      unaryPotentials[p][c] = 0;
+  // store the edges of a layer so that the slice does not have to be
+  // queried again when the capacities are updated
+  const map<int, supernode* >& _supernodes = slice->getSupernodes();
+  nLayerEdges = 0;
+  if(param->includeLocalEdges) {
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      for(vector < supernode* >::iterator itN = its->second->neighbors.begin();
+          itN != its->second->neighbors.end(); itN++) {
+        // set edges once
+        if(its->first >= (*itN)->id) {
+          ++nLayerEdges;
+        }
+      }
     }
   }
-
-  nEdgePotentials = nEdges;
-  edgePotentials = new maxflow_cap_type[nEdgePotentials];
-  for(uint e = 0; e < nEdgePotentials; ++e) {
-    edgePotentials[e] = 0;
+  edgeSources = new sidType[nLayerEdges];
+  edgeTargets = new sidType[nLayerEdges];
+  edgeGradientIdxs = new int[nLayerEdges];
+  edgeDistanceIdxs = new int[nLayerEdges];
+  ulong edgeId = 0;
+  if(param->includeLocalEdges) {
+    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+        its != _supernodes.end(); its++) {
+      for(vector < supernode* >::iterator itN = its->second->neighbors.begin();
+          itN != its->second->neighbors.end(); itN++) {
+        // set edges once
+        if(its->first < (*itN)->id) {
+          continue;
+        }
+        edgeSources[edgeId] = its->first;
+        edgeTargets[edgeId] = (*itN)->id;
+        // get gradient index. Do not use any orientation index with maxflow
+        // as it's only used for the EM dataset
+        edgeGradientIdxs[edgeId] = slice->getGradientIdx(its->first,(*itN)->id);
+        edgeDistanceIdxs[edgeId] = 0;
+#if USE_LONG_RANGE_EDGES
+        edgeDistanceIdxs[edgeId] = slice->getDistanceIdx(its->first, (*itN)->id);
+#endif
+        ++edgeId;
+      }
+    }
   }
 
-  // pre-allocate array
+  // inter-layer edges : link between a node and itself in the next layer
+  // followed by the links between the neighbors of the node and the node
+  // in the next layer
   nextLayerEdgeId.resize(nNodes, -1);
+  edgeId = nLayerEdges*N_LAYERS;
+  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+      its != _supernodes.end(); its++) {
+    nextLayerEdgeId[its->first] = edgeId;
+    edgeId += 1 + its->second->neighbors.size();
+  }
+  nEdges = edgeId;
+
+  computePotentials();
+
+  // add nodes
+  g->add_node(nNodes*N_LAYERS);
+  for(ulong sid = 0; sid < nNodes*N_LAYERS; ++sid) {
+    // source capacity is first
+    maxflow_cap_type pOutside = unaryPotentials[UNARY_IDX(sid, OUTSIDE_LABEL)];
+    maxflow_cap_type pInside = unaryPotentials[UNARY_IDX(sid, INSIDE_LABEL)];
+    maxflow_cap_type minPotential = min(pInside, pOutside);
+    g->add_tweights(sid, pOutside - minPotential, pInside - minPotential);
+    graphTWeights[sid] = pOutside - pInside;
+  }
+
+  // add edges. Must iterate in the exact same order as precomputeEdgePotentials!!
+  edgeId = 0;
+  for(int n = 0; n < N_LAYERS; ++n) {
+    for(ulong e = 0; e < nLayerEdges; ++e) {
+      // add edge in all layers
+      g->add_edge(edgeSources[e] + (n*nNodes), edgeTargets[e] + (n*nNodes), edgePotentials[edgeId], 0);
+      ++edgeId;
+    }
+  }
+  // the following is valid for 2 layers only
+  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
+      its != _supernodes.end(); its++) {
+    // s-t links capacities are 0
+    // so we don't update their t-weights here
+
+    // link between a node and itself in the next layer
+    g->add_edge(its->first, its->first + nNodes, edgePotentials[edgeId], 0);
+    ++edgeId;
+
+    vector < supernode* >* lNeighbors = &(its->second->neighbors);
+    for(vector < supernode* >::iterator itN = lNeighbors->begin();
+        itN != lNeighbors->end(); itN++) {
+      g->add_edge((*itN)->id, its->first + nNodes, edgePotentials[edgeId], 0);
+      ++edgeId;
+    }
+  }
+
+  for(ulong e = 0; e < nEdges; ++e) {
+    graphEdgePotentials[e] = edgePotentials[e];
+  }
+  firstArc = g->get_first_arc();
+  maxflowComputed = false;
+}
+
+void GI_multiobject::computePotentials()
+{
+  for(ulong i = 0; i < nNodes*N_LAYERS*2; ++i) {
+    unaryPotentials[i] = 0;
+  }
+  for(ulong e = 0; e < nEdges; ++e) {
+    edgePotentials[e] = 0;
+  }
 
   if(param->includeLocalEdges) {
     precomputeEdgePotentials();
   }
+
+  // layer 0 corresponds to foreground + boundary
+  // layer 1 corresponds to foreground only
+  double score[4];
+  score[0] = 0;
+  score[1] = -1e30; // -infinity
+  score[2] = 0;
+  score[3] = 0;
+  double D = score[0] + score[3] - score[1] - score[2];
+  assert(D>=0); //submodularity condition
+
+  // s-t links capacities are 0
+  // so we don't update their t-weights (stored in "unaryPotentials") here
+  for(ulong e = N_LAYERS*nLayerEdges; e < nEdges; ++e) {
+    edgePotentials[e] += D;
+  }
+
   precomputeDataTerm();
+}
 
-  addUnaryNodes();
-  if(param->includeLocalEdges) {
-    addLocalEdges();
+void GI_multiobject::updateParameters(const EnergyParam* _param,
+                                      double* _smw,
+                                      labelType* _groundTruthLabels,
+                                      double* _lossPerLabel)
+{
+  param = _param;
+  smw = _smw;
+  groundTruthLabels = _groundTruthLabels;
+  lossPerLabel = _lossPerLabel;
+
+  computePotentials();
+
+  ulong nChangedNodes = 0;
+  for(ulong sid = 0; sid < nNodes*N_LAYERS; ++sid) {
+    maxflow_cap_type tw = unaryPotentials[UNARY_IDX(sid, OUTSIDE_LABEL)] -
+      unaryPotentials[UNARY_IDX(sid, INSIDE_LABEL)];
+    if(tw != graphTWeights[sid]) {
+      g->set_trcap(sid, g->get_trcap(sid) + (tw - graphTWeights[sid]));
+      g->mark_node(sid);
+      graphTWeights[sid] = tw;
+      ++nChangedNodes;
+    }
+  }
+
+  ulong nChangedEdges = 0;
+  for(ulong e = 0; e < nEdges; ++e) {
+    if(edgePotentials[e] != graphEdgePotentials[e]) {
+      updateEdge(e, edgePotentials[e]);
+      ++nChangedEdges;
+    }
+  }
+  INFERENCE_PRINT("[GI_multiobject] Updated %ld nodes and %ld edges\n", nChangedNodes, nChangedEdges);
+}
+
+void GI_multiobject::updateEdge(ulong edgeId, maxflow_cap_type newCap)
+{
+  GraphType::arc_id a = firstArc + 2*edgeId;
+  GraphType::arc_id ra = a + 1;
+  GraphType::node_id i;
+  GraphType::node_id j;
+  g->get_arc_ends(a, i, j);
+
+  // reverse capacity is always 0 so the flow from i to j is equal to the
+  // residual capacity of the reverse arc
+  maxflow_cap_type flow = g->get_rcap(ra);
+  maxflow_cap_type rcap = newCap - flow;
+  if(rcap >= 0) {
+    g->set_rcap(a, rcap);
+  } else {
+    // the flow exceeds the new capacity. The excess is sent back to the
+    // terminals by adding the same capacity to the source and sink edges
+    // of i and j (this does not change the cut).
+    g->set_rcap(a, 0);
+    g->set_rcap(ra, newCap);
+    g->set_trcap(i, g->get_trcap(i) - rcap);
+    g->set_trcap(j, g->get_trcap(j) + rcap);
   }
+  g->mark_node(i);
+  g->mark_node(j);
+  graphEdgePotentials[edgeId] = newCap;
 }
 
 /**
@@ -135,7 +329,9 @@ double GI_multiobject::run(labelType* inferredLabels,
                        bool computeEnergyAtEachIteration,
                        double* _loss)
 {
-  double flow = g->maxflow();
+  // search trees can not be reused for the first call
+  double flow = g->maxflow(maxflowComputed);
+  maxflowComputed = true;
   INFERENCE_PRINT("[GI_multiobject] flow=%g\n", flow);
   INFERENCE_PRINT("[GI_multiobject] nNodes=%ld nEdges=%ld\n", nNodes, nEdges);
 
@@ -185,24 +381,6 @@ double GI_multiobject::run(labelType* inferredLabels,
   return energy;
 }
 
-void GI_multiobject::addUnaryNodes()
-{
-  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
-  g->add_node(_supernodes.size()*N_LAYERS);
-
-  ulong sid = 0;
-  for(int l = 0; l < N_LAYERS; ++l) {
-    for(uint i = 0; i < _supernodes.size(); ++i) {
-      // source capacity is first
-
-      maxflow_cap_type minPotential = min(unaryPotentials[sid][INSIDE_LABEL], unaryPotentials[sid][OUTSIDE_LABEL]);
-      g->add_tweights(sid, unaryPotentials[sid][OUTSIDE_LABEL] - minPotential,
-                      unaryPotentials[sid][INSIDE_LABEL] - minPotential);
-      ++sid;
-    }
-  }
-}
-
 // todo: pass unary term
 // 0 0: Background
 // 0 1: K (does not matter)
@@ -210,21 +388,17 @@ void GI_multiobject::addUnaryNodes()
 // 1 1: Foreground
 void GI_multiobject::precomputeDataTerm()
 {
-  const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
   bool useLossFunction = lossPerLabel!=0;
 
-  double weightBackground = 0;
-  double weightForeground = 0;
-  double weightBoundary = 0;
-  sidType sid = 0;
-  double score[4];
-  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-      it != _supernodes.end(); it++) {
-    sid = it->first;
-
-    weightBackground = computeUnaryPotential(slice, sid, BACKGROUND);
-    weightBoundary = computeUnaryPotential(slice, sid, BOUNDARY);
-    weightForeground = computeUnaryPotential(slice, sid, FOREGROUND);
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(long _sid = 0; _sid < (long)nNodes; ++_sid) {
+    sidType sid = _sid;
+    double score[4];
+    double weightBackground = computeUnaryPotential(slice, sid, BACKGROUND);
+    double weightBoundary = computeUnaryPotential(slice, sid, BOUNDARY);
+    double weightForeground = computeUnaryPotential(slice, sid, FOREGROUND);
 
     if(useLossFunction) {
       // add loss of the ground truth label
@@ -246,214 +420,69 @@ void GI_multiobject::precomputeDataTerm()
     double D = score[0] + score[3] - score[1] - score[2];
     assert(D>=0); //submodularity condition
 
-    unaryPotentials[sid][OUTSIDE_LABEL] += score[0]-score[2]; // A-C
-    unaryPotentials[nNodes + sid][INSIDE_LABEL] += score[3] - score[2]; // D-C
+    // each node only modifies its own entries
+    unaryPotentials[UNARY_IDX(sid, OUTSIDE_LABEL)] += score[0]-score[2]; // A-C
+    unaryPotentials[UNARY_IDX(nNodes + sid, INSIDE_LABEL)] += score[3] - score[2]; // D-C
     edgePotentials[nextLayerEdgeId[sid]] += D;
   }
 }
 
 void GI_multiobject::precomputeEdgePotentials()
 {
-  int multiObj_nClasses = 2;
-  int nPairwiseStates = multiObj_nClasses*multiObj_nClasses;
-  double *score = new double[nPairwiseStates];
-  int gradientIdx;
-  int idx;
-  int oidx = 0;
-  supernode *s;
-  ulong edgeId = 0;
-  double s33[3][3];
-
+  // layers are independent : each layer only modifies the potentials of
+  // its own nodes and edges
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
   for(int n = 0; n < N_LAYERS; ++n) {
-
-    const map<int, supernode* >& _supernodes = slice->getSupernodes();
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      s = its->second;
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
-
-        // set edges once
-        if(its->first < (*itN)->id) {
-          continue;
-        }
-
-        // get gradient index. Do not use any orientation index with maxflow
-        // as it's only used for the EM dataset
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
+    double score[4];
+    double s33[3][3];
+    int idx;
+    int oidx = 0;
+    ulong edgeId = n*nLayerEdges;
+    for(ulong e = 0; e < nLayerEdges; ++e, ++edgeId) {
+      int gradientIdx = edgeGradientIdxs[e];
 
 #if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
-        oidx = distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
+      oidx = edgeDistanceIdxs[e]*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
 #endif
 
-        for(int r = 0; r < 3; ++r) {
-          for(int c = 0; c < 3; ++c) {
-            double w_sum = 0;
-            for(int i = 0; i <= gradientIdx; i++) {
-              int p = 3*r + c;
-              idx = (i*param->nClasses*param->nClasses) + oidx + p;
-              w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-            }
-            s33[r][c] = w_sum;
-          }
-        }
-
-        if(n == 0) {
-          // layer 0 is inside + boundary
-          score[0] = s33[BACKGROUND][BACKGROUND];
-          score[1] = s33[BACKGROUND][BOUNDARY];
-          score[2] = s33[BOUNDARY][BACKGROUND];
-          score[3] = s33[BOUNDARY][BOUNDARY];
-        } else {
-          // layer 1 is inside
-          score[0] = s33[BOUNDARY][BOUNDARY];
-          score[1] = s33[BOUNDARY][FOREGROUND];
-          score[2] = s33[FOREGROUND][BOUNDARY];
-          score[3] = s33[FOREGROUND][FOREGROUND];
-        }
-
-        //double D = edgePotential[1] + edgePotential[2] - edgePotential[0] - edgePotential[3];
-        double D = score[0] + score[3] - score[1] - score[2];
-        if(D < 0) {
-          printf("Score for layer %d, gradient %d = %g\na=%f, d=%f\n%f %f\n%f %f\n",
-                 n, gradientIdx, D, score[0] + score[3], score[1] + score[2], score[0], score[1], score[2], score[3]);
-
-          idx = 0;
-          printf("pw\n");
-          double* _pw = smw + param->nUnaryWeights;
-          for(int g = 0; g < param->nGradientLevels; ++g) {
-            for(int i = 0; i < param->nClasses; ++i) {
-              for(int j = 0; j < param->nClasses; ++j) {
-                printf("%g ", _pw[idx]);
-                ++idx;
-              }
-              printf("\n");
-            }
-            //_pw += param->nClasses*param->nClasses;
-          }
-          printf("\n");
-
-          for(int r = 0; r < 3; ++r) {
-            for(int c = 0; c < 3; ++c) {
-              double w_sum = 0;
-              for(int i = 0; i <= gradientIdx; i++) {
-                int p = 3*r + c;
-                idx = (i*param->nClasses*param->nClasses) + oidx + p;
-                w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-                printf("rc %d %d %d %g\n", r, c, idx, smw[idx+param->nUnaryWeights]);
-              }
-              s33[r][c] = w_sum;
-            }
-          }
-
-          printf("s33\n");
-          for(int r = 0; r < 3; ++r) {
-            for(int c = 0; c < 3; ++c) {
-              printf("%f ", s33[r][c]);
-            }
-            printf("\n");
+      for(int r = 0; r < 3; ++r) {
+        for(int c = 0; c < 3; ++c) {
+          double w_sum = 0;
+          for(int i = 0; i <= gradientIdx; i++) {
+            int p = 3*r + c;
+            idx = (i*param->nClasses*param->nClasses) + oidx + p;
+            w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
           }
-          printf("\n");
-
+          s33[r][c] = w_sum;
         }
-        assert(D>=0); //submodularity condition
-
-        unaryPotentials[its->first + (n*nNodes)][OUTSIDE_LABEL] += (score[0] - score[2]); // A-C
-        unaryPotentials[(*itN)->id + (n*nNodes)][INSIDE_LABEL] += (score[3] - score[2]); // D-C
-
-        edgePotentials[edgeId] += D;
-
-        ++edgeId;
       }
-    }
-  }
-
-  // layer 0 corresponds to foreground + boundary
-  // layer 1 corresponds to foreground only
-  const map<int, supernode* >& _supernodes = slice->getSupernodes();
-  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-      its != _supernodes.end(); its++) {
-    s = its->second;
-
-    score[0] = 0;
-    score[1] = -1e30; // -infinity
-    score[2] = 0;
-    score[3] = 0;
-    double D = score[0] + score[3] - score[1] - score[2];
-    //printf("score = %g\n%g %g\n%g %g\n",D,score[0], score[1], score[2], score[3]);
-    assert(D>=0); //submodularity condition
-
-    // s-t links capacities are 0
-    // so we don't update their t-weights (stored in "unaryPotentials") here
-
-    // link between a node and itself in the next layer
-    edgePotentials[edgeId] += D;
-    nextLayerEdgeId[its->first] = edgeId;
-    ++edgeId;
-
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
-      edgePotentials[edgeId] += D;
-      ++edgeId;
-    }
-  }
-
-  delete[] score;
-
-  INFERENCE_PRINT("[gi_multiobj] EDGE %ld %ld\n", edgeId, nEdgePotentials);
-}
-
-void GI_multiobject::addLocalEdges()
-{
-  const map<int, supernode* >& _supernodes = slice->getSupernodes();
-  ulong edgeId = 0;
-  supernode *s;
-
-  // Must iterate in the exact same order as precomputeEdgePotentials!!
-
-  for(int n = 0; n < N_LAYERS; ++n) {
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      s = its->second;
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
-
-        // set edges once
-        if(its->first < (*itN)->id) {
-          continue;
-        }
 
-        // add edge in all layers
-        g->add_edge(its->first + (n*nNodes), (*itN)->id + (n*nNodes), edgePotentials[edgeId], 0);
-
-        ++edgeId;
+      if(n == 0) {
+        // layer 0 is inside + boundary
+        score[0] = s33[BACKGROUND][BACKGROUND];
+        score[1] = s33[BACKGROUND][BOUNDARY];
+        score[2] = s33[BOUNDARY][BACKGROUND];
+        score[3] = s33[BOUNDARY][BOUNDARY];
+      } else {
+        // layer 1 is inside
+        score[0] = s33[BOUNDARY][BOUNDARY];
+        score[1] = s33[BOUNDARY][FOREGROUND];
+        score[2] = s33[FOREGROUND][BOUNDARY];
+        score[3] = s33[FOREGROUND][FOREGROUND];
       }
-    }
-  }
-
-  // the following is valid for 2 layers only
-  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-      its != _supernodes.end(); its++) {
-    s = its->second;
 
-    // s-t links capacities are 0
-    // so we don't update their t-weights (stored in "unaryPotentials") here
-
-    // link between a node and itself in the next layer
-    g->add_edge(its->first, its->first + nNodes, edgePotentials[edgeId], 0);
-    ++edgeId;
+      double D = score[0] + score[3] - score[1] - score[2];
+      if(D < 0) {
+        printf("[gi_multiobj] Score for layer %d, gradient %d = %g\na=%f, d=%f\n%f %f\n%f %f\n",
+               n, gradientIdx, D, score[0] + score[3], score[1] + score[2], score[0], score[1], score[2], score[3]);
+      }
+      assert(D>=0); //submodularity condition
 
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
-      g->add_edge((*itN)->id, its->first + nNodes, edgePotentials[edgeId], 0);
-      ++edgeId;
+      unaryPotentials[UNARY_IDX(edgeSources[e] + (n*nNodes), OUTSIDE_LABEL)] += (score[0] - score[2]); // A-C
+      unaryPotentials[UNARY_IDX(edgeTargets[e] + (n*nNodes), INSIDE_LABEL)] += (score[3] - score[2]); // D-C
 
+      edgePotentials[edgeId] += D;
     }
-  }
-}
\ No newline at end of file
+  }}
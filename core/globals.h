@@ -42,6 +42,10 @@ int DEFAULT_FEATURE_DISTANCE = 2;
 
 int DEFAULT_LONG_RANGE_EDGES_DISTANCE = 2;
 
+bool MMAP_RAW_DATA = false;
+
+bool COMPRESS_GRAPH_CACHE = false;
+
 typedef unsigned long ulong;
 
 #endif //GLOBALS_H
\ No newline at end of file
@@ -44,7 +44,9 @@ enum eFeatureType
   F_BIAS = 256,
   F_DFT = 512,
   F_SIFT = 1024,
-  F_END_FEATURETYPE = 2048
+  F_LBP = 2048,
+  F_SHAPE = 4096,
+  F_END_FEATURETYPE = 8192
 };
 
 // Background, foreground and boundary have to be assigned to the first 3 labels.
@@ -120,6 +122,12 @@ extern int DEFAULT_FEATURE_DISTANCE;
 
 extern int DEFAULT_LONG_RANGE_EDGES_DISTANCE;
 
+// map raw volumes (volumedata files) in memory instead of reading them
+extern bool MMAP_RAW_DATA;
+
+// store neighbor ids as delta-encoded varints in the supervoxel graph cache
+extern bool COMPRESS_GRAPH_CACHE;
+
 //-----------------------------------------------------------------------------
 
 #define DEFAULT_FEATURE_TYPE (F_HISTOGRAM | F_FILTER | F_BIAS)
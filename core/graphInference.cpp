@@ -16,6 +16,7 @@
 
 #include "globalsE.h"
 #include "Config.h"
+#include "utils.h"
 
 //------------------------------------------------------------------------------
 
@@ -56,18 +57,29 @@ void GraphInference::init()
  * Compute energy for a given configuration nodeLabels
  */
 double GraphInference::computeEnergy(labelType* nodeLabels)
+{
+  return computeEnergy_T<double>(nodeLabels, true);
+}
+
+/**
+ * Same as computeEnergy but weights, features and accumulators are
+ * converted to T. Used to measure the error made by the single precision
+ * potentials.
+ */
+template <typename T>
+T GraphInference::computeEnergy_T(labelType* nodeLabels, bool verbose)
 {
   // Compute energy
-  double energyU = 0.0;
-  double energyP = 0.0;
-  double loss = 0.0;
+  T energyU = 0.0;
+  T energyP = 0.0;
+  T loss = 0.0;
   int nDiff = 0;
 
   int fvSize = feature->getSizeFeatureVector();
   int label = 0;
   int nSupernodes = slice->getNbSupernodes();
-  double energySupernode = 0;
-  double energyEdge = 0;
+  T energySupernode = 0;
+  T energyEdge = 0;
   for(int sid = 0; sid < nSupernodes; sid++)
     {
       label = nodeLabels[sid];
@@ -75,9 +87,9 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
       if(lossPerLabel) {
         if(label != groundTruthLabels[sid]) {
           if(nodeCoeffs) {
-            loss += (*nodeCoeffs)[sid]*lossPerLabel[groundTruthLabels[sid]];
+            loss += (*nodeCoeffs)[sid]*(T)lossPerLabel[groundTruthLabels[sid]];
           } else {
-            loss += lossPerLabel[groundTruthLabels[sid]];
+            loss += (T)lossPerLabel[groundTruthLabels[sid]];
           }
           ++nDiff;
         }
@@ -91,11 +103,11 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
       osvm_node *n = slice->getFeature(sid);
       energySupernode = 0;
       for(int s = 0; s < fvSize; s++) {
-        energySupernode -= smw[SVM_FEAT_INDEX(param, label,s)]*n[s].value;
+        energySupernode -= (T)smw[SVM_FEAT_INDEX(param, label,s)]*(T)n[s].value;
       }
 
 #ifdef W_OFFSET
-      energySupernode -= smw[label];
+      energySupernode -= (T)smw[label];
 #endif
       
       if(nodeCoeffs) {
@@ -121,7 +133,7 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
             }
             
             if(nodeLabels[itNode->first] == nodeLabels[(*itNode2)->id]) {
-              energyEdge = smw[param->nUnaryWeights];
+              energyEdge = (T)smw[param->nUnaryWeights];
               if(edgeCoeffs) {
                 energyEdge *= (*edgeCoeffs)[edgeId];
               }
@@ -162,7 +174,7 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
             energyEdge = 0;
             for(int i =0; i <= gradientIdx; i++) {
               w_edgeIdx = (i*param->nClasses*param->nClasses*param->nOrientations) + offset + nodeLabels[itNode->first]*param->nClasses + nodeLabels[(*itNode2)->id];
-              energyEdge -= smw[w_edgeIdx + param->nUnaryWeights];
+              energyEdge -= (T)smw[w_edgeIdx + param->nUnaryWeights];
             }
 
             if(edgeCoeffs) {
@@ -176,15 +188,92 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
       }
     }
 
-  double energy = energyU + energyP;
+  T energy = energyU + energyP;
 
-  INFERENCE_PRINT("[graphInference] Energy unary=%g, pairwise=%g, nDiff=%d/%d, loss=%g, totalE=%g, totalE-loss=%g\n",
-                  energyU, energyP, nDiff, nSupernodes, loss, energy, energy-loss);
+  if(verbose) {
+    INFERENCE_PRINT("[graphInference] Energy unary=%g, pairwise=%g, nDiff=%d/%d, loss=%g, totalE=%g, totalE-loss=%g\n",
+                    (double)energyU, (double)energyP, nDiff, nSupernodes,
+                    (double)loss, (double)energy, (double)(energy-loss));
+  }
 
   return energy - loss;
 }
 
-void GraphInference::computeNodePotentials(double**& unaryPotentials, double& maxPotential)
+double GraphInference::validateEnergy(labelType* nodeLabels)
+{
+  const char* precision = (sizeof(potentialType) == sizeof(float))?"float":"double";
+  ulong nNodes = slice->getNbSupernodes();
+
+  string filename = "validate_potentials_" +
+    getNameFromPathWithoutExtension(slice->getName()) + ".bin";
+  string config_tmp;
+  if(Config::Instance()->getParameter("validate_potentials_dir", config_tmp)) {
+    filename = config_tmp + "/" + filename;
+  }
+
+  // both labelings are evaluated in double so that only the inference
+  // results differ, not the accumulation
+  double energy = computeEnergy_T<double>(nodeLabels, false);
+
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if(fp) {
+    int refPotentialSize = 0;
+    ulong refNodes = 0;
+    if(fread(&refPotentialSize, sizeof(int), 1, fp) != 1 ||
+       fread(&refNodes, sizeof(ulong), 1, fp) != 1 ||
+       refNodes != nNodes) {
+      printf("[graphInference] Error: %s does not match the current slice\n", filename.c_str());
+      fclose(fp);
+      exit(-1);
+    }
+    labelType* refLabels = new labelType[nNodes];
+    if(fread(refLabels, sizeof(labelType), nNodes, fp) != nNodes) {
+      printf("[graphInference] Error while reading %s\n", filename.c_str());
+      fclose(fp);
+      exit(-1);
+    }
+    fclose(fp);
+
+    if(refPotentialSize == (int)sizeof(potentialType)) {
+      INFERENCE_PRINT("[graphInference] Warning: %s was written by a build with %s potentials as well\n",
+                      filename.c_str(), precision);
+    }
+
+    double refEnergy = computeEnergy_T<double>(refLabels, false);
+    ulong nDiff = 0;
+    for(ulong i = 0; i < nNodes; ++i) {
+      if(refLabels[i] != nodeLabels[i]) {
+        ++nDiff;
+      }
+    }
+    delete[] refLabels;
+
+    double diff = energy - refEnergy;
+    double relDiff = (refEnergy != 0)?fabs(diff/refEnergy):fabs(diff);
+    INFERENCE_PRINT("[graphInference] Energy validation %s=%.10g %s=%.10g diff=%g relative=%g labels differing=%ld/%ld\n",
+                    precision, energy,
+                    (refPotentialSize == (int)sizeof(float))?"float":"double", refEnergy,
+                    diff, relDiff, nDiff, nNodes);
+    return diff;
+  }
+
+  // no reference yet : store the labeling for the build using the other precision
+  fp = fopen(filename.c_str(), "wb");
+  if(!fp) {
+    printf("[graphInference] Error while opening %s\n", filename.c_str());
+    exit(-1);
+  }
+  int potentialSize = sizeof(potentialType);
+  fwrite(&potentialSize, sizeof(int), 1, fp);
+  fwrite(&nNodes, sizeof(ulong), 1, fp);
+  fwrite(nodeLabels, sizeof(labelType), nNodes, fp);
+  fclose(fp);
+  INFERENCE_PRINT("[graphInference] Energy validation %s=%.10g, labels written to %s\n",
+                  precision, energy, filename.c_str());
+  return 0;
+}
+
+void GraphInference::computeNodePotentials(potentialType**& unaryPotentials, double& maxPotential)
 {
   // allocate memory to store features
   int fvSize = feature->getSizeFeatureVector();
@@ -203,7 +292,7 @@ void GraphInference::computeNodePotentials(double**& unaryPotentials, double& ma
   for(map<int, supernode* >::const_iterator its = _supernodes.begin();
       its != _supernodes.end(); its++) {
     sid = its->first;
-    double* buf = unaryPotentials[sid];
+    potentialType* buf = unaryPotentials[sid];
 
     if(param->nClasses != 2) {
       for(int i = 0; i < (int)param->nClasses; i++) {
@@ -40,6 +40,9 @@
 #define T_GI_LIBDAI_ICM_QPBO 10
 #define T_GI_MF 11
 #define T_GI_MULTIOBJ 12
+#define T_GI_BP 13
+#define T_GI_MAXFLOW_PARALLEL 14
+#define T_GI_HIERARCHICAL 15
 
 //------------------------------------------------------------------------------
 
@@ -67,7 +70,18 @@ class GraphInference
    */
   double computeEnergy(labelType* nodeLabels);
 
-  void computeNodePotentials(double**& unaryPotentials, double& maxPotential);
+  /**
+   * Compare the labeling inferred with the potentialType of this build
+   * against the one inferred by a build using the other precision (see
+   * USE_FLOAT_POTENTIALS). The first run writes nodeLabels to
+   * validate_potentials_<slice>.bin (in validate_potentials_dir if set),
+   * the run of the other build loads it, evaluates both labelings in double
+   * and prints the energy gap and the number of differing labels.
+   * Returns energy(nodeLabels) - energy(reference), 0 if no reference exists.
+   */
+  double validateEnergy(labelType* nodeLabels);
+
+  void computeNodePotentials(potentialType**& unaryPotentials, double& maxPotential);
 
   void init();
 
@@ -158,6 +172,11 @@ class GraphInference
   // ugly hack to remove void labels
   static map<ulong, labelType> classIdxToLabel;
 
+ private:
+
+  template <typename T>
+  T computeEnergy_T(labelType* nodeLabels, bool verbose);
+
 };
 
 double GraphInference::computePairwisePotential(Slice_P* slice, supernode* s,
@@ -19,9 +19,13 @@
 #include "energyParam.h"
 #include "graphInference.h"
 #include "Slice.h"
+#include "Slice3d.h"
+#include "F_Precomputed.h"
 #include "gi_sampling.h"
 #include "gi_max.h"
 #include "gi_MF.h"
+#include "gi_BP.h"
+#include "gi_hierarchical.h"
 #include "utils.h"
 #include "globalsE.h"
 
@@ -100,11 +104,6 @@ GraphInference* createGraphInferenceInstance(int algo_type,
                                              map<sidType, nodeCoeffType>* _nodeCoeffs,
                                              map<sidType, edgeCoeffType>* _edgeCoeffs)
 {
-
-#if USE_LONG_RANGE_EDGES
-  const int nDistances = DEFAULT_LONG_RANGE_EDGES_DISTANCE;
-#endif
-
   string config_tmp;
   bool useGCForSubModularEnergy = false;
   if(Config::Instance()->getParameter("useGCForSubModularEnergy", config_tmp)) {
@@ -113,39 +112,16 @@ GraphInference* createGraphInferenceInstance(int algo_type,
     }
   }
   bool useGC = false;
-  double d = 0; // diagonal
-  double a = 0; //anti-diagonal
   if(useGCForSubModularEnergy) {
     // For 2 classes, use graph-cuts if pairwise potential is attractive
-    if(param.includeLocalEdges && param.nClasses == 2) {
-      double* pw = param.weights + param.nUnaryWeights;
-      if(param.nGradientLevels == 0) {
-        useGC = true;
-      } else {
-        useGC = true;
-#if USE_LONG_RANGE_EDGES
-        for(int p = 0; useGC && (p < nDistances); ++p) {
-          a = 0;
-          d = 0;
-#else
-          {
-#endif
-            for(int g = 0; g < param.nGradientLevels; ++g) {
-              d += pw[0] + pw[3];
-              a += pw[1] + pw[2];
-              if(a > d) {
-                useGC = false;
-                break;
-              }
-              pw += param.nClasses*param.nClasses;
-            }
-          }
-        }
-    }
+    PairwiseKernel* kernel = createPairwiseKernel(&param);
+    useGC = kernel->isSubmodular(param.weights);
+    delete kernel;
   }
 
 #ifdef USE_MAXFLOW
-  if(useGC && algo_type != T_GI_OPENGM && algo_type != T_GI_MAX && algo_type != T_GI_MULTIOBJ) {
+  if(useGC && algo_type != T_GI_OPENGM && algo_type != T_GI_MAX && algo_type != T_GI_MULTIOBJ &&
+     algo_type != T_GI_MAXFLOW_PARALLEL) {
     algo_type = T_GI_MAXFLOW;
   }
 #else
@@ -185,8 +161,42 @@ GraphInference* createGraphInferenceInstance(int algo_type,
                           _nodeCoeffs,
                           _edgeCoeffs);
       break;
+
+    case T_GI_MAXFLOW_PARALLEL:
+      gi = new GI_maxflow(slice,
+                          &param,
+                          param.weights,
+                          groundTruthLabels,
+                          lossPerLabel,
+                          feature,
+                          _nodeCoeffs,
+                          _edgeCoeffs,
+                          true);
+      break;
 #endif
 
+    case T_GI_BP:
+      gi = new GI_BP(slice,
+                     &param,
+                     param.weights,
+                     groundTruthLabels,
+                     lossPerLabel,
+                     feature,
+                     _nodeCoeffs,
+                     _edgeCoeffs);
+      break;
+
+    case T_GI_HIERARCHICAL:
+      gi = new GI_Hierarchical(slice,
+                               &param,
+                               param.weights,
+                               groundTruthLabels,
+                               lossPerLabel,
+                               feature,
+                               _nodeCoeffs,
+                               _edgeCoeffs);
+      break;
+
     case T_GI_MF:
       gi = new GI_MF(slice,
                      &param,
@@ -317,6 +327,13 @@ labelType* computeLabels(Slice_P* g, Feature* feature, const EnergyParam& param,
       postprocessBoundaryLabels(g, nodeLabels);
     }
 
+    string config_tmp;
+    if(Config::Instance()->getParameter("validate_potentials", config_tmp)) {
+      if(atoi(config_tmp.c_str())) {
+        gi_Inference->validateEnergy(nodeLabels);
+      }
+    }
+
     if(energy) {
       *energy = gi_Inference->computeEnergy(nodeLabels);
     }
@@ -326,6 +343,35 @@ labelType* computeLabels(Slice_P* g, Feature* feature, const EnergyParam& param,
   }
 }
 
+void computeLabelsROI(Slice3d* slice, const EnergyParam& param,
+                      int algoType, const node& start, const node& end,
+                      int nHaloLayers, labelType* globalLabels)
+{
+  vector<sidType> sid_mapping;
+  vector<bool> isCoreSupernode;
+  Slice3d* roi = slice->extractROI(start, end, nHaloLayers,
+                                   sid_mapping, isCoreSupernode);
+  if(roi->getNbSupernodes() == 0) {
+    delete roi;
+    return;
+  }
+
+  Feature* roiFeature = new F_Precomputed(roi->getPrecomputedFeatures(),
+                                          Feature::getPrecomputedSizeForOneSupernode(roi->getFeatureSize()));
+  labelType* roiLabels = computeLabels(roi, roiFeature, param, algoType, 0);
+
+  // halo supernodes are only used as boundary conditions
+  for(ulong sid = 0; sid < sid_mapping.size(); ++sid) {
+    if(isCoreSupernode[sid]) {
+      globalLabels[sid_mapping[sid]] = roiLabels[sid];
+    }
+  }
+
+  delete[] roiLabels;
+  delete roiFeature;
+  delete roi;
+}
+
 // compute an estimate of the score
 // return max among a subset of sampled superpixels and only compute score for class 0
 double compute_score(Slice_P* slice, Feature* feature, const EnergyParam& param,
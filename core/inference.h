@@ -145,6 +145,17 @@ labelType* computeLabels(Slice_P* g, Feature* feature, const EnergyParam& param,
 labelType* computeLabels(Slice_P* g, Feature* feature, const EnergyParam& param,
                          int algoType, double* energy);
 
+
+/**
+ * Run inference on the supernodes intersecting the box [start, end[ and on
+ * nHaloLayers rings of neighbors around them (see Slice3d::extractROI).
+ * Labels of the supernodes intersecting the box are written into
+ * globalLabels which is indexed by the supernode ids of slice.
+ */
+void computeLabelsROI(Slice3d* slice, const EnergyParam& param,
+                      int algoType, const node& start, const node& end,
+                      int nHaloLayers, labelType* globalLabels);
+
 labelType* computeLabels_sampling(Slice_P* g, Feature* feature, const EnergyParam& param,
                                   int algoType, double* energy,
                                   labelType* groundTruthLabels, double* lossPerLabel,
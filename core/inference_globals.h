@@ -28,6 +28,18 @@
 typedef float nodeCoeffType;
 typedef float edgeCoeffType;
 
+// type used to store unary/pairwise potentials and messages in the
+// in-tree inference backends : GI_BP, GI_ICM, GI_MF and the potential
+// arrays of GI_maxflow/GI_multiobject (see USE_FLOAT_POTENTIALS in
+// CMakeLists_common.txt). The Boykov-Kolmogorov graph always uses float
+// capacities (graph_cap_type) and gi_libDAI/gi_MRF use the types of their
+// libraries, so this does not change the precision of these backends.
+#if USE_FLOAT_POTENTIALS
+typedef float potentialType;
+#else
+typedef double potentialType;
+#endif
+
 //------------------------------------------------------------------------------
 
 // set this to 1 to lear an offset for each class
@@ -51,13 +63,11 @@ typedef float edgeCoeffType;
 // DO NOT EDIT
 
 // macros used to index w vector
-#if USE_LONG_RANGE_EDGES
-#define SVM_FEAT_INDEX0(param) (((param)->nDistances*(param)->nGradientLevels*(param)->nOrientations*(param)->nClasses*(param)->nClasses) + \
+// The layout only depends on the model : nDistances is 0 (one block of
+// pairwise weights) unless the model uses long range edges.
+#define SVM_NB_DISTANCE_BLOCKS(param) (((param)->nDistances > 1)?(param)->nDistances:1)
+#define SVM_FEAT_INDEX0(param) ((SVM_NB_DISTANCE_BLOCKS(param)*(param)->nGradientLevels*(param)->nOrientations*(param)->nClasses*(param)->nClasses) + \
                                 (param)->nUnaryWeights + ((param)->nGradientLevels==0 && (param)->includeLocalEdges))
-#else
-#define SVM_FEAT_INDEX0(param) (((param)->nGradientLevels*(param)->nOrientations*(param)->nClasses*(param)->nClasses) + \
-                                (param)->nUnaryWeights + ((param)->nGradientLevels==0 && (param)->includeLocalEdges))
-#endif
 
 #define SVM_FEAT_NUM_CLASSES(param) ((param)->nUnaryWeights)
 #define SVM_FEAT_INDEX(param,c,f) (SVM_FEAT_INDEX0(param) + ((f)*SVM_FEAT_NUM_CLASSES(param))+(c))
@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#include "pairwiseKernel.h"
+
+//------------------------------------------------------------------------------
+
+PairwiseKernel::PairwiseKernel(const EnergyParam* param)
+{
+  nClasses = param->nClasses;
+  nPairwiseStates = nClasses*nClasses;
+  nUnaryWeights = param->nUnaryWeights;
+  includeLocalEdges = param->includeLocalEdges;
+  potts = (param->nGradientLevels == 0);
+
+  // layout of the pairwise weights (see SVM_FEAT_INDEX0)
+  int nGradientLevels = max(param->nGradientLevels, 1);
+  int nOrientations = max(param->nOrientations, 1);
+  gradientStride = nPairwiseStates*nOrientations;
+  distanceStride = nGradientLevels*nOrientations*nPairwiseStates;
+
+  nG = 1;
+  nO = 1;
+  nD = 1;
+  if(!potts) {
+    nG = nGradientLevels;
+    nO = nOrientations;
+    nD = SVM_NB_DISTANCE_BLOCKS(param);
+  }
+  nEdgeClasses = nD*nO*nG;
+}
+
+//------------------------------------------------------------------------------
+
+bool PairwiseKernel::isSubmodular(const double* smw, double margin)
+{
+  if(!includeLocalEdges || nClasses != 2) {
+    return false;
+  }
+
+  double* tables = new double[nEdgeClasses*nPairwiseStates];
+  computeTables(smw, tables);
+  bool submodular = true;
+  for(int e = 0; e < nEdgeClasses; ++e) {
+    const double* table = tables + e*nPairwiseStates;
+    double d = table[0] + table[3]; // diagonal
+    double a = table[1] + table[2]; // anti-diagonal
+    if(a > (d - margin)) {
+      submodular = false;
+      break;
+    }
+  }
+  delete[] tables;
+  return submodular;
+}
+
+//------------------------------------------------------------------------------
+
+PairwiseKernel* createPairwiseKernel(const EnergyParam* param)
+{
+  bool useGradients = param->nGradientLevels > 1;
+  bool useOrientations = param->nGradientLevels > 0 && param->nOrientations > 1;
+  bool useDistances = param->nGradientLevels > 0 && param->nDistances > 1;
+
+  PairwiseKernel* kernel = 0;
+  if(useDistances) {
+    if(useOrientations) {
+      if(useGradients) {
+        kernel = new PairwiseKernel_T<true, true, true>(param);
+      } else {
+        kernel = new PairwiseKernel_T<false, true, true>(param);
+      }
+    } else {
+      if(useGradients) {
+        kernel = new PairwiseKernel_T<true, false, true>(param);
+      } else {
+        kernel = new PairwiseKernel_T<false, false, true>(param);
+      }
+    }
+  } else {
+    if(useOrientations) {
+      if(useGradients) {
+        kernel = new PairwiseKernel_T<true, true, false>(param);
+      } else {
+        kernel = new PairwiseKernel_T<false, true, false>(param);
+      }
+    } else {
+      if(useGradients) {
+        kernel = new PairwiseKernel_T<true, false, false>(param);
+      } else {
+        kernel = new PairwiseKernel_T<false, false, false>(param);
+      }
+    }
+  }
+  return kernel;
+}
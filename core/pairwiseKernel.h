@@ -0,0 +1,206 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+
+#ifndef PAIRWISE_KERNEL_H
+#define PAIRWISE_KERNEL_H
+
+// SliceMe
+#include "Slice_P.h"
+#include "energyParam.h"
+#include "inference_globals.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+/**
+ * Pairwise potentials of the SSVM model.
+ * Each undirected edge belongs to a class (combination of its gradient,
+ * orientation and distance indices). All the edges of a class share the
+ * same table of nClasses*nClasses scores indexed by
+ * label(max sid)*nClasses + label(min sid).
+ * Use createPairwiseKernel to get the specialization matching the edge
+ * attributes used by a model. The attributes that are not used are never
+ * looked up.
+ * The specialization and the weight layout only depend on the EnergyParam
+ * of the model. Two compile-time flags still change the energy for all
+ * models : USE_LONG_RANGE_EDGES (long range edges and their distance
+ * indices are only built if it is set) and W_OFFSET (per-class offset
+ * added to the unary terms).
+ */
+class PairwiseKernel
+{
+ public:
+
+  PairwiseKernel(const EnergyParam* param);
+
+  virtual ~PairwiseKernel() {}
+
+  /**
+   * Class of the edge between sid and nsid with sid > nsid.
+   */
+  virtual int getEdgeClass(Slice_P* slice, sidType sid, sidType nsid) = 0;
+
+  /**
+   * Compute the classes of nEdges edges. sources[i] > targets[i].
+   */
+  virtual void computeEdgeClasses(Slice_P* slice, ulong nEdges,
+                                  const sidType* sources,
+                                  const sidType* targets,
+                                  int* classes) = 0;
+
+  int getNbEdgeClasses() { return nEdgeClasses; }
+
+  int getNbPairwiseStates() { return nPairwiseStates; }
+
+  /**
+   * Fill the nEdgeClasses tables of nClasses*nClasses scores.
+   * Scores of a gradient level include the weights of all the lower
+   * levels so the tables are computed as running sums over the gradient
+   * levels.
+   */
+  template <typename T>
+  void computeTables(const double* smw, T* tables)
+  {
+    if(!includeLocalEdges) {
+      for(int p = 0; p < nEdgeClasses*nPairwiseStates; ++p) {
+        tables[p] = 0;
+      }
+      return;
+    }
+
+    if(potts) {
+      for(int p = 0; p < nPairwiseStates; ++p) {
+        tables[p] = 0;
+      }
+      for(int c = 0; c < nClasses; ++c) {
+        tables[c*nClasses + c] = smw[nUnaryWeights];
+      }
+      return;
+    }
+
+    const double* w = smw + nUnaryWeights;
+    double* sum = new double[nPairwiseStates];
+    for(int d = 0; d < nD; ++d) {
+      for(int o = 0; o < nO; ++o) {
+        for(int p = 0; p < nPairwiseStates; ++p) {
+          sum[p] = 0;
+        }
+        const double* wo = w + d*distanceStride + o*nPairwiseStates;
+        for(int g = 0; g < nG; ++g) {
+          const double* wg = wo + g*gradientStride;
+          T* table = tables + ((d*nO + o)*nG + g)*nPairwiseStates;
+          for(int p = 0; p < nPairwiseStates; ++p) {
+            sum[p] += wg[p];
+            table[p] = sum[p];
+          }
+        }
+      }
+    }
+    delete[] sum;
+  }
+
+  /**
+   * Returns true if the scores of every edge class are submodular for a
+   * 2-class model, i.e. S(0,0) + S(1,1) >= S(0,1) + S(1,0) + margin
+   * (E=-S so E(0,0) + E(1,1) =< E(0,1) + E(1,0)).
+   */
+  bool isSubmodular(const double* smw, double margin = 0);
+
+ protected:
+
+  int nClasses;
+  int nPairwiseStates;
+  int nUnaryWeights;
+  bool includeLocalEdges;
+  bool potts;
+
+  // number of gradient levels, orientations and distances taken into
+  // account to compute the edge classes (1 if the attribute is not used)
+  int nG;
+  int nO;
+  int nD;
+  int nEdgeClasses;
+
+  // offsets between the weights of 2 consecutive gradient levels and
+  // distances
+  int gradientStride;
+  int distanceStride;
+};
+
+//------------------------------------------------------------------------------
+
+template <bool useGradients, bool useOrientations, bool useDistances>
+class PairwiseKernel_T : public PairwiseKernel
+{
+ public:
+
+  PairwiseKernel_T(const EnergyParam* param) : PairwiseKernel(param) {}
+
+  inline int getEdgeClass_T(Slice_P* slice, sidType sid, sidType nsid)
+  {
+    int edgeClass = 0;
+    if(useDistances) {
+      edgeClass = slice->getDistanceIdx(sid, nsid)*nO;
+    }
+    if(useOrientations) {
+      edgeClass += slice->getOrientationIdx(sid, nsid);
+    }
+    edgeClass *= nG;
+    if(useGradients) {
+      edgeClass += slice->getGradientIdx(sid, nsid);
+    }
+    return edgeClass;
+  }
+
+  int getEdgeClass(Slice_P* slice, sidType sid, sidType nsid)
+  {
+    return getEdgeClass_T(slice, sid, nsid);
+  }
+
+  void computeEdgeClasses(Slice_P* slice, ulong nEdges,
+                          const sidType* sources,
+                          const sidType* targets,
+                          int* classes)
+  {
+    if(!useGradients && !useOrientations && !useDistances) {
+      for(ulong e = 0; e < nEdges; ++e) {
+        classes[e] = 0;
+      }
+      return;
+    }
+
+    // the edge attributes are precomputed so the lookups do not modify
+    // the maps of the slice
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for(long e = 0; e < (long)nEdges; ++e) {
+      classes[e] = getEdgeClass_T(slice, sources[e], targets[e]);
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Returns the kernel specialized for the edge attributes used by param.
+ * Caller is responsible for deleting the returned object.
+ */
+PairwiseKernel* createPairwiseKernel(const EnergyParam* param);
+
+#endif // PAIRWISE_KERNEL_H
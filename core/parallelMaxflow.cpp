@@ -0,0 +1,418 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "parallelMaxflow.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// SliceMe
+#include "inference_globals.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+#define GLOBAL_RELABEL_ALPHA 6
+#define RELABEL_WORK 12
+
+//------------------------------------------------------------------------------
+
+ParallelMaxflow::ParallelMaxflow(ulong _nNodes, ulong nEdgesMax)
+{
+  nNodes = _nNodes;
+  edgeTails.reserve(nEdgesMax);
+  edgeHeads.reserve(nEdgesMax);
+  edgeCaps.reserve(nEdgesMax);
+  edgeRevCaps.reserve(nEdgesMax);
+
+  nArcs = 0;
+  offsets = 0;
+  heads = 0;
+  reverseArcs = 0;
+  caps = 0;
+
+  sourceCaps = new captype[nNodes];
+  sinkCaps = new captype[nNodes];
+  for(ulong i = 0; i < nNodes; ++i) {
+    sourceCaps[i] = 0;
+    sinkCaps[i] = 0;
+  }
+  excess = 0;
+  addedExcess = 0;
+  labels = 0;
+  newLabels = 0;
+  flags = 0;
+
+  globalRelabelFrequency = 0.5;
+  done = false;
+}
+
+ParallelMaxflow::~ParallelMaxflow()
+{
+  delete[] sourceCaps;
+  delete[] sinkCaps;
+  if(offsets) {
+    delete[] offsets;
+    delete[] heads;
+    delete[] reverseArcs;
+    delete[] caps;
+  }
+  if(excess) {
+    delete[] excess;
+    delete[] addedExcess;
+    delete[] labels;
+    delete[] newLabels;
+    delete[] flags;
+  }
+}
+
+void ParallelMaxflow::add_edge(ulong i, ulong j, captype cap, captype rev_cap)
+{
+  edgeTails.push_back(i);
+  edgeHeads.push_back(j);
+  edgeCaps.push_back(cap);
+  edgeRevCaps.push_back(rev_cap);
+}
+
+void ParallelMaxflow::add_tweights(ulong i, captype cap_source, captype cap_sink)
+{
+  sourceCaps[i] += cap_source;
+  sinkCaps[i] += cap_sink;
+}
+
+void ParallelMaxflow::createArcs()
+{
+  ulong nEdges = edgeTails.size();
+  nArcs = 2*nEdges;
+  offsets = new ulong[nNodes+1];
+  heads = new ulong[nArcs];
+  reverseArcs = new ulong[nArcs];
+  caps = new captype[nArcs];
+
+  for(ulong i = 0; i <= nNodes; ++i) {
+    offsets[i] = 0;
+  }
+  for(ulong e = 0; e < nEdges; ++e) {
+    ++offsets[edgeTails[e]+1];
+    ++offsets[edgeHeads[e]+1];
+  }
+  for(ulong i = 0; i < nNodes; ++i) {
+    offsets[i+1] += offsets[i];
+  }
+
+  ulong* next = new ulong[nNodes];
+  for(ulong i = 0; i < nNodes; ++i) {
+    next[i] = offsets[i];
+  }
+  for(ulong e = 0; e < nEdges; ++e) {
+    ulong i = edgeTails[e];
+    ulong j = edgeHeads[e];
+    ulong a = next[i]++;
+    ulong ra = next[j]++;
+    heads[a] = j;
+    heads[ra] = i;
+    caps[a] = edgeCaps[e];
+    caps[ra] = edgeRevCaps[e];
+    reverseArcs[a] = ra;
+    reverseArcs[ra] = a;
+  }
+  delete[] next;
+
+  // edge lists are not needed anymore
+  vector<ulong>().swap(edgeTails);
+  vector<ulong>().swap(edgeHeads);
+  vector<captype>().swap(edgeCaps);
+  vector<captype>().swap(edgeRevCaps);
+}
+
+void ParallelMaxflow::globalRelabel()
+{
+  int maxLabel = (int)nNodes;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(long i = 0; i < (long)nNodes; ++i) {
+    labels[i] = maxLabel;
+    flags[i] = 0;
+  }
+
+  // nodes connected to the sink are at distance 1
+  vector<ulong> frontier;
+  for(ulong i = 0; i < nNodes; ++i) {
+    if(sinkCaps[i] > 0) {
+      labels[i] = 1;
+      flags[i] = 1;
+      frontier.push_back(i);
+    }
+  }
+
+  int level = 1;
+  while(!frontier.empty()) {
+    vector<ulong> nextFrontier;
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+    {
+      vector<ulong> localFrontier;
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+      for(long k = 0; k < (long)frontier.size(); ++k) {
+        ulong u = frontier[k];
+        for(ulong a = offsets[u]; a < offsets[u+1]; ++a) {
+          ulong x = heads[a];
+          // arc x->u has to be residual
+          if(caps[reverseArcs[a]] <= 0 || flags[x]) {
+            continue;
+          }
+          char visited;
+#ifdef WITH_OPENMP
+#pragma omp atomic capture
+#endif
+          { visited = flags[x]; flags[x] = 1; }
+          if(!visited) {
+            labels[x] = level + 1;
+            localFrontier.push_back(x);
+          }
+        }
+      }
+#ifdef WITH_OPENMP
+#pragma omp critical
+#endif
+      nextFrontier.insert(nextFrontier.end(), localFrontier.begin(), localFrontier.end());
+    }
+    frontier.swap(nextFrontier);
+    ++level;
+  }
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(long i = 0; i < (long)nNodes; ++i) {
+    flags[i] = 0;
+  }
+}
+
+void ParallelMaxflow::selectActiveNodes(const vector<ulong>& candidates,
+                                        vector<ulong>& activeNodes)
+{
+  activeNodes.clear();
+  int maxLabel = (int)nNodes;
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    vector<ulong> localNodes;
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for(long k = 0; k < (long)candidates.size(); ++k) {
+      ulong v = candidates[k];
+      if(excess[v] > 0 && labels[v] < maxLabel) {
+        localNodes.push_back(v);
+      }
+    }
+#ifdef WITH_OPENMP
+#pragma omp critical
+#endif
+    activeNodes.insert(activeNodes.end(), localNodes.begin(), localNodes.end());
+  }
+}
+
+ParallelMaxflow::flowtype ParallelMaxflow::maxflow()
+{
+  if(done) {
+    printf("[ParallelMaxflow] Error : maxflow can only be called once\n");
+    exit(-1);
+  }
+  done = true;
+
+  createArcs();
+
+  excess = new captype[nNodes];
+  addedExcess = new captype[nNodes];
+  labels = new int[nNodes];
+  newLabels = new int[nNodes];
+  flags = new char[nNodes];
+
+  // saturate terminal edges. The flow going directly from the source to
+  // the sink through a node does not change the cut.
+  flowtype flow = 0;
+  for(ulong i = 0; i < nNodes; ++i) {
+    captype f = min(sourceCaps[i], sinkCaps[i]);
+    flow += f;
+    excess[i] = sourceCaps[i] - f;
+    sinkCaps[i] -= f;
+    sourceCaps[i] = 0;
+    addedExcess[i] = 0;
+  }
+
+  int maxLabel = (int)nNodes;
+  double globalRelabelThreshold = globalRelabelFrequency*(GLOBAL_RELABEL_ALPHA*(double)nNodes + nArcs);
+
+  globalRelabel();
+
+  vector<ulong> candidates(nNodes);
+  for(ulong i = 0; i < nNodes; ++i) {
+    candidates[i] = i;
+  }
+  vector<ulong> activeNodes;
+  selectActiveNodes(candidates, activeNodes);
+
+  double work = 0;
+  ulong nRounds = 0;
+  ulong nGlobalRelabels = 1;
+  while(!activeNodes.empty()) {
+    ++nRounds;
+
+    if(work > globalRelabelThreshold) {
+      globalRelabel();
+      ++nGlobalRelabels;
+      work = 0;
+      candidates.swap(activeNodes);
+      selectActiveNodes(candidates, activeNodes);
+      if(activeNodes.empty()) {
+        break;
+      }
+    }
+
+    for(ulong k = 0; k < activeNodes.size(); ++k) {
+      flags[activeNodes[k]] = 1;
+    }
+
+    flowtype roundFlow = 0;
+    double roundWork = 0;
+    candidates.clear();
+
+#ifdef WITH_OPENMP
+#pragma omp parallel reduction(+:roundFlow,roundWork)
+#endif
+    {
+      vector<ulong> touchedNodes;
+
+      // push along admissible arcs using the labels of the previous round.
+      // Flow can not be pushed on (v,w) and (w,v) at the same time so the
+      // residual capacities of an arc pair are only modified by one node.
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+      for(long k = 0; k < (long)activeNodes.size(); ++k) {
+        ulong v = activeNodes[k];
+        captype e = excess[v];
+        int d = labels[v];
+        if(d == 1 && sinkCaps[v] > 0) {
+          captype delta = min(e, sinkCaps[v]);
+          sinkCaps[v] -= delta;
+          e -= delta;
+          roundFlow += delta;
+        }
+        for(ulong a = offsets[v]; a < offsets[v+1] && e > 0; ++a) {
+          ulong w = heads[a];
+          if(labels[w] != d - 1 || caps[a] <= 0) {
+            continue;
+          }
+          captype delta = min(e, caps[a]);
+          caps[a] -= delta;
+          caps[reverseArcs[a]] += delta;
+          e -= delta;
+#ifdef WITH_OPENMP
+#pragma omp atomic
+#endif
+          addedExcess[w] += delta;
+          char touched;
+#ifdef WITH_OPENMP
+#pragma omp atomic capture
+#endif
+          { touched = flags[w]; flags[w] = 1; }
+          if(!touched) {
+            touchedNodes.push_back(w);
+          }
+        }
+        excess[v] = e;
+      }
+
+      // relabel nodes which still have some excess
+#ifdef WITH_OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+      for(long k = 0; k < (long)activeNodes.size(); ++k) {
+        ulong v = activeNodes[k];
+        newLabels[v] = labels[v];
+        if(excess[v] <= 0) {
+          continue;
+        }
+        int m = maxLabel;
+        if(sinkCaps[v] > 0) {
+          m = 0;
+        }
+        for(ulong a = offsets[v]; a < offsets[v+1]; ++a) {
+          if(caps[a] > 0 && labels[heads[a]] < m) {
+            m = labels[heads[a]];
+          }
+        }
+        newLabels[v] = min(m + 1, maxLabel);
+        roundWork += RELABEL_WORK + (offsets[v+1] - offsets[v]);
+      }
+
+#ifdef WITH_OPENMP
+#pragma omp critical
+#endif
+      candidates.insert(candidates.end(), touchedNodes.begin(), touchedNodes.end());
+    }
+
+    flow += roundFlow;
+    work += roundWork;
+
+    // apply new labels and received flow
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for(long k = 0; k < (long)activeNodes.size(); ++k) {
+      ulong v = activeNodes[k];
+      labels[v] = newLabels[v];
+    }
+    candidates.insert(candidates.end(), activeNodes.begin(), activeNodes.end());
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for(long k = 0; k < (long)candidates.size(); ++k) {
+      ulong v = candidates[k];
+      excess[v] += addedExcess[v];
+      addedExcess[v] = 0;
+      flags[v] = 0;
+    }
+
+    selectActiveNodes(candidates, activeNodes);
+  }
+
+  // final labels give the set of nodes connected to the sink
+  globalRelabel();
+  ++nGlobalRelabels;
+
+  INFERENCE_PRINT("[ParallelMaxflow] flow=%g, %ld rounds, %ld global relabels\n",
+                  flow, nRounds, nGlobalRelabels);
+  return flow;
+}
+
+ParallelMaxflow::termtype ParallelMaxflow::what_segment(ulong i) const
+{
+  return (labels[i] < (int)nNodes)?SINK:SOURCE;
+}
@@ -0,0 +1,133 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PARALLEL_MAXFLOW_H
+#define PARALLEL_MAXFLOW_H
+
+// SliceMe
+#include "globalsE.h"
+
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Min-cut solver for large sparse graphs based on a synchronous parallel
+ * push-relabel algorithm (pushes and relabels are computed for all the
+ * active nodes at once, with periodic global relabeling done by a
+ * parallel breadth-first search from the sink).
+ *
+ * The interface follows the Boykov-Kolmogorov Graph class so that both
+ * solvers can be used interchangeably. Nodes returned as SINK are the
+ * nodes from which the sink can be reached in the residual graph, which
+ * is the segmentation returned by the Boykov-Kolmogorov solver (free
+ * nodes are assigned to the source). The cut does not depend on the
+ * order in which nodes are processed.
+ *
+ * Flows are computed in double precision while the Boykov-Kolmogorov
+ * graph used by GI_maxflow works in single precision (GI_maxflow gives
+ * both solvers the same float capacities). Cuts are identical for integer
+ * capacities. Otherwise, nodes whose residual capacity to the sink is
+ * within float rounding of 0 (about 1e-7 times the largest capacity) can
+ * be assigned differently.
+ */
+class ParallelMaxflow
+{
+ public:
+  typedef double captype;
+  typedef double flowtype;
+
+  enum termtype
+    {
+      SOURCE = 0,
+      SINK = 1
+    };
+
+  /**
+   * nNodes nodes are created. nEdgesMax is only used to reserve memory.
+   */
+  ParallelMaxflow(ulong nNodes, ulong nEdgesMax = 0);
+
+  ~ParallelMaxflow();
+
+  /**
+   * Add an edge (i,j) with capacity cap and an edge (j,i) with capacity
+   * rev_cap. Must be called before maxflow.
+   */
+  void add_edge(ulong i, ulong j, captype cap, captype rev_cap);
+
+  /**
+   * Add capacities to the terminal edges of node i.
+   */
+  void add_tweights(ulong i, captype cap_source, captype cap_sink);
+
+  flowtype maxflow();
+
+  termtype what_segment(ulong i) const;
+
+  /**
+   * Global relabeling is triggered after
+   * frequency*(6*nNodes + nArcs) units of work (default 0.5).
+   */
+  void setGlobalRelabelFrequency(double frequency) { globalRelabelFrequency = frequency; }
+
+ private:
+
+  void createArcs();
+
+  /**
+   * Set labels to the exact distance to the sink in the residual graph.
+   * Nodes that can not reach the sink get label nNodes.
+   */
+  void globalRelabel();
+
+  /**
+   * Keep the nodes of candidates that have an excess and a label < nNodes.
+   */
+  void selectActiveNodes(const std::vector<ulong>& candidates,
+                         std::vector<ulong>& activeNodes);
+
+  ulong nNodes;
+
+  // edges given by add_edge
+  std::vector<ulong> edgeTails;
+  std::vector<ulong> edgeHeads;
+  std::vector<captype> edgeCaps;
+  std::vector<captype> edgeRevCaps;
+
+  // CSR residual graph
+  ulong nArcs;
+  ulong* offsets;
+  ulong* heads;
+  ulong* reverseArcs;
+  captype* caps;
+
+  // residual capacity of the edges from the source and to the sink
+  captype* sourceCaps;
+  captype* sinkCaps;
+
+  captype* excess;
+  captype* addedExcess;
+  int* labels;
+  int* newLabels;
+  // set for nodes that are in the active list or were already added to
+  // the list of nodes that received some flow
+  char* flags;
+
+  double globalRelabelFrequency;
+  bool done;
+};
+
+#endif // PARALLEL_MAXFLOW_H
@@ -44,7 +44,10 @@
 #include "Feature.h"
 #include "F_Combo.h"
 
+#if USE_LIBDAI
 #include "gi_libDAI.h"
+#endif
+#include "gi_BP.h"
 
 #include "energyParam.h"
 #include "svm_struct_api_types.h"
@@ -198,6 +201,21 @@ static int parse_opt (int key, char *arg, struct arguments *argments)
 
 //------------------------------------------------------------------------------
 
+void exportMarginals(Slice_P* slice, const char* output_dir, int label,
+                     int nClasses, float* marginals)
+{
+  stringstream sout;
+  sout << output_dir;
+  sout << "/marginals_" << label << "/";
+  mkdir(sout.str().c_str(), 0777);
+  sout << getNameFromPathWithoutExtension(slice->getName());
+  sout << ".png";
+  printf("Exporting %s\n", sout.str().c_str());
+  slice->exportProbabilities(sout.str().c_str(), nClasses, marginals);
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc,char* argv[])
 {
   args.image_dir = 0;
@@ -376,30 +394,41 @@ int main(int argc,char* argv[])
 
       // export marginals
       printf("[Main] Exporting marginals\n");
-      GI_libDAI* gi_Inference = new GI_libDAI(slice,
-                                              &param,
-                                              param.weights,
-                                              groundTruthLabels,
-                                              lossPerLabel,
-                                              feature,
-                                              0, 0);
-
       int nNodes = slice->getNbSupernodes();
       float* marginals = new float[nNodes];
-      GI_libDAI* libDAI = gi_Inference;
-
-      for(int l = 0; l < param.nClasses; ++l) {
-        libDAI->getMarginals(marginals, l);
-        
-        stringstream sout;
-        sout << args.output_dir;
-        sout << "/marginals_" << l << "/";
-        mkdir(sout.str().c_str(), 0777);
-        sout << getNameFromPathWithoutExtension(slice->getName());
-        sout << ".png";
-        printf("Exporting %s\n", sout.str().c_str());
-        slice->exportProbabilities(sout.str().c_str(), param.nClasses, marginals);
+
+#if USE_LIBDAI
+      if(args.algo_type != T_GI_BP) {
+        GI_libDAI* libDAI = new GI_libDAI(slice,
+                                          &param,
+                                          param.weights,
+                                          groundTruthLabels,
+                                          lossPerLabel,
+                                          feature,
+                                          0, 0);
+        for(int l = 0; l < param.nClasses; ++l) {
+          libDAI->getMarginals(marginals, l);
+          exportMarginals(slice, args.output_dir, l, param.nClasses, marginals);
+        }
+        delete libDAI;
+      } else
+#endif
+      {
+        // messages are computed once and reused for all labels
+        GI_BP* bp = new GI_BP(slice,
+                              &param,
+                              param.weights,
+                              groundTruthLabels,
+                              lossPerLabel,
+                              feature,
+                              0, 0);
+        for(int l = 0; l < param.nClasses; ++l) {
+          bp->getMarginals(marginals, l);
+          exportMarginals(slice, args.output_dir, l, param.nClasses, marginals);
+        }
+        delete bp;
       }
+      delete[] marginals;
       
     }
   }
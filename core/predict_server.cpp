@@ -0,0 +1,1016 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include <cv.h>
+#include <highgui.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+// SliceMe
+#include "Config.h"
+#include "Slice.h"
+#include "Slice3d.h"
+#include "utils.h"
+#include "globalsE.h"
+#include "globals.h"
+#include "inference.h"
+#include "Feature.h"
+#include "F_Precomputed.h"
+
+#if USE_LIBDAI
+#include "gi_libDAI.h"
+#endif
+
+#include "energyParam.h"
+#include "svm_struct_api_types.h"
+
+#include "predict_server.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+/* Program options */
+static struct option long_options[] = {
+  {"config_file", required_argument, 0, 'c'}, //"config_file"},
+  {"cache_size", required_argument, 0, 'n'}, //"number of volumes kept in memory"},
+  {"queue_size", required_argument, 0, 'q'}, //"maximum number of pending requests"},
+  {"socket", required_argument, 0, 's'}, //"path of the unix socket"},
+  {"nThreads", required_argument, 0, 't'}, //"number of worker threads"},
+  {"verbose", no_argument, 0, 'v'}, //"verbose"},
+  {"weight_file", required_argument, 0, 'w'}, //"weight_file"},
+  {"help", no_argument, 0, 'h'}, //"usage"},
+  { 0, 0, 0, 0}
+};
+
+struct arguments
+{
+  char* config_file;
+  char* weight_file;
+  char* socket_path;
+  int cache_size;
+  int queue_size;
+  int nThreads;
+};
+
+arguments args;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Volume kept in memory between requests.
+ * Supervoxels, features and edge indices are computed once and reused
+ * until the volume is modified (i.e. its modification time changes).
+ */
+struct VolumeCacheEntry
+{
+  string key;
+  time_t mtime;
+  Slice_P* slice;
+  Feature* feature;
+  bool loaded;
+  bool stale;
+  int refCount;
+  ulong lastUsed;
+
+  // labels computed for the whole volume, indexed by algorithm type
+  map<int, labelType*> labels;
+  // marginals, nClasses planes of getNbSupernodes() values
+  float* marginals;
+
+  // same as above but only valid for the supernodes that intersected
+  // the regions of interest requested so far
+  map<int, labelType*> roi_labels;
+  float* roi_marginals;
+
+  // serialize loading and inference on a given volume
+  pthread_mutex_t lock;
+};
+
+// parameters shared by all the workers (read-only once the server is running)
+static EnergyParam* param = 0;
+static int default_algo_type = T_GI_MULTIOBJ;
+// number of rings of neighbors added around a region of interest.
+// A negative value disables the ROI mode.
+static int roi_halo = 1;
+
+// cache of volumes
+static list<VolumeCacheEntry*> volume_cache;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ulong cache_clock = 0;
+
+// Loading and deleting volumes go through global state that is not
+// thread-safe (features configured from the Config singleton,
+// Feature::feature_cache, SupernodeStats requested statistics) so they are
+// serialized by setup_mutex. Inference only reads this state and runs
+// concurrently on different volumes (each entry has its own lock).
+// setup_mutex is never locked with cache_mutex held.
+static pthread_mutex_t setup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// bounded queue of client connections
+static int* request_queue = 0;
+static int queue_head = 0;
+static int queue_count = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+
+static ulong shm_counter = 0;
+
+//------------------------------------------------------------------------------
+void print_usage(){
+ printf(
+  "usage: \n \
+  predict_server -c config.txt -w model.txt \n \
+  -c config_file \n \
+  -n cache_size : number of volumes kept in memory \n \
+  -q queue_size : maximum number of pending requests \n \
+  -s socket : path of the unix socket (default is %s) \n \
+  -t nThreads : number of worker threads \n \
+  -v : verbose \n \
+  -w weight_file : model obtained from training\n",
+  PREDICT_SERVER_DEFAULT_SOCKET);
+}
+
+/* Parse a single option. */
+static int parse_opt (int key, char *arg, struct arguments *argments)
+{
+  switch (key)
+    {
+    case 'c':
+      argments->config_file = arg;
+      break;
+    case 'n':
+      if(arg!=0)
+        argments->cache_size = atoi(arg);
+      break;
+    case 'q':
+      if(arg!=0)
+        argments->queue_size = atoi(arg);
+      break;
+    case 's':
+      argments->socket_path = arg;
+      break;
+    case 't':
+      if(arg!=0)
+        argments->nThreads = atoi(arg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    case 'w':
+      argments->weight_file = arg;
+      break;
+    case 'h':
+      print_usage();
+      return 1;
+      break;
+    default:
+      std::cout << "some option was wrong or missing." << std::endl;
+      print_usage();
+      return -1;
+    }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool readAll(int fd, char* buffer, size_t size)
+{
+  size_t n = 0;
+  while(n < size) {
+    ssize_t r = read(fd, buffer + n, size - n);
+    if(r < 0 && errno == EINTR) {
+      continue;
+    }
+    if(r <= 0) {
+      return false;
+    }
+    n += r;
+  }
+  return true;
+}
+
+static bool writeAll(int fd, const char* buffer, size_t size)
+{
+  size_t n = 0;
+  while(n < size) {
+    ssize_t r = write(fd, buffer + n, size - n);
+    if(r < 0 && errno == EINTR) {
+      continue;
+    }
+    if(r <= 0) {
+      return false;
+    }
+    n += r;
+  }
+  return true;
+}
+
+static void sendReply(int fd, PredictServerReply& reply)
+{
+  if(!writeAll(fd, (const char*)&reply, sizeof(PredictServerReply))) {
+    PRINT_MESSAGE("[predict_server] Failed to send reply\n");
+  }
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Has to be called with setup_mutex locked.
+ */
+static void deleteSlice(Slice_P* slice, Feature* feature)
+{
+  if(feature) {
+    Feature::deleteFeature(slice, feature);
+  }
+  switch(slice->getType())
+    {
+    case SLICEP_SLICE:
+      delete static_cast<Slice*>(slice);
+      break;
+    case SLICEP_SLICE3D:
+      delete static_cast<Slice3d*>(slice);
+      break;
+    default:
+      break;
+    }
+}
+
+static void deleteEntry(VolumeCacheEntry* entry)
+{
+  PRINT_MESSAGE("[predict_server] Removing %s from cache\n", entry->key.c_str());
+  for(map<int, labelType*>::iterator it = entry->labels.begin();
+      it != entry->labels.end(); ++it) {
+    delete[] it->second;
+  }
+  for(map<int, labelType*>::iterator it = entry->roi_labels.begin();
+      it != entry->roi_labels.end(); ++it) {
+    delete[] it->second;
+  }
+  if(entry->marginals) {
+    delete[] entry->marginals;
+  }
+  if(entry->roi_marginals) {
+    delete[] entry->roi_marginals;
+  }
+  if(entry->slice) {
+    pthread_mutex_lock(&setup_mutex);
+    deleteSlice(entry->slice, entry->feature);
+    pthread_mutex_unlock(&setup_mutex);
+  }
+  pthread_mutex_destroy(&entry->lock);
+  delete entry;
+}
+
+/**
+ * Remove stale entries and least recently used entries until the size of
+ * the cache is below args.cache_size. Entries currently in use are skipped.
+ * Has to be called with cache_mutex locked. The removed entries are
+ * returned in evicted and have to be deleted once cache_mutex is released.
+ */
+static void evictEntries(vector<VolumeCacheEntry*>& evicted)
+{
+  list<VolumeCacheEntry*>::iterator it = volume_cache.begin();
+  while(it != volume_cache.end()) {
+    if((*it)->stale && (*it)->refCount == 0) {
+      evicted.push_back(*it);
+      it = volume_cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  while((int)volume_cache.size() > args.cache_size) {
+    list<VolumeCacheEntry*>::iterator itLRU = volume_cache.end();
+    for(it = volume_cache.begin(); it != volume_cache.end(); ++it) {
+      if((*it)->refCount == 0 &&
+         (itLRU == volume_cache.end() || (*it)->lastUsed < (*itLRU)->lastUsed)) {
+        itLRU = it;
+      }
+    }
+    if(itLRU == volume_cache.end()) {
+      // all the entries are in use
+      break;
+    }
+    evicted.push_back(*itLRU);
+    volume_cache.erase(itLRU);
+  }
+}
+
+/**
+ * Return the cache entry for the given key. A new (empty) entry is created
+ * if the volume is not in the cache or if it was modified since it was loaded.
+ * The reference count of the returned entry is incremented.
+ */
+static VolumeCacheEntry* acquireEntry(const string& key, time_t mtime)
+{
+  VolumeCacheEntry* entry = 0;
+  pthread_mutex_lock(&cache_mutex);
+  for(list<VolumeCacheEntry*>::iterator it = volume_cache.begin();
+      it != volume_cache.end(); ++it) {
+    if((*it)->key == key && !(*it)->stale) {
+      if((*it)->mtime == mtime) {
+        entry = *it;
+      } else {
+        (*it)->stale = true;
+      }
+      break;
+    }
+  }
+
+  if(entry == 0) {
+    entry = new VolumeCacheEntry;
+    entry->key = key;
+    entry->mtime = mtime;
+    entry->slice = 0;
+    entry->feature = 0;
+    entry->loaded = false;
+    entry->stale = false;
+    entry->refCount = 0;
+    entry->marginals = 0;
+    entry->roi_marginals = 0;
+    pthread_mutex_init(&entry->lock, 0);
+    volume_cache.push_back(entry);
+  }
+
+  ++entry->refCount;
+  entry->lastUsed = ++cache_clock;
+  pthread_mutex_unlock(&cache_mutex);
+  return entry;
+}
+
+static void releaseEntry(VolumeCacheEntry* entry, bool failed)
+{
+  pthread_mutex_lock(&cache_mutex);
+  --entry->refCount;
+  if(failed) {
+    entry->stale = true;
+  }
+  vector<VolumeCacheEntry*> evicted;
+  evictEntries(evicted);
+  pthread_mutex_unlock(&cache_mutex);
+
+  for(vector<VolumeCacheEntry*>::iterator it = evicted.begin();
+      it != evicted.end(); ++it) {
+    deleteEntry(*it);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Compute features and edge indices for a volume passed through shared memory.
+ * Volumes loaded from disk go through loadDataAndFeatures instead.
+ */
+static Feature* prepareSlice(Slice3d* slice3d, Config* config)
+{
+  string config_tmp;
+
+  int nGradientLevels = 5;
+  if(config->getParameter("nGradientLevels", config_tmp)) {
+    nGradientLevels = atoi(config_tmp.c_str());
+  }
+
+  int nOrientations = 1;
+  if(config->getParameter("nOrientations", config_tmp)) {
+    nOrientations = atoi(config_tmp.c_str());
+  }
+
+  vector<eFeatureType> feature_types;
+  int paramFeatureTypes = DEFAULT_FEATURE_TYPE;
+  if(config->getParameter("featureTypes", config_tmp)) {
+    paramFeatureTypes = atoi(config_tmp.c_str());
+  }
+  getFeatureTypes(paramFeatureTypes, feature_types);
+
+  slice3d->generateSupervoxels(SUPERVOXEL_DEFAULT_CUBENESS);
+
+  Feature* feature = Feature::getFeature(slice3d, feature_types);
+  slice3d->precomputeFeatures(feature);
+
+#if USE_LONG_RANGE_EDGES
+  int nDistances = 1;
+  if(config->getParameter("nDistances", config_tmp)) {
+    nDistances = atoi(config_tmp.c_str());
+  }
+  slice3d->precomputeEdgeIndices(nGradientLevels, nOrientations, nDistances);
+#else
+  slice3d->precomputeEdgeIndices(nGradientLevels, nOrientations, 0);
+#endif
+
+  return feature;
+}
+
+/**
+ * Load volume, supervoxels and features. Has to be called with
+ * setup_mutex and the lock of the entry held.
+ */
+static int loadEntry(VolumeCacheEntry* entry, const PredictServerRequest& request)
+{
+  Config* config = Config::Instance();
+  string config_tmp;
+
+  printf("[predict_server] Loading %s\n", entry->key.c_str());
+
+  if(request.input_type == PREDICT_SERVER_INPUT_PATH) {
+    int featureSize = 0;
+    loadDataAndFeatures(request.input, "", config,
+                        entry->slice, entry->feature, &featureSize);
+  } else {
+    ulong volumeSize = (ulong)request.width*request.height*request.depth;
+    if(volumeSize == 0) {
+      return PREDICT_SERVER_INVALID_REQUEST;
+    }
+    int fd = shm_open(request.input, O_RDONLY, 0);
+    if(fd == -1) {
+      return PREDICT_SERVER_SHM_FAILED;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (ulong)st.st_size < volumeSize) {
+      close(fd);
+      return PREDICT_SERVER_INVALID_REQUEST;
+    }
+    void* data = mmap(0, volumeSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+      return PREDICT_SERVER_SHM_FAILED;
+    }
+
+    // the client may release the shared memory object at any time
+    uchar* raw_data = new uchar[volumeSize];
+    memcpy(raw_data, data, volumeSize);
+    munmap(data, volumeSize);
+
+    Slice3d* slice3d = new Slice3d(raw_data, request.width, request.height,
+                                   request.depth, DEFAULT_VOXEL_STEP);
+    slice3d->setDeleteRawData(true);
+    // files cached by Slice3d (e.g. neighbors) are prefixed by inputDir
+    stringstream sout_dir;
+    sout_dir << "/tmp/predict_server_" << getpid() << "_";
+    sout_dir << getNameFromPathWithoutExtension(request.input) << "_";
+    sout_dir << entry->mtime << "_";
+    slice3d->inputDir = sout_dir.str();
+    entry->feature = prepareSlice(slice3d, config);
+    entry->slice = slice3d;
+  }
+
+  if(entry->slice == 0 || entry->feature == 0) {
+    return PREDICT_SERVER_LOAD_FAILED;
+  }
+
+  bool rescale_features = true;
+  if(config->getParameter("rescale_features", config_tmp)) {
+    rescale_features = config_tmp.c_str()[0] == '1';
+  }
+  if(rescale_features) {
+    const char* scale_filename = "scale.txt";
+    entry->slice->rescalePrecomputedFeatures(scale_filename);
+  }
+
+  entry->loaded = true;
+  return PREDICT_SERVER_OK;
+}
+
+//------------------------------------------------------------------------------
+
+static int getAlgoType(int algo_type)
+{
+  if(algo_type < 0) {
+    algo_type = default_algo_type;
+  }
+  if(algo_type == T_GI_MULTIOBJ && param->nClasses == 2) {
+    algo_type = T_GI_MAXFLOW;
+  }
+  if(algo_type == T_GI_MULTIOBJ && param->nClasses > 3) {
+    algo_type = T_GI_LIBDAI;
+  }
+  return algo_type;
+}
+
+#if USE_LIBDAI
+/**
+ * Compute marginals for all the supernodes of slice.
+ * marginals contains nClasses planes of slice->getNbSupernodes() values.
+ */
+static void computeMarginals(Slice_P* slice, Feature* feature, float* marginals)
+{
+  const ulong nNodes = slice->getNbSupernodes();
+  GI_libDAI* gi_Inference = new GI_libDAI(slice, param, param->weights,
+                                          0, 0, feature, 0, 0);
+  for(int l = 0; l < param->nClasses; ++l) {
+    gi_Inference->getMarginals(marginals + l*nNodes, l);
+  }
+  delete gi_Inference;
+}
+#endif
+
+/**
+ * Only accept algorithms that can be instantiated by
+ * createGraphInferenceInstance (which exits on unknown types).
+ */
+static bool isSupportedAlgoType(int algo_type)
+{
+  switch(algo_type)
+    {
+#if USE_LIBDAI
+    case T_GI_LIBDAI:
+    case T_GI_LIBDAI_ICM:
+    case T_GI_LIBDAI_ICM_QPBO:
+#endif
+#if USE_MAXFLOW
+    case T_GI_MAXFLOW:
+    case T_GI_MAXFLOW_PARALLEL:
+#endif
+#if USE_MULTIOBJ
+    case T_GI_MULTIOBJ:
+#endif
+    case T_GI_BP:
+    case T_GI_HIERARCHICAL:
+    case T_GI_MF:
+    case T_GI_MAX:
+    case T_GI_SAMPLING:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/**
+ * Clip region of interest to the size of the slice.
+ * Returns false if the region is empty.
+ */
+static bool getROI(Slice_P* slice, const PredictServerRequest& request,
+                   int* start, int* end)
+{
+  int size[3];
+  size[0] = slice->getWidth();
+  size[1] = slice->getHeight();
+  size[2] = slice->getDepth();
+  for(int i = 0; i < 3; ++i) {
+    start[i] = max(0, request.roi_start[i]);
+    end[i] = (request.roi_end[i] <= 0)?size[i]:min(size[i], request.roi_end[i]);
+    if(start[i] >= end[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void* createOutput(PredictServerReply& reply,
+                          const PredictServerRequest& request)
+{
+  if(request.output_shm[0] != 0) {
+    strncpy(reply.output_shm, request.output_shm, PREDICT_SERVER_MAX_SHM_NAME - 1);
+  } else {
+    pthread_mutex_lock(&cache_mutex);
+    ulong shm_id = shm_counter++;
+    pthread_mutex_unlock(&cache_mutex);
+    snprintf(reply.output_shm, PREDICT_SERVER_MAX_SHM_NAME,
+             "/predict_server_%d_%ld", getpid(), shm_id);
+  }
+  reply.output_shm[PREDICT_SERVER_MAX_SHM_NAME - 1] = 0;
+
+  int fd = shm_open(reply.output_shm, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if(fd == -1) {
+    return 0;
+  }
+  if(ftruncate(fd, reply.output_size) == -1) {
+    close(fd);
+    shm_unlink(reply.output_shm);
+    return 0;
+  }
+  void* data = mmap(0, reply.output_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    shm_unlink(reply.output_shm);
+    return 0;
+  }
+  return data;
+}
+
+/**
+ * Returns the latest modification time of the given path. For directories,
+ * the files they contain are also checked since modifying a file does not
+ * change the modification time of its directory.
+ */
+static bool getModificationTime(const string& path, time_t& mtime)
+{
+  struct stat st;
+  if(stat(path.c_str(), &st) == -1) {
+    return false;
+  }
+  mtime = st.st_mtime;
+  if(S_ISDIR(st.st_mode)) {
+    vector<string> files;
+    getFilesInDirRec(path.c_str(), files, 0);
+    for(vector<string>::iterator it = files.begin(); it != files.end(); ++it) {
+      if(stat(it->c_str(), &st) == 0 && st.st_mtime > mtime) {
+        mtime = st.st_mtime;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Handle a single request.
+ */
+static int processRequest(const PredictServerRequest& request,
+                          PredictServerReply& reply)
+{
+  if(request.version != PREDICT_SERVER_VERSION ||
+     (request.output_type != PREDICT_SERVER_OUTPUT_LABELS &&
+      request.output_type != PREDICT_SERVER_OUTPUT_PROBABILITIES)) {
+    return PREDICT_SERVER_INVALID_REQUEST;
+  }
+
+  string input(request.input, strnlen(request.input, PREDICT_SERVER_MAX_PATH));
+  if(input.length() == PREDICT_SERVER_MAX_PATH) {
+    return PREDICT_SERVER_INVALID_REQUEST;
+  }
+
+  // cache key is the path (or shared memory name) + the modification time
+  time_t mtime;
+  string key;
+  if(request.input_type == PREDICT_SERVER_INPUT_PATH) {
+    if(!getModificationTime(input, mtime)) {
+      return PREDICT_SERVER_LOAD_FAILED;
+    }
+    key = "path:" + input;
+  } else if(request.input_type == PREDICT_SERVER_INPUT_SHM) {
+    int fd = shm_open(input.c_str(), O_RDONLY, 0);
+    if(fd == -1) {
+      return PREDICT_SERVER_SHM_FAILED;
+    }
+    struct stat st;
+    int r = fstat(fd, &st);
+    close(fd);
+    if(r == -1) {
+      return PREDICT_SERVER_SHM_FAILED;
+    }
+    mtime = st.st_mtime;
+    stringstream sout;
+    sout << "shm:" << input << ":" << request.width << "x" << request.height
+         << "x" << request.depth;
+    key = sout.str();
+  } else {
+    return PREDICT_SERVER_INVALID_REQUEST;
+  }
+
+  VolumeCacheEntry* entry = acquireEntry(key, mtime);
+  pthread_mutex_lock(&entry->lock);
+
+  int status = PREDICT_SERVER_OK;
+  if(!entry->loaded) {
+    pthread_mutex_lock(&setup_mutex);
+    status = loadEntry(entry, request);
+    pthread_mutex_unlock(&setup_mutex);
+  }
+
+  int roi_start[3];
+  int roi_end[3];
+  if(status == PREDICT_SERVER_OK && !getROI(entry->slice, request, roi_start, roi_end)) {
+    status = PREDICT_SERVER_INVALID_REQUEST;
+  }
+
+  const int nClasses = param->nClasses;
+  const int algo_type = getAlgoType(request.algo_type);
+  if(status == PREDICT_SERVER_OK && !isSupportedAlgoType(algo_type)) {
+    status = PREDICT_SERVER_UNSUPPORTED;
+  }
+  Slice_P* slice = entry->slice;
+  labelType* labels = 0;
+  float* marginals = 0;
+  if(status == PREDICT_SERVER_OK) {
+    const ulong nNodes = slice->getNbSupernodes();
+
+    // ROI mode : only the supernodes intersecting the region (plus a halo)
+    // are used for inference and results are written back into arrays
+    // indexed by the global supernode ids.
+    bool useROI = (roi_halo >= 0) && (slice->getType() == SLICEP_SLICE3D) &&
+      (roi_start[0] != 0 || roi_start[1] != 0 || roi_start[2] != 0 ||
+       roi_end[0] != slice->getWidth() || roi_end[1] != slice->getHeight() ||
+       roi_end[2] != slice->getDepth());
+    node start;
+    node end;
+    start.x = roi_start[0]; start.y = roi_start[1]; start.z = roi_start[2];
+    end.x = roi_end[0]; end.y = roi_end[1]; end.z = roi_end[2];
+
+    if(request.output_type == PREDICT_SERVER_OUTPUT_LABELS) {
+      map<int, labelType*>::iterator itLabels = entry->labels.find(algo_type);
+      if(itLabels != entry->labels.end()) {
+        // labels were already computed for the whole volume
+        labels = itLabels->second;
+      } else if(useROI) {
+        PRINT_MESSAGE("[predict_server] Running inference on a region of %s (algo_type=%d)\n",
+                      entry->key.c_str(), algo_type);
+        itLabels = entry->roi_labels.find(algo_type);
+        if(itLabels == entry->roi_labels.end()) {
+          labels = new labelType[nNodes];
+          memset(labels, 0, nNodes*sizeof(labelType));
+          entry->roi_labels[algo_type] = labels;
+        } else {
+          labels = itLabels->second;
+        }
+        computeLabelsROI(static_cast<Slice3d*>(slice), *param, algo_type,
+                         start, end, roi_halo, labels);
+      } else {
+        PRINT_MESSAGE("[predict_server] Running inference on %s (algo_type=%d)\n",
+                      entry->key.c_str(), algo_type);
+        labels = computeLabels(slice, entry->feature, *param, algo_type, 0);
+        entry->labels[algo_type] = labels;
+      }
+    } else {
+#if USE_LIBDAI
+      if(entry->marginals) {
+        marginals = entry->marginals;
+      } else if(useROI) {
+        PRINT_MESSAGE("[predict_server] Computing marginals on a region of %s\n", entry->key.c_str());
+        if(entry->roi_marginals == 0) {
+          entry->roi_marginals = new float[nNodes*nClasses];
+          memset(entry->roi_marginals, 0, nNodes*nClasses*sizeof(float));
+        }
+        marginals = entry->roi_marginals;
+
+        vector<sidType> sid_mapping;
+        vector<bool> isCoreSupernode;
+        Slice3d* roi = static_cast<Slice3d*>(slice)->extractROI(start, end, roi_halo,
+                                                                sid_mapping, isCoreSupernode);
+        const ulong nROINodes = roi->getNbSupernodes();
+        Feature* roiFeature = new F_Precomputed(roi->getPrecomputedFeatures(),
+                                                Feature::getPrecomputedSizeForOneSupernode(roi->getFeatureSize()));
+        float* roiMarginals = new float[nROINodes*nClasses];
+        computeMarginals(roi, roiFeature, roiMarginals);
+        for(ulong sid = 0; sid < nROINodes; ++sid) {
+          if(isCoreSupernode[sid]) {
+            for(int l = 0; l < nClasses; ++l) {
+              marginals[l*nNodes + sid_mapping[sid]] = roiMarginals[l*nROINodes + sid];
+            }
+          }
+        }
+        delete[] roiMarginals;
+        delete roiFeature;
+        delete roi;
+      } else {
+        PRINT_MESSAGE("[predict_server] Computing marginals on %s\n", entry->key.c_str());
+        entry->marginals = new float[nNodes*nClasses];
+        computeMarginals(slice, entry->feature, entry->marginals);
+        marginals = entry->marginals;
+      }
+#else
+      printf("[predict_server] Set USE_LIBDAI to true to compute probabilities\n");
+      status = PREDICT_SERVER_UNSUPPORTED;
+#endif
+    }
+  }
+
+  if(status == PREDICT_SERVER_OK) {
+    reply.width = roi_end[0] - roi_start[0];
+    reply.height = roi_end[1] - roi_start[1];
+    reply.depth = roi_end[2] - roi_start[2];
+    reply.nClasses = nClasses;
+    ulong roiSize = (ulong)reply.width*reply.height*reply.depth;
+    if(labels) {
+      reply.output_size = roiSize*sizeof(uchar);
+    } else {
+      reply.output_size = roiSize*nClasses*sizeof(float);
+    }
+
+    void* output = createOutput(reply, request);
+    if(output == 0) {
+      status = PREDICT_SERVER_SHM_FAILED;
+    } else {
+      ulong nNodes = slice->getNbSupernodes();
+      ulong idx = 0;
+      for(int z = roi_start[2]; z < roi_end[2]; ++z) {
+        for(int y = roi_start[1]; y < roi_end[1]; ++y) {
+          for(int x = roi_start[0]; x < roi_end[0]; ++x) {
+            sidType sid = slice->getSid(x, y, z);
+            if(labels) {
+              ((uchar*)output)[idx] = (uchar)labels[sid];
+            } else {
+              for(int l = 0; l < nClasses; ++l) {
+                ((float*)output)[l*roiSize + idx] = marginals[l*nNodes + sid];
+              }
+            }
+            ++idx;
+          }
+        }
+      }
+      munmap(output, reply.output_size);
+    }
+  }
+
+  bool failed = !entry->loaded;
+  pthread_mutex_unlock(&entry->lock);
+  releaseEntry(entry, failed);
+  return status;
+}
+
+//------------------------------------------------------------------------------
+
+static void* worker(void* arg)
+{
+  while(true) {
+    pthread_mutex_lock(&queue_mutex);
+    while(queue_count == 0) {
+      pthread_cond_wait(&queue_not_empty, &queue_mutex);
+    }
+    int fd = request_queue[queue_head];
+    queue_head = (queue_head + 1) % args.queue_size;
+    --queue_count;
+    pthread_mutex_unlock(&queue_mutex);
+
+    PredictServerRequest request;
+    PredictServerReply reply;
+    memset(&reply, 0, sizeof(PredictServerReply));
+    if(readAll(fd, (char*)&request, sizeof(PredictServerRequest))) {
+      request.input[PREDICT_SERVER_MAX_PATH - 1] = 0;
+      request.output_shm[PREDICT_SERVER_MAX_SHM_NAME - 1] = 0;
+      reply.status = processRequest(request, reply);
+      sendReply(fd, reply);
+    }
+    close(fd);
+  }
+  return 0;
+}
+
+/**
+ * Add a connection to the queue.
+ * Returns false if the queue is full.
+ */
+static bool enqueue(int fd)
+{
+  bool queued = false;
+  pthread_mutex_lock(&queue_mutex);
+  if(queue_count < args.queue_size) {
+    request_queue[(queue_head + queue_count) % args.queue_size] = fd;
+    ++queue_count;
+    queued = true;
+    pthread_cond_signal(&queue_not_empty);
+  }
+  pthread_mutex_unlock(&queue_mutex);
+  return queued;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+  args.config_file = 0;
+  args.weight_file = 0;
+  args.socket_path = (char*)PREDICT_SERVER_DEFAULT_SOCKET;
+  args.cache_size = 2;
+  args.queue_size = 16;
+  args.nThreads = 2;
+  verbose = false;
+
+  int option_index = 0;
+  int key;
+  int parsing_output;
+
+  if(argc < 2){
+     fprintf(stderr, "Insufficient number of arguments. Missing configuration and model file.\n Example: predict_server -c config.txt -w model.txt\n usage with -h");
+     exit(EXIT_FAILURE);
+  }
+
+  while((key = getopt_long(argc, argv, "c:n:q:s:t:vw:h", long_options, &option_index)) != -1){
+      parsing_output = parse_opt(key, optarg, &args);
+      if(parsing_output == -1){
+          fprintf(stderr, "Wrong argument. Parsing failed.");
+          exit(EXIT_FAILURE);
+      }else if(parsing_output == 1){
+          exit(EXIT_SUCCESS);
+      }
+  }
+
+  if((args.weight_file == 0) || !fileExists(args.weight_file)) {
+    fprintf(stderr, "[predict_server] A parameter file has to be provided with -w\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(args.nThreads < 1 || args.queue_size < 1 || args.cache_size < 1) {
+    fprintf(stderr, "[predict_server] nThreads, queue_size and cache_size should be positive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  string config_tmp;
+  Config* config = new Config(args.config_file);
+  Config::setInstance(config);
+
+  set_default_parameters(config);
+
+  // the model and the configuration are loaded once for all the requests
+  param = new EnergyParam(args.weight_file);
+
+  if(config->getParameter("giType", config_tmp)) {
+    default_algo_type = atoi(config_tmp.c_str());
+    printf("[predict_server] giType = %d\n", default_algo_type);
+  }
+
+  if(config->getParameter("roi_halo", config_tmp)) {
+    roi_halo = atoi(config_tmp.c_str());
+  }
+
+  if(param->nClasses == 3) {
+    printf("[predict_server] Set class labels\n");
+    BACKGROUND = 0;
+    BOUNDARY = 1;
+    FOREGROUND = 2;
+  }
+
+  // a client closing its connection should not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(server_fd == -1) {
+    perror("[predict_server] socket");
+    exit(EXIT_FAILURE);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(args.socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "[predict_server] Socket path %s is too long\n", args.socket_path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, args.socket_path);
+  unlink(args.socket_path);
+
+  if(bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    perror("[predict_server] bind");
+    exit(EXIT_FAILURE);
+  }
+
+  if(listen(server_fd, args.queue_size) == -1) {
+    perror("[predict_server] listen");
+    exit(EXIT_FAILURE);
+  }
+
+  request_queue = new int[args.queue_size];
+  pthread_t* workers = new pthread_t[args.nThreads];
+  for(int t = 0; t < args.nThreads; ++t) {
+    pthread_create(&workers[t], 0, worker, 0);
+  }
+
+  printf("[predict_server] Listening on %s (%d threads, queue size = %d, cache size = %d)\n",
+         args.socket_path, args.nThreads, args.queue_size, args.cache_size);
+
+  while(true) {
+    int client_fd = accept(server_fd, 0, 0);
+    if(client_fd == -1) {
+      if(errno != EINTR) {
+        perror("[predict_server] accept");
+      }
+      continue;
+    }
+
+    if(!enqueue(client_fd)) {
+      // reject the request instead of letting the latency grow unbounded.
+      // The request is not read to avoid blocking the accept loop.
+      PredictServerReply reply;
+      memset(&reply, 0, sizeof(PredictServerReply));
+      reply.status = PREDICT_SERVER_BUSY;
+      sendReply(client_fd, reply);
+      close(client_fd);
+    }
+  }
+
+  close(server_fd);
+  unlink(args.socket_path);
+  delete[] workers;
+  delete[] request_queue;
+  delete param;
+  return 0;
+}
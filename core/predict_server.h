@@ -0,0 +1,104 @@
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PREDICT_SERVER_H
+#define PREDICT_SERVER_H
+
+/*
+ * Wire format used by predict_server.
+ * A client connects to the Unix socket, sends one PredictServerRequest,
+ * receives one PredictServerReply and the connection is closed.
+ * Results are written to a POSIX shared memory object whose name is
+ * returned in the reply. The client is responsible for calling shm_unlink
+ * once the data has been read.
+ *
+ * Both structures are exchanged as raw bytes, client and server have to
+ * run on the same machine (which is the case for a Unix socket).
+ */
+
+#define PREDICT_SERVER_DEFAULT_SOCKET "/tmp/predict_server.sock"
+#define PREDICT_SERVER_MAX_PATH 1024
+#define PREDICT_SERVER_MAX_SHM_NAME 256
+#define PREDICT_SERVER_VERSION 1
+
+//------------------------------------------------------------------------------
+
+enum ePredictServerInputType
+  {
+    // input is a directory or a file that can be read by Slice3d/Slice
+    PREDICT_SERVER_INPUT_PATH = 0,
+    // input is a shared memory object containing width*height*depth uchar
+    // voxels ordered by z,y,x
+    PREDICT_SERVER_INPUT_SHM
+  };
+
+enum ePredictServerOutputType
+  {
+    // one uchar per voxel containing the class index
+    PREDICT_SERVER_OUTPUT_LABELS = 0,
+    // nClasses planes of floats (one plane per class, each plane
+    // containing one value per voxel ordered by z,y,x)
+    PREDICT_SERVER_OUTPUT_PROBABILITIES
+  };
+
+enum ePredictServerStatus
+  {
+    PREDICT_SERVER_OK = 0,
+    PREDICT_SERVER_BUSY,
+    PREDICT_SERVER_INVALID_REQUEST,
+    PREDICT_SERVER_LOAD_FAILED,
+    PREDICT_SERVER_UNSUPPORTED,
+    PREDICT_SERVER_SHM_FAILED
+  };
+
+//------------------------------------------------------------------------------
+
+struct PredictServerRequest
+{
+  int version;
+  int input_type;
+  // volume path or name of the shared memory object
+  char input[PREDICT_SERVER_MAX_PATH];
+  // size of the volume stored in shared memory (ignored for paths)
+  int width;
+  int height;
+  int depth;
+  // region of interest given as [start, end[. end[i] <= 0 means that
+  // the region extends to the end of the volume along the i-th axis.
+  // Inference is only run on the supernodes intersecting the region plus
+  // roi_halo rings of neighbors (see the roi_halo configuration parameter)
+  int roi_start[3];
+  int roi_end[3];
+  // one of the T_GI_* values defined in graphInference.h.
+  // -1 selects the algorithm specified in the configuration file
+  int algo_type;
+  int output_type;
+  // name of the shared memory object to be created by the server.
+  // A unique name is generated if this field is empty.
+  char output_shm[PREDICT_SERVER_MAX_SHM_NAME];
+};
+
+struct PredictServerReply
+{
+  int status;
+  // size of the region of interest actually processed
+  int width;
+  int height;
+  int depth;
+  int nClasses;
+  unsigned long output_size; // in bytes
+  char output_shm[PREDICT_SERVER_MAX_SHM_NAME];
+};
+
+#endif // PREDICT_SERVER_H
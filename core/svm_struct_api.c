@@ -70,6 +70,10 @@ using namespace dai;
 #if USE_MAXFLOW
 #include "gi_maxflow.h"
 #endif
+#if USE_MRF
+#include "gi_MRF.h"
+#endif
+#include "gi_BP.h"
 #if USE_MULTIOBJ
 #include "gi_multiobject.h"
 #endif
@@ -116,8 +120,22 @@ ulong** FPs = 0;
 ulong** FNs = 0;
 
 // Memory buffer used to store the potentials
-// Array of size maxBuffers*nNodes*nClasses 
-double*** tempPotentials = 0;
+// Array of size maxBuffers*2*nNodes*nClasses 
+potentialType** tempPotentials = 0;
+
+#if USE_MRF
+// GI_MRF instances are kept from one iteration to the next so that the
+// graph is only built once per example. Indexed by slice.
+map<Slice_P*, GI_MRF*> mrfInstances;
+#endif
+
+// Same for GI_BP (the factor graph is built once per example)
+map<Slice_P*, GI_BP*> bpInstances;
+
+#if USE_MULTIOBJ
+// Same for GI_multiobject (the layered graph is built once per example)
+map<Slice_P*, GI_multiobject*> multiobjInstances;
+#endif
 
 // Optional : add label names in this vector if you want to see them printed in the log file
 vector<string> labelNames;
@@ -618,9 +636,7 @@ SWORD* computePsi(SWORD* words, SPATTERN x, LABEL y, const STRUCTMODEL *sm,
     } else {
       sizePsi_pairwise *= sparm->nGradientLevels;
       sizePsi_pairwise *= sparm->nOrientations;
-#if USE_LONG_RANGE_EDGES
-      sizePsi_pairwise *= sparm->nDistances;
-#endif
+      sizePsi_pairwise *= SVM_NB_DISTANCE_BLOCKS(sparm);
     }
   }
 
@@ -852,13 +868,7 @@ void sparmToEnergyParam(const STRUCT_LEARN_PARM& sparm, EnergyParam* param)
   param->includeLocalEdges = sparm.includeLocalEdges;
   param->nScales = sparm.nScales;
 
-#if USE_LONG_RANGE_EDGES
-  param->sizePsi = (sparm.nDistances*sparm.nGradientLevels*sparm.nOrientations*sparm.nClasses*sparm.nClasses) + (sparm.nGradientLevels==0 && sparm.includeLocalEdges)
-    + sparm.nUnaryWeights + sparm.nScalingCoefficients;
-#else
-  param->sizePsi = (sparm.nGradientLevels*sparm.nOrientations*sparm.nClasses*sparm.nClasses) + (sparm.nGradientLevels==0 && sparm.includeLocalEdges)
-    + sparm.nUnaryWeights + sparm.nScalingCoefficients;
-#endif
+  param->sizePsi = SVM_FEAT_INDEX0(&sparm) + sparm.nScalingCoefficients;
 
   param->weights = 0; // not used in graphInference class
 }
@@ -975,7 +985,7 @@ void runInferenceWithCurrentParameters(SPATTERN x, LABEL y, STRUCTMODEL *sm,
                loss, nDiff);
   }
 
-#ifdef USE_OPENMP
+#ifdef WITH_OPENMP
 #pragma omp atomic
 #endif
   totalLoss += loss;
@@ -1072,7 +1082,7 @@ void load_3d_dataset(string imageDir,
     *featureSize = -1;
     if(slice3d->loadFeatures(sout_feature_filename.str().c_str(), featureSize)) {
       featuresLoaded = true;
-      feature = new F_Precomputed(slice3d->getPrecomputedFeatures(), *featureSize/DEFAULT_FEATURE_DISTANCE);
+      feature = new F_Precomputed(slice3d->getPrecomputedFeatures(), Feature::getPrecomputedSizeForOneSupernode(*featureSize));
       printf("[SVM_struct] Features Loaded succesfully\n");
     } else {
       printf("[SVM_struct] Features not loaded succesfully\n");
@@ -1967,12 +1977,9 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
   if(sparm->giType == T_GI_MF) {
     // Allocate memory for potentials
     SSVM_PRINT("[SVM_struct] Allocating temporary memory to store potentials. maxBuffers=%d, maxNbNodes=%d\n", maxBuffers, maxNbNodes);
-    tempPotentials = new double**[maxBuffers];
+    tempPotentials = new potentialType*[maxBuffers];
     for(int il = 0; il < maxBuffers; il++) {
-      tempPotentials[il] = new double*[maxNbNodes];
-      for(uint n = 0; n < maxNbNodes; n++) {
-        tempPotentials[il][n] = new double[sparm->nClasses];
-      }
+      tempPotentials[il] = new potentialType[2*maxNbNodes*sparm->nClasses];
     }
   }
 
@@ -2024,13 +2031,7 @@ void        init_struct_model(SAMPLE sample, STRUCTMODEL *sm,
   // sizePsi = K*K + K + 1
   // + 1 for weight of the unary cost from the RBF SVM.
 
-#if USE_LONG_RANGE_EDGES
-  sm->sizePsi = (sparm->nDistances*sparm->nGradientLevels*sparm->nOrientations*sparm->nClasses*sparm->nClasses) + (sparm->nGradientLevels==0 && sparm->includeLocalEdges)
-    + sparm->nUnaryWeights + sparm->nScalingCoefficients;
-#else
-  sm->sizePsi = (sparm->nGradientLevels*sparm->nOrientations*sparm->nClasses*sparm->nClasses) + (sparm->nGradientLevels==0 && sparm->includeLocalEdges)
-    + sparm->nUnaryWeights + sparm->nScalingCoefficients;
-#endif
+  sm->sizePsi = SVM_FEAT_INDEX0(sparm) + sparm->nScalingCoefficients;
 
   SSVM_PRINT("[SVM_struct] %d scales detected including %d local scales and %d scaling coefficients\n",
          sparm->nScales,sparm->nLocalScales,sparm->nScalingCoefficients);
@@ -2205,7 +2206,7 @@ LABEL       find_most_violated_constraint_marginrescaling(SPATTERN x, LABEL y,
   ofs << energyGT << endl;
   ofs.close();
 
-#ifdef USE_OPENMP
+#ifdef WITH_OPENMP
   #pragma omp atomic
 #endif
   totalWPsiGT -= energyGT;
@@ -2317,42 +2318,14 @@ LABEL       find_most_violated_constraint_marginrescaling(SPATTERN x, LABEL y,
 bool isSubmodular(const STRUCT_LEARN_PARM *sparm, double* smw)
 {
   bool submodularEnergy = false;
-  double* pw = smw + sparm->nUnaryWeights;
-  double d = 0; // diagonal
-  double a = 0; //anti-diagonal
-
   if(useGCForSubModularEnergy) {
     // For 2 classes, use graph-cuts if pairwise potential is attractive/submodular.
-    // Let E be the energy and S the score (E=-S)
-    // Recall that potential is submodular if :
-    // E(0,0) + E(1,1) =< E(0,1) + E(1,0)
-    // S(0,0) + S(1,1) >= S(0,1) + S(1,0) or d >= a
-    if(sparm->includeLocalEdges && sparm->nClasses == 2) {
-      if(sparm->nGradientLevels == 0) {
-        submodularEnergy = true;
-      } else {
-        submodularEnergy = true;
-#if USE_LONG_RANGE_EDGES
-        for(int p = 0; submodularEnergy && (p < sparm->nDistances); ++p)
-          {
-            a = 0;
-            d = 0;
-#else
-          {
-#endif
-            for(int g = 0; g < sparm->nGradientLevels; ++g) {
-              d += pw[0] + pw[3];
-              a += pw[1] + pw[2];
-              if(a > (d - 1e-8)) { // add a small margin because of numerical errors
-              //if(a > d) {
-                submodularEnergy = false;
-                break;
-              }
-              pw += sparm->nClasses*sparm->nClasses;
-            }
-          }
-      }
-    }
+    // add a small margin because of numerical errors
+    EnergyParam param;
+    sparmToEnergyParam(*sparm, &param);
+    PairwiseKernel* kernel = createPairwiseKernel(&param);
+    submodularEnergy = kernel->isSubmodular(smw, 1e-8);
+    delete kernel;
   }
   return submodularEnergy;
 }
@@ -2686,6 +2659,79 @@ void runInference(SPATTERN x, LABEL y,
     }
 #endif
 
+#if USE_MRF
+  case T_GI_MRF:
+    {
+      GI_MRF* gi_mrf = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(mrfInstances)
+#endif
+      {
+        map<Slice_P*, GI_MRF*>::iterator itMRF = mrfInstances.find(x.slice);
+        if(itMRF != mrfInstances.end()) {
+          gi_mrf = itMRF->second;
+          if(!gi_mrf->isCompatible(&param)) {
+            delete gi_mrf;
+            gi_mrf = 0;
+            mrfInstances.erase(itMRF);
+          }
+        }
+      }
+
+      if(gi_mrf) {
+        gi_mrf->updateParameters(&param,
+                                 smw,
+                                 y.nodeLabels, // groundtruth labels used to compute loss
+                                 sparm->lossPerLabel,
+                                 x.feature);
+      } else {
+        gi_mrf = new GI_MRF(x.slice,
+                            &param,
+                            smw,
+                            y.nodeLabels, // groundtruth labels used to compute loss
+                            sparm->lossPerLabel,
+                            x.feature,
+                            x.nodeCoeffs);
+#ifdef WITH_OPENMP
+#pragma omp critical(mrfInstances)
+#endif
+        mrfInstances[x.slice] = gi_mrf;
+      }
+
+      // instance is owned by mrfInstances
+      gi_MVC = 0;
+      double energy = gi_mrf->run(ybar.nodeLabels, // inferred labels
+                                  x.id,
+                                  MVC_MAX_ITER,
+                                  y.nodeLabels, // ground truth
+                                  computeEnergyAtEachIteration);
+      SSVM_PRINT("[MostViolatedConstraint] MRF energy=%g (This should be equal to -score)\n", energy);
+    }
+    break;
+#endif
+
+#if USE_MAXFLOW
+  case T_GI_MAXFLOW_PARALLEL:
+    {
+      gi_MVC = new GI_maxflow(x.slice,
+                              &param,
+                              smw,
+                              y.nodeLabels, // groundtruth labels used to compute loss  
+                              sparm->lossPerLabel,
+                              x.feature,
+                              x.nodeCoeffs,
+                              x.edgeCoeffs,
+                              true);
+      double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
+                                  x.id,
+                                  MVC_MAX_ITER,
+                                  y.nodeLabels, // ground truth
+                                  computeEnergyAtEachIteration);
+      SSVM_PRINT("[MostViolatedConstraint] parallel maxflow energy=%g (This should be equal to -score)\n", energy);
+    }
+    break;
+#endif
+
   case T_GI_MAX:
     {
       gi_MVC = new GI_max(x.slice,
@@ -2704,6 +2750,55 @@ void runInference(SPATTERN x, LABEL y,
     }
     break;
 
+  case T_GI_BP:
+    {
+      GI_BP* gi_bp = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(bpInstances)
+#endif
+      {
+        map<Slice_P*, GI_BP*>::iterator itBP = bpInstances.find(x.slice);
+        if(itBP != bpInstances.end()) {
+          gi_bp = itBP->second;
+          if(!gi_bp->isCompatible(&param)) {
+            delete gi_bp;
+            gi_bp = 0;
+            bpInstances.erase(itBP);
+          }
+        }
+      }
+
+      if(gi_bp) {
+        gi_bp->updateParameters(&param,
+                                smw,
+                                y.nodeLabels, // groundtruth labels used to compute loss
+                                sparm->lossPerLabel);
+      } else {
+        gi_bp = new GI_BP(x.slice,
+                          &param,
+                          smw,
+                          y.nodeLabels, // groundtruth labels used to compute loss
+                          sparm->lossPerLabel,
+                          x.feature,
+                          x.nodeCoeffs,
+                          x.edgeCoeffs);
+#ifdef WITH_OPENMP
+#pragma omp critical(bpInstances)
+#endif
+        bpInstances[x.slice] = gi_bp;
+      }
+
+      // instance is owned by bpInstances
+      gi_MVC = 0;
+      double energy = gi_bp->run(ybar.nodeLabels, // inferred labels
+                                 x.id,
+                                 MVC_MAX_ITER,
+                                 y.nodeLabels, // ground truth
+                                 computeEnergyAtEachIteration);
+      SSVM_PRINT("[MostViolatedConstraint] BP energy=%g (This should be equal to -score)\n", energy);
+    }
+    break;
+
   case T_GI_MF:
     {
       GI_MF* gi_MF = new GI_MF(x.slice,
@@ -2931,21 +3026,44 @@ void runInference(SPATTERN x, LABEL y,
 #if USE_MULTIOBJ
   case T_GI_MULTIOBJ:
     {
+      GI_multiobject* gi_multiobj = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(multiobjInstances)
+#endif
+      {
+        map<Slice_P*, GI_multiobject*>::iterator itMO = multiobjInstances.find(x.slice);
+        if(itMO != multiobjInstances.end()) {
+          gi_multiobj = itMO->second;
+        }
+      }
 
-      gi_MVC = new GI_multiobject(x.slice,
-                                  &param,
-                                  smw,
-                                  y.nodeLabels, // groundtruth labels used to compute loss  
-                                  sparm->lossPerLabel,
-                                  x.feature,
-                                  x.nodeCoeffs, 0
-                                  );
+      if(gi_multiobj) {
+        gi_multiobj->updateParameters(&param,
+                                      smw,
+                                      y.nodeLabels, // groundtruth labels used to compute loss
+                                      sparm->lossPerLabel);
+      } else {
+        gi_multiobj = new GI_multiobject(x.slice,
+                                         &param,
+                                         smw,
+                                         y.nodeLabels, // groundtruth labels used to compute loss  
+                                         sparm->lossPerLabel,
+                                         x.feature,
+                                         x.nodeCoeffs, 0
+                                         );
+#ifdef WITH_OPENMP
+#pragma omp critical(multiobjInstances)
+#endif
+        multiobjInstances[x.slice] = gi_multiobj;
+      }
 
-      double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
-                                  x.id,
-                                  MVC_MAX_ITER,
-                                  y.nodeLabels, // ground truth
-                                  computeEnergyAtEachIteration);
+      // instance is owned by multiobjInstances
+      gi_MVC = 0;
+      double energy = gi_multiobj->run(ybar.nodeLabels, // inferred labels
+                                       x.id,
+                                       MVC_MAX_ITER,
+                                       y.nodeLabels, // ground truth
+                                       computeEnergyAtEachIteration);
 
       SSVM_PRINT("[MostViolatedConstraint] multiobj energy=%g (This should be equal to -score)\n", energy);
       break;
@@ -3007,7 +3125,7 @@ SVECTOR     *psi(SPATTERN x, LABEL y, const STRUCTMODEL *sm,
   double lhsXw = 0;
   SWORD* words = computePsi(x,y,sm,sparm,&lhsXw);
 
-#ifdef USE_OPENMP
+#ifdef WITH_OPENMP
 #pragma omp atomic
 #endif
   totalWPsi += lhsXw;
@@ -3063,7 +3181,7 @@ double      loss(LABEL y, LABEL ybar, const STRUCT_LEARN_PARM *sparm)
 
   SSVM_PRINT("[MostViolatedConstraint] Loss = %g (%d/%d nodes have different labels)\n", loss, nDiff, y.nNodes);
 
-#ifdef USE_OPENMP
+#ifdef WITH_OPENMP
 #pragma omp atomic
 #endif
   totalLossMVC += loss;
@@ -3591,6 +3709,25 @@ void        write_label(FILE *fp, LABEL y)
 
 void        free_pattern(SPATTERN x) {
   /* Frees the memory of x. */
+#if USE_MRF
+  map<Slice_P*, GI_MRF*>::iterator itMRF = mrfInstances.find(x.slice);
+  if(itMRF != mrfInstances.end()) {
+    delete itMRF->second;
+    mrfInstances.erase(itMRF);
+  }
+#endif
+  map<Slice_P*, GI_BP*>::iterator itBP = bpInstances.find(x.slice);
+  if(itBP != bpInstances.end()) {
+    delete itBP->second;
+    bpInstances.erase(itBP);
+  }
+#if USE_MULTIOBJ
+  map<Slice_P*, GI_multiobject*>::iterator itMO = multiobjInstances.find(x.slice);
+  if(itMO != multiobjInstances.end()) {
+    delete itMO->second;
+    multiobjInstances.erase(itMO);
+  }
+#endif
   delete x.slice;
   delete x.feature;
   if(x.imgAnnotation != 0) {
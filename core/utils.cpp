@@ -71,6 +71,78 @@ bool fileExists(string filename) {
   return fileExists(filename.c_str());
 }
 
+static uint readUInt(const uchar* buffer, int nBytes, bool bigEndian)
+{
+  uint value = 0;
+  for(int i = 0; i < nBytes; ++i) {
+    int shift = bigEndian?(8*(nBytes-1-i)):(8*i);
+    value |= ((uint)buffer[i]) << shift;
+  }
+  return value;
+}
+
+bool getImageSize(const char* filename, int& width, int& height)
+{
+  ifstream ifs(filename, ios::binary);
+  if(ifs.fail()) {
+    return false;
+  }
+
+  uchar header[24];
+  ifs.read((char*)header, 24);
+  bool headerRead = (ifs.gcount() == 24);
+
+  // png : 8 bytes signature followed by the IHDR chunk
+  const uchar png_signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+  if(headerRead && memcmp(header, png_signature, 8) == 0 &&
+     memcmp(header+12, "IHDR", 4) == 0) {
+    width = readUInt(header+16, 4, true);
+    height = readUInt(header+20, 4, true);
+    return true;
+  }
+
+  // tif : image width and length are stored in the first IFD
+  if(headerRead && (memcmp(header, "II*\0", 4) == 0 || memcmp(header, "MM\0*", 4) == 0)) {
+    bool bigEndian = (header[0] == 'M');
+    uint ifdOffset = readUInt(header+4, 4, bigEndian);
+    uchar buffer[12];
+    ifs.clear();
+    ifs.seekg(ifdOffset, ios::beg);
+    ifs.read((char*)buffer, 2);
+    int nEntries = (ifs.gcount() == 2)?readUInt(buffer, 2, bigEndian):0;
+    width = -1;
+    height = -1;
+    for(int e = 0; e < nEntries; ++e) {
+      ifs.read((char*)buffer, 12);
+      if(ifs.gcount() != 12) {
+        break;
+      }
+      uint tag = readUInt(buffer, 2, bigEndian);
+      uint type = readUInt(buffer+2, 2, bigEndian);
+      // type 3 = SHORT, 4 = LONG
+      uint value = (type == 3)?readUInt(buffer+8, 2, bigEndian):readUInt(buffer+8, 4, bigEndian);
+      if(tag == 256) {
+        width = value;
+      } else if(tag == 257) {
+        height = value;
+      }
+    }
+    if(width > 0 && height > 0) {
+      return true;
+    }
+  }
+  ifs.close();
+
+  IplImage* img = cvLoadImage(filename, 0);
+  if(!img) {
+    return false;
+  }
+  width = img->width;
+  height = img->height;
+  cvReleaseImage(&img);
+  return true;
+}
+
 string getDirectoryFromPath(string path) {
   size_t pos = path.find_last_of("/\\");
   if(pos == string::npos) {
@@ -975,6 +1047,187 @@ void exportVIVACube(uchar* rawData,
   delete[] nfoFilename;
 }
 
+/**
+ * Parse the header of a nrrd file.
+ * Only uncompressed 3d volumes are supported.
+ * dataFile is the file containing the data (the nrrd file itself if the
+ * data is not detached) and dataOffset is the offset of the data in that file.
+ */
+static bool readRawNRRDHeader(const char* filename,
+                              string& type,
+                              int* sizes,
+                              string& dataFile,
+                              ulong& dataOffset,
+                              bool& bigEndian)
+{
+  ifstream ifs(filename, ios::binary);
+  if(ifs.fail()) {
+    return false;
+  }
+
+  string line;
+  getline(ifs, line);
+  if(line.compare(0, 4, "NRRD") != 0) {
+    return false;
+  }
+
+  int dimension = 0;
+  string encoding;
+  bigEndian = false;
+  dataFile = "";
+  while(getline(ifs, line)) {
+    if(line.length() > 0 && line[line.length()-1] == '\r') {
+      line.erase(line.length()-1);
+    }
+    if(line.length() == 0) {
+      // end of the header
+      break;
+    }
+    if(line[0] == '#') {
+      continue;
+    }
+    size_t pos = line.find(": ");
+    if(pos == string::npos) {
+      // key/value pairs (key:=value) are ignored
+      continue;
+    }
+    string field = line.substr(0, pos);
+    string value = line.substr(pos+2);
+    if(field == "type") {
+      type = value;
+    } else if(field == "dimension") {
+      dimension = atoi(value.c_str());
+    } else if(field == "sizes") {
+      if(sscanf(value.c_str(), "%d %d %d", &sizes[0], &sizes[1], &sizes[2]) != 3) {
+        return false;
+      }
+    } else if(field == "encoding") {
+      encoding = value;
+    } else if(field == "endian") {
+      bigEndian = (value == "big");
+    } else if(field == "data file" || field == "datafile") {
+      if(value.compare(0, 4, "LIST") == 0 || value.find('%') != string::npos) {
+        return false;
+      }
+      dataFile = value;
+    } else if(field == "line skip" || field == "lineskip" ||
+              field == "byte skip" || field == "byteskip") {
+      if(atoi(value.c_str()) != 0) {
+        return false;
+      }
+    }
+  }
+
+  if(dimension != 3 || encoding != "raw") {
+    return false;
+  }
+
+  if(dataFile.length() == 0) {
+    dataFile = filename;
+    dataOffset = ifs.tellg();
+  } else {
+    if(dataFile[0] != '/') {
+      dataFile = getDirectoryFromPath(filename) + dataFile;
+    }
+    dataOffset = 0;
+  }
+  return true;
+}
+
+/**
+ * Read elementSize*width*height*depth bytes of data described by the header
+ * of filename into outputData.
+ */
+static bool readRawNRRDData(const string& dataFile, ulong dataOffset,
+                            bool bigEndian, int elementSize,
+                            ulong nElements, char* outputData)
+{
+  ifstream ifs(dataFile.c_str(), ios::binary);
+  if(ifs.fail()) {
+    return false;
+  }
+  ifs.seekg(dataOffset, ios::beg);
+  ifs.read(outputData, nElements*elementSize);
+  if((ulong)ifs.gcount() != nElements*elementSize) {
+    return false;
+  }
+
+  if(bigEndian && elementSize > 1) {
+    for(ulong i = 0; i < nElements; ++i) {
+      reverse(outputData + i*elementSize, outputData + (i+1)*elementSize);
+    }
+  }
+  return true;
+}
+
+bool importRawNRRDCube(const char* filename,
+                       uchar*& outputData,
+                       int& width,
+                       int& height,
+                       int& depth)
+{
+  string type;
+  int sizes[3];
+  string dataFile;
+  ulong dataOffset;
+  bool bigEndian;
+  if(!readRawNRRDHeader(filename, type, sizes, dataFile, dataOffset, bigEndian)) {
+    return false;
+  }
+  if(type != "uchar" && type != "unsigned char" && type != "uint8" && type != "uint8_t") {
+    return false;
+  }
+
+  ulong nElements = ((ulong)sizes[0])*sizes[1]*sizes[2];
+  outputData = new uchar[nElements];
+  if(!readRawNRRDData(dataFile, dataOffset, bigEndian, sizeof(uchar),
+                      nElements, (char*)outputData)) {
+    delete[] outputData;
+    outputData = 0;
+    return false;
+  }
+
+  width = sizes[0];
+  height = sizes[1];
+  depth = sizes[2];
+  return true;
+}
+
+bool importRawNRRDCube(const char* filename,
+                       uint*& outputData,
+                       int& width,
+                       int& height,
+                       int& depth)
+{
+  string type;
+  int sizes[3];
+  string dataFile;
+  ulong dataOffset;
+  bool bigEndian;
+  if(!readRawNRRDHeader(filename, type, sizes, dataFile, dataOffset, bigEndian)) {
+    return false;
+  }
+  // supervoxel labels are sometimes stored as signed integers
+  if(type != "uint" && type != "unsigned int" && type != "uint32" && type != "uint32_t" &&
+     type != "int" && type != "signed int" && type != "int32" && type != "int32_t") {
+    return false;
+  }
+
+  ulong nElements = ((ulong)sizes[0])*sizes[1]*sizes[2];
+  outputData = new uint[nElements];
+  if(!readRawNRRDData(dataFile, dataOffset, bigEndian, sizeof(uint),
+                      nElements, (char*)outputData)) {
+    delete[] outputData;
+    outputData = 0;
+    return false;
+  }
+
+  width = sizes[0];
+  height = sizes[1];
+  depth = sizes[2];
+  return true;
+}
+
 #ifdef USE_ITK
 void importTIFCube(const char* imgFileName,
 		   uchar*& outputData,
@@ -1003,9 +1256,10 @@ void importTIFCube(const char* imgFileName,
   }
 
   ImageType::SizeType size = img->GetLargestPossibleRegion().GetSize();
-  ulong totalSize = size[0]*size[1]*size[2];
-  outputData = new uchar[totalSize];
-  memcpy(outputData,img->GetBufferPointer(),totalSize);
+
+  // take ownership of the buffer allocated by ITK (with new[])
+  img->GetPixelContainer()->SetContainerManageMemory(false);
+  outputData = img->GetBufferPointer();
 
   width = size[0];
   height = size[1];
@@ -1063,6 +1317,20 @@ void importCube(const char* imgFileName,
                 int& height,
                 int& depth)
 {
+  // rescaling below is the identity for uchar cubes so they can be read
+  // without going through a float buffer.
+  itk::ImageIOBase::Pointer imageIO =
+    itk::ImageIOFactory::CreateImageIO(imgFileName, itk::ImageIOFactory::ReadMode);
+  if(imageIO) {
+    imageIO->SetFileName(imgFileName);
+    imageIO->ReadImageInformation();
+    if(imageIO->GetComponentType() == itk::ImageIOBase::UCHAR &&
+       imageIO->GetNumberOfComponents() == 1) {
+      importTIFCube(imgFileName, outputData, width, height, depth);
+      return;
+    }
+  }
+
   const int Dimension = 3;
   //typedef unsigned char PixelType;
   typedef float PixelType;
@@ -1170,10 +1438,10 @@ void importNRRDCube_uint(const char* imgFileName,
     }
 
   ImageType::SizeType size = img->GetLargestPossibleRegion().GetSize();
-  ulong totalSize = size[0]*size[1]*size[2];
-  outputData = new uint[totalSize];
 
-  PixelType* ptrData = img->GetBufferPointer();
+  // take ownership of the buffer allocated by ITK (with new[])
+  img->GetPixelContainer()->SetContainerManageMemory(false);
+  outputData = img->GetBufferPointer();
 
   /*
   double minValue=-0.1;
@@ -1193,10 +1461,6 @@ void importNRRDCube_uint(const char* imgFileName,
   }
   */
 
-  for(ulong i=0; i < totalSize; i++) {
-    outputData[i] = ptrData[i];
-  }
-
   width = size[0];
   height = size[1];
   depth = size[2];
@@ -2083,6 +2347,12 @@ void set_default_parameters(Config* config)
     DEFAULT_FEATURE_DISTANCE = atoi(config_tmp.c_str());
     printf("[utils] DEFAULT_FEATURE_DISTANCE=%d\n", DEFAULT_FEATURE_DISTANCE);
   }
+  if(config->getParameter("mmap_raw_data", config_tmp)) {
+    MMAP_RAW_DATA = config_tmp.c_str()[0] == '1';
+  }
+  if(config->getParameter("compress_graph_cache", config_tmp)) {
+    COMPRESS_GRAPH_CACHE = config_tmp.c_str()[0] == '1';
+  }
 }
 
 void getColormapName(string& paramColormap)
@@ -2231,7 +2501,7 @@ void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
       *featureSize = -1;
       if(slice->loadFeatures(sout_feature_filename.str().c_str(), featureSize)) {
         featuresLoaded = true;
-        feature = new F_Precomputed(slice->getPrecomputedFeatures(), *featureSize/DEFAULT_FEATURE_DISTANCE);
+        feature = new F_Precomputed(slice->getPrecomputedFeatures(), Feature::getPrecomputedSizeForOneSupernode(*featureSize));
         printf("[utils] Features Loaded succesfully\n");
       } else {
         printf("[utils] Features not loaded succesfully\n");
@@ -2245,10 +2515,10 @@ void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
     }
 
     // precompute gradient indices to avoid race conditions
-    slice3d->precomputeGradientIndices(nGradientLevels);
-    slice3d->precomputeOrientationIndices(nOrientations);
 #if USE_LONG_RANGE_EDGES
-    slice3d->precomputeDistanceIndices(nDistances);
+    slice3d->precomputeEdgeIndices(nGradientLevels, nOrientations, nDistances);
+#else
+    slice3d->precomputeEdgeIndices(nGradientLevels, nOrientations, 0);
 #endif
 
     slice = slice3d;
@@ -180,7 +180,31 @@ double getMedian(vector<double>& list_values);
 bool getGroundTruthName(string& groundTruthName, const string& maskDir,
                         const string& filename);
 
+/**
+ * Read an uncompressed nrrd file (encoding raw, 3 dimensions) directly into
+ * a newly allocated buffer, without going through ITK.
+ * Returns false if the file can not be read natively (compressed data,
+ * different pixel type...) in which case the ITK import functions should be
+ * used instead. Caller is responsible for freeing memory.
+ */
+bool importRawNRRDCube(const char* filename,
+                       uchar*& outputData,
+                       int& width,
+                       int& height,
+                       int& depth);
+
+bool importRawNRRDCube(const char* filename,
+                       uint*& outputData,
+                       int& width,
+                       int& height,
+                       int& depth);
+
 #ifdef USE_ITK
+/**
+ * ITK import functions below hand the buffer allocated by the ITK reader
+ * over to the caller (no copy). Caller is responsible for freeing memory
+ * with delete[].
+ */
 void importTIFCube(const char* imgFileName,
                    uchar*& outputData,
                    sizeSliceType& width,
@@ -255,6 +279,13 @@ bool isDirectory(string path);
 bool fileExists(const char* filename);
 bool fileExists(string filename);
 
+/**
+ * Read the size of a png or tif image from its header without decoding
+ * the pixels. Falls back on cvLoadImage for other formats.
+ * Returns false if the image can not be read.
+ */
+bool getImageSize(const char* filename, int& width, int& height);
+
 string findLastFile(const string& file_pattern, const string& extension, int* _idx = 0);
 
 string getDirectoryFromPath(string path);